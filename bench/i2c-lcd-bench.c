@@ -0,0 +1,1513 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-emulator.h"
+#include "i2c-lcd-page-wrapper.h"
+#include "i2c-lcd-compositor.h"
+#include "i2c-lcd-bus.h"
+#include "i2c-lcd-uring.h"
+#include "i2c-lcd-calibrate.h"
+#include "i2c-lcd-async.h"
+#include "i2c-lcd-dlist.h"
+#include "i2c-lcd-field.h"
+
+/* Benchmarks for the i2c LCD library. Every benchmark is run against two
+ * transports:
+ *  - "emulator": the in-process HD44780 + PCF8574 emulator, which also checks
+ *    that what ends up on the display is correct and that no instruction was
+ *    sent while the controller was busy.
+ *  - "sink": the file descriptor of /dev/null, so that the cost of the
+ *    syscalls themselves is included.
+ * Results are written as one JSON object per line. "chars_per_sec" is over
+ * the whole benchmark (including any cursor moves between operations), while
+ * the latencies are of the measured operation alone. "syscalls_per_char"
+ * counts the reads and writes made through the transport, which are each one
+ * syscall on a real i2c device, and "sleeps_per_char" counts the calls to
+ * nanosleep() made by the library.
+ *
+ * Redrawing through io_uring is compared with redrawing through the usual
+ * write() and sleep path over a pipe (see bench_uring()).
+ *
+ * Redrawing through the writer thread of i2c-lcd-async.c measures how long
+ * submitting takes and how much is dropped when the LCD cannot keep up (see
+ * bench_async()).
+ *
+ * Single characters written to scattered cells compare moving the cursor by
+ * setting the DDRAM address with planning the cheapest move (see
+ * bench_scattered()).
+ *
+ * i2c_lcd_calibrate() is run against a slower emulated controller, to check
+ * that it converges and that the profile it finds can be saved and loaded
+ * (see bench_calibrate()).
+ *
+ * With -d <i2c device> -a <address>, the ways of writing to a real PCF8574 are
+ * also compared (see bench_bus()).
+ */
+
+
+struct bench_target {
+	const char *name;
+	struct i2c_lcd_emu emu;
+	/* The second controller of a 40x4 module */
+	struct i2c_lcd_emu emu2;
+	int sink_fd;
+	size_t sink_writes;
+	size_t sink_reads;
+	size_t sink_bytes;
+};
+
+
+static ssize_t sink_write(struct i2c_lcd1602 *i2c_lcd1602, const uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	struct bench_target *target = i2c_lcd1602->transport_ctx;
+
+	target->sink_writes++;
+	target->sink_bytes += n;
+	return write(target->sink_fd, buf, n);
+	/* }}} */
+}
+
+
+static ssize_t sink_read(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	struct bench_target *target = i2c_lcd1602->transport_ctx;
+
+	target->sink_reads++;
+	/* Nothing drives the data lines, so reads see the busy flag clear */
+	memset(buf, 0, n);
+	return n;
+	/* }}} */
+}
+
+
+static int sink_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (msgs[i].read) sink_read(i2c_lcd1602, msgs[i].buf, msgs[i].len);
+		else sink_write(i2c_lcd1602, msgs[i].buf, msgs[i].len);
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+static const struct i2c_lcd1602_transport sink_transport = {
+	.write = sink_write,
+	.read = sink_read,
+	.submit = sink_submit
+};
+
+
+/* Passes everything on to another transport, except that when armed the next
+ * write only gets its first three bytes (one nibble) onto the bus before
+ * failing the way a NACK does, leaving the controller a nibble out of step */
+struct bench_glitch {
+	const struct i2c_lcd1602_transport *inner;
+	void *inner_ctx;
+	int armed;
+};
+
+
+static ssize_t glitch_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	struct bench_glitch *glitch = i2c_lcd1602->transport_ctx;
+	size_t len = glitch->armed && n > 3 ? 3 : n;
+
+	i2c_lcd1602->transport_ctx = glitch->inner_ctx;
+	ssize_t r = glitch->inner->write(i2c_lcd1602, buf, len);
+	i2c_lcd1602->transport_ctx = glitch;
+
+	if (len < n) {
+		glitch->armed = 0;
+		errno = EREMOTEIO;
+		return -1;
+	}
+	return r;
+	/* }}} */
+}
+
+
+static ssize_t glitch_read(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	struct bench_glitch *glitch = i2c_lcd1602->transport_ctx;
+
+	i2c_lcd1602->transport_ctx = glitch->inner_ctx;
+	ssize_t r = glitch->inner->read(i2c_lcd1602, buf, n);
+	i2c_lcd1602->transport_ctx = glitch;
+
+	return r;
+	/* }}} */
+}
+
+
+static int glitch_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	struct bench_glitch *glitch = i2c_lcd1602->transport_ctx;
+
+	i2c_lcd1602->transport_ctx = glitch->inner_ctx;
+	int r = glitch->inner->submit(i2c_lcd1602, msgs, n);
+	i2c_lcd1602->transport_ctx = glitch;
+
+	return r;
+	/* }}} */
+}
+
+
+static const struct i2c_lcd1602_transport glitch_transport = {
+	.write = glitch_write,
+	.read = glitch_read,
+	.submit = glitch_submit
+};
+
+
+/** Return a page for an LCD of the given size that talks to 'target', after
+ * running the startup instructions */
+static struct i2c_lcd_page bench_setup(struct bench_target *target, \
+	uint8_t columns, uint8_t rows) {
+	/* {{{ */
+	struct i2c_lcd1602 i2c_lcd1602 = \
+		i2c_lcd1602_init(-1, 0x27, columns, rows, 0, LCD_BACKLIGHT);
+
+	if (0 == strcmp(target->name, "emulator")) {
+		i2c_lcd_emu_init(&target->emu);
+		i2c_lcd_emu_attach(&target->emu, &i2c_lcd1602);
+	} else {
+		i2c_lcd1602_set_transport(&i2c_lcd1602, &sink_transport, target);
+	}
+
+	struct i2c_lcd_page i2c_lcd_page = i2c_lcd_page_init(i2c_lcd1602);
+	i2c_lcd1602_begin(&i2c_lcd_page.i2c_lcd1602);
+
+	return i2c_lcd_page;
+	/* }}} */
+}
+
+
+/** Return a page for a 40x4 module with two controllers that talks to
+ * 'target', after running the startup instructions on both. The enable input
+ * of the second controller is wired to P1 (R/W), which these benchmarks never
+ * read through. */
+static struct i2c_lcd_page bench_setup_dual(struct bench_target *target) {
+	/* {{{ */
+	struct i2c_lcd1602 first = \
+		i2c_lcd1602_init(-1, 0x27, 40, 2, 0, LCD_BACKLIGHT);
+
+	if (0 == strcmp(target->name, "emulator")) {
+		i2c_lcd_emu_init(&target->emu);
+		i2c_lcd_emu_init(&target->emu2);
+		i2c_lcd_emu_share(&target->emu, &target->emu2, Rw);
+		i2c_lcd_emu_attach(&target->emu, &first);
+	} else {
+		i2c_lcd1602_set_transport(&first, &sink_transport, target);
+	}
+
+	struct i2c_lcd1602 second = first;
+	i2c_lcd1602_set_enable(&second, Rw);
+
+	struct i2c_lcd_page i2c_lcd_page = i2c_lcd_page_init_dual(first, second);
+	i2c_lcd1602_begin(&i2c_lcd_page.i2c_lcd1602);
+	i2c_lcd1602_begin(&i2c_lcd_page.second);
+
+	return i2c_lcd_page;
+	/* }}} */
+}
+
+
+/** Store the number of transport calls (each of which is one syscall for a
+ * real i2c device) and bytes sent so far to 'target' */
+static void bench_counters(struct bench_target *target, size_t *calls, \
+	size_t *bytes) {
+	/* {{{ */
+	if (0 == strcmp(target->name, "emulator")) {
+		*calls = target->emu.writes + target->emu.reads;
+		*bytes = target->emu.bytes_written;
+	} else {
+		*calls = target->sink_writes + target->sink_reads;
+		*bytes = target->sink_bytes;
+	}
+	/* }}} */
+}
+
+
+static long now_ns(void) {
+	/* {{{ */
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+	/* }}} */
+}
+
+
+static int compare_long(const void *a, const void *b) {
+	/* {{{ */
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+
+	return (x > y) - (x < y);
+	/* }}} */
+}
+
+
+/* The measurements for one benchmark on one target */
+struct bench_result {
+	const char *bench;
+	uint8_t columns;
+	uint8_t rows;
+	size_t ops;
+	size_t chars_per_op;
+	long *latency_ns;
+	long total_ns;
+	size_t calls;
+	size_t bytes;
+	uint64_t sleeps;
+	/* Waits for the controller, how late they ended in total and at worst,
+	 * and how long was spent spinning in them */
+	uint64_t waits;
+	uint64_t wait_late_ns;
+	uint64_t wait_late_max_ns;
+	uint64_t spin_ns;
+	/* Whether the emulated display showed what was expected at the end, or
+	 * -1 if this could not be checked */
+	int correct;
+};
+
+
+/** Write 'result' as one line of JSON */
+static void bench_report(FILE *out, struct bench_target *target, \
+	struct bench_result *result) {
+	/* {{{ */
+	size_t chars = result->ops * result->chars_per_op;
+	long sum_ns = 0;
+
+	for (size_t i = 0; i < result->ops; i++) sum_ns += result->latency_ns[i];
+	qsort(result->latency_ns, result->ops, sizeof(long), compare_long);
+
+	fprintf(out, "{\"bench\": \"%s\", \"transport\": \"%s\", " \
+		"\"geometry\": \"%dx%d\", \"ops\": %zu, \"chars_per_sec\": %.1f, " \
+		"\"syscalls_per_char\": %.3f, \"sleeps_per_char\": %.3f, " \
+		"\"bytes_per_op\": %.1f, " \
+		"\"p50_ns\": %ld, \"p99_ns\": %ld, \"mean_ns\": %ld, " \
+		"\"wait_late_mean_ns\": %.0f, \"wait_late_max_ns\": %" PRIu64 ", " \
+		"\"spin_ns_per_op\": %.0f, " \
+		"\"busy_violations\": %zd, \"correct\": %s}\n",
+		result->bench, target->name, result->columns, result->rows, \
+		result->ops, chars * 1e9 / result->total_ns, \
+		(double) result->calls / chars, (double) result->sleeps / chars, \
+		(double) result->bytes / result->ops, \
+		result->latency_ns[result->ops / 2], \
+		result->latency_ns[result->ops * 99 / 100], \
+		sum_ns / (long) result->ops, \
+		result->waits > 0 ? (double) result->wait_late_ns / result->waits : 0.0, \
+		result->wait_late_max_ns, (double) result->spin_ns / result->ops, \
+		0 == strcmp(target->name, "emulator") \
+			? (ssize_t) (target->emu.busy_violations + (target->emu.shared \
+				? target->emu2.busy_violations : 0)) : (ssize_t) -1, \
+		result->correct < 0 ? "null" : result->correct ? "true" : "false");
+	fflush(out);
+	/* }}} */
+}
+
+
+/** Check that the emulated display shows 'expected' */
+static int bench_check(struct bench_target *target, uint8_t columns, \
+	uint8_t rows, const char *expected) {
+	/* {{{ */
+	char shown[4 * 40 + 1];
+
+	if (0 != strcmp(target->name, "emulator")) return -1;
+
+	/* Rows past the fourth are on the second controller of a module with
+	 * two */
+	if (rows == 4 && columns == 40) {
+		i2c_lcd_emu_render(&target->emu, columns, 2, shown);
+		i2c_lcd_emu_render(&target->emu2, columns, 2, shown + 2 * columns);
+	} else {
+		i2c_lcd_emu_render(&target->emu, columns, rows, shown);
+	}
+	return 0 == strncmp(shown, expected, columns * rows);
+	/* }}} */
+}
+
+
+/* The state shared by the start and end of each measured operation */
+struct bench_run {
+	struct bench_target *target;
+	struct i2c_lcd1602 *i2c_lcd1602;
+	struct bench_result result;
+	size_t calls_before;
+	size_t bytes_before;
+	long start_ns;
+	long op_start_ns;
+};
+
+
+static void bench_begin(struct bench_run *run, struct bench_target *target, \
+	struct i2c_lcd1602 *i2c_lcd1602, const char *bench, uint8_t columns, uint8_t rows, size_t ops, \
+	size_t chars_per_op, long *latency_ns) {
+	/* {{{ */
+	run->target = target;
+	run->i2c_lcd1602 = i2c_lcd1602;
+	i2c_lcd1602_stats_reset(i2c_lcd1602);
+	run->result = (struct bench_result) {
+		.bench = bench,
+		.columns = columns,
+		.rows = rows,
+		.ops = ops,
+		.chars_per_op = chars_per_op,
+		.latency_ns = latency_ns,
+		.correct = -1
+	};
+	bench_counters(target, &run->calls_before, &run->bytes_before);
+	run->start_ns = now_ns();
+	/* }}} */
+}
+
+
+static void bench_end(struct bench_run *run) {
+	/* {{{ */
+	size_t calls;
+	size_t bytes;
+
+	run->result.total_ns = now_ns() - run->start_ns;
+	bench_counters(run->target, &calls, &bytes);
+	run->result.calls = calls - run->calls_before;
+	run->result.bytes = bytes - run->bytes_before;
+
+	struct i2c_lcd1602_stats stats;
+	i2c_lcd1602_stats_snapshot(run->i2c_lcd1602, &stats);
+	run->result.sleeps = stats.sleeps;
+	run->result.waits = stats.waits;
+	run->result.wait_late_ns = stats.wait_late_ns;
+	run->result.wait_late_max_ns = stats.wait_late_max_ns;
+	run->result.spin_ns = stats.spin_ns;
+	/* }}} */
+}
+
+
+/** Fill 'frame' with 'columns' * 'rows' characters that differ from the
+ * previous frame in every cell */
+static void bench_make_frame(char *frame, uint8_t columns, uint8_t rows, \
+	size_t i) {
+	/* {{{ */
+	for (int j = 0; j < columns * rows; j++) frame[j] = 'A' + (i + j) % 26;
+	/* }}} */
+}
+
+
+/** Redraw (and optionally clear first) eight 16x2 LCDs sharing 'target'
+ * through a bus scheduler, either flushing after each LCD so that each waits
+ * for its own controller in turn, or queueing all of them and flushing once
+ * so that they are interleaved. Each LCD shows a different frame; on the
+ * emulator, the first is 'target->emu' and the others have their own. */
+static void bench_multi(FILE *out, struct bench_target *target, size_t ops, \
+	long *latency_ns, int clear, int interleaved) {
+	/* {{{ */
+	static struct i2c_lcd_emu emus[I2C_LCD_BUS_DISPLAYS];
+	struct i2c_lcd1602 lcds[I2C_LCD_BUS_DISPLAYS];
+	struct i2c_lcd_bus bus;
+	struct bench_run run;
+	/* The transfers the other emulators had seen when the run began, which
+	 * include i2c_lcd1602_begin() */
+	size_t calls_before[I2C_LCD_BUS_DISPLAYS];
+	size_t bytes_before[I2C_LCD_BUS_DISPLAYS];
+	char frame[2 * 16];
+	int emulated = 0 == strcmp(target->name, "emulator");
+
+	i2c_lcd_bus_init(&bus, -1);
+	for (int d = 0; d < I2C_LCD_BUS_DISPLAYS; d++) {
+		lcds[d] = i2c_lcd1602_init(-1, 0x20 + d, 16, 2, 0, LCD_BACKLIGHT);
+		if (emulated) {
+			struct i2c_lcd_emu *emu = d == 0 ? &target->emu : &emus[d];
+			i2c_lcd_emu_init(emu);
+			i2c_lcd_emu_attach(emu, &lcds[d]);
+		} else {
+			i2c_lcd1602_set_transport(&lcds[d], &sink_transport, target);
+		}
+		i2c_lcd1602_begin(&lcds[d]);
+		i2c_lcd_bus_add(&bus, &lcds[d]);
+	}
+	target->emu.shared = NULL;
+
+	char name[64];
+	snprintf(name, sizeof(name), "multi_%sredraw_%s", clear ? "clear_" : "", \
+		interleaved ? "interleaved" : "sequential");
+	bench_begin(&run, target, &lcds[0], name, 16, 2, ops, \
+		I2C_LCD_BUS_DISPLAYS * sizeof(frame), latency_ns);
+	for (int d = 1; d < I2C_LCD_BUS_DISPLAYS; d++) {
+		i2c_lcd1602_stats_reset(&lcds[d]);
+		calls_before[d] = emus[d].writes + emus[d].reads;
+		bytes_before[d] = emus[d].bytes_written;
+	}
+	for (size_t i = 0; i < ops; i++) {
+		long t = now_ns();
+		for (int d = 0; d < I2C_LCD_BUS_DISPLAYS; d++) {
+			bench_make_frame(frame, 16, 2, i + d);
+			if (clear) i2c_lcd_bus_clear_display(&bus, d);
+			for (int row = 0; row < 2; row++) {
+				i2c_lcd_bus_set_cursor_pos(&bus, d, row * 0x40);
+				i2c_lcd_bus_write_buffer(&bus, d, frame + row * 16, 16);
+			}
+			if (!interleaved) i2c_lcd_bus_flush(&bus);
+		}
+		i2c_lcd_bus_flush(&bus);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+
+	/* Count the waits and transfers of every LCD, and check every LCD on the
+	 * emulator */
+	for (int d = 1; d < I2C_LCD_BUS_DISPLAYS; d++) {
+		struct i2c_lcd1602_stats stats;
+		i2c_lcd1602_stats_snapshot(&lcds[d], &stats);
+		run.result.sleeps += stats.sleeps;
+		run.result.waits += stats.waits;
+		run.result.wait_late_ns += stats.wait_late_ns;
+		if (stats.wait_late_max_ns > run.result.wait_late_max_ns) {
+			run.result.wait_late_max_ns = stats.wait_late_max_ns;
+		}
+		run.result.spin_ns += stats.spin_ns;
+	}
+	if (emulated) {
+		for (int d = 1; d < I2C_LCD_BUS_DISPLAYS; d++) {
+			run.result.calls += emus[d].writes + emus[d].reads - calls_before[d];
+			run.result.bytes += emus[d].bytes_written - bytes_before[d];
+		}
+		run.result.correct = 1;
+		for (int d = 0; d < I2C_LCD_BUS_DISPLAYS; d++) {
+			struct i2c_lcd_emu *emu = d == 0 ? &target->emu : &emus[d];
+			char shown[2 * 16 + 1];
+
+			bench_make_frame(frame, 16, 2, ops - 1 + d);
+			i2c_lcd_emu_render(emu, 16, 2, shown);
+			if (0 != memcmp(shown, frame, sizeof(frame)) \
+				|| (d > 0 && emu->busy_violations > 0)) {
+
+				run.result.correct = 0;
+			}
+		}
+	}
+	bench_report(out, target, &run.result);
+	/* }}} */
+}
+
+
+/** Write single characters to scattered cells of a 16x2 LCD, with 'timing'.
+ * Three in four go one to three cells to the right of the last one on the
+ * same line (as when a few digits of a reading change), and the rest
+ * anywhere. The cursor is moved either with i2c_lcd1602_set_cursor_pos(),
+ * which always sets the DDRAM address, or with i2c_lcd_page_set_cursor_pos(),
+ * which plans the cheapest move from where the cursor is. */
+static void bench_scattered(FILE *out, struct bench_target *target, \
+	size_t ops, long *latency_ns, const struct i2c_lcd1602_timing *timing, \
+	int planned, const char *bench) {
+	/* {{{ */
+	struct i2c_lcd_page page = bench_setup(target, 16, 2);
+	struct bench_run run;
+	char frame[2 * 16];
+	uint32_t seed = 1;
+	int cell = 0;
+
+	memset(frame, ' ', sizeof(frame));
+	page.i2c_lcd1602.timing = *timing;
+	bench_begin(&run, target, &page.i2c_lcd1602, bench, 16, 2, ops, 1, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 4 != 0) {
+			cell = cell / 16 * 16 + (cell % 16 + 1 + (seed >> 20) % 3) % 16;
+		} else {
+			cell = (seed >> 22) % 32;
+		}
+		frame[cell] = 'a' + i % 26;
+
+		long t = now_ns();
+		if (planned) {
+			i2c_lcd_page_set_cursor_pos(&page, cell % 16, cell / 16);
+			i2c_lcd_page_send_char(&page, frame[cell]);
+		} else {
+			i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, \
+				cell / 16 * 0x40 + cell % 16);
+			i2c_lcd1602_send_char(&page.i2c_lcd1602, frame[cell]);
+		}
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+	/* }}} */
+}
+
+
+/** Submit 'ops' redraws of a 16x2 LCD (a set DDRAM address and 16
+ * characters for each row) through the writer thread of i2c-lcd-async.c as
+ * fast as they can be submitted, which is far faster than the LCD takes them,
+ * so the ring fills up and 'policy' decides what happens. The latencies are
+ * of submitting each redraw. Once the ring has drained, the display must show
+ * the last redraw with I2C_LCD_ASYNC_BLOCK. With the policies that drop
+ * entries, whatever was dropped may have left characters anywhere, so the
+ * last redraw is submitted again on the empty ring and must be shown then. */
+static void bench_async(FILE *out, struct bench_target *target, size_t ops, \
+	long *latency_ns, enum i2c_lcd_async_policy policy) {
+	/* {{{ */
+	const char *policies[] = {
+		[I2C_LCD_ASYNC_BLOCK] = "block",
+		[I2C_LCD_ASYNC_DROP_NEWEST] = "drop_newest",
+		[I2C_LCD_ASYNC_DROP_OLDEST] = "drop_oldest"
+	};
+	struct i2c_lcd_page page = bench_setup(target, 16, 2);
+	struct i2c_lcd_async async;
+	char frame[2 * 16];
+	/* A set DDRAM address and 16 characters for each row */
+	size_t entries = 2 * (1 + 16);
+	long sum_ns = 0;
+
+	if (0 != i2c_lcd_async_start(&async, &page.i2c_lcd1602, policy)) {
+		fprintf(stderr, "Failed to start the writer thread\n");
+		return;
+	}
+
+	long start = now_ns();
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 16, 2, i);
+		long t = now_ns();
+		for (int row = 0; row < 2; row++) {
+			i2c_lcd_async_set_cursor_pos(&async, row * 0x40);
+			i2c_lcd_async_write_buffer(&async, frame + row * 16, 16);
+		}
+		latency_ns[i] = now_ns() - t;
+		sum_ns += latency_ns[i];
+	}
+	long submit_ns = now_ns() - start;
+	i2c_lcd_async_flush(&async);
+	long drain_ns = now_ns() - start;
+	size_t dropped = i2c_lcd_async_dropped(&async);
+
+	if (policy != I2C_LCD_ASYNC_BLOCK) {
+		for (int row = 0; row < 2; row++) {
+			i2c_lcd_async_set_cursor_pos(&async, row * 0x40);
+			i2c_lcd_async_write_buffer(&async, frame + row * 16, 16);
+		}
+	}
+	i2c_lcd_async_stop(&async);
+	i2c_lcd1602_wait_ready(&page.i2c_lcd1602);
+	int correct = bench_check(target, 16, 2, frame);
+	qsort(latency_ns, ops, sizeof(long), compare_long);
+
+	fprintf(out, "{\"bench\": \"async_redraw\", \"transport\": \"%s\", " \
+		"\"policy\": \"%s\", \"geometry\": \"16x2\", \"ops\": %zu, " \
+		"\"entries_per_op\": %zu, \"submit_ns_per_entry\": %.1f, " \
+		"\"p50_ns\": %ld, \"p99_ns\": %ld, \"mean_ns\": %ld, " \
+		"\"drain_ms\": %.1f, \"dropped\": %zu, \"errors\": %zu, " \
+		"\"busy_violations\": %zd, \"correct\": %s}\n",
+		target->name, policies[policy], ops, entries, \
+		(double) submit_ns / (ops * entries), \
+		latency_ns[ops / 2], latency_ns[ops * 99 / 100], \
+		sum_ns / (long) ops, drain_ns / 1e6, dropped, \
+		i2c_lcd_async_errors(&async), \
+		0 == strcmp(target->name, "emulator") \
+			? (ssize_t) target->emu.busy_violations : (ssize_t) -1, \
+		correct < 0 ? "null" : correct ? "true" : "false");
+	fflush(out);
+	/* }}} */
+}
+
+
+static void bench_all(FILE *out, struct bench_target *target, size_t ops, \
+	const struct i2c_lcd1602_timing *calibrated) {
+	/* {{{ */
+	long *latency_ns = calloc(ops, sizeof(long));
+	struct bench_run run;
+	char frame[4 * 40];
+
+	/* One character at a time with i2c_lcd1602_send_char() */
+	struct i2c_lcd_page page = bench_setup(target, 16, 2);
+	bench_begin(&run, target, &page.i2c_lcd1602, "send_char", 16, 2, ops, 1, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		if (i % 16 == 0) i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, 0);
+		long t = now_ns();
+		i2c_lcd1602_send_char(&page.i2c_lcd1602, 'a' + i % 26);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	bench_report(out, target, &run.result);
+
+	/* Runs of 16 characters with i2c_lcd1602_write_buffer() */
+	page = bench_setup(target, 16, 2);
+	bench_begin(&run, target, &page.i2c_lcd1602, "write_buffer_16", 16, 2, ops, 16, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 16, 1, i);
+		i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, 0);
+		long t = now_ns();
+		i2c_lcd1602_write_buffer(&page.i2c_lcd1602, frame, 16);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 1, frame);
+	bench_report(out, target, &run.result);
+
+	/* Redrawing every cell of a 16x2 page with i2c_lcd_page_flush() */
+	page = bench_setup(target, 16, 2);
+	bench_begin(&run, target, &page.i2c_lcd1602, "page_redraw", 16, 2, ops, 32, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 16, 2, i);
+		long t = now_ns();
+		i2c_lcd_page_write(&page, 0, 0, frame, 16);
+		i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* Updating a 4 digit counter on an otherwise static 16x2 page */
+	page = bench_setup(target, 16, 2);
+	memcpy(frame, "RPM             Temp  21.5 C    ", 32);
+	i2c_lcd_page_write(&page, 0, 0, frame, 16);
+	i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+	i2c_lcd_page_flush(&page);
+	bench_begin(&run, target, &page.i2c_lcd1602, "page_field_update", 16, 2, ops, 4, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		char digits[5];
+		snprintf(digits, sizeof(digits), "%04zu", 1000 + i % 9000);
+		memcpy(frame + 4, digits, 4);
+		long t = now_ns();
+		i2c_lcd_page_write(&page, 4, 0, digits, 4);
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* The same counter drawn with a numeric field, which only sends the
+	 * digits that changed */
+	page = bench_setup(target, 16, 2);
+	memcpy(frame, "RPM             Temp  21.5 C    ", 32);
+	i2c_lcd_page_write(&page, 0, 0, frame, 16);
+	i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+	i2c_lcd_page_flush(&page);
+	struct i2c_lcd_field field;
+	i2c_lcd_field_init(&field, &page, 4, 0, 4, 0, I2C_LCD_FIELD_RIGHT, '0');
+	i2c_lcd_field_set(&field, 999);
+	bench_begin(&run, target, &page.i2c_lcd1602, "field_update", 16, 2, ops, 4, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		long t = now_ns();
+		i2c_lcd_field_set(&field, 1000 + i % 9000);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	snprintf(frame + 4, 5, "%04zu", 1000 + (ops - 1) % 9000);
+	frame[8] = ' ';
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* The same counter written 10 times per frame through a compositor, so
+	 * only every 10th value reaches the LCD */
+	page = bench_setup(target, 16, 2);
+	memcpy(frame, "RPM             Temp  21.5 C    ", 32);
+	i2c_lcd_page_write(&page, 0, 0, frame, 16);
+	i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+	i2c_lcd_page_flush(&page);
+	struct i2c_lcd_comp comp;
+	i2c_lcd_comp_init(&comp, &page);
+	int rpm = i2c_lcd_comp_add_region(&comp, "rpm", 4, 0, 4, 0);
+	bench_begin(&run, target, &page.i2c_lcd1602, "comp_field_update", 16, 2, ops, 4, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		long t = now_ns();
+		i2c_lcd_comp_printf(&comp, rpm, "%04zu", 1000 + i % 9000);
+		if (i % 10 == 9 || i == ops - 1) i2c_lcd_comp_tick(&comp);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	snprintf(frame + 4, 5, "%04zu", 1000 + (ops - 1) % 9000);
+	frame[8] = ' ';
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+	i2c_lcd_comp_destroy(&comp);
+
+	/* Drawing a fixed 16x2 screen with two fields from scratch, cell by cell
+	 * with i2c_lcd1602_send_char() */
+	page = bench_setup(target, 16, 2);
+	bench_begin(&run, target, &page.i2c_lcd1602, "template_rebuild", 16, 2, ops, 32, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		snprintf(frame, sizeof(frame), "RPM %04zu  Fan OKQueue %4zu  idle", \
+			1000 + i % 9000, i % 1000);
+		long t = now_ns();
+		for (int row = 0; row < 2; row++) {
+			i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, \
+				i2c_lcd1602_row_offset(&page.i2c_lcd1602, row));
+			for (int j = 0; j < 16; j++) {
+				i2c_lcd1602_send_char(&page.i2c_lcd1602, frame[row * 16 + j]);
+			}
+		}
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* The same screen recorded once as a display list with the fields as
+	 * holes, which are patched before each replay */
+	page = bench_setup(target, 16, 2);
+	struct i2c_lcd_dlist dlist;
+	i2c_lcd_dlist_init(&dlist, &page.i2c_lcd1602);
+	i2c_lcd_dlist_set_cursor_pos(&dlist, i2c_lcd1602_row_offset(&page.i2c_lcd1602, 0));
+	i2c_lcd_dlist_write_buffer(&dlist, "RPM ", 4);
+	int rpm_hole = i2c_lcd_dlist_hole(&dlist, "rpm", 4);
+	i2c_lcd_dlist_write_buffer(&dlist, "  Fan OK", 8);
+	i2c_lcd_dlist_set_cursor_pos(&dlist, i2c_lcd1602_row_offset(&page.i2c_lcd1602, 1));
+	i2c_lcd_dlist_write_buffer(&dlist, "Queue ", 6);
+	int queue_hole = i2c_lcd_dlist_hole(&dlist, "queue", 4);
+	i2c_lcd_dlist_write_buffer(&dlist, "  idle", 6);
+	bench_begin(&run, target, &page.i2c_lcd1602, "template_replay", 16, 2, ops, 32, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		char field[8];
+		snprintf(frame, sizeof(frame), "RPM %04zu  Fan OKQueue %4zu  idle", \
+			1000 + i % 9000, i % 1000);
+		long t = now_ns();
+		snprintf(field, sizeof(field), "%04zu", 1000 + i % 9000);
+		i2c_lcd_dlist_set(&dlist, rpm_hole, field, 4);
+		snprintf(field, sizeof(field), "%4zu", i % 1000);
+		i2c_lcd_dlist_set(&dlist, queue_hole, field, 4);
+		i2c_lcd_dlist_replay(&dlist);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* Scrolling a 66 character ticker through row 0 of a 16x2 page with
+	 * i2c_lcd_page_marquee_step() */
+	page = bench_setup(target, 16, 2);
+	const char *ticker = "EURUSD 1.0842 +0.12%  GBPUSD 1.2715 -0.05%  USDJPY 151.32 +0.40%  ";
+	struct i2c_lcd_page_marquee marquee;
+	size_t ticker_len = strlen(ticker);
+	i2c_lcd_page_marquee_start(&page, &marquee, 0, ticker, ticker_len);
+	bench_begin(&run, target, &page.i2c_lcd1602, "marquee_step", 16, 2, ops, 1, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		long t = now_ns();
+		i2c_lcd_page_marquee_step(&page, &marquee);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	for (int j = 0; j < 16; j++) frame[j] = ticker[(marquee.pos + j) % ticker_len];
+	run.result.correct = bench_check(target, 16, 1, frame);
+	bench_report(out, target, &run.result);
+
+	/* Recovering from a transfer cut short one nibble in, on every flush.
+	 * The flush resynchronizes the controller and replays the page. */
+	page = bench_setup(target, 16, 2);
+	struct bench_glitch glitch = {
+		.inner = page.i2c_lcd1602.transport,
+		.inner_ctx = page.i2c_lcd1602.transport_ctx
+	};
+	i2c_lcd1602_set_transport(&page.i2c_lcd1602, &glitch_transport, &glitch);
+	bench_begin(&run, target, &page.i2c_lcd1602, "recover", 16, 2, ops, 32, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 16, 2, i);
+		i2c_lcd_page_write(&page, 0, 0, frame, 16);
+		i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+		glitch.armed = 1;
+		long t = now_ns();
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame) \
+		&& page.recoveries == ops;
+	bench_report(out, target, &run.result);
+
+	/* The same without resynchronizing: initializing the LCD again and
+	 * redrawing the page from scratch */
+	page = bench_setup(target, 16, 2);
+	bench_begin(&run, target, &page.i2c_lcd1602, "reinit", 16, 2, ops, 32, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 16, 2, i);
+		long t = now_ns();
+		i2c_lcd1602_begin(&page.i2c_lcd1602);
+		page = i2c_lcd_page_init(page.i2c_lcd1602);
+		i2c_lcd_page_write(&page, 0, 0, frame, 16);
+		i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* Restarting a program that shows a 16x2 page: taking over what the
+	 * display shows with i2c_lcd_page_begin_warm(), and initializing it and
+	 * redrawing the page. Only the emulator can be read back from. */
+	if (0 == strcmp(target->name, "emulator")) {
+		char state_path[] = "/tmp/i2c-lcd-bench-state-XXXXXX";
+		int state_fd = mkstemp(state_path);
+		size_t warm = 0;
+
+		if (state_fd >= 0) close(state_fd);
+
+		page = bench_setup(target, 16, 2);
+		bench_make_frame(frame, 16, 2, 0);
+		i2c_lcd_page_write(&page, 0, 0, frame, 16);
+		i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+		i2c_lcd_page_flush(&page);
+		i2c_lcd_page_save(&page, state_path);
+
+		bench_begin(&run, target, &page.i2c_lcd1602, "warm_start", 16, 2, ops, 32, latency_ns);
+		for (size_t i = 0; i < ops; i++) {
+			struct i2c_lcd1602 restarted = \
+				i2c_lcd1602_init(-1, 0x27, 16, 2, 0, LCD_BACKLIGHT);
+			i2c_lcd_emu_attach(&target->emu, &restarted);
+			restarted.stats = page.i2c_lcd1602.stats;
+
+			long t = now_ns();
+			page = i2c_lcd_page_init(restarted);
+			if (0 == i2c_lcd_page_begin_warm(&page, state_path)) warm++;
+			latency_ns[i] = now_ns() - t;
+		}
+		bench_end(&run);
+		/* The page carries on from what it took over */
+		frame[0] = '#';
+		i2c_lcd_page_write(&page, 0, 0, frame, 1);
+		i2c_lcd_page_flush(&page);
+		run.result.correct = bench_check(target, 16, 2, frame) && warm == ops;
+		bench_report(out, target, &run.result);
+
+		bench_begin(&run, target, &page.i2c_lcd1602, "cold_start", 16, 2, ops, 32, latency_ns);
+		for (size_t i = 0; i < ops; i++) {
+			struct i2c_lcd1602 restarted = \
+				i2c_lcd1602_init(-1, 0x27, 16, 2, 0, LCD_BACKLIGHT);
+			i2c_lcd_emu_attach(&target->emu, &restarted);
+			restarted.stats = page.i2c_lcd1602.stats;
+
+			long t = now_ns();
+			page = i2c_lcd_page_init(restarted);
+			i2c_lcd1602_begin(&page.i2c_lcd1602);
+			i2c_lcd_page_write(&page, 0, 0, frame, 16);
+			i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+			i2c_lcd_page_flush(&page);
+			latency_ns[i] = now_ns() - t;
+		}
+		bench_end(&run);
+		run.result.correct = bench_check(target, 16, 2, frame);
+		bench_report(out, target, &run.result);
+
+		unlink(state_path);
+	}
+
+	/* One character at a time with each way of waiting. With the datasheet
+	 * timing there is no delay around the enable strobe, so the waits are
+	 * all of the order of the 37µs instructions take */
+	const char *wait_benches[I2C_LCD1602_WAIT_MODES] = {
+		[I2C_LCD1602_WAIT_SLEEP] = "wait_sleep",
+		[I2C_LCD1602_WAIT_ABSTIME] = "wait_abstime",
+		[I2C_LCD1602_WAIT_SPIN] = "wait_spin",
+		[I2C_LCD1602_WAIT_HYBRID] = "wait_hybrid"
+	};
+	for (int mode = 0; mode < I2C_LCD1602_WAIT_MODES; mode++) {
+		page = bench_setup(target, 16, 2);
+		i2c_lcd1602_set_wait(&page.i2c_lcd1602, mode, \
+			page.i2c_lcd1602.spin_threshold_ns);
+		if (mode == I2C_LCD1602_WAIT_HYBRID) {
+			i2c_lcd1602_calibrate_wait(&page.i2c_lcd1602);
+		}
+		bench_begin(&run, target, &page.i2c_lcd1602, wait_benches[mode], 16, 2, ops, 1, latency_ns);
+		for (size_t i = 0; i < ops; i++) {
+			frame[i % 16] = 'a' + i % 26;
+			if (i % 16 == 0) i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, 0);
+			long t = now_ns();
+			i2c_lcd1602_send_char(&page.i2c_lcd1602, frame[i % 16]);
+			latency_ns[i] = now_ns() - t;
+		}
+		bench_end(&run);
+		run.result.correct = ops >= 16 ? bench_check(target, 16, 1, frame) : -1;
+		bench_report(out, target, &run.result);
+	}
+
+	/* Turning the backlight on and off, which only changes an output of the
+	 * PCF8574 */
+	page = bench_setup(target, 16, 2);
+	memcpy(frame, "RPM             Temp  21.5 C    ", 32);
+	i2c_lcd_page_write(&page, 0, 0, frame, 16);
+	i2c_lcd_page_write(&page, 0, 1, frame + 16, 16);
+	i2c_lcd_page_flush(&page);
+	bench_begin(&run, target, &page.i2c_lcd1602, "backlight_toggle", 16, 2, ops, 1, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		long t = now_ns();
+		i2c_lcd1602_set_backlight(&page.i2c_lcd1602, \
+			i % 2 ? LCD_BACKLIGHT : LCD_NOBACKLIGHT);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	if (run.result.correct == 1) {
+		run.result.correct = \
+			(target->emu.port & LCD_BACKLIGHT) == page.i2c_lcd1602.backlight;
+	}
+	bench_report(out, target, &run.result);
+
+	/* A field updated by an application that sends its display settings
+	 * again every time, most of which the register model skips */
+	page = bench_setup(target, 16, 2);
+	i2c_lcd1602_write_buffer(&page.i2c_lcd1602, frame, 16);
+	i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, 0x40);
+	i2c_lcd1602_write_buffer(&page.i2c_lcd1602, frame + 16, 16);
+	bench_begin(&run, target, &page.i2c_lcd1602, "settings_refresh", 16, 2, ops, 4, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		char digits[5];
+		snprintf(digits, sizeof(digits), "%04zu", 1000 + i % 9000);
+		memcpy(frame + 4, digits, 4);
+		long t = now_ns();
+		i2c_lcd1602_display_control(&page.i2c_lcd1602, LCD_DISPLAYON, \
+			LCD_CURSOROFF, LCD_BLINKOFF);
+		i2c_lcd1602_entry_mode_set(&page.i2c_lcd1602, LCD_ENTRYINCREMENT, \
+			LCD_ENTRYNOSHIFT);
+		i2c_lcd1602_set_backlight(&page.i2c_lcd1602, LCD_BACKLIGHT);
+		i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, 4);
+		i2c_lcd1602_write_buffer(&page.i2c_lcd1602, digits, 4);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 16, 2, frame);
+	bench_report(out, target, &run.result);
+
+	/* Redrawing every cell of a 20x4 display. Rows 2 and 3 continue DDRAM
+	 * lines 0 and 1 (page 11 of the HD44780 datasheet). */
+	page = bench_setup(target, 20, 4);
+	bench_begin(&run, target, &page.i2c_lcd1602, "redraw", 20, 4, ops, 80, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 20, 4, i);
+		long t = now_ns();
+		for (int row = 0; row < 4; row++) {
+			i2c_lcd1602_set_cursor_pos(&page.i2c_lcd1602, \
+				i2c_lcd1602_row_offset(&page.i2c_lcd1602, row));
+			i2c_lcd1602_write_buffer(&page.i2c_lcd1602, frame + row * 20, 20);
+		}
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 20, 4, frame);
+	bench_report(out, target, &run.result);
+
+	/* The same with i2c_lcd_page_flush(), which sends all four rows in one
+	 * transaction */
+	page = bench_setup(target, 20, 4);
+	bench_begin(&run, target, &page.i2c_lcd1602, "page_redraw", 20, 4, ops, 80, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 20, 4, i);
+		long t = now_ns();
+		for (int row = 0; row < 4; row++) {
+			i2c_lcd_page_write(&page, 0, row, frame + row * 20, 20);
+		}
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 20, 4, frame);
+	bench_report(out, target, &run.result);
+
+	/* Redrawing every cell of a 40x4 module, whose two controllers are sent
+	 * their rows in the same transaction */
+	page = bench_setup_dual(target);
+	bench_begin(&run, target, &page.i2c_lcd1602, "page_redraw", 40, 4, ops, 160, latency_ns);
+	for (size_t i = 0; i < ops; i++) {
+		bench_make_frame(frame, 40, 4, i);
+		long t = now_ns();
+		for (int row = 0; row < 4; row++) {
+			i2c_lcd_page_write(&page, 0, row, frame + row * 40, 40);
+		}
+		i2c_lcd_page_flush(&page);
+		latency_ns[i] = now_ns() - t;
+	}
+	bench_end(&run);
+	run.result.correct = bench_check(target, 40, 4, frame);
+	bench_report(out, target, &run.result);
+
+	/* Single characters in scattered cells, moving the cursor by setting the
+	 * DDRAM address or the cheapest way, with the datasheet timing and (if
+	 * there is one) a calibrated timing */
+	bench_scattered(out, target, ops, latency_ns, \
+		&i2c_lcd1602_datasheet_timing, 0, "scattered_set_ddram");
+	bench_scattered(out, target, ops, latency_ns, \
+		&i2c_lcd1602_datasheet_timing, 1, "scattered_planned");
+	if (calibrated != NULL) {
+		bench_scattered(out, target, ops, latency_ns, calibrated, 0, \
+			"scattered_set_ddram_calibrated");
+		bench_scattered(out, target, ops, latency_ns, calibrated, 1, \
+			"scattered_planned_calibrated");
+	}
+
+	/* Redrawing through the writer thread faster than the LCD can keep up,
+	 * with each policy for a full ring */
+	bench_async(out, target, ops, latency_ns, I2C_LCD_ASYNC_BLOCK);
+	bench_async(out, target, ops, latency_ns, I2C_LCD_ASYNC_DROP_NEWEST);
+	bench_async(out, target, ops, latency_ns, I2C_LCD_ASYNC_DROP_OLDEST);
+
+	/* Eight LCDs on one bus, each waiting for its own controller in turn or
+	 * interleaved by the bus scheduler */
+	for (int clear = 0; clear < 2; clear++) {
+		bench_multi(out, target, ops, latency_ns, clear, 0);
+		bench_multi(out, target, ops, latency_ns, clear, 1);
+	}
+
+	free(latency_ns);
+	/* }}} */
+}
+
+
+/* Counts the calls made to another transport, each of which is one syscall */
+struct bench_counting {
+	const struct i2c_lcd1602_transport *inner;
+	size_t calls;
+};
+
+
+static ssize_t counting_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	struct bench_counting *counting = i2c_lcd1602->transport_ctx;
+
+	counting->calls++;
+	return counting->inner->write(i2c_lcd1602, buf, n);
+	/* }}} */
+}
+
+
+static ssize_t counting_read(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	struct bench_counting *counting = i2c_lcd1602->transport_ctx;
+
+	counting->calls++;
+	return counting->inner->read(i2c_lcd1602, buf, n);
+	/* }}} */
+}
+
+
+static int counting_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	struct bench_counting *counting = i2c_lcd1602->transport_ctx;
+
+	counting->calls++;
+	return counting->inner->submit(i2c_lcd1602, msgs, n);
+	/* }}} */
+}
+
+
+static const struct i2c_lcd1602_transport counting_transport = {
+	.write = counting_write,
+	.read = counting_read,
+	.submit = counting_submit
+};
+
+
+/** Feed everything written to the pipe so far to the emulator */
+static void bench_drain(int fd, struct i2c_lcd_emu *i2c_lcd_emu) {
+	/* {{{ */
+	uint8_t buf[4096];
+	ssize_t r;
+
+	while (0 < (r = read(fd, buf, sizeof(buf)))) {
+		i2c_lcd_emu_feed(i2c_lcd_emu, buf, r);
+	}
+	/* }}} */
+}
+
+
+/** Compare three ways of redrawing a 16x2 LCD (optionally clearing it first):
+ * i2c_lcd1602_set_cursor_pos() and i2c_lcd1602_write_buffer(), whose
+ * instructions go through i2c_lcd1602_write_4bits(); i2c_lcd_page_flush(),
+ * which batches the frame into as few writes as it can but still sleeps on
+ * the calling thread; and submitting the frame as one chain through io_uring.
+ * All three write to a pipe, which is drained into the emulator after every
+ * frame to check what was sent. "syscalls_per_frame" counts the writes and
+ * sleeps of the first two and the io_uring_enter() calls of the last. */
+static int bench_uring(FILE *out, size_t ops) {
+	/* {{{ */
+	const char *paths[] = { "write_4bits", "page", "uring" };
+	long *latency_ns = calloc(ops, sizeof(long));
+	char frame[2 * 16];
+	int fds[2];
+
+	if (0 != pipe(fds)) {
+		free(latency_ns);
+		return -1;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	for (int clear = 0; clear < 2; clear++) {
+		for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+			struct i2c_lcd1602 first = \
+				i2c_lcd1602_init(fds[1], 0x27, 16, 2, 0, LCD_BACKLIGHT);
+			struct bench_counting counting = { .inner = &i2c_lcd1602_fd_transport };
+			struct i2c_lcd_emu emu;
+			struct i2c_lcd_uring uring;
+			size_t failures = 0;
+			long sum_ns = 0;
+
+			i2c_lcd1602_set_transport(&first, &counting_transport, &counting);
+			i2c_lcd_emu_init(&emu);
+			struct i2c_lcd_page page = i2c_lcd_page_init(first);
+			struct i2c_lcd1602 *i2c_lcd1602 = &page.i2c_lcd1602;
+			i2c_lcd1602_begin(i2c_lcd1602);
+			bench_drain(fds[0], &emu);
+
+			if (p == 2 && 0 != i2c_lcd_uring_init(&uring, i2c_lcd1602)) {
+				fprintf(stderr, "io_uring is not available: %s\n", strerror(errno));
+				break;
+			}
+			counting.calls = 0;
+			i2c_lcd1602_stats_reset(i2c_lcd1602);
+
+			long start = now_ns();
+			for (size_t i = 0; i < ops; i++) {
+				bench_make_frame(frame, 16, 2, i);
+				long t = now_ns();
+				if (p == 0) {
+					if (clear) i2c_lcd1602_clear_display(i2c_lcd1602);
+					for (int row = 0; row < 2; row++) {
+						i2c_lcd1602_set_cursor_pos(i2c_lcd1602, row * 0x40);
+						i2c_lcd1602_write_buffer(i2c_lcd1602, frame + row * 16, 16);
+					}
+				} else if (p == 1) {
+					if (clear) i2c_lcd_page_clear_display(&page);
+					for (int row = 0; row < 2; row++) {
+						i2c_lcd_page_write(&page, 0, row, frame + row * 16, 16);
+					}
+					if (0 != i2c_lcd_page_flush(&page)) failures++;
+				} else {
+					if (clear) i2c_lcd_uring_clear_display(&uring);
+					for (int row = 0; row < 2; row++) {
+						i2c_lcd_uring_set_cursor_pos(&uring, row * 0x40);
+						i2c_lcd_uring_write_buffer(&uring, frame + row * 16, 16);
+					}
+					if (0 != i2c_lcd_uring_submit(&uring, 1)) failures++;
+				}
+				/* Count the controller executing the last instruction as part
+				 * of the frame */
+				i2c_lcd1602_wait_ready(i2c_lcd1602);
+				latency_ns[i] = now_ns() - t;
+				sum_ns += latency_ns[i];
+				bench_drain(fds[0], &emu);
+			}
+			long total_ns = now_ns() - start;
+			qsort(latency_ns, ops, sizeof(long), compare_long);
+
+			struct i2c_lcd1602_stats stats;
+			i2c_lcd1602_stats_snapshot(i2c_lcd1602, &stats);
+			size_t syscalls = counting.calls + stats.sleeps;
+			if (p == 2) {
+				syscalls = uring.enters;
+				i2c_lcd_uring_destroy(&uring);
+			}
+
+			char shown[2 * 16 + 1];
+			i2c_lcd_emu_render(&emu, 16, 2, shown);
+
+			fprintf(out, "{\"bench\": \"%s\", \"transport\": \"pipe\", " \
+				"\"path\": \"%s\", \"geometry\": \"16x2\", \"ops\": %zu, " \
+				"\"frames_per_sec\": %.1f, \"syscalls_per_frame\": %.2f, " \
+				"\"p50_ns\": %ld, \"p99_ns\": %ld, \"mean_ns\": %ld, " \
+				"\"failures\": %zu, \"correct\": %s}\n",
+				clear ? "clear_redraw" : "redraw", paths[p], ops, \
+				ops * 1e9 / total_ns, (double) syscalls / ops, \
+				latency_ns[ops / 2], latency_ns[ops * 99 / 100], \
+				sum_ns / (long) ops, failures, \
+				0 == memcmp(shown, frame, sizeof(frame)) ? "true" : "false");
+			fflush(out);
+		}
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	free(latency_ns);
+
+	return 0;
+	/* }}} */
+}
+
+
+/* How long one byte takes on a 400kHz i2c bus (8 data bits plus an ACK) */
+#define BENCH_BYTE_NS_400KHZ 22500
+
+/** Calibrate a 16x2 LCD with i2c_lcd_calibrate() against an emulated
+ * controller that is slower than the datasheet (as with an oscillator at
+ * 190kHz instead of 270kHz) and that ignores instructions sent while it is
+ * busy, on a 400kHz bus. Calibration starts from i2c_lcd1602_safe_timing
+ * with the execution times scaled to the slower controller. It has converged
+ * if no delay ended up longer than it started (but for the margin), the
+ * strobe delays are gone, clear display and return home are within the
+ * margin of what the controller needs, and a frame drawn with the calibrated
+ * timing is shown with no instruction sent while the controller was busy. The calibrated timing is
+ * then saved with i2c_lcd_timing_save() and loaded back with
+ * i2c_lcd_timing_load(), and must come back unchanged. */
+static int bench_calibrate(FILE *out) {
+	/* {{{ */
+	struct i2c_lcd1602 i2c_lcd1602 = \
+		i2c_lcd1602_init(-1, 0x27, 16, 2, 0, LCD_BACKLIGHT);
+	struct i2c_lcd1602_timing start = i2c_lcd1602_safe_timing;
+	struct i2c_lcd1602_timing calibrated;
+	struct i2c_lcd1602_timing loaded = i2c_lcd1602_datasheet_timing;
+	struct i2c_lcd_emu emu;
+	char path[] = "/tmp/i2c-lcd-bench-timing-XXXXXX";
+	char frame[2 * 16];
+	char shown[2 * 16 + 1];
+	int converged = 1;
+
+	i2c_lcd_emu_init(&emu);
+	emu.byte_ns = BENCH_BYTE_NS_400KHZ;
+	emu.strict = 1;
+	for (int i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+		emu.timing.exec_ns[i] = emu.timing.exec_ns[i] * 270 / 190;
+		start.exec_ns[i] = emu.timing.exec_ns[i];
+	}
+	i2c_lcd_emu_attach(&emu, &i2c_lcd1602);
+	i2c_lcd1602.timing = start;
+	i2c_lcd1602_begin(&i2c_lcd1602);
+
+	long t = now_ns();
+	int ret = i2c_lcd_calibrate(&i2c_lcd1602, &calibrated);
+	long calibrate_ns = now_ns() - t;
+
+	if (ret == 0) {
+		/* A delay that could not be shortened at all still gets the margin
+		 * of a quarter */
+		if (calibrated.strobe_setup_ns > 0 || calibrated.strobe_hold_ns > 0 \
+			|| calibrated.nibble_ns > start.nibble_ns + start.nibble_ns / 4) {
+
+			converged = 0;
+		}
+		for (int i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+			if (calibrated.exec_ns[i] > start.exec_ns[i] + start.exec_ns[i] / 4) {
+				converged = 0;
+			}
+		}
+		/* Halving can only stop within a factor of two of what is needed,
+		 * and a quarter is added as a margin */
+		if (calibrated.exec_ns[I2C_LCD1602_CMD_CLEAR] \
+				> emu.timing.exec_ns[I2C_LCD1602_CMD_CLEAR] * 5 / 2 \
+			|| calibrated.exec_ns[I2C_LCD1602_CMD_HOME] \
+				> emu.timing.exec_ns[I2C_LCD1602_CMD_HOME] * 5 / 2) {
+
+			converged = 0;
+		}
+
+		emu.busy_violations = 0;
+		bench_make_frame(frame, 16, 2, 0);
+		i2c_lcd1602_clear_display(&i2c_lcd1602);
+		i2c_lcd1602_cursor_home(&i2c_lcd1602);
+		for (int row = 0; row < 2; row++) {
+			i2c_lcd1602_set_cursor_pos(&i2c_lcd1602, row * 0x40);
+			i2c_lcd1602_write_buffer(&i2c_lcd1602, frame + row * 16, 16);
+		}
+		i2c_lcd1602_wait_ready(&i2c_lcd1602);
+		i2c_lcd_emu_render(&emu, 16, 2, shown);
+		if (0 != memcmp(shown, frame, sizeof(frame)) \
+			|| emu.busy_violations > 0) {
+
+			converged = 0;
+		}
+	}
+
+	int fd = mkstemp(path);
+	int round_trip = ret == 0 && fd >= 0 \
+		&& 0 == i2c_lcd_timing_save(&calibrated, path) \
+		&& 0 == i2c_lcd_timing_load(&loaded, path) \
+		&& 0 == memcmp(&loaded, &calibrated, sizeof(loaded));
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+
+	fprintf(out, "{\"bench\": \"calibrate\", \"transport\": \"emulator\", " \
+		"\"geometry\": \"16x2\", \"calibrate_ms\": %ld, \"result\": %d, " \
+		"\"strobe_setup_ns\": %ld, \"strobe_hold_ns\": %ld, " \
+		"\"nibble_ns\": %ld, \"data_ns\": %ld, \"clear_ns\": %ld, " \
+		"\"home_ns\": %ld, \"modeled_clear_ns\": %ld, " \
+		"\"modeled_home_ns\": %ld, \"converged\": %s, \"round_trip\": %s}\n",
+		calibrate_ns / 1000000, ret, i2c_lcd1602.timing.strobe_setup_ns, \
+		i2c_lcd1602.timing.strobe_hold_ns, i2c_lcd1602.timing.nibble_ns, \
+		i2c_lcd1602.timing.exec_ns[I2C_LCD1602_CMD_DATA], \
+		i2c_lcd1602.timing.exec_ns[I2C_LCD1602_CMD_CLEAR], \
+		i2c_lcd1602.timing.exec_ns[I2C_LCD1602_CMD_HOME], \
+		emu.timing.exec_ns[I2C_LCD1602_CMD_CLEAR], \
+		emu.timing.exec_ns[I2C_LCD1602_CMD_HOME], \
+		ret == 0 && converged ? "true" : "false", \
+		round_trip ? "true" : "false");
+	fflush(out);
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Compare the ways of writing a batch of 64 bytes to the PCF8574 at 'address'
+ * on the i2c device 'device': a write() per byte (as the library used to),
+ * one write(), one I2C_RDWR ioctl() and SMBus writes, each if the adapter
+ * supports it. Every byte keeps E low with the backlight on, so the LCD sees
+ * nothing. */
+static int bench_bus(FILE *out, const char *device, uint8_t address, \
+	size_t ops) {
+	/* {{{ */
+	struct {
+		const char *name;
+		const struct i2c_lcd1602_transport *transport;
+		size_t xfer_max;
+		/* What the adapter must support for this way to work */
+		unsigned long funcs;
+	} paths[] = {
+		{ "write_1", &i2c_lcd1602_fd_transport, 1, I2C_FUNC_I2C },
+		{ "write", &i2c_lcd1602_fd_transport, I2C_LCD1602_XFER_MAX, I2C_FUNC_I2C },
+		{ "rdwr", &i2c_lcd1602_rdwr_transport, I2C_LCD1602_XFER_MAX, I2C_FUNC_I2C },
+		{ "smbus", &i2c_lcd1602_smbus_transport, I2C_LCD1602_XFER_MAX, \
+			I2C_FUNC_SMBUS_WRITE_I2C_BLOCK | I2C_FUNC_SMBUS_WRITE_BYTE_DATA \
+			| I2C_FUNC_SMBUS_WRITE_BYTE }
+	};
+	uint8_t bytes[64];
+	long *latency_ns = calloc(ops, sizeof(long));
+	int fd;
+
+	memset(bytes, LCD_BACKLIGHT, sizeof(bytes));
+
+	if (0 > (fd = open(device, O_RDWR))) {
+		fprintf(stderr, "Failed to open %s\n", device);
+		free(latency_ns);
+		return -1;
+	}
+	if (0 > ioctl(fd, I2C_SLAVE, address)) {
+		fprintf(stderr, "Failed to address 0x%02x on %s\n", address, device);
+		close(fd);
+		free(latency_ns);
+		return -1;
+	}
+
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+		struct i2c_lcd1602 i2c_lcd1602 = \
+			i2c_lcd1602_init(fd, address, 16, 2, 0, LCD_BACKLIGHT);
+		const struct i2c_lcd1602_transport *selected = i2c_lcd1602.transport;
+		struct bench_counting counting = { .inner = paths[p].transport };
+		size_t failures = 0;
+		long sum_ns = 0;
+
+		if (!(i2c_lcd1602.funcs & paths[p].funcs)) continue;
+
+		i2c_lcd1602_set_transport(&i2c_lcd1602, &counting_transport, &counting);
+		i2c_lcd1602.xfer_max = paths[p].xfer_max;
+
+		long start = now_ns();
+		for (size_t i = 0; i < ops; i++) {
+			long t = now_ns();
+			if (0 != i2c_lcd1602_write_bytes(&i2c_lcd1602, bytes, sizeof(bytes))) {
+				failures++;
+			}
+			latency_ns[i] = now_ns() - t;
+			sum_ns += latency_ns[i];
+		}
+		long total_ns = now_ns() - start;
+		qsort(latency_ns, ops, sizeof(long), compare_long);
+
+		fprintf(out, "{\"bench\": \"bus_64\", \"transport\": \"%s\", " \
+			"\"selected\": %s, \"ops\": %zu, \"bytes_per_sec\": %.1f, " \
+			"\"syscalls_per_op\": %.1f, \"p50_ns\": %ld, \"p99_ns\": %ld, " \
+			"\"mean_ns\": %ld, \"failures\": %zu}\n",
+			paths[p].name, selected == paths[p].transport \
+				&& paths[p].xfer_max == I2C_LCD1602_XFER_MAX ? "true" : "false", \
+			ops, ops * sizeof(bytes) * 1e9 / total_ns, \
+			(double) counting.calls / ops, latency_ns[ops / 2], \
+			latency_ns[ops * 99 / 100], sum_ns / (long) ops, failures);
+		fflush(out);
+	}
+
+	close(fd);
+	free(latency_ns);
+
+	return 0;
+	/* }}} */
+}
+
+
+int main(int argc, char **argv) {
+	size_t ops = 100;
+	const char *output_path = NULL;
+	const char *device = NULL;
+	uint8_t address = 0x27;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:o:d:a:"))) {
+		if (opt == 'n') {
+			ops = strtoul(optarg, NULL, 10);
+		} else if (opt == 'o') {
+			output_path = optarg;
+		} else if (opt == 'd') {
+			device = optarg;
+		} else if (opt == 'a') {
+			address = strtoul(optarg, NULL, 0);
+		} else {
+			printf("Usage: ./i2c-lcd-bench [-n <operations-per-benchmark>] [-o <output-file>] [-d <i2c-device> [-a <address>]]\n");
+			return -1;
+		}
+	}
+	if (ops == 0) ops = 1;
+
+	FILE *out = stdout;
+	if (output_path != NULL && NULL == (out = fopen(output_path, "w"))) {
+		fprintf(stderr, "Failed to open %s\n", output_path);
+		return -1;
+	}
+
+	/* The timing the scattered benchmarks compare with the datasheet timing,
+	 * as calibrated on an emulated controller that ignores instructions sent
+	 * while it is busy */
+	struct i2c_lcd1602 calibrating = \
+		i2c_lcd1602_init(-1, 0x27, 16, 2, 0, LCD_BACKLIGHT);
+	struct i2c_lcd1602_timing calibrated;
+	struct i2c_lcd_emu calibrating_emu;
+	i2c_lcd_emu_init(&calibrating_emu);
+	calibrating_emu.strict = 1;
+	i2c_lcd_emu_attach(&calibrating_emu, &calibrating);
+	i2c_lcd1602_begin(&calibrating);
+	int have_calibrated = 0 == i2c_lcd_calibrate(&calibrating, &calibrated);
+
+	static struct bench_target emulator = { .name = "emulator" };
+	bench_all(out, &emulator, ops, have_calibrated ? &calibrated : NULL);
+
+	static struct bench_target sink = { .name = "sink" };
+	if (0 > (sink.sink_fd = open("/dev/null", O_WRONLY))) {
+		fprintf(stderr, "Failed to open /dev/null\n");
+		return -1;
+	}
+	bench_all(out, &sink, ops, have_calibrated ? &calibrated : NULL);
+	close(sink.sink_fd);
+
+	/* A failed write to the pipe must not kill the benchmarks */
+	signal(SIGPIPE, SIG_IGN);
+	if (0 != bench_uring(out, ops)) return -1;
+
+	if (0 != bench_calibrate(out)) return -1;
+
+	if (device != NULL && 0 != bench_bus(out, device, address, ops)) return -1;
+
+	if (out != stdout) fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "i2c-lcd-proto.h"
+#include "i2c-lcd-client.h"
+
+
+/** Connect to the daemon listening at 'path' (I2C_LCD_PROTO_SOCKET if
+ * NULL).
+ *
+ * Returns 0 on success, and -1 (with errno set) if the daemon could not be
+ * reached.
+ */
+int i2c_lcd_client_connect(struct i2c_lcd_client *i2c_lcd_client, \
+	const char *path) {
+	/* {{{ */
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	memset(i2c_lcd_client, 0, sizeof(*i2c_lcd_client));
+	if (path == NULL) path = I2C_LCD_PROTO_SOCKET;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+	i2c_lcd_client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (i2c_lcd_client->fd < 0) return -1;
+
+	if (0 != connect(i2c_lcd_client->fd, (struct sockaddr *) &addr, \
+		sizeof(addr))) {
+
+		int saved = errno;
+		close(i2c_lcd_client->fd);
+		i2c_lcd_client->fd = -1;
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Close the connection. What was sent is still shown, but regions stay
+ * until the daemon exits. */
+void i2c_lcd_client_close(struct i2c_lcd_client *i2c_lcd_client) {
+	/* {{{ */
+	if (i2c_lcd_client->fd >= 0) close(i2c_lcd_client->fd);
+	i2c_lcd_client->fd = -1;
+	/* }}} */
+}
+
+
+/** Send a request of type 'type' with the 'len' bytes at 'payload', and
+ * 'more' bytes at 'extra' after them, storing its sequence number in 'seq'.
+ *
+ * Returns 0 on success, and -1 if it could not be sent.
+ */
+static int i2c_lcd_client_send(struct i2c_lcd_client *i2c_lcd_client, \
+	uint8_t type, uint8_t flags, const void *payload, size_t len, \
+	const void *extra, size_t more, uint32_t *seq) {
+	/* {{{ */
+	uint8_t msg[I2C_LCD_PROTO_MSG_MAX];
+	struct i2c_lcd_proto_header header = {
+		.type = type,
+		.flags = flags,
+		.len = len + more,
+		.seq = ++i2c_lcd_client->seq
+	};
+
+	if (sizeof(header) + len + more > sizeof(msg)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	memcpy(msg, &header, sizeof(header));
+	memcpy(&msg[sizeof(header)], payload, len);
+	if (more > 0) memcpy(&msg[sizeof(header) + len], extra, more);
+
+	ssize_t r;
+	do {
+		r = send(i2c_lcd_client->fd, msg, sizeof(header) + len + more, \
+			MSG_NOSIGNAL);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) return -1;
+
+	*seq = header.seq;
+	return 0;
+	/* }}} */
+}
+
+
+/** Wait for the reply to request 'seq' (if 'reply' is set, storing its
+ * status there) or for request 'seq' to be acked. Acks for other requests
+ * that arrive meanwhile are remembered.
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+static int i2c_lcd_client_wait(struct i2c_lcd_client *i2c_lcd_client, \
+	uint32_t seq, int32_t *reply) {
+	/* {{{ */
+	uint8_t msg[I2C_LCD_PROTO_MSG_MAX];
+
+	while (reply != NULL || !i2c_lcd_client->acked_any \
+		|| (int32_t) (i2c_lcd_client->acked - seq) < 0) {
+
+		ssize_t r = recv(i2c_lcd_client->fd, msg, sizeof(msg), 0);
+		if (r < 0 && errno == EINTR) continue;
+		if (r < (ssize_t) sizeof(struct i2c_lcd_proto_header)) return -1;
+
+		struct i2c_lcd_proto_header header;
+		memcpy(&header, msg, sizeof(header));
+
+		if (header.type == I2C_LCD_PROTO_ACK) {
+			i2c_lcd_client->acked = header.seq;
+			i2c_lcd_client->acked_any = 1;
+		} else if (header.type == I2C_LCD_PROTO_REPLY && reply != NULL \
+			&& header.seq == seq \
+			&& r >= (ssize_t) (sizeof(header) + sizeof(struct i2c_lcd_proto_reply))) {
+
+			struct i2c_lcd_proto_reply body;
+			memcpy(&body, &msg[sizeof(header)], sizeof(body));
+			*reply = body.status;
+			return 0;
+		}
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Send a request, and if 'ack' is set, wait until the daemon has shown it.
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+static int i2c_lcd_client_request(struct i2c_lcd_client *i2c_lcd_client, \
+	uint8_t type, const void *payload, size_t len, const void *extra, \
+	size_t more, int ack) {
+	/* {{{ */
+	uint32_t seq;
+
+	if (0 != i2c_lcd_client_send(i2c_lcd_client, type, \
+		ack ? I2C_LCD_PROTO_F_ACK : 0, payload, len, extra, more, &seq)) {
+
+		return -1;
+	}
+
+	return ack ? i2c_lcd_client_wait(i2c_lcd_client, seq, NULL) : 0;
+	/* }}} */
+}
+
+
+/** Look up the region called 'name', having the daemon add it covering
+ * 'width' cells of 'row' from 'column' on if no client has yet (see
+ * i2c_lcd_comp_add_region()).
+ *
+ * Returns the index of the region, or -1 if it could not be added or the
+ * connection failed.
+ */
+int i2c_lcd_client_region(struct i2c_lcd_client *i2c_lcd_client, \
+	const char *name, uint8_t column, uint8_t row, uint8_t width, \
+	long min_interval_ns) {
+	/* {{{ */
+	struct i2c_lcd_proto_region region = {
+		.column = column,
+		.row = row,
+		.width = width,
+		.min_interval_us = min_interval_ns / 1000
+	};
+	uint32_t seq;
+	int32_t status;
+
+	snprintf(region.name, sizeof(region.name), "%s", name);
+
+	if (0 != i2c_lcd_client_send(i2c_lcd_client, I2C_LCD_PROTO_REGION, 0, \
+		&region, sizeof(region), NULL, 0, &seq)) {
+
+		return -1;
+	}
+	if (0 != i2c_lcd_client_wait(i2c_lcd_client, seq, &status)) return -1;
+
+	return status;
+	/* }}} */
+}
+
+
+/** Set the contents of region 'region' to the 'n' characters at 'text' (see
+ * i2c_lcd_comp_write()). If 'ack' is set, wait until they are on the display.
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+int i2c_lcd_client_text(struct i2c_lcd_client *i2c_lcd_client, int region, \
+	const char *text, size_t n, int ack) {
+	/* {{{ */
+	struct i2c_lcd_proto_text body = { .region = region };
+
+	return i2c_lcd_client_request(i2c_lcd_client, I2C_LCD_PROTO_TEXT, &body, \
+		sizeof(body), text, n, ack);
+	/* }}} */
+}
+
+
+/** Move the cursor to the given x, y (column, row) coordinates, and show it
+ * (blinking if 'blink' is set) if 'visible' is set or hide it otherwise.
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+int i2c_lcd_client_cursor(struct i2c_lcd_client *i2c_lcd_client, \
+	uint8_t column, uint8_t row, uint8_t visible, uint8_t blink, int ack) {
+	/* {{{ */
+	struct i2c_lcd_proto_cursor body = {
+		.column = column,
+		.row = row,
+		.visible = visible,
+		.blink = blink
+	};
+
+	return i2c_lcd_client_request(i2c_lcd_client, I2C_LCD_PROTO_CURSOR, &body, \
+		sizeof(body), NULL, 0, ack);
+	/* }}} */
+}
+
+
+/** Turn the backlight on (if 'on' is set) or off.
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+int i2c_lcd_client_backlight(struct i2c_lcd_client *i2c_lcd_client, \
+	uint8_t on, int ack) {
+	/* {{{ */
+	struct i2c_lcd_proto_backlight body = { .on = on };
+
+	return i2c_lcd_client_request(i2c_lcd_client, I2C_LCD_PROTO_BACKLIGHT, \
+		&body, sizeof(body), NULL, 0, ack);
+	/* }}} */
+}
+
+
+/** Put a custom character with the 5x8 dot pattern 'rows' at the given x, y
+ * (column, row) coordinates (see i2c_lcd_page_write_glyph()).
+ *
+ * Returns 0 on success, and -1 if the connection failed.
+ */
+int i2c_lcd_client_glyph(struct i2c_lcd_client *i2c_lcd_client, \
+	uint8_t column, uint8_t row, const uint8_t rows[8], int ack) {
+	/* {{{ */
+	struct i2c_lcd_proto_glyph body = {
+		.column = column,
+		.row = row
+	};
+
+	memcpy(body.rows, rows, sizeof(body.rows));
+
+	return i2c_lcd_client_request(i2c_lcd_client, I2C_LCD_PROTO_GLYPH, &body, \
+		sizeof(body), NULL, 0, ack);
+	/* }}} */
+}
@@ -0,0 +1,34 @@
+#ifndef I2C_LCD_CLIENT
+#define I2C_LCD_CLIENT
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-lcd-proto.h"
+
+/* A connection to i2c-lcd-daemon */
+struct i2c_lcd_client {
+	int fd;
+	/* The sequence number of the last request sent */
+	uint32_t seq;
+	/* The sequence number of the last ack received, if any has been */
+	uint32_t acked;
+	uint8_t acked_any;
+};
+
+
+int i2c_lcd_client_connect(struct i2c_lcd_client *i2c_lcd_client, const char *path);
+
+void i2c_lcd_client_close(struct i2c_lcd_client *i2c_lcd_client);
+
+int i2c_lcd_client_region(struct i2c_lcd_client *i2c_lcd_client, const char *name, uint8_t column, uint8_t row, uint8_t width, long min_interval_ns);
+
+int i2c_lcd_client_text(struct i2c_lcd_client *i2c_lcd_client, int region, const char *text, size_t n, int ack);
+
+int i2c_lcd_client_cursor(struct i2c_lcd_client *i2c_lcd_client, uint8_t column, uint8_t row, uint8_t visible, uint8_t blink, int ack);
+
+int i2c_lcd_client_backlight(struct i2c_lcd_client *i2c_lcd_client, uint8_t on, int ack);
+
+int i2c_lcd_client_glyph(struct i2c_lcd_client *i2c_lcd_client, uint8_t column, uint8_t row, const uint8_t rows[8], int ack);
+
+#endif
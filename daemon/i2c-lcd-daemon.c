@@ -0,0 +1,561 @@
+/* For ppoll() and accept4() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-emulator.h"
+#include "i2c-lcd-page-wrapper.h"
+#include "i2c-lcd-compositor.h"
+#include "i2c-lcd-proto.h"
+
+/* The most clients connected at once */
+#define I2C_LCD_DAEMON_CLIENTS 32
+
+
+/* A connected client, and the ack it is owed once what it asked for is on the
+ * display */
+struct i2c_lcd_daemon_client {
+	int fd;
+	uint32_t ack_seq;
+	uint8_t ack_owed;
+	/* The regions (as bits by index) written since the last request that
+	 * asked for an ack, and those the owed ack waits for. The ack is only
+	 * sent once they have been rendered, as a region with a minimum interval
+	 * may sit out a frame or more. */
+	uint32_t written;
+	uint32_t ack_regions;
+};
+
+
+/* Owns the LCD, and merges what every client asks for into one compositor.
+ * Requests only change the regions (or the frame of the page, for glyphs),
+ * which are sent to the LCD at most once per frame as one diffed flush, so the
+ * bus load does not grow with the number of clients or how often they write. */
+struct i2c_lcd_daemon {
+	struct i2c_lcd_page page;
+	struct i2c_lcd_comp comp;
+	/* The controllers, if the LCD is emulated */
+	struct i2c_lcd_emu emu[I2C_LCD_PAGE_CONTROLLERS];
+	int listen_fd;
+	struct i2c_lcd_daemon_client clients[I2C_LCD_DAEMON_CLIENTS];
+	size_t n_clients;
+	long frame_ns;
+	/* CLOCK_MONOTONIC time of the last frame */
+	struct timespec frame_at;
+	/* Whether anything may need to be sent at the next frame, and whether
+	 * glyphs were written to the frame of the page outside any region */
+	uint8_t dirty;
+	uint8_t page_dirty;
+	/* Statistics */
+	uint64_t connections;
+	uint64_t requests;
+	uint64_t bad_requests;
+	uint64_t frames;
+	uint64_t frame_failures;
+	uint64_t acks;
+};
+
+
+static volatile sig_atomic_t running = 1;
+
+
+static void on_signal(int sig) {
+	/* {{{ */
+	(void) sig;
+	running = 0;
+	/* }}} */
+}
+
+
+/** Return the number of nanoseconds from 'a' to 'b' */
+static long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+	/* {{{ */
+	return (b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+	/* }}} */
+}
+
+
+/** Send a message of type 'type' with sequence number 'seq' and the 'len'
+ * bytes at 'payload' to a client.
+ *
+ * Returns 0 on success, and -1 if the client is gone or not reading.
+ */
+static int i2c_lcd_daemon_send(struct i2c_lcd_daemon_client *client, \
+	uint8_t type, uint32_t seq, const void *payload, size_t len) {
+	/* {{{ */
+	uint8_t msg[I2C_LCD_PROTO_MSG_MAX];
+	struct i2c_lcd_proto_header header = {
+		.type = type,
+		.len = len,
+		.seq = seq
+	};
+
+	memcpy(msg, &header, sizeof(header));
+	if (len > 0) memcpy(&msg[sizeof(header)], payload, len);
+
+	/* A client whose socket buffer is full is not reading its acks, and is
+	 * dropped rather than allowed to stall the display */
+	if (0 > send(client->fd, msg, sizeof(header) + len, \
+		MSG_DONTWAIT | MSG_NOSIGNAL)) {
+
+		return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Disconnect client 'i' */
+static void i2c_lcd_daemon_drop(struct i2c_lcd_daemon *d, size_t i) {
+	/* {{{ */
+	close(d->clients[i].fd);
+	d->clients[i] = d->clients[--d->n_clients];
+	/* }}} */
+}
+
+
+/** Carry out the request 'msg' of 'len' bytes from client 'i'.
+ *
+ * Returns 0 on success, and -1 if the client should be disconnected.
+ */
+static int i2c_lcd_daemon_handle(struct i2c_lcd_daemon *d, size_t i, \
+	const uint8_t *msg, size_t len) {
+	/* {{{ */
+	struct i2c_lcd_daemon_client *client = &d->clients[i];
+	struct i2c_lcd_proto_header header;
+	const uint8_t *payload = &msg[sizeof(header)];
+
+	if (len < sizeof(header)) return -1;
+	memcpy(&header, msg, sizeof(header));
+	len -= sizeof(header);
+	if (header.len != len) return -1;
+
+	d->requests++;
+
+	switch (header.type) {
+	case I2C_LCD_PROTO_REGION: {
+		struct i2c_lcd_proto_region body;
+		if (len < sizeof(body)) return -1;
+		memcpy(&body, payload, sizeof(body));
+		body.name[sizeof(body.name) - 1] = '\0';
+
+		struct i2c_lcd_proto_reply reply = {
+			.status = i2c_lcd_comp_find(&d->comp, body.name)
+		};
+		if (reply.status < 0) {
+			reply.status = i2c_lcd_comp_add_region(&d->comp, body.name, \
+				body.column, body.row, body.width, \
+				body.min_interval_us * 1000L);
+			if (reply.status >= 0) d->dirty = 1;
+		}
+		if (reply.status < 0) d->bad_requests++;
+
+		return i2c_lcd_daemon_send(client, I2C_LCD_PROTO_REPLY, header.seq, \
+			&reply, sizeof(reply));
+	}
+	case I2C_LCD_PROTO_TEXT: {
+		struct i2c_lcd_proto_text body;
+		if (len < sizeof(body)) return -1;
+		memcpy(&body, payload, sizeof(body));
+
+		if (0 != i2c_lcd_comp_write(&d->comp, body.region, \
+			(const char *) &payload[sizeof(body)], len - sizeof(body))) {
+
+			d->bad_requests++;
+		} else {
+			client->written |= 1u << body.region;
+		}
+		break;
+	}
+	case I2C_LCD_PROTO_CURSOR: {
+		struct i2c_lcd_proto_cursor body;
+		if (len < sizeof(body)) return -1;
+		memcpy(&body, payload, sizeof(body));
+
+		i2c_lcd_page_set_cursor_pos(&d->page, body.column, body.row);
+		/* Only the controller of the row the cursor is on shows it */
+		for (int c = 0; c < d->page.controllers; c++) {
+			uint8_t here = c == body.row / 2;
+			i2c_lcd1602_display_control(c == 0 ? &d->page.i2c_lcd1602 \
+				: &d->page.second, 1, here && body.visible, \
+				here && body.blink);
+		}
+		break;
+	}
+	case I2C_LCD_PROTO_BACKLIGHT: {
+		struct i2c_lcd_proto_backlight body;
+		if (len < sizeof(body)) return -1;
+		memcpy(&body, payload, sizeof(body));
+
+		for (int c = 0; c < d->page.controllers; c++) {
+			i2c_lcd1602_set_backlight(c == 0 ? &d->page.i2c_lcd1602 \
+				: &d->page.second, body.on ? LCD_BACKLIGHT : LCD_NOBACKLIGHT);
+		}
+		break;
+	}
+	case I2C_LCD_PROTO_GLYPH: {
+		struct i2c_lcd_proto_glyph body;
+		if (len < sizeof(body)) return -1;
+		memcpy(&body, payload, sizeof(body));
+
+		if (0 != i2c_lcd_page_write_glyph(&d->page, body.column, body.row, \
+			body.rows)) {
+
+			d->bad_requests++;
+		}
+		d->page_dirty = 1;
+		break;
+	}
+	default:
+		d->bad_requests++;
+		return -1;
+	}
+
+	if (header.flags & I2C_LCD_PROTO_F_ACK) {
+		client->ack_seq = header.seq;
+		client->ack_owed = 1;
+		client->ack_regions |= client->written;
+		client->written = 0;
+	}
+	d->dirty = 1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Read every request waiting from client 'i'.
+ *
+ * Returns 0 on success, and -1 if the client has disconnected or should be.
+ */
+static int i2c_lcd_daemon_read(struct i2c_lcd_daemon *d, size_t i) {
+	/* {{{ */
+	uint8_t msg[I2C_LCD_PROTO_MSG_MAX];
+
+	while (1) {
+		ssize_t r = recv(d->clients[i].fd, msg, sizeof(msg), \
+			MSG_DONTWAIT | MSG_TRUNC);
+
+		if (r < 0 && errno == EINTR) continue;
+		if (r < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		if (r == 0 || (size_t) r > sizeof(msg)) return -1;
+
+		if (0 != i2c_lcd_daemon_handle(d, i, msg, r)) return -1;
+	}
+	/* }}} */
+}
+
+
+/** Send one frame: render the regions that have changed, flush the page,
+ * and ack every client whose requests are now all on the display. If the
+ * frame could not be sent, no acks are sent and it is tried again at the
+ * next frame time. */
+static void i2c_lcd_daemon_frame(struct i2c_lcd_daemon *d) {
+	/* {{{ */
+	int failed = 0 != i2c_lcd_comp_tick(&d->comp);
+	if (d->page_dirty) {
+		if (0 != i2c_lcd_page_flush(&d->page)) {
+			failed = 1;
+		} else {
+			d->page_dirty = 0;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &d->frame_at);
+	d->frames++;
+
+	/* The compositor flushes the failed frame again at its next tick */
+	if (failed) {
+		d->frame_failures++;
+		d->dirty = 1;
+		return;
+	}
+
+	/* Regions that sat out this frame for their minimum interval are
+	 * rendered at a later one. The compositor is only used from this
+	 * thread, so its regions can be read without the lock. */
+	uint32_t dirty = 0;
+	for (size_t r = 0; r < d->comp.n_regions; r++) {
+		if (d->comp.regions[r].dirty) dirty |= 1u << r;
+	}
+	d->dirty = dirty != 0;
+
+	for (size_t i = 0; i < d->n_clients; ) {
+		struct i2c_lcd_daemon_client *client = &d->clients[i];
+
+		if (client->ack_owed && !(client->ack_regions & dirty)) {
+
+			if (0 != i2c_lcd_daemon_send(client, I2C_LCD_PROTO_ACK, \
+				client->ack_seq, NULL, 0)) {
+
+				i2c_lcd_daemon_drop(d, i);
+				continue;
+			}
+			client->ack_owed = 0;
+			client->ack_regions = 0;
+			d->acks++;
+		}
+		i++;
+	}
+	/* }}} */
+}
+
+
+/** Serve clients until interrupted. A frame is sent as soon as something
+ * has changed and a frame time has passed since the last one, so a lone
+ * request is shown right away, while a burst of them from any number of
+ * clients is merged into one frame per frame time. */
+static void i2c_lcd_daemon_run(struct i2c_lcd_daemon *d) {
+	/* {{{ */
+	struct pollfd fds[1 + I2C_LCD_DAEMON_CLIENTS];
+
+	while (running) {
+		struct timespec now;
+		struct timespec timeout;
+		struct timespec *wait = NULL;
+
+		if (d->dirty) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long left = d->frame_ns - timespec_diff_ns(&d->frame_at, &now);
+			if (left < 0) left = 0;
+			timeout.tv_sec = left / 1000000000L;
+			timeout.tv_nsec = left % 1000000000L;
+			wait = &timeout;
+		}
+
+		fds[0].fd = d->listen_fd;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < d->n_clients; i++) {
+			fds[1 + i].fd = d->clients[i].fd;
+			fds[1 + i].events = POLLIN;
+		}
+		size_t polled = d->n_clients;
+
+		int n = ppoll(fds, 1 + polled, wait, NULL);
+		if (n < 0 && errno != EINTR) {
+			perror("ppoll");
+			break;
+		}
+
+		/* Backwards, so dropping a client does not move one not yet read */
+		for (size_t i = polled; n > 0 && i-- > 0; ) {
+			if (fds[1 + i].revents == 0) continue;
+			if (0 != i2c_lcd_daemon_read(d, i)) i2c_lcd_daemon_drop(d, i);
+		}
+
+		if (n > 0 && (fds[0].revents & POLLIN)) {
+			int fd = accept4(d->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd >= 0 && d->n_clients == I2C_LCD_DAEMON_CLIENTS) {
+				close(fd);
+			} else if (fd >= 0) {
+				d->clients[d->n_clients++] = (struct i2c_lcd_daemon_client) {
+					.fd = fd
+				};
+				d->connections++;
+			}
+		}
+
+		if (d->dirty) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (timespec_diff_ns(&d->frame_at, &now) >= d->frame_ns) {
+				i2c_lcd_daemon_frame(d);
+			}
+		}
+	}
+	/* }}} */
+}
+
+
+/** Listen on the Unix domain socket at 'path', replacing whatever was left
+ * there by an earlier run.
+ *
+ * Returns the listening socket, or -1 on failure.
+ */
+static int i2c_lcd_daemon_listen(const char *path) {
+	/* {{{ */
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	unlink(path);
+	if (0 != bind(fd, (struct sockaddr *) &addr, sizeof(addr)) \
+		|| 0 != listen(fd, 16)) {
+
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+	/* }}} */
+}
+
+
+static void usage(const char *argv0) {
+	/* {{{ */
+	fprintf(stderr, \
+		"Usage: %s [-s socket] [-d /dev/i2c-N -a addr | -e] [-c columns]\n" \
+		"       [-r rows] [-f fps] [-w state-file]\n" \
+		"  -s  listen on this socket (default " I2C_LCD_PROTO_SOCKET ")\n" \
+		"  -d  i2c bus of the LCD, with -a its address in hex (e.g. 0x27)\n" \
+		"  -e  drive an emulated LCD instead, and print it on exit\n" \
+		"  -c  columns (default 16), -r rows (default 2); 40x4 modules\n" \
+		"      have their second controller enabled through R/W\n" \
+		"  -f  most frames per second sent to the LCD (default 30)\n" \
+		"  -w  take over the display left by an earlier run, see\n" \
+		"      i2c_lcd_page_begin_warm(), and save its state on exit\n", \
+		argv0);
+	/* }}} */
+}
+
+
+int main(int argc, char **argv) {
+	static struct i2c_lcd_daemon d;
+	const char *socket_path = I2C_LCD_PROTO_SOCKET;
+	const char *bus_path = NULL;
+	const char *state_path = NULL;
+	int addr = 0x27;
+	int emulate = 0;
+	int columns = 16;
+	int rows = 2;
+	int fps = 30;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "s:d:a:ec:r:f:w:h"))) {
+		switch (opt) {
+		case 's': socket_path = optarg; break;
+		case 'd': bus_path = optarg; break;
+		case 'a': addr = strtol(optarg, NULL, 16); break;
+		case 'e': emulate = 1; break;
+		case 'c': columns = atoi(optarg); break;
+		case 'r': rows = atoi(optarg); break;
+		case 'f': fps = atoi(optarg); break;
+		case 'w': state_path = optarg; break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if ((bus_path == NULL) == !emulate || fps <= 0 || columns <= 0 \
+		|| columns > I2C_LCD_PAGE_DDRAM_WIDTH || rows <= 0 \
+		|| rows > I2C_LCD_PAGE_DDRAM_LINES) {
+
+		usage(argv[0]);
+		return 1;
+	}
+
+	int fd = -1;
+	if (!emulate) {
+		if ( (fd = open(bus_path, O_RDWR | O_CLOEXEC)) < 0) {
+			fprintf(stderr, "Failed to open the i2c lcd device\n");
+			return 1;
+		}
+		if (0 > ioctl(fd, I2C_SLAVE, addr)) {
+			fprintf(stderr, "Failed to set the peripheral address for the i2c controller\n");
+			return 1;
+		}
+	}
+
+	/* A module with more than 80 characters has a controller for each pair
+	 * of rows */
+	uint8_t dual = columns * rows > 2 * I2C_LCD_PAGE_DDRAM_WIDTH;
+	struct i2c_lcd1602 first = i2c_lcd1602_init(fd, addr, columns, \
+		dual ? 2 : rows, 0, LCD_BACKLIGHT);
+	if (emulate) {
+		i2c_lcd_emu_init(&d.emu[0]);
+		if (dual) {
+			i2c_lcd_emu_init(&d.emu[1]);
+			i2c_lcd_emu_share(&d.emu[0], &d.emu[1], Rw);
+		}
+		i2c_lcd_emu_attach(&d.emu[0], &first);
+	}
+	if (dual) {
+		struct i2c_lcd1602 second = first;
+		i2c_lcd1602_set_enable(&second, Rw);
+		d.page = i2c_lcd_page_init_dual(first, second);
+	} else {
+		d.page = i2c_lcd_page_init(first);
+	}
+
+	if (state_path != NULL) {
+		if (0 > i2c_lcd_page_begin_warm(&d.page, state_path)) {
+			fprintf(stderr, "Failed to start the LCD\n");
+			return 1;
+		}
+	} else {
+		i2c_lcd1602_begin(&d.page.i2c_lcd1602);
+		if (dual) i2c_lcd1602_begin(&d.page.second);
+	}
+
+	if (0 != i2c_lcd_comp_init(&d.comp, &d.page)) {
+		fprintf(stderr, "Failed to set up the compositor\n");
+		return 1;
+	}
+	d.frame_ns = 1000000000L / fps;
+
+	if ( (d.listen_fd = i2c_lcd_daemon_listen(socket_path)) < 0) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, \
+			strerror(errno));
+		return 1;
+	}
+
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	i2c_lcd_daemon_run(&d);
+
+	/* Show whatever was last asked for before exiting */
+	i2c_lcd_daemon_frame(&d);
+	if (state_path != NULL) i2c_lcd_page_save(&d.page, state_path);
+
+	for (size_t i = 0; i < d.n_clients; i++) close(d.clients[i].fd);
+	close(d.listen_fd);
+	unlink(socket_path);
+	i2c_lcd_comp_destroy(&d.comp);
+
+	if (emulate) {
+		char out[2 * I2C_LCD_PAGE_DDRAM_WIDTH + 1];
+		for (int c = 0; c < (dual ? 2 : 1); c++) {
+			i2c_lcd_emu_render(&d.emu[c], columns, dual ? 2 : rows, out);
+			for (int r = 0; r < (dual ? 2 : rows); r++) {
+				/* Custom characters are codes 0 - 7, so not printf() */
+				putchar('|');
+				fwrite(&out[r * columns], 1, columns, stdout);
+				puts("|");
+			}
+		}
+	}
+
+	fprintf(stderr, "{\"connections\": %llu, \"requests\": %llu, " \
+		"\"bad_requests\": %llu, \"frames\": %llu, " \
+		"\"frame_failures\": %llu, \"acks\": %llu, " \
+		"\"bytes_written\": %llu, \"busy_violations\": %zu}\n", \
+		(unsigned long long) d.connections, (unsigned long long) d.requests, \
+		(unsigned long long) d.bad_requests, (unsigned long long) d.frames, \
+		(unsigned long long) d.frame_failures, (unsigned long long) d.acks, \
+		(unsigned long long) d.page.i2c_lcd1602.stats.bytes_written, \
+		d.emu[0].busy_violations + d.emu[1].busy_violations);
+
+	if (fd >= 0) close(fd);
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i2c-lcd-client.h"
+
+/* The most clients one run can start */
+#define LOADGEN_CLIENTS 64
+
+
+/* One client connection and what it measured */
+struct loadgen_client {
+	pthread_t thread;
+	int index;
+	/* The latency of each request, from sending it to its ack */
+	long *latency_ns;
+	size_t acked;
+	uint8_t failed;
+};
+
+
+/* The options of the run */
+static const char *socket_path = NULL;
+static int requests = 1000;
+static int width = 8;
+static int rows = 2;
+static int columns = 16;
+static long interval_ns = 0;
+static int ack_every = 1;
+
+
+/** Return the number of nanoseconds from 'a' to 'b' */
+static long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+	/* {{{ */
+	return (b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+	/* }}} */
+}
+
+
+static int compare_long(const void *a, const void *b) {
+	/* {{{ */
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+
+	return (x > y) - (x < y);
+	/* }}} */
+}
+
+
+/** Write requests to a region of its own as a client of the daemon would,
+ * such as a metrics agent updating a counter. Every 'ack_every'th request
+ * (and the last) asks to be acked, and its latency is how long it took to
+ * reach the display. */
+static void *loadgen_thread(void *arg) {
+	/* {{{ */
+	struct loadgen_client *c = arg;
+	struct i2c_lcd_client client;
+	char name[16];
+	char text[32];
+
+	if (0 != i2c_lcd_client_connect(&client, socket_path)) {
+		perror("connect");
+		c->failed = 1;
+		return NULL;
+	}
+
+	/* Lay the regions out row by row, then column by column */
+	int per_row = columns / width > 0 ? columns / width : 1;
+	snprintf(name, sizeof(name), "load%d", c->index);
+	int region = i2c_lcd_client_region(&client, name, \
+		(c->index / rows % per_row) * width, c->index % rows, width, 0);
+	if (region < 0) {
+		fprintf(stderr, "client %d: could not add region\n", c->index);
+		c->failed = 1;
+		i2c_lcd_client_close(&client);
+		return NULL;
+	}
+
+	for (int k = 0; k < requests; k++) {
+		struct timespec sent;
+		struct timespec shown;
+		int ack = (k + 1) % ack_every == 0 || k == requests - 1;
+
+		int n = snprintf(text, sizeof(text), "%c%d", 'A' + c->index % 26, k);
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		if (0 != i2c_lcd_client_text(&client, region, text, n, ack)) {
+			c->failed = 1;
+			break;
+		}
+		if (ack) {
+			clock_gettime(CLOCK_MONOTONIC, &shown);
+			c->latency_ns[c->acked++] = timespec_diff_ns(&sent, &shown);
+		}
+
+		if (interval_ns > 0) {
+			struct timespec t = {
+				.tv_sec = interval_ns / 1000000000L,
+				.tv_nsec = interval_ns % 1000000000L
+			};
+			nanosleep(&t, NULL);
+		}
+	}
+
+	i2c_lcd_client_close(&client);
+	return NULL;
+	/* }}} */
+}
+
+
+static void usage(const char *argv0) {
+	/* {{{ */
+	fprintf(stderr, \
+		"Usage: %s [-s socket] [-n clients] [-r requests] [-w width]\n" \
+		"       [-c columns] [-R rows] [-i interval-us] [-a ack-every]\n" \
+		"  -n  clients connected at once (default 4)\n" \
+		"  -r  requests sent by each client (default 1000)\n" \
+		"  -w  width of the region of each client (default 8), laid out on\n" \
+		"      an LCD of -c columns (default 16) and -R rows (default 2)\n" \
+		"  -i  time between the requests of a client (default 0)\n" \
+		"  -a  ask for an ack on every this many requests (default 1)\n", \
+		argv0);
+	/* }}} */
+}
+
+
+int main(int argc, char **argv) {
+	static struct loadgen_client clients[LOADGEN_CLIENTS];
+	int n_clients = 4;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "s:n:r:w:c:R:i:a:h"))) {
+		switch (opt) {
+		case 's': socket_path = optarg; break;
+		case 'n': n_clients = atoi(optarg); break;
+		case 'r': requests = atoi(optarg); break;
+		case 'w': width = atoi(optarg); break;
+		case 'c': columns = atoi(optarg); break;
+		case 'R': rows = atoi(optarg); break;
+		case 'i': interval_ns = atol(optarg) * 1000L; break;
+		case 'a': ack_every = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (n_clients <= 0 || n_clients > LOADGEN_CLIENTS || requests <= 0 \
+		|| width <= 0 || columns <= 0 || rows <= 0 || ack_every <= 0) {
+
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < n_clients; i++) {
+		clients[i].index = i;
+		clients[i].latency_ns = calloc(requests, sizeof(long));
+		if (clients[i].latency_ns == NULL \
+			|| 0 != pthread_create(&clients[i].thread, NULL, loadgen_thread, \
+			&clients[i])) {
+
+			fprintf(stderr, "Failed to start client %d\n", i);
+			return 1;
+		}
+	}
+
+	size_t total = 0;
+	int failed = 0;
+	for (int i = 0; i < n_clients; i++) {
+		struct loadgen_client *c = &clients[i];
+
+		pthread_join(c->thread, NULL);
+		failed |= c->failed;
+		total += requests;
+		if (c->acked == 0) continue;
+
+		double mean = 0;
+		for (size_t k = 0; k < c->acked; k++) mean += c->latency_ns[k];
+		mean /= c->acked;
+		qsort(c->latency_ns, c->acked, sizeof(long), compare_long);
+
+		printf("{\"client\": %d, \"requests\": %d, \"acked\": %zu, " \
+			"\"p50_ns\": %ld, \"p99_ns\": %ld, \"max_ns\": %ld, " \
+			"\"mean_ns\": %.0f, \"failed\": %s}\n", \
+			i, requests, c->acked, c->latency_ns[c->acked / 2], \
+			c->latency_ns[c->acked * 99 / 100], c->latency_ns[c->acked - 1], \
+			mean, c->failed ? "true" : "false");
+		free(c->latency_ns);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = timespec_diff_ns(&start, &end) / 1e9;
+
+	printf("{\"clients\": %d, \"requests\": %zu, \"seconds\": %.3f, " \
+		"\"requests_per_sec\": %.1f, \"failed\": %s}\n", \
+		n_clients, total, seconds, total / seconds, failed ? "true" : "false");
+
+	return failed;
+}
@@ -0,0 +1,93 @@
+#ifndef I2C_LCD_PROTO
+#define I2C_LCD_PROTO
+
+#include <stdint.h>
+
+/* The protocol spoken over the Unix domain socket of i2c-lcd-daemon. The
+ * socket is SOCK_SEQPACKET, so each request and reply is one message and
+ * needs no framing. Every message starts with a header and is followed by the
+ * payload of its type. Integers are in host byte order, since both ends are on
+ * the same machine. */
+
+/* Where the daemon listens unless told otherwise */
+#define I2C_LCD_PROTO_SOCKET "/tmp/i2c-lcd.sock"
+/* The longest message either end sends */
+#define I2C_LCD_PROTO_MSG_MAX 64
+/* The longest region name, including the terminating '\0' (the same as
+ * I2C_LCD_COMP_NAME_MAX) */
+#define I2C_LCD_PROTO_NAME_MAX 16
+
+enum i2c_lcd_proto_type {
+	/* Client to daemon */
+	/* Look up the region with a name, adding it if there is none. Always
+	 * answered with a reply holding its index, or -1. */
+	I2C_LCD_PROTO_REGION,
+	/* Set the contents of a region */
+	I2C_LCD_PROTO_TEXT,
+	/* Move the cursor, and show or hide it */
+	I2C_LCD_PROTO_CURSOR,
+	/* Turn the backlight on or off */
+	I2C_LCD_PROTO_BACKLIGHT,
+	/* Put a custom character into a cell */
+	I2C_LCD_PROTO_GLYPH,
+	/* Daemon to client */
+	/* The answer to a request that needs one, with the same sequence
+	 * number */
+	I2C_LCD_PROTO_REPLY,
+	/* Every request up to and including the sequence number that asked for
+	 * an ack is on the display. Sent once per frame for each client that is
+	 * owed one, with the latest such sequence number. */
+	I2C_LCD_PROTO_ACK
+};
+
+/* Set in the flags of a request to be sent an ack once it has been shown */
+#define I2C_LCD_PROTO_F_ACK 0x01
+
+struct i2c_lcd_proto_header {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t len;
+	/* Chosen by the client, increasing by one for each request */
+	uint32_t seq;
+};
+
+struct i2c_lcd_proto_region {
+	uint8_t column;
+	uint8_t row;
+	uint8_t width;
+	uint8_t reserved;
+	/* The shortest time between two renders of the region, or 0 */
+	uint32_t min_interval_us;
+	char name[I2C_LCD_PROTO_NAME_MAX];
+};
+
+/* Followed by the text, which is as long as the rest of the message */
+struct i2c_lcd_proto_text {
+	uint8_t region;
+	uint8_t reserved[3];
+};
+
+struct i2c_lcd_proto_cursor {
+	uint8_t column;
+	uint8_t row;
+	uint8_t visible;
+	uint8_t blink;
+};
+
+struct i2c_lcd_proto_backlight {
+	uint8_t on;
+	uint8_t reserved[3];
+};
+
+struct i2c_lcd_proto_glyph {
+	uint8_t column;
+	uint8_t row;
+	uint8_t reserved[2];
+	uint8_t rows[8];
+};
+
+struct i2c_lcd_proto_reply {
+	int32_t status;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-page-wrapper.h"
+#include "i2c-lcd-compositor.h"
+
+
+/** Add 'ns' nanoseconds to 't' */
+static void timespec_add_ns(struct timespec *t, long ns) {
+	/* {{{ */
+	t->tv_nsec += ns;
+	while (t->tv_nsec >= 1000000000) {
+		t->tv_nsec -= 1000000000;
+		t->tv_sec++;
+	}
+	/* }}} */
+}
+
+
+/** Return the number of nanoseconds from 'a' to 'b' */
+static long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+	/* {{{ */
+	return (b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+	/* }}} */
+}
+
+
+/** Set up a compositor for 'i2c_lcd_page', with no regions. While the
+ * compositor is in use, the frame of the page should only be written through
+ * it.
+ *
+ * Returns 0 on success, and -1 if its lock could not be created.
+ */
+int i2c_lcd_comp_init(struct i2c_lcd_comp *i2c_lcd_comp, \
+	struct i2c_lcd_page *i2c_lcd_page) {
+	/* {{{ */
+	memset(i2c_lcd_comp, 0, sizeof(*i2c_lcd_comp));
+	i2c_lcd_comp->i2c_lcd_page = i2c_lcd_page;
+	atomic_init(&i2c_lcd_comp->running, 0);
+
+	if (0 != pthread_mutex_init(&i2c_lcd_comp->lock, NULL)) return -1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Free the resources of a compositor, which must not be running */
+void i2c_lcd_comp_destroy(struct i2c_lcd_comp *i2c_lcd_comp) {
+	/* {{{ */
+	pthread_mutex_destroy(&i2c_lcd_comp->lock);
+	/* }}} */
+}
+
+
+/** Add a region called 'name' covering 'width' cells of 'row' from 'column'
+ * on. It is rendered at most once every 'min_interval_ns' nanoseconds, however
+ * often it is written; writes in between are coalesced and only the latest is
+ * shown. The region starts out blank.
+ *
+ * Returns the index of the region, which is passed to i2c_lcd_comp_write(), or
+ * -1 if there is no room for it or it does not fit on a line.
+ */
+int i2c_lcd_comp_add_region(struct i2c_lcd_comp *i2c_lcd_comp, \
+	const char *name, uint8_t column, uint8_t row, uint8_t width, \
+	long min_interval_ns) {
+	/* {{{ */
+	int index = -1;
+
+	if (width == 0 || column + width > I2C_LCD_PAGE_DDRAM_WIDTH) return -1;
+
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	if (i2c_lcd_comp->n_regions < I2C_LCD_COMP_REGIONS) {
+		index = i2c_lcd_comp->n_regions++;
+
+		struct i2c_lcd_comp_region *region = &i2c_lcd_comp->regions[index];
+		memset(region, 0, sizeof(*region));
+		snprintf(region->name, sizeof(region->name), "%s", name);
+		region->column = column;
+		region->row = row;
+		region->width = width;
+		region->min_interval_ns = min_interval_ns;
+		memset(region->text, ' ', width);
+		region->dirty = 1;
+	}
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	return index;
+	/* }}} */
+}
+
+
+/** Return the index of the region called 'name', or -1 if there is none */
+int i2c_lcd_comp_find(struct i2c_lcd_comp *i2c_lcd_comp, const char *name) {
+	/* {{{ */
+	int index = -1;
+
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	for (size_t i = 0; i < i2c_lcd_comp->n_regions && index == -1; i++) {
+		if (0 == strncmp(i2c_lcd_comp->regions[i].name, name, \
+			I2C_LCD_COMP_NAME_MAX)) {
+
+			index = i;
+		}
+	}
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	return index;
+	/* }}} */
+}
+
+
+/** Set the contents of region 'region' to the 'n' characters at 'text',
+ * padded with spaces or cut to the width of the region. Nothing is sent to the
+ * LCD until the next tick, and writing the same contents again does not make
+ * the region dirty. Safe to call from any thread.
+ *
+ * Returns 0 on success, and -1 if there is no such region.
+ */
+int i2c_lcd_comp_write(struct i2c_lcd_comp *i2c_lcd_comp, int region, \
+	const char *text, size_t n) {
+	/* {{{ */
+	char cells[I2C_LCD_PAGE_DDRAM_WIDTH];
+
+	if (region < 0 || (size_t) region >= I2C_LCD_COMP_REGIONS) return -1;
+
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	if ((size_t) region >= i2c_lcd_comp->n_regions) {
+		pthread_mutex_unlock(&i2c_lcd_comp->lock);
+		return -1;
+	}
+
+	struct i2c_lcd_comp_region *r = &i2c_lcd_comp->regions[region];
+	if (n > r->width) n = r->width;
+	memcpy(cells, text, n);
+	memset(&cells[n], ' ', r->width - n);
+
+	if (0 != memcmp(r->text, cells, r->width)) {
+		memcpy(r->text, cells, r->width);
+		r->dirty = 1;
+	}
+	r->writes++;
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Set the contents of region 'region' from a printf() format, see
+ * i2c_lcd_comp_write().
+ *
+ * Returns 0 on success, and -1 if there is no such region.
+ */
+int i2c_lcd_comp_printf(struct i2c_lcd_comp *i2c_lcd_comp, int region, \
+	const char *format, ...) {
+	/* {{{ */
+	char text[I2C_LCD_PAGE_DDRAM_WIDTH + 1];
+	va_list ap;
+
+	va_start(ap, format);
+	int n = vsnprintf(text, sizeof(text), format, ap);
+	va_end(ap);
+
+	if (n < 0) n = 0;
+	if (n > I2C_LCD_PAGE_DDRAM_WIDTH) n = I2C_LCD_PAGE_DDRAM_WIDTH;
+
+	return i2c_lcd_comp_write(i2c_lcd_comp, region, text, n);
+	/* }}} */
+}
+
+
+/** Copy the latest contents of every dirty region into the page, except
+ * those rendered less than their minimum interval ago unless 'force' is set,
+ * and flush the page. The regions are marked clean once copied, so a frame
+ * whose flush failed is flushed again on the next call (the page still holds
+ * it) whether or not anything is dirty.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+static int i2c_lcd_comp_render(struct i2c_lcd_comp *i2c_lcd_comp, int force) {
+	/* {{{ */
+	struct i2c_lcd_page *i2c_lcd_page = i2c_lcd_comp->i2c_lcd_page;
+	struct timespec now;
+	int rendered = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	i2c_lcd_comp->ticks++;
+
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	for (size_t i = 0; i < i2c_lcd_comp->n_regions; i++) {
+		struct i2c_lcd_comp_region *r = &i2c_lcd_comp->regions[i];
+
+		if (!r->dirty) continue;
+		if (!force && r->renders > 0 && r->min_interval_ns > 0 \
+			&& timespec_diff_ns(&r->rendered_at, &now) < r->min_interval_ns) {
+			continue;
+		}
+
+		i2c_lcd_page_write(i2c_lcd_page, r->column, r->row, r->text, r->width);
+		r->dirty = 0;
+		r->rendered_at = now;
+		r->renders++;
+		rendered = 1;
+	}
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	if (!rendered && !i2c_lcd_comp->flush_pending) return 0;
+
+	i2c_lcd_comp->frames++;
+	if (0 != i2c_lcd_page_flush(i2c_lcd_page)) {
+		i2c_lcd_comp->flush_failures++;
+		i2c_lcd_comp->flush_pending = 1;
+		return -1;
+	}
+	i2c_lcd_comp->flush_pending = 0;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Render one frame: copy the latest contents of every dirty region whose
+ * minimum interval has passed into the page, and flush the page. Regions that
+ * are dirty but were rendered too recently stay dirty for a later tick. The
+ * lock is only held while copying, so writers never wait for the bus. Called
+ * by the frame thread, or by the application if it has its own frame loop.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd_comp_tick(struct i2c_lcd_comp *i2c_lcd_comp) {
+	/* {{{ */
+	return i2c_lcd_comp_render(i2c_lcd_comp, 0);
+	/* }}} */
+}
+
+
+/** The frame thread. Ticks once every frame_ns on an absolute schedule, so
+ * the time taken by each tick does not add up. If it falls more than a frame
+ * behind (a slow bus, or the thread not being scheduled) the missed frames are
+ * skipped rather than sent back to back. */
+static void *i2c_lcd_comp_thread(void *arg) {
+	/* {{{ */
+	struct i2c_lcd_comp *i2c_lcd_comp = arg;
+	struct timespec next;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	while (atomic_load(&i2c_lcd_comp->running)) {
+		pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+		i2c_lcd_comp_tick(i2c_lcd_comp);
+
+		timespec_add_ns(&next, i2c_lcd_comp->frame_ns);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_diff_ns(&next, &now) > i2c_lcd_comp->frame_ns) next = now;
+
+		pthread_mutex_lock(&i2c_lcd_comp->lock);
+		while (atomic_load(&i2c_lcd_comp->running) && ETIMEDOUT != \
+			pthread_cond_timedwait(&i2c_lcd_comp->wake, &i2c_lcd_comp->lock, &next));
+	}
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	/* Show the last state written before stopping */
+	i2c_lcd_comp_render(i2c_lcd_comp, 1);
+
+	return NULL;
+	/* }}} */
+}
+
+
+/** Start a thread that calls i2c_lcd_comp_tick() 'fps' times a second, until
+ * i2c_lcd_comp_stop() is called. The page must not be used by anything else
+ * meanwhile.
+ *
+ * Returns 0 on success, and -1 if the thread could not be started.
+ */
+int i2c_lcd_comp_start(struct i2c_lcd_comp *i2c_lcd_comp, unsigned fps) {
+	/* {{{ */
+	pthread_condattr_t attr;
+
+	if (fps == 0) return -1;
+	i2c_lcd_comp->frame_ns = 1000000000L / fps;
+
+	/* The frame deadlines are CLOCK_MONOTONIC times */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	int ret = pthread_cond_init(&i2c_lcd_comp->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	if (ret != 0) return -1;
+
+	atomic_store(&i2c_lcd_comp->running, 1);
+	if (0 != pthread_create(&i2c_lcd_comp->thread, NULL, i2c_lcd_comp_thread, \
+		i2c_lcd_comp)) {
+
+		atomic_store(&i2c_lcd_comp->running, 0);
+		pthread_cond_destroy(&i2c_lcd_comp->wake);
+		return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Stop the frame thread, after it has rendered whatever was last written */
+void i2c_lcd_comp_stop(struct i2c_lcd_comp *i2c_lcd_comp) {
+	/* {{{ */
+	pthread_mutex_lock(&i2c_lcd_comp->lock);
+	atomic_store(&i2c_lcd_comp->running, 0);
+	pthread_cond_signal(&i2c_lcd_comp->wake);
+	pthread_mutex_unlock(&i2c_lcd_comp->lock);
+
+	pthread_join(i2c_lcd_comp->thread, NULL);
+
+	pthread_cond_destroy(&i2c_lcd_comp->wake);
+	/* }}} */
+}
@@ -0,0 +1,84 @@
+#ifndef I2C_LCD_COMPOSITOR
+#define I2C_LCD_COMPOSITOR
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-page-wrapper.h"
+
+/* The most regions a compositor can have */
+#define I2C_LCD_COMP_REGIONS 16
+/* The longest region name, including the terminating '\0' */
+#define I2C_LCD_COMP_NAME_MAX 16
+
+
+/* A rectangle of one row of the page that is written to as a whole, such as a
+ * field showing one value */
+struct i2c_lcd_comp_region {
+	char name[I2C_LCD_COMP_NAME_MAX];
+	uint8_t column;
+	uint8_t row;
+	uint8_t width;
+	/* The shortest time between two renders of the region, or 0 to render it
+	 * on every tick it has changed */
+	long min_interval_ns;
+	/* The latest contents written to the region, and whether they have been
+	 * rendered into the page yet */
+	char text[I2C_LCD_PAGE_DDRAM_WIDTH];
+	uint8_t dirty;
+	/* CLOCK_MONOTONIC time of the last render */
+	struct timespec rendered_at;
+	/* Statistics */
+	uint64_t writes;
+	uint64_t renders;
+};
+
+
+/* Collects writes to regions of a page from any number of threads, and sends
+ * only the latest contents of each region to the LCD once per frame. Writing
+ * to a region only copies the text, so the bus load is bounded by the frame
+ * rate rather than by how often the regions are written. */
+struct i2c_lcd_comp {
+	struct i2c_lcd_page *i2c_lcd_page;
+	struct i2c_lcd_comp_region regions[I2C_LCD_COMP_REGIONS];
+	size_t n_regions;
+	/* Protects 'regions'. Never held while talking to the LCD. */
+	pthread_mutex_t lock;
+	/* The frame thread, see i2c_lcd_comp_start() */
+	long frame_ns;
+	atomic_int running;
+	pthread_cond_t wake;
+	pthread_t thread;
+	/* Set when a flush failed, so that the next frame flushes the page again
+	 * even if no region has been written since */
+	uint8_t flush_pending;
+	/* Statistics */
+	uint64_t ticks;
+	uint64_t frames;
+	uint64_t flush_failures;
+};
+
+
+int i2c_lcd_comp_init(struct i2c_lcd_comp *i2c_lcd_comp, struct i2c_lcd_page *i2c_lcd_page);
+
+void i2c_lcd_comp_destroy(struct i2c_lcd_comp *i2c_lcd_comp);
+
+int i2c_lcd_comp_add_region(struct i2c_lcd_comp *i2c_lcd_comp, const char *name, uint8_t column, uint8_t row, uint8_t width, long min_interval_ns);
+
+int i2c_lcd_comp_find(struct i2c_lcd_comp *i2c_lcd_comp, const char *name);
+
+int i2c_lcd_comp_write(struct i2c_lcd_comp *i2c_lcd_comp, int region, const char *text, size_t n);
+
+int i2c_lcd_comp_printf(struct i2c_lcd_comp *i2c_lcd_comp, int region, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+int i2c_lcd_comp_tick(struct i2c_lcd_comp *i2c_lcd_comp);
+
+int i2c_lcd_comp_start(struct i2c_lcd_comp *i2c_lcd_comp, unsigned fps);
+
+void i2c_lcd_comp_stop(struct i2c_lcd_comp *i2c_lcd_comp);
+
+#endif
@@ -0,0 +1,167 @@
+#include <string.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-page-wrapper.h"
+#include "i2c-lcd-field.h"
+
+
+/** Set up a field of 'width' cells of 'row' from 'column' on, showing values
+ * with 'decimals' digits after the decimal point, aligned to 'align' and
+ * padded with 'pad' (see struct i2c_lcd_field). Nothing is sent until the
+ * first call to i2c_lcd_field_set(), which writes every cell. A field that
+ * does not fit on a line of DDRAM is cut to the end of the line.
+ */
+void i2c_lcd_field_init(struct i2c_lcd_field *i2c_lcd_field, \
+	struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, \
+	uint8_t width, uint8_t decimals, enum i2c_lcd_field_align align, \
+	char pad) {
+	/* {{{ */
+	memset(i2c_lcd_field, 0, sizeof(*i2c_lcd_field));
+	i2c_lcd_field->i2c_lcd_page = i2c_lcd_page;
+	i2c_lcd_field->column = column;
+	i2c_lcd_field->row = row;
+	i2c_lcd_field->width = column >= I2C_LCD_PAGE_DDRAM_WIDTH ? 0 \
+		: width > I2C_LCD_PAGE_DDRAM_WIDTH - column \
+		? I2C_LCD_PAGE_DDRAM_WIDTH - column : width;
+	i2c_lcd_field->decimals = decimals;
+	i2c_lcd_field->align = align;
+	i2c_lcd_field->pad = pad;
+	/* }}} */
+}
+
+
+/** Format 'value' into the 'width' cells of the field at 'cells', as the
+ * field would show it. A value that does not fit, sign and decimal point
+ * included, fills every cell with I2C_LCD_FIELD_OVERFLOW rather than losing
+ * digits.
+ *
+ * Returns the number of cells holding the value, which is 'width' if it did
+ * not fit.
+ */
+size_t i2c_lcd_field_format(const struct i2c_lcd_field *i2c_lcd_field, \
+	long value, char *cells) {
+	/* {{{ */
+	uint8_t width = i2c_lcd_field->width;
+	/* The digits of the longest long, a decimal point, a leading 0 and the
+	 * sign fit with room to spare */
+	char digits[I2C_LCD_PAGE_DDRAM_WIDTH + 24];
+	size_t n = 0;
+	/* Negate in unsigned arithmetic so that LONG_MIN does not overflow */
+	unsigned long magnitude = value < 0 ? 0UL - (unsigned long) value \
+		: (unsigned long) value;
+
+	/* Collect the digits from the least significant on, with the decimal
+	 * point after the first 'decimals' of them and at least one digit before
+	 * it */
+	do {
+		if (n == i2c_lcd_field->decimals && n > 0) digits[n++] = '.';
+		digits[n++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while ((magnitude > 0 || n <= i2c_lcd_field->decimals) \
+		&& n < sizeof(digits) - 1);
+
+	size_t len = n + (value < 0);
+	if (len > width) {
+		memset(cells, I2C_LCD_FIELD_OVERFLOW, width);
+		return width;
+	}
+
+	size_t pos = 0;
+	if (i2c_lcd_field->align == I2C_LCD_FIELD_RIGHT) {
+		if (i2c_lcd_field->pad == '0') {
+			if (value < 0) cells[pos++] = '-';
+			while (pos < width - n) cells[pos++] = '0';
+		} else {
+			while (pos < width - len) cells[pos++] = i2c_lcd_field->pad;
+			if (value < 0) cells[pos++] = '-';
+		}
+	} else if (value < 0) {
+		cells[pos++] = '-';
+	}
+
+	while (n > 0) cells[pos++] = digits[--n];
+	while (pos < width) cells[pos++] = ' ';
+
+	return len;
+	/* }}} */
+}
+
+
+/** Show 'value' in the field. Only the cells that differ from what the field
+ * showed last are sent: each run of them costs a Set DDRAM address
+ * instruction (page 29 of the HD44780 datasheet), unless the cursor of the
+ * page is already at its start, and its characters in one transaction.
+ * Changed cells close enough together to be cheaper to rewrite than to skip
+ * are sent as one run. The cells are written through to the shadow of the
+ * page, so the next i2c_lcd_page_flush() does not send them again, and the
+ * cursor of the page is left after the last cell written.
+ *
+ * Returns the number of cells sent, and -1 if a write to the i2c device
+ * failed, in which case the field is written in full on the next call.
+ */
+int i2c_lcd_field_set(struct i2c_lcd_field *i2c_lcd_field, long value) {
+	/* {{{ */
+	struct i2c_lcd_page *i2c_lcd_page = i2c_lcd_field->i2c_lcd_page;
+	char cells[I2C_LCD_PAGE_DDRAM_WIDTH];
+	uint8_t width = i2c_lcd_field->width;
+	int sent = 0;
+
+	i2c_lcd_field_format(i2c_lcd_field, value, cells);
+	i2c_lcd_field->updates++;
+
+	size_t i = 0;
+	while (i < width) {
+		if (i2c_lcd_field->shown && cells[i] == i2c_lcd_field->text[i]) {
+			i++;
+			continue;
+		}
+
+		/* Extend the run over unchanged cells as long as rewriting them
+		 * costs less than a new Set DDRAM address instruction */
+		size_t start = i;
+		size_t end = ++i;
+		while (i < width) {
+			if (!i2c_lcd_field->shown || cells[i] != i2c_lcd_field->text[i]) {
+				end = ++i;
+				continue;
+			}
+			size_t gap = 0;
+			while (i + gap < width \
+				&& cells[i + gap] == i2c_lcd_field->text[i + gap]) {
+				gap++;
+			}
+			if (i + gap == width || gap * I2C_LCD1602_BYTES_PER_CHAR \
+				>= I2C_LCD1602_BYTES_PER_COMMAND + 1) {
+				break;
+			}
+			i += gap;
+		}
+
+		if (0 != i2c_lcd_page_write_at(i2c_lcd_page, i2c_lcd_field->column \
+			+ start, i2c_lcd_field->row, &cells[start], end - start)) {
+
+			i2c_lcd_field->shown = 0;
+			return -1;
+		}
+		sent += end - start;
+		i = end;
+	}
+
+	memcpy(i2c_lcd_field->text, cells, width);
+	i2c_lcd_field->shown = 1;
+	i2c_lcd_field->cells_sent += sent;
+
+	return sent;
+	/* }}} */
+}
+
+
+/** Forget what the field shows, so that the next i2c_lcd_field_set() writes
+ * every cell. To be called when something other than the field may have
+ * written over it, such as a clear of the display.
+ */
+void i2c_lcd_field_invalidate(struct i2c_lcd_field *i2c_lcd_field) {
+	/* {{{ */
+	i2c_lcd_field->shown = 0;
+	/* }}} */
+}
@@ -0,0 +1,55 @@
+#ifndef I2C_LCD_FIELD
+#define I2C_LCD_FIELD
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-page-wrapper.h"
+
+/* What every cell of a field shows when its value does not fit */
+#define I2C_LCD_FIELD_OVERFLOW '#'
+
+/* Where in its field a value that is shorter than the field goes */
+enum i2c_lcd_field_align {
+	I2C_LCD_FIELD_RIGHT,
+	I2C_LCD_FIELD_LEFT
+};
+
+
+/* A fixed-width number at a position of a page, such as a counter or a gauge
+ * that is updated many times a second. The value is formatted into the cells
+ * of the field without printf() or allocation, and only the cells that differ
+ * from what the field last showed are sent, so a counter going from 1234 to
+ * 1235 costs moving the cursor and one character. */
+struct i2c_lcd_field {
+	struct i2c_lcd_page *i2c_lcd_page;
+	uint8_t column;
+	uint8_t row;
+	uint8_t width;
+	/* The number of digits after the decimal point: the value 215 with 1
+	 * decimal is shown as 21.5 */
+	uint8_t decimals;
+	enum i2c_lcd_field_align align;
+	/* What fills the cells a right-aligned value does not use, ' ' or '0'.
+	 * Zeros go after the sign. Left-aligned values are always followed by
+	 * spaces. */
+	char pad;
+	/* What the field is showing, if 'shown' is set */
+	char text[I2C_LCD_PAGE_DDRAM_WIDTH];
+	uint8_t shown;
+	/* Statistics */
+	uint64_t updates;
+	uint64_t cells_sent;
+};
+
+
+void i2c_lcd_field_init(struct i2c_lcd_field *i2c_lcd_field, struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, uint8_t width, uint8_t decimals, enum i2c_lcd_field_align align, char pad);
+
+size_t i2c_lcd_field_format(const struct i2c_lcd_field *i2c_lcd_field, long value, char *cells);
+
+int i2c_lcd_field_set(struct i2c_lcd_field *i2c_lcd_field, long value);
+
+void i2c_lcd_field_invalidate(struct i2c_lcd_field *i2c_lcd_field);
+
+#endif
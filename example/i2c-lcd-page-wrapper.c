@@ -2,8 +2,10 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "i2c-LCD1602.h"
+#include "i2c-lcd-charset.h"
 #include "i2c-lcd-page-wrapper.h"
 
 /* HD44780 datasheet:
@@ -15,99 +17,1534 @@ struct i2c_lcd_page i2c_lcd_page_init(struct i2c_lcd1602 i2c_lcd1602) {
 	/* {{{ */
 	struct i2c_lcd_page i2c_lcd = {
 		.i2c_lcd1602 = i2c_lcd1602,
+		.controllers = 1,
 		.cursor_col = 0,
 		.cursor_row = 0,
 		.display_pos = 0,
 		.row_width = 40 // See page 11 of the HD44780 datasheet
 	};
 
+	/* Clearing the display fills DDRAM with spaces (page 24 of the HD44780
+	 * datasheet) */
+	memset(i2c_lcd.shadow, ' ', sizeof(i2c_lcd.shadow));
+	memset(i2c_lcd.frame, ' ', sizeof(i2c_lcd.frame));
+	/* The contents of CGRAM are unknown, so no slot holds a known glyph */
+	memset(i2c_lcd.frame_glyph, 0, sizeof(i2c_lcd.frame_glyph));
+	memset(i2c_lcd.slots, 0, sizeof(i2c_lcd.slots));
+
 	return i2c_lcd;
 	/* }}} */
 }
 
 
-/** Clear the display, and set the cursor position to zero */
+/** Return a page for a module with two controllers, such as a 40x4, where
+ * 'first' drives rows 0 and 1 and 'second' rows 2 and 3. Both are i2c LCDs of
+ * 40x2 on the same bus, with the enable of 'second' set to the output of the
+ * PCF8574 its controller is strobed by (see i2c_lcd1602_set_enable()), and
+ * both should have been begun. The page sends the changes for both
+ * controllers in one transaction, and waits only for the controllers it is
+ * sending to. The cursor is shown by whichever controller holds the row it is
+ * on, so a visible cursor should only be turned on in that one. */
+struct i2c_lcd_page i2c_lcd_page_init_dual(struct i2c_lcd1602 first, \
+	struct i2c_lcd1602 second) {
+	/* {{{ */
+	struct i2c_lcd_page i2c_lcd = i2c_lcd_page_init(first);
+
+	i2c_lcd.second = second;
+	i2c_lcd.controllers = 2;
+
+	return i2c_lcd;
+	/* }}} */
+}
+
+
+/* The page address of a cell that does not exist */
+#define I2C_LCD_PAGE_NO_AC 0xff
+
+
+/** Return the controller holding DDRAM line 'line' of the page */
+static struct i2c_lcd1602 *i2c_lcd_page_controller( \
+	struct i2c_lcd_page *i2c_lcd_page, int line) {
+	/* {{{ */
+	return line < 2 ? &i2c_lcd_page->i2c_lcd1602 : &i2c_lcd_page->second;
+	/* }}} */
+}
+
+
+/** Return how many rows of the page each controller shows. Displays of up to
+ * two rows are addressed as two rows (the second may be off screen). */
+static uint8_t i2c_lcd_page_controller_rows(struct i2c_lcd_page *i2c_lcd_page) {
+	/* {{{ */
+	return i2c_lcd_page->i2c_lcd1602.rows > 2 ? i2c_lcd_page->i2c_lcd1602.rows : 2;
+	/* }}} */
+}
+
+
+/** Return the page address of the given x, y (column, row) coordinates
+ * relative to the current display position, or I2C_LCD_PAGE_NO_AC if there is
+ * no such row. A page address is the DDRAM address in the controller of the
+ * row (bits 0 - 6) plus 0x80 for the second controller. */
+static uint8_t i2c_lcd_page_ac(struct i2c_lcd_page *i2c_lcd_page, \
+	uint8_t column, uint8_t row) {
+	/* {{{ */
+	uint8_t rows = i2c_lcd_page_controller_rows(i2c_lcd_page);
+	uint8_t controller = row / rows;
+
+	if (controller >= i2c_lcd_page->controllers) return I2C_LCD_PAGE_NO_AC;
+
+	/* These numbers come from page 11, 21 of the HD44780 datasheet which shows
+	 * how rows are really just treated as higher-number columns, with each
+	 * row containing 40 columns and row 2 starting at 0x40. Rows past the
+	 * second continue the first two lines, 'columns' characters in. */
+	row %= rows;
+	int line = controller * 2 + row % 2;
+	int offset = (row / 2) * i2c_lcd_page->i2c_lcd1602.columns;
+
+	/* Shifting the display moves the window around each line as a loop
+	 * (page 11 of the HD44780 datasheet) */
+	return (i2c_lcd_page->display_pos + offset + column) \
+		% I2C_LCD_PAGE_DDRAM_WIDTH + line * 0x40;
+	/* }}} */
+}
+
+
+/** Set the cursor coordinates to those of page address 'ac', the inverse of
+ * i2c_lcd_page_ac(). Columns past the display window on a display of four
+ * rows are given as the row below on the same line. */
+static void i2c_lcd_page_set_cursor_ac(struct i2c_lcd_page *i2c_lcd_page, \
+	uint8_t ac) {
+	/* {{{ */
+	uint8_t rows = i2c_lcd_page_controller_rows(i2c_lcd_page);
+	uint8_t columns = i2c_lcd_page->i2c_lcd1602.columns;
+	int line = ac / 0x40;
+	int offset = (ac % 0x40 - i2c_lcd_page->display_pos % I2C_LCD_PAGE_DDRAM_WIDTH \
+		+ I2C_LCD_PAGE_DDRAM_WIDTH) % I2C_LCD_PAGE_DDRAM_WIDTH;
+	int row = line % 2;
+
+	if (columns > 0 && row + 2 * (offset / columns) < rows) {
+		row += 2 * (offset / columns);
+		offset %= columns;
+	}
+
+	i2c_lcd_page->cursor_row = (line / 2) * rows + row;
+	i2c_lcd_page->cursor_col = offset;
+	/* }}} */
+}
+
+
+/** Return a pointer to the cell of 'fb' (one of the shadow or the frame of
+ * 'i2c_lcd_page') that holds page address 'ac', or NULL if 'ac' is not a
+ * valid page address */
+static uint8_t *i2c_lcd_page_cell(uint8_t \
+	fb[I2C_LCD_PAGE_DDRAM_LINES][I2C_LCD_PAGE_DDRAM_WIDTH], uint8_t ac) {
+	/* {{{ */
+	uint8_t line = ac / 0x40;
+	uint8_t col = ac % 0x40;
+
+	if (line >= I2C_LCD_PAGE_DDRAM_LINES || col >= I2C_LCD_PAGE_DDRAM_WIDTH) {
+		return NULL;
+	}
+
+	return &fb[line][col];
+	/* }}} */
+}
+
+
+/** Clear the display, and set the cursor position to zero. On a module with
+ * two controllers the second is sent its instruction while the first is still
+ * executing, so clearing both takes no longer than clearing one. */
 void i2c_lcd_page_clear_display(struct i2c_lcd_page *i2c_lcd_page) {
 	/* {{{ */
-	/* Adjust display position */
+	/* Adjust display position and cursor coordinates */
 	i2c_lcd_page->display_pos = 0;
+	i2c_lcd_page->cursor_col = 0;
+	i2c_lcd_page->cursor_row = 0;
+	/* Clearing the display fills DDRAM with spaces */
+	memset(i2c_lcd_page->shadow, ' ', sizeof(i2c_lcd_page->shadow));
+	memset(i2c_lcd_page->frame, ' ', sizeof(i2c_lcd_page->frame));
+	/* CGRAM is not affected, so the glyphs stay in their slots */
+	memset(i2c_lcd_page->frame_glyph, 0, sizeof(i2c_lcd_page->frame_glyph));
+
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		if (0 != i2c_lcd1602_clear_display(i2c_lcd_page_controller(i2c_lcd_page, \
+			c * 2))) {
+
+			i2c_lcd_page->lost = 1;
+		}
+	}
+	/* }}} */
+}
+
+
+/** Move the cursor coordinates one step to the right (if 'right' is set) or
+ * left, following the address counter from the end of one DDRAM line to the
+ * start of the other and back (page 11, 29 of the HD44780 datasheet) */
+static void i2c_lcd_page_step_cursor(struct i2c_lcd_page *i2c_lcd_page, \
+	int right) {
+	/* {{{ */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+	int line = ac / 0x40;
+	int col = ac % 0x40;
+
+	if (ac == I2C_LCD_PAGE_NO_AC) return;
+
+	/* The other line is the one of the same controller */
+	if (right && ++col == I2C_LCD_PAGE_DDRAM_WIDTH) {
+		col = 0;
+		line ^= 1;
+	} else if (!right && col-- == 0) {
+		col = I2C_LCD_PAGE_DDRAM_WIDTH - 1;
+		line ^= 1;
+	}
+
+	i2c_lcd_page_set_cursor_ac(i2c_lcd_page, line * 0x40 + col);
+	/* }}} */
+}
+
 
-	i2c_lcd1602_clear_display(&i2c_lcd_page->i2c_lcd1602);
+/** Move the display window 'columns' columns to the left (or to the right if
+ * negative), leaving the cursor at the same DDRAM address (page 11, 29 of the
+ * HD44780 datasheet) */
+static void i2c_lcd_page_move_window(struct i2c_lcd_page *i2c_lcd_page, \
+	int columns) {
+	/* {{{ */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+
+	i2c_lcd_page->display_pos = (i2c_lcd_page->display_pos + columns \
+		+ I2C_LCD_PAGE_DDRAM_WIDTH) % I2C_LCD_PAGE_DDRAM_WIDTH;
+
+	if (ac != I2C_LCD_PAGE_NO_AC) i2c_lcd_page_set_cursor_ac(i2c_lcd_page, ac);
 	/* }}} */
 }
 
 
-/** Move the cursor to the given x, y (column, row) coordinates. */
+/** Move the cursor to the given x, y (column, row) coordinates, the cheapest
+ * way the timing of the LCD allows. The way there is planned from where the
+ * register model of the controller says its address counter is, which may
+ * have been moved by something other than the page (such as
+ * i2c_lcd1602_create_char()), so nothing is sent if it is already there.
+ * Otherwise the cost of each way of getting there is estimated and the
+ * cheapest is used:
+ * - setting the DDRAM address (page 24 of the HD44780 datasheet)
+ * - shifting the cursor once for each column on the same line (page 29)
+ * - return home, when going to the first column with the display not shifted
+ *   (page 24)
+ * - rewriting the characters already between the cursor and the target in
+ *   one write, letting the address counter move after each one (page 26)
+ * If where the address counter is is unknown, or it is in CGRAM, the DDRAM
+ * address is always set.
+ */
 void i2c_lcd_page_set_cursor_pos(struct i2c_lcd_page *i2c_lcd_page, \
 	uint8_t column, uint8_t row) {
 	/* {{{ */
-	/* See page 24 of the HD44780 datasheet */
+	uint8_t to = i2c_lcd_page_ac(i2c_lcd_page, column, row);
 
-	/* These numbers come from page 11, 21 of the HD44780 datasheet which shows
-	 * how rows are really just treated as higher-number columns, with each
-	 * row containing 40 columns and row 2 starting at 0x40 */
-	int row_offsets[] = { 0x0, 0x40 };
+	if (to == I2C_LCD_PAGE_NO_AC) return;
 
-	uint8_t ac = i2c_lcd_page->display_pos + column + row_offsets[row];
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+		to / 0x40);
+	/* The page address of where the address counter of the controller is,
+	 * if it is in a cell of the page */
+	uint8_t from = i2c_lcd1602->ac == I2C_LCD1602_AC_UNKNOWN \
+		|| i2c_lcd1602->ac % 0x40 >= I2C_LCD_PAGE_DDRAM_WIDTH \
+		? I2C_LCD_PAGE_NO_AC : (to & 0x80) | i2c_lcd1602->ac;
+	enum {
+		MOVE_SET_DDRAM,
+		MOVE_SHIFT,
+		MOVE_HOME,
+		MOVE_REWRITE
+	} move = MOVE_SET_DDRAM;
+	long best = i2c_lcd1602_command_cost(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM);
+	long cost;
 
 	/* Adjust the cursor coordinates */
-	i2c_lcd_page->cursor_col = column;
+	i2c_lcd_page->cursor_col = column % I2C_LCD_PAGE_DDRAM_WIDTH;
 	i2c_lcd_page->cursor_row = row;
 
-	i2c_lcd1602_set_cursor_pos(&i2c_lcd_page->i2c_lcd1602, ac);
+	if (from == to) return;
+
+	int distance = (to % 0x40) - (from % 0x40);
+	int steps = distance < 0 ? -distance : distance;
+	int increment = \
+		i2c_lcd1602->entry_shift_increment == LCD_ENTRYINCREMENT ? 1 : -1;
+
+	if (from != I2C_LCD_PAGE_NO_AC && from / 0x40 == to / 0x40) {
+		cost = steps * i2c_lcd1602_command_cost(i2c_lcd1602, I2C_LCD1602_CMD_SHIFT);
+		if (cost < best) {
+			best = cost;
+			move = MOVE_SHIFT;
+		}
+
+		/* Only if writing moves the cursor towards the target, and does not
+		 * shift the display */
+		if (distance * increment > 0 && i2c_lcd1602->entry_shift == LCD_ENTRYNOSHIFT) {
+			cost = i2c_lcd1602_write_buffer_cost(i2c_lcd1602, steps);
+			if (cost < best) {
+				best = cost;
+				move = MOVE_REWRITE;
+			}
+		}
+	}
+
+	/* Return home also undoes any display shift, of every controller */
+	if (to == 0 && i2c_lcd_page->display_pos == 0 \
+		&& i2c_lcd_page->controllers == 1) {
+		cost = i2c_lcd1602_command_cost(i2c_lcd1602, I2C_LCD1602_CMD_HOME);
+		if (cost < best) {
+			best = cost;
+			move = MOVE_HOME;
+		}
+	}
+
+	int ret = 0;
+	switch (move) {
+	case MOVE_SET_DDRAM:
+		ret = i2c_lcd1602_set_cursor_pos(i2c_lcd1602, to & 0x7f);
+		break;
+	case MOVE_SHIFT:
+		for (int i = 0; i < steps && ret == 0; i++) {
+			ret = i2c_lcd1602_shift(i2c_lcd1602, 0, distance > 0);
+		}
+		break;
+	case MOVE_HOME:
+		ret = i2c_lcd1602_cursor_home(i2c_lcd1602);
+		break;
+	case MOVE_REWRITE: {
+		char cells[I2C_LCD_PAGE_DDRAM_WIDTH];
+		uint8_t *shadow = i2c_lcd_page->shadow[from / 0x40];
+
+		for (int i = 0; i < steps; i++) {
+			cells[i] = shadow[from % 0x40 + i * increment];
+		}
+		ret = i2c_lcd1602_write_buffer(i2c_lcd1602, cells, steps);
+		break;
+	}
+	}
+	if (ret != 0) i2c_lcd_page->lost = 1;
 	/* }}} */
 }
 
 
-/** Shift the screen or the cursor to the right or to the left */
+/** Shift the screen or the cursor to the right or to the left. Shifting the
+ * screen shifts every controller of the module. */
 void i2c_lcd_page_shift(struct i2c_lcd_page *i2c_lcd_page, char screen_cursor,
 	char right_left) {
 	/* {{{ */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+
 	/* If it is the cursor being moved, adjust the cursor coordinates */
 	if (screen_cursor == 0) {
-		if (right_left == 1) {
-			i2c_lcd_page->cursor_col++;
-		} else {
-			i2c_lcd_page->cursor_col--;
+		i2c_lcd_page_step_cursor(i2c_lcd_page, right_left == 1);
+		if (ac != I2C_LCD_PAGE_NO_AC && 0 != i2c_lcd1602_shift( \
+			i2c_lcd_page_controller(i2c_lcd_page, ac / 0x40), screen_cursor, \
+			right_left)) {
+
+			i2c_lcd_page->lost = 1;
 		}
-	/* If it is the screen that is being moved, adjust the display position */
+	/* If it is the screen that is being moved, adjust the display position.
+	 * The display position wraps around the 40 columns of each line, and the
+	 * cursor stays at the same DDRAM address (page 11, 29 of the HD44780
+	 * datasheet). */
 	} else if (screen_cursor == 1) {
-		if (right_left == 1) {
-			i2c_lcd_page->display_pos--;
-			i2c_lcd_page->cursor_col++;
-		} else {
-			i2c_lcd_page->display_pos++;
-			i2c_lcd_page->cursor_col--;
+		i2c_lcd_page_move_window(i2c_lcd_page, right_left == 1 ? -1 : 1);
+		for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+			if (0 != i2c_lcd1602_shift(i2c_lcd_page_controller(i2c_lcd_page, \
+				c * 2), screen_cursor, right_left)) {
+
+				i2c_lcd_page->lost = 1;
+			}
 		}
 	}
-
-	i2c_lcd1602_shift(&i2c_lcd_page->i2c_lcd1602, screen_cursor, right_left);
 	/* }}} */
 }
 
 
 void i2c_lcd_page_send_char(struct i2c_lcd_page *i2c_lcd_page, char c) {
 	/* {{{ */
+	/* Record the character in the shadow of DDRAM at the current cursor
+	 * position, before the cursor moves */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+	uint8_t *cell;
+	if (NULL != (cell = i2c_lcd_page_cell(i2c_lcd_page->shadow, ac))) *cell = c;
+	if (NULL != (cell = i2c_lcd_page_cell(i2c_lcd_page->frame, ac))) *cell = c;
+	if (NULL != (cell = i2c_lcd_page_cell(i2c_lcd_page->frame_glyph, ac))) *cell = 0;
+
+	if (ac == I2C_LCD_PAGE_NO_AC) ac = 0;
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+		ac / 0x40);
+
 	/* If the LCD is NOT set to shift the whole display (as well as the cursor)
 	 * after receiving a character ... */
-	if (i2c_lcd_page->i2c_lcd1602.entry_shift == 0) {
+	if (i2c_lcd1602->entry_shift == 0) {
 		/* If the LCD is set to shift the cursor to the right after receiving
 		 * a character ... */
-		if (i2c_lcd_page->i2c_lcd1602.entry_shift_increment == LCD_ENTRYINCREMENT) {
-			i2c_lcd_page->cursor_col++;
-		} else if (i2c_lcd_page->i2c_lcd1602.entry_shift_increment == LCD_ENTRYDECREMENT) {
-			i2c_lcd_page->cursor_col--;
+		if (i2c_lcd1602->entry_shift_increment == LCD_ENTRYINCREMENT) {
+			i2c_lcd_page_step_cursor(i2c_lcd_page, 1);
+		} else if (i2c_lcd1602->entry_shift_increment == LCD_ENTRYDECREMENT) {
+			i2c_lcd_page_step_cursor(i2c_lcd_page, 0);
 		}
-	} else if (i2c_lcd_page->i2c_lcd1602.entry_shift == 1) {
+	} else if (i2c_lcd1602->entry_shift == 1) {
 		/* If the LCD is set to shift the display to the right after receiving
 		 * a character ... */
-		if (i2c_lcd_page->i2c_lcd1602.entry_shift_increment == LCD_ENTRYINCREMENT) {
-			i2c_lcd_page->display_pos++;
-		} else if (i2c_lcd_page->i2c_lcd1602.entry_shift_increment == LCD_ENTRYDECREMENT) {
-			i2c_lcd_page->display_pos--;
+		if (i2c_lcd1602->entry_shift_increment == LCD_ENTRYINCREMENT) {
+			i2c_lcd_page->display_pos = (i2c_lcd_page->display_pos + 1) \
+				% I2C_LCD_PAGE_DDRAM_WIDTH;
+		} else if (i2c_lcd1602->entry_shift_increment == LCD_ENTRYDECREMENT) {
+			i2c_lcd_page->display_pos = (i2c_lcd_page->display_pos \
+				+ I2C_LCD_PAGE_DDRAM_WIDTH - 1) % I2C_LCD_PAGE_DDRAM_WIDTH;
+		}
+	}
+
+	if (0 != i2c_lcd1602_send_char(i2c_lcd1602, c)) i2c_lcd_page->lost = 1;
+	/* }}} */
+}
+
+
+/** Return whether every controller of the page is in step with what has been
+ * sent to it */
+static int i2c_lcd_page_in_sync(struct i2c_lcd_page *i2c_lcd_page) {
+	/* {{{ */
+	if (i2c_lcd_page->lost) return 0;
+
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		if (i2c_lcd_page_controller(i2c_lcd_page, c * 2)->out_of_sync) return 0;
+	}
+
+	return 1;
+	/* }}} */
+}
+
+
+/** Write 'n' characters straight to the LCD at the given x, y (column, row)
+ * coordinates, rather than into the frame for the next i2c_lcd_page_flush().
+ * The set DDRAM address instruction (page 29 of the HD44780 datasheet), if
+ * the address counter is not already there, and the characters are sent in
+ * one transaction. The characters are recorded in the shadow of DDRAM and
+ * the frame, and the cursor is left after them, as with
+ * i2c_lcd_page_set_cursor_pos() followed by i2c_lcd_page_send_char(). The
+ * characters are cut at the end of the DDRAM line. If the LCD is set to shift
+ * the display or to move the cursor to the left, they are sent one at a time
+ * with i2c_lcd_page_send_char() instead.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd_page_write_at(struct i2c_lcd_page *i2c_lcd_page, \
+	uint8_t column, uint8_t row, const char *buf, size_t n) {
+	/* {{{ */
+	uint8_t bytes[I2C_LCD1602_BYTES_PER_COMMAND + 1 \
+		+ I2C_LCD_PAGE_DDRAM_WIDTH * I2C_LCD1602_BYTES_PER_CHAR];
+	size_t len = 0;
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, column, row);
+
+	if (ac == I2C_LCD_PAGE_NO_AC) return 0;
+
+	/* The bytes go straight to the PCF8574, so the LCD must be in step, and
+	 * show what the shadow says, first */
+	if (!i2c_lcd_page_in_sync(i2c_lcd_page) \
+		&& 0 != i2c_lcd_page_recover(i2c_lcd_page)) {
+
+		return -1;
+	}
+
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+		ac / 0x40);
+	if (n > I2C_LCD_PAGE_DDRAM_WIDTH - ac % 0x40) {
+		n = I2C_LCD_PAGE_DDRAM_WIDTH - ac % 0x40;
+	}
+
+	if (i2c_lcd1602->entry_shift != LCD_ENTRYNOSHIFT \
+		|| i2c_lcd1602->entry_shift_increment != LCD_ENTRYINCREMENT) {
+
+		i2c_lcd_page_set_cursor_pos(i2c_lcd_page, column, row);
+		for (size_t i = 0; i < n; i++) i2c_lcd_page_send_char(i2c_lcd_page, buf[i]);
+		return 0;
+	}
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t command_mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+	uint8_t data_mode = set_mode(1, 0) | i2c_lcd1602->backlight;
+
+	int set_ddram = i2c_lcd1602->ac != (ac & 0x7f);
+	if (set_ddram) {
+		len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+			LCD_SETDDRAMADDR | (ac & 0x7f), command_mode);
+	}
+
+	/* Present RS before the first enable strobe of the characters */
+	bytes[len++] = data_mode;
+	for (size_t i = 0; i < n; i++) {
+		len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &bytes[len], buf[i], \
+			data_mode);
+	}
+
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) {
+		i2c_lcd_page->lost = 1;
+		return -1;
+	}
+
+	if (set_ddram) {
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM, 1);
+		i2c_lcd1602_track(i2c_lcd1602, LCD_SETDDRAMADDR | (ac & 0x7f), \
+			command_mode);
+	}
+	i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_DATA, n);
+	i2c_lcd1602_set_busy(i2c_lcd1602, \
+		i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]);
+
+	i2c_lcd_page->cursor_col = column % I2C_LCD_PAGE_DDRAM_WIDTH;
+	i2c_lcd_page->cursor_row = row;
+	for (size_t i = 0; i < n; i++) {
+		i2c_lcd1602_track(i2c_lcd1602, buf[i], data_mode);
+		ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+			i2c_lcd_page->cursor_row);
+		*i2c_lcd_page_cell(i2c_lcd_page->shadow, ac) = buf[i];
+		*i2c_lcd_page_cell(i2c_lcd_page->frame, ac) = buf[i];
+		*i2c_lcd_page_cell(i2c_lcd_page->frame_glyph, ac) = 0;
+		i2c_lcd_page_step_cursor(i2c_lcd_page, 1);
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Write 'n' characters into the frame starting at the given x, y (column,
+ * row) coordinates. Nothing is sent to the LCD until i2c_lcd_page_flush() is
+ * called. Like the display window, the row wraps around its 40 columns of
+ * DDRAM, and characters past the 40th are dropped. */
+void i2c_lcd_page_write(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, \
+	uint8_t row, const char *buf, size_t n) {
+	/* {{{ */
+	if (n > I2C_LCD_PAGE_DDRAM_WIDTH) n = I2C_LCD_PAGE_DDRAM_WIDTH;
+
+	for (size_t i = 0; i < n; i++) {
+		uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, column + i, row);
+		uint8_t *cell = i2c_lcd_page_cell(i2c_lcd_page->frame, ac);
+
+		if (cell == NULL) return;
+
+		*cell = buf[i];
+		*i2c_lcd_page_cell(i2c_lcd_page->frame_glyph, ac) = 0;
+	}
+	/* }}} */
+}
+
+
+/** Return the hash of the dot pattern of a glyph (32 bit FNV-1a) */
+static uint32_t i2c_lcd_page_glyph_hash(const uint8_t rows[8]) {
+	/* {{{ */
+	uint32_t hash = 2166136261u;
+
+	for (int i = 0; i < 8; i++) {
+		hash ^= rows[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+	/* }}} */
+}
+
+
+/** Return the index in 'glyphs' of the glyph with the dot pattern 'rows',
+ * adding it if the page does not know it yet. Glyphs that are neither in
+ * CGRAM nor used anywhere in the frame are forgotten to make room.
+ *
+ * Returns -1 if there is no room for another glyph.
+ */
+static int i2c_lcd_page_glyph_find(struct i2c_lcd_page *i2c_lcd_page, \
+	const uint8_t rows[8]) {
+	/* {{{ */
+	uint32_t hash = i2c_lcd_page_glyph_hash(rows);
+	uint8_t referenced[I2C_LCD_PAGE_GLYPHS] = { 0 };
+	int spare = -1;
+
+	for (int i = 0; i < I2C_LCD_PAGE_GLYPHS; i++) {
+		struct i2c_lcd_page_glyph *glyph = &i2c_lcd_page->glyphs[i];
+
+		if (!glyph->used) {
+			if (spare == -1) spare = i;
+		} else if (glyph->hash == hash && 0 == memcmp(glyph->rows, rows, 8)) {
+			return i;
+		}
+	}
+
+	if (spare == -1) {
+		uint8_t *frame_glyph = &i2c_lcd_page->frame_glyph[0][0];
+		for (size_t i = 0; i < sizeof(i2c_lcd_page->frame_glyph); i++) {
+			if (frame_glyph[i] != 0) referenced[frame_glyph[i] - 1] = 1;
+		}
+		for (int i = 0; i < I2C_LCD_PAGE_GLYPHS && spare == -1; i++) {
+			int in_cgram = 0;
+			for (int c = 0; c < I2C_LCD_PAGE_CONTROLLERS; c++) {
+				if (i2c_lcd_page->glyphs[i].slot[c] != -1) in_cgram = 1;
+			}
+			if (!in_cgram && !referenced[i]) spare = i;
+		}
+		if (spare == -1) return -1;
+	}
+
+	struct i2c_lcd_page_glyph *glyph = &i2c_lcd_page->glyphs[spare];
+	memcpy(glyph->rows, rows, 8);
+	glyph->hash = hash;
+	glyph->used = 1;
+	memset(glyph->slot, -1, sizeof(glyph->slot));
+	glyph->last_use = 0;
+
+	return spare;
+	/* }}} */
+}
+
+
+/** Put a custom character with the 5x8 dot pattern 'rows' (one byte per row
+ * from top to bottom, using the low 5 bits of each) into the frame at the
+ * given x, y (column, row) coordinates. Any number of different glyphs can be
+ * used; i2c_lcd_page_flush() keeps the ones on screen in the 8 CGRAM slots,
+ * uploading a glyph only when it is not already in one. Character codes 0 to
+ * 7 are used for glyphs, so they should not also be written as plain
+ * characters.
+ *
+ * Returns 0 on success, and -1 if the page already knows about
+ * I2C_LCD_PAGE_GLYPHS other glyphs that are all in use.
+ */
+int i2c_lcd_page_write_glyph(struct i2c_lcd_page *i2c_lcd_page, \
+	uint8_t column, uint8_t row, const uint8_t rows[8]) {
+	/* {{{ */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, column, row);
+	uint8_t *cell = i2c_lcd_page_cell(i2c_lcd_page->frame_glyph, ac);
+	uint8_t pattern[8];
+	int index;
+
+	if (cell == NULL) return -1;
+
+	/* Only the low 5 bits of each row are shown (page 19 of the HD44780
+	 * datasheet), so ignore the rest when telling glyphs apart */
+	for (int i = 0; i < 8; i++) pattern[i] = rows[i] & 0x1f;
+
+	if (-1 == (index = i2c_lcd_page_glyph_find(i2c_lcd_page, pattern))) return -1;
+
+	*cell = index + 1;
+	/* The character code is decided when the frame is flushed */
+	*i2c_lcd_page_cell(i2c_lcd_page->frame, ac) = I2C_LCD_PAGE_GLYPH_FALLBACK;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Write the 'n' bytes of UTF-8 text at 's' into the frame starting at the
+ * given x, y (column, row) coordinates, transcoded for the character ROM of
+ * the LCD with 'i2c_lcd_charset'. Code points the ROM does not have are shown
+ * as glyphs (see i2c_lcd_page_write_glyph()) if the glyph function of
+ * 'i2c_lcd_charset' returns a dot pattern for them, and as its fallback
+ * character otherwise. As with i2c_lcd_page_write(), characters past the
+ * 40th are dropped.
+ *
+ * Returns the number of cells written.
+ */
+size_t i2c_lcd_page_write_utf8(struct i2c_lcd_page *i2c_lcd_page, \
+	uint8_t column, uint8_t row, const struct i2c_lcd_charset *i2c_lcd_charset, \
+	const char *s, size_t n) {
+	/* {{{ */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, column, row);
+	uint8_t codes[I2C_LCD_PAGE_DDRAM_WIDTH];
+	size_t cells = 0;
+	size_t i = 0;
+
+	if (NULL == i2c_lcd_page_cell(i2c_lcd_page->frame, ac)) return 0;
+
+	size_t room = I2C_LCD_PAGE_DDRAM_WIDTH;
+
+	while (i < n && cells < room) {
+		/* Transcode runs of ASCII in bulk */
+		size_t run = 0;
+		while (i + run < n && run < room - cells && (uint8_t) s[i + run] < 0x80) run++;
+		if (run > 0) {
+			i2c_lcd_charset_transcode(i2c_lcd_charset, &s[i], run, codes);
+			i2c_lcd_page_write(i2c_lcd_page, column + cells, row, (char *) codes, run);
+			i += run;
+			cells += run;
+			continue;
+		}
+
+		uint32_t cp;
+		const uint8_t *rows;
+		i += i2c_lcd_charset_decode(&s[i], n - i, &cp);
+
+		int k = i2c_lcd_charset_lookup(i2c_lcd_charset, cp, codes);
+		if (k > 0) {
+			if ((size_t) k > room - cells) k = room - cells;
+			i2c_lcd_page_write(i2c_lcd_page, column + cells, row, (char *) codes, k);
+			cells += k;
+			continue;
+		}
+
+		if (i2c_lcd_charset->glyph != NULL \
+			&& NULL != (rows = i2c_lcd_charset->glyph(i2c_lcd_charset->glyph_ctx, cp)) \
+			&& 0 == i2c_lcd_page_write_glyph(i2c_lcd_page, column + cells, row, rows)) {
+			cells++;
+			continue;
+		}
+
+		codes[0] = i2c_lcd_charset->fallback;
+		i2c_lcd_page_write(i2c_lcd_page, column + cells, row, (char *) codes, 1);
+		cells++;
+	}
+
+	return cells;
+	/* }}} */
+}
+
+
+/** Return whether the cell at 'col' of DDRAM line 'line' is currently shown on
+ * the display */
+static int i2c_lcd_page_visible(struct i2c_lcd_page *i2c_lcd_page, int line, \
+	int col) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = &i2c_lcd_page->i2c_lcd1602;
+	int offset = (col - i2c_lcd_page->display_pos % I2C_LCD_PAGE_DDRAM_WIDTH \
+		+ I2C_LCD_PAGE_DDRAM_WIDTH) % I2C_LCD_PAGE_DDRAM_WIDTH;
+	/* Each controller shows up to two lines, and on displays of four rows
+	 * each line is two rows long */
+	int lines = i2c_lcd_page->controllers \
+		* (i2c_lcd1602->rows < 2 ? i2c_lcd1602->rows : 2);
+	int span = i2c_lcd1602->rows > 2 ? i2c_lcd1602->rows / 2 : 1;
+
+	return line < lines && offset < i2c_lcd1602->columns * span;
+	/* }}} */
+}
+
+
+/** Make sure every glyph in the frame that is on screen on controller 'c' has
+ * a CGRAM slot in that controller, encoding the uploads of glyphs that do not
+ * into 'bytes', and set the frame cells of the controller that show each
+ * glyph to the character code of its slot. A glyph that needs a slot takes an
+ * unused one, or else the one holding the least recently used glyph that is
+ * not on screen. The glyph that was in it loses its slot, so cells still
+ * showing it are rewritten with I2C_LCD_PAGE_GLYPH_FALLBACK by the flush.
+ * Glyphs that are off screen only take unused slots, and are shown as
+ * I2C_LCD_PAGE_GLYPH_FALLBACK until a flush while they are on screen.
+ *
+ * Returns the number of bytes encoded into 'bytes'.
+ */
+static size_t i2c_lcd_page_load_glyphs(struct i2c_lcd_page *i2c_lcd_page, \
+	int c, uint8_t *bytes) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, c * 2);
+	uint8_t *slots = i2c_lcd_page->slots[c];
+	uint8_t command_mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+	uint8_t data_mode = set_mode(1, 0) | i2c_lcd1602->backlight;
+	/* Which slots hold a glyph that is on screen and so must not be evicted */
+	uint8_t pinned[I2C_LCD_PAGE_CGRAM_SLOTS] = { 0 };
+	uint32_t now = i2c_lcd_page->glyph_clock;
+	size_t len = 0;
+
+	/* First the glyphs on screen, then the ones off screen */
+	for (int pass = 0; pass < 2; pass++) {
+		for (int line = c * 2; line < c * 2 + 2; line++) {
+			for (int col = 0; col < I2C_LCD_PAGE_DDRAM_WIDTH; col++) {
+				uint8_t index = i2c_lcd_page->frame_glyph[line][col];
+				int visible = i2c_lcd_page_visible(i2c_lcd_page, line, col);
+
+				if (index == 0 || visible != (pass == 0)) continue;
+
+				struct i2c_lcd_page_glyph *glyph = &i2c_lcd_page->glyphs[index - 1];
+
+				if (glyph->slot[c] == -1) {
+					int slot = -1;
+
+					for (int s = 0; s < I2C_LCD_PAGE_CGRAM_SLOTS && slot == -1; s++) {
+						if (slots[s] == 0) slot = s;
+					}
+					/* Glyphs on screen may evict ones that are not */
+					int evict = slot == -1 && visible;
+					for (int s = 0; s < I2C_LCD_PAGE_CGRAM_SLOTS && evict; s++) {
+						if (pinned[s]) continue;
+						if (slot == -1 || i2c_lcd_page->glyphs[slots[s] - 1].last_use \
+							< i2c_lcd_page->glyphs[slots[slot] - 1].last_use) {
+							slot = s;
+						}
+					}
+					if (slot == -1) continue;
+
+					if (slots[slot] != 0) {
+						i2c_lcd_page->glyphs[slots[slot] - 1].slot[c] = -1;
+					}
+					slots[slot] = index;
+					glyph->slot[c] = slot;
+
+					/* See page 19, 24 of the HD44780 datasheet */
+					len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+						LCD_SETCGRAMADDR | (slot << 3), command_mode);
+					bytes[len++] = data_mode;
+					for (int i = 0; i < 8; i++) {
+						len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &bytes[len], \
+							glyph->rows[i], data_mode);
+					}
+					i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_CGRAM, 1);
+					i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_DATA, 8);
+				}
+
+				if (visible) {
+					pinned[glyph->slot[c]] = 1;
+					glyph->last_use = now;
+				}
+			}
+		}
+	}
+
+	/* Point the cells at the slots their glyphs ended up in */
+	for (int line = c * 2; line < c * 2 + 2; line++) {
+		for (int col = 0; col < I2C_LCD_PAGE_DDRAM_WIDTH; col++) {
+			uint8_t index = i2c_lcd_page->frame_glyph[line][col];
+
+			if (index == 0) continue;
+
+			int8_t slot = i2c_lcd_page->glyphs[index - 1].slot[c];
+			i2c_lcd_page->frame[line][col] = \
+				slot == -1 ? I2C_LCD_PAGE_GLYPH_FALLBACK : slot;
+		}
+	}
+
+	return len;
+	/* }}} */
+}
+
+
+/** Encode the part of a flush (see i2c_lcd_page_send()) that goes to
+ * controller 'c' into 'bytes', and store the type of the last thing encoded
+ * in 'last' and the DDRAM address the address counter is left at (see
+ * i2c_lcd1602_track()) in 'ac_after'.
+ *
+ * Returns the number of bytes encoded into 'bytes'.
+ */
+static size_t i2c_lcd_page_flush_controller(struct i2c_lcd_page *i2c_lcd_page, \
+	int c, const uint8_t *instructions, size_t n, uint8_t *bytes, \
+	enum i2c_lcd1602_command_type *last, uint8_t *ac_after) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, c * 2);
+	size_t len = 0;
+	/* The page address the LCD will be at after the bytes so far, or -1 if
+	 * unknown */
+	int ac;
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t command_mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+	uint8_t data_mode = set_mode(1, 0) | i2c_lcd1602->backlight;
+
+	*last = I2C_LCD1602_CMD_DATA;
+	*ac_after = i2c_lcd1602->ac;
+	for (size_t i = 0; i < n; i++) {
+		len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+			instructions[i], command_mode);
+		*last = i2c_lcd1602_command_type(instructions[i], command_mode);
+		i2c_lcd1602_stats_count(i2c_lcd1602, *last, 1);
+	}
+	size_t instructions_len = len;
+
+	/* Runs are written left to right, so if the LCD is not already set to
+	 * increment without shifting the display, it must be for the flush */
+	int entry_mode_changed = \
+		i2c_lcd1602->entry_shift_increment != LCD_ENTRYINCREMENT \
+		|| i2c_lcd1602->entry_shift != LCD_ENTRYNOSHIFT;
+	if (entry_mode_changed) {
+		len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+			LCD_ENTRYMODESET | LCD_ENTRYINCREMENT | LCD_ENTRYNOSHIFT, command_mode);
+	}
+	size_t prologue = len;
+
+	/* Glyphs are uploaded first, which leaves the address counter in CGRAM
+	 * and so the DDRAM address unknown. Otherwise the address counter is
+	 * where the register model of the controller has it, or at the cursor if
+	 * it is on this controller, and a run starting there needs no set DDRAM
+	 * address. */
+	size_t glyph_len = i2c_lcd_page_load_glyphs(i2c_lcd_page, c, &bytes[len]);
+	len += glyph_len;
+	uint8_t cursor_ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+	int has_cursor = cursor_ac != I2C_LCD_PAGE_NO_AC && cursor_ac / 0x80 == c;
+	ac = glyph_len == 0 && has_cursor ? cursor_ac : -1;
+	if (glyph_len == 0 && i2c_lcd1602->ac != I2C_LCD1602_AC_UNKNOWN) {
+		ac = c * 0x80 + i2c_lcd1602->ac;
+	}
+	/* When replaying, return home has just been sent */
+	if (i2c_lcd_page->replay) ac = glyph_len == 0 ? c * 0x80 : -1;
+
+	for (int line = c * 2; line < c * 2 + 2; line++) {
+		uint8_t *shadow = i2c_lcd_page->shadow[line];
+		uint8_t *frame = i2c_lcd_page->frame[line];
+		int col = 0;
+
+		while (col < I2C_LCD_PAGE_DDRAM_WIDTH) {
+			if (frame[col] == shadow[col] && !i2c_lcd_page->replay) {
+				col++;
+				continue;
+			}
+
+			/* Find where this run ends, extending it over clean cells when
+			 * rewriting them is cheaper than moving the cursor */
+			int start = col;
+			int end = col;
+			for (int next = end + 1; next < I2C_LCD_PAGE_DDRAM_WIDTH; next++) {
+				if (frame[next] == shadow[next] && !i2c_lcd_page->replay) continue;
+
+				/* Moving the cursor costs a set DDRAM address instruction
+				 * plus presenting RS again for the data that follows */
+				int gap = next - end - 1;
+				if (gap * I2C_LCD1602_BYTES_PER_CHAR \
+					>= I2C_LCD1602_BYTES_PER_COMMAND + 1) {
+					break;
+				}
+				end = next;
+			}
+
+			/* See page 11, 21 of the HD44780 datasheet */
+			int run_ac = line * 0x40 + start;
+			if (ac != run_ac) {
+				len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+					LCD_SETDDRAMADDR | (run_ac & 0x7f), command_mode);
+				i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM, 1);
+			}
+
+			/* Present RS before the first enable strobe of the run */
+			bytes[len++] = data_mode;
+			for (int i = start; i <= end; i++) {
+				len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &bytes[len], \
+					frame[i], data_mode);
+				shadow[i] = frame[i];
+			}
+			*last = I2C_LCD1602_CMD_DATA;
+			i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_DATA, \
+				end - start + 1);
+
+			/* The address counter wraps from the end of one line to the start
+			 * of the other (page 11 of the HD44780 datasheet) */
+			ac = line * 0x40 + end + 1;
+			if (end + 1 == I2C_LCD_PAGE_DDRAM_WIDTH) ac = (line ^ 1) * 0x40;
+
+			col = end + 1;
+		}
+	}
+
+	/* If nothing was dirty, only the instructions need sending */
+	if (len == prologue) return instructions_len;
+
+	if (entry_mode_changed) {
+		len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], LCD_ENTRYMODESET \
+			| i2c_lcd1602->entry_shift_increment | i2c_lcd1602->entry_shift, \
+			command_mode);
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_ENTRY_MODE, 2);
+		*last = I2C_LCD1602_CMD_ENTRY_MODE;
+	}
+
+	/* Put the cursor back where the page expects it to be */
+	if (has_cursor && ac != cursor_ac) {
+		len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+			LCD_SETDDRAMADDR | (cursor_ac & 0x7f), command_mode);
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM, 1);
+		*last = I2C_LCD1602_CMD_SET_DDRAM;
+		ac = cursor_ac;
+	}
+	*ac_after = ac == -1 ? I2C_LCD1602_AC_UNKNOWN : ac & 0x7f;
+
+	return len;
+	/* }}} */
+}
+
+
+/** Send the frame to the LCD. The frame is compared against the shadow of
+ * DDRAM and only the cells that differ are sent. Dirty cells that are close
+ * together are sent as one run (relying on the address counter incrementing
+ * after each character, page 26 of the HD44780 datasheet) whenever rewriting
+ * the clean cells between them costs fewer bytes than setting the DDRAM
+ * address again. Glyphs written with i2c_lcd_page_write_glyph() that are not
+ * in CGRAM yet are uploaded first. The 'n' instructions in 'instructions'
+ * (which must not move the address counter) are sent to every controller
+ * before anything else. The whole frame is sent in one transaction, the
+ * changes for each controller one after the other, so a 4-row display costs
+ * no more per character than a 2-row one.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+static int i2c_lcd_page_send(struct i2c_lcd_page *i2c_lcd_page, \
+	const uint8_t *instructions, size_t n) {
+	/* {{{ */
+	uint8_t bytes[I2C_LCD_PAGE_FLUSH_MAX];
+	size_t len = 0;
+	size_t sent[I2C_LCD_PAGE_CONTROLLERS];
+	/* The type of the last thing sent to each controller, which determines
+	 * how long it will be busy after the flush */
+	enum i2c_lcd1602_command_type last[I2C_LCD_PAGE_CONTROLLERS];
+	uint8_t ac_after[I2C_LCD_PAGE_CONTROLLERS];
+
+	i2c_lcd_page->glyph_clock++;
+
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		sent[c] = i2c_lcd_page_flush_controller(i2c_lcd_page, c, instructions, \
+			n, &bytes[len], &last[c], &ac_after[c]);
+		len += sent[c];
+	}
+
+	if (len == 0) return 0;
+
+	/* Only the controllers that are sent something need to be ready */
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		if (sent[c] > 0) {
+			i2c_lcd1602_wait_ready(i2c_lcd_page_controller(i2c_lcd_page, c * 2));
+		}
+	}
+
+	int ret = i2c_lcd1602_write_bytes(&i2c_lcd_page->i2c_lcd1602, bytes, len);
+
+	/* The bytes of every controller were in the one transfer */
+	if (i2c_lcd_page->i2c_lcd1602.out_of_sync) {
+		for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+			if (sent[c] > 0) {
+				i2c_lcd_page_controller(i2c_lcd_page, c * 2)->out_of_sync = 1;
+			}
+		}
+	}
+	if (ret != 0) return -1;
+
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+			c * 2);
+		if (sent[c] > 0) {
+			i2c_lcd1602_set_busy(i2c_lcd1602, i2c_lcd1602->timing.exec_ns[last[c]]);
+			i2c_lcd1602->ac = ac_after[c];
+		}
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Put the LCD back into the state the page has it in after a transfer to it
+ * failed, without initializing it again. Each controller that is out of sync
+ * is resynchronized (see i2c_lcd1602_resync()), and then, since the nibbles
+ * read out of step may have been written anywhere, every controller is sent
+ * return home (undoing any display shift, page 24 of the HD44780 datasheet),
+ * shifted back to the display position of the page the shorter way round,
+ * and has its glyphs uploaded and all 80 cells of the frame rewritten in one
+ * flush. The time this took is kept in 'recovery_ns'.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed, in
+ * which case the next flush tries again.
+ */
+int i2c_lcd_page_recover(struct i2c_lcd_page *i2c_lcd_page) {
+	/* {{{ */
+	uint8_t bytes[I2C_LCD1602_BYTES_PER_COMMAND];
+	uint8_t shifts[I2C_LCD_PAGE_DDRAM_WIDTH / 2];
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+			c * 2);
+		/* Set RS and R/W appropriately, respecting the backlight settings */
+		uint8_t command_mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+
+		if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+			return -1;
+		}
+
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+		size_t len = i2c_lcd1602_encode_command(i2c_lcd1602, bytes, \
+			LCD_RETURNHOME, command_mode);
+		if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) return -1;
+		i2c_lcd1602_set_busy(i2c_lcd1602, \
+			i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_HOME]);
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_HOME, 1);
+		i2c_lcd1602_track(i2c_lcd1602, LCD_RETURNHOME, command_mode);
+
+		/* CGRAM may have been written to as well */
+		memset(i2c_lcd_page->slots[c], 0, sizeof(i2c_lcd_page->slots[c]));
+		for (int g = 0; g < I2C_LCD_PAGE_GLYPHS; g++) {
+			i2c_lcd_page->glyphs[g].slot[c] = -1;
+		}
+	}
+
+	/* See page 29 of the HD44780 datasheet */
+	size_t n = i2c_lcd_page->display_pos;
+	uint8_t shift = LCD_CURSORDISPLAYSHIFT | LCD_DISPLAYMOVE | LCD_MOVELEFT;
+	if (n > I2C_LCD_PAGE_DDRAM_WIDTH / 2) {
+		n = I2C_LCD_PAGE_DDRAM_WIDTH - n;
+		shift = LCD_CURSORDISPLAYSHIFT | LCD_DISPLAYMOVE | LCD_MOVERIGHT;
+	}
+	memset(shifts, shift, n);
+
+	i2c_lcd_page->replay = 1;
+	int ret = i2c_lcd_page_send(i2c_lcd_page, shifts, n);
+	i2c_lcd_page->replay = 0;
+
+	if (ret != 0) return -1;
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		if (i2c_lcd_page_controller(i2c_lcd_page, c * 2)->out_of_sync) return -1;
+	}
+	i2c_lcd_page->lost = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	i2c_lcd_page->recoveries++;
+	i2c_lcd_page->recovery_ns = (end.tv_sec - start.tv_sec) * 1000000000L \
+		+ (end.tv_nsec - start.tv_nsec);
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Send the frame to the LCD after the 'n' instructions in 'instructions',
+ * see i2c_lcd_page_send(). If a controller is out of sync, or gets out of
+ * sync because the transfer fails part way, the page is recovered with
+ * i2c_lcd_page_recover() instead, which also brings the display shift (the
+ * only thing the instructions change) to where the page has it.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+static int i2c_lcd_page_flush_after(struct i2c_lcd_page *i2c_lcd_page, \
+	const uint8_t *instructions, size_t n) {
+	/* {{{ */
+	if (!i2c_lcd_page_in_sync(i2c_lcd_page)) {
+		return i2c_lcd_page_recover(i2c_lcd_page);
+	}
+
+	int ret = i2c_lcd_page_send(i2c_lcd_page, instructions, n);
+
+	if (!i2c_lcd_page_in_sync(i2c_lcd_page)) {
+		return i2c_lcd_page_recover(i2c_lcd_page);
+	}
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Send the frame to the LCD, see i2c_lcd_page_flush_after().
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd_page_flush(struct i2c_lcd_page *i2c_lcd_page) {
+	/* {{{ */
+	return i2c_lcd_page_flush_after(i2c_lcd_page, NULL, 0);
+	/* }}} */
+}
+
+
+/** Start scrolling 'len' characters of 'text' (character codes, see
+ * i2c_lcd_charset_transcode()) through row 'row' with
+ * i2c_lcd_page_marquee_step(). The first 40 characters are written into the
+ * whole 40 column DDRAM line of the row (which is longer than the display
+ * window, page 11 of the HD44780 datasheet) and flushed. Text shorter than 40
+ * characters is padded with spaces and then simply goes round the line; longer
+ * text is streamed into the line a character at a time as it scrolls. 'text'
+ * must stay valid while the marquee is used.
+ *
+ * On a display of four rows the third and fourth rows continue the DDRAM lines
+ * of the first two, so the marquee takes both rows of its line, and nothing
+ * else should be written to the other one while it is used.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed or the
+ * other row of the line of 'row' shows anything but spaces.
+ */
+int i2c_lcd_page_marquee_start(struct i2c_lcd_page *i2c_lcd_page, \
+	struct i2c_lcd_page_marquee *marquee, uint8_t row, const char *text, \
+	size_t len) {
+	/* {{{ */
+	char line[I2C_LCD_PAGE_DDRAM_WIDTH];
+	uint8_t rows = i2c_lcd_page_controller_rows(i2c_lcd_page);
+	/* The row of the same controller that continues the same DDRAM line */
+	uint8_t other = (row % rows) ^ 2;
+
+	/* Writing and shifting the line would scroll the other row with it */
+	if (other < rows) {
+		for (uint8_t c = 0; c < i2c_lcd_page->i2c_lcd1602.columns; c++) {
+			uint8_t *cell = i2c_lcd_page_cell(i2c_lcd_page->frame, \
+				i2c_lcd_page_ac(i2c_lcd_page, c, row - row % rows + other));
+
+			if (cell != NULL && *cell != ' ') return -1;
+		}
+	}
+
+	marquee->text = text;
+	marquee->len = len;
+	marquee->row = row;
+	marquee->pos = 0;
+
+	memset(line, ' ', sizeof(line));
+	memcpy(line, text, len < sizeof(line) ? len : sizeof(line));
+	i2c_lcd_page_write(i2c_lcd_page, 0, row, line, sizeof(line));
+
+	return i2c_lcd_page_flush(i2c_lcd_page);
+	/* }}} */
+}
+
+
+/** Scroll a marquee started with i2c_lcd_page_marquee_start() one character
+ * to the left. This shifts the display with a single instruction (page 29 of
+ * the HD44780 datasheet) instead of rewriting the window, so every line of the
+ * display moves, not just the row of the marquee. For text longer than 40
+ * characters the next character is then written into the column that has
+ * just scrolled off the left edge, which is the one that comes into view at
+ * the right edge 40 - 'columns' steps later. Any other changes to the frame
+ * are flushed along with it, all in one transaction.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd_page_marquee_step(struct i2c_lcd_page *i2c_lcd_page, \
+	struct i2c_lcd_page_marquee *marquee) {
+	/* {{{ */
+	/* See page 29 of the HD44780 datasheet */
+	uint8_t shift = LCD_CURSORDISPLAYSHIFT | LCD_DISPLAYMOVE | LCD_MOVELEFT;
+
+	/* The display moves one column to the left, but the cursor stays at the
+	 * same address */
+	i2c_lcd_page_move_window(i2c_lcd_page, 1);
+
+	/* Text shorter than the line goes round with the padding after it */
+	size_t period = marquee->len > I2C_LCD_PAGE_DDRAM_WIDTH \
+		? marquee->len : I2C_LCD_PAGE_DDRAM_WIDTH;
+	marquee->pos = (marquee->pos + 1) % period;
+
+	if (marquee->len > I2C_LCD_PAGE_DDRAM_WIDTH) {
+		size_t next = (marquee->pos + I2C_LCD_PAGE_DDRAM_WIDTH - 1) % marquee->len;
+		i2c_lcd_page_write(i2c_lcd_page, I2C_LCD_PAGE_DDRAM_WIDTH - 1, \
+			marquee->row, &marquee->text[next], 1);
+	}
+
+	/* Shift first, so that the new character goes into a column that is
+	 * already off screen */
+	return i2c_lcd_page_flush_after(i2c_lcd_page, &shift, 1);
+	/* }}} */
+}
+
+
+/** Store the boot id of the running kernel, which changes on every boot, in
+ * 'boot_id'.
+ *
+ * Returns 0 on success, and -1 if it could not be read.
+ */
+static int i2c_lcd_page_boot_id(char boot_id[I2C_LCD_PAGE_BOOT_ID_MAX]) {
+	/* {{{ */
+	FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	int ret = -1;
+
+	if (f == NULL) return -1;
+
+	if (NULL != fgets(boot_id, I2C_LCD_PAGE_BOOT_ID_MAX, f)) {
+		boot_id[strcspn(boot_id, "\n")] = '\0';
+		ret = boot_id[0] != '\0' ? 0 : -1;
+	}
+	fclose(f);
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Save what the LCD of the page is showing and how it is set up to the file
+ * at 'path', for i2c_lcd_page_begin_warm() to take the display over from
+ * after the program restarts. The file has one "<name> <values>" line for the
+ * boot id, the geometry, the backlight, the display position and cursor, the
+ * settings of each controller and the contents of each DDRAM line (in hex).
+ * It is the shadow that is saved, so this should be called after the last
+ * flush.
+ *
+ * Returns 0 on success, and -1 if the file could not be written.
+ */
+int i2c_lcd_page_save(struct i2c_lcd_page *i2c_lcd_page, const char *path) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = &i2c_lcd_page->i2c_lcd1602;
+	char boot_id[I2C_LCD_PAGE_BOOT_ID_MAX];
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL) return -1;
+
+	fprintf(f, "# i2c-LCD1602 page state\n");
+	if (0 == i2c_lcd_page_boot_id(boot_id)) fprintf(f, "boot_id %s\n", boot_id);
+	fprintf(f, "lcd %d %d %d %d\n", i2c_lcd1602->address, i2c_lcd1602->columns, \
+		i2c_lcd1602->rows, i2c_lcd_page->controllers);
+	fprintf(f, "backlight %d\n", i2c_lcd1602->backlight);
+	fprintf(f, "display_pos %d\n", i2c_lcd_page->display_pos);
+	fprintf(f, "cursor %d %d\n", i2c_lcd_page->cursor_col, i2c_lcd_page->cursor_row);
+	for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+		struct i2c_lcd1602 *controller = i2c_lcd_page_controller(i2c_lcd_page, \
+			c * 2);
+		fprintf(f, "controller %d %d %d %d\n", c, controller->function, \
+			controller->display, \
+			LCD_ENTRYMODESET | controller->entry_shift_increment \
+			| controller->entry_shift);
+	}
+	for (int line = 0; line < 2 * i2c_lcd_page->controllers; line++) {
+		fprintf(f, "line %d ", line);
+		for (int col = 0; col < I2C_LCD_PAGE_DDRAM_WIDTH; col++) {
+			fprintf(f, "%02x", i2c_lcd_page->shadow[line][col]);
+		}
+		fprintf(f, "\n");
+	}
+
+	if (0 != fclose(f)) return -1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Load a state saved with i2c_lcd_page_save() from the file at 'path' into
+ * 'i2c_lcd_page' and its controllers, and set 'same_boot' if it was saved
+ * since the last boot.
+ *
+ * Returns 0 on success, and -1 if the file could not be read, contains a line
+ * that is not understood or a value out of range, is missing its geometry or
+ * a DDRAM line, or is for an LCD of another address or geometry.
+ */
+static int i2c_lcd_page_load(struct i2c_lcd_page *i2c_lcd_page, \
+	const char *path, int *same_boot) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = &i2c_lcd_page->i2c_lcd1602;
+	char boot_id[I2C_LCD_PAGE_BOOT_ID_MAX];
+	char line[256];
+	int lines = 0;
+	int geometry = 0;
+	int ret = 0;
+	FILE *f = fopen(path, "r");
+
+	*same_boot = 0;
+	if (f == NULL) return -1;
+
+	while (NULL != fgets(line, sizeof(line), f) && ret == 0) {
+		char name[64];
+		char value[2 * I2C_LCD_PAGE_DDRAM_WIDTH + 1];
+		int a, b, c, d;
+		int n;
+
+		if (line[0] == '#' || line[0] == '\n') continue;
+		if (1 != sscanf(line, "%63s%n", name, &n)) {
+			ret = -1;
+			continue;
+		}
+
+		if (0 == strcmp(name, "boot_id")) {
+			*same_boot = 1 == sscanf(line + n, "%64s", value) \
+				&& 0 == i2c_lcd_page_boot_id(boot_id) && 0 == strcmp(value, boot_id);
+		} else if (0 == strcmp(name, "lcd")) {
+			if (4 != sscanf(line + n, "%d %d %d %d", &a, &b, &c, &d) \
+				|| a != i2c_lcd1602->address || b != i2c_lcd1602->columns \
+				|| c != i2c_lcd1602->rows || d != i2c_lcd_page->controllers) {
+				ret = -1;
+			}
+			geometry = 1;
+		} else if (0 == strcmp(name, "backlight")) {
+			/* The backlight bit is part of every byte sent to the PCF8574, so
+			 * anything else would drive E, RS or R/W */
+			if (1 != sscanf(line + n, "%d", &a) \
+				|| (a != LCD_BACKLIGHT && a != LCD_NOBACKLIGHT)) {
+
+				ret = -1;
+				continue;
+			}
+			for (int i = 0; i < i2c_lcd_page->controllers; i++) {
+				i2c_lcd_page_controller(i2c_lcd_page, i * 2)->backlight = a;
+			}
+		} else if (0 == strcmp(name, "display_pos")) {
+			if (1 != sscanf(line + n, "%d", &a) || a < 0 \
+				|| a >= I2C_LCD_PAGE_DDRAM_WIDTH) {
+				ret = -1;
+			} else {
+				i2c_lcd_page->display_pos = a;
+			}
+		} else if (0 == strcmp(name, "cursor")) {
+			/* The cursor may be past the display window, but not past the
+			 * DDRAM line or the rows of the page */
+			if (2 != sscanf(line + n, "%d %d", &a, &b) || a < 0 \
+				|| a >= I2C_LCD_PAGE_DDRAM_WIDTH || b < 0 || b >= \
+				i2c_lcd_page_controller_rows(i2c_lcd_page) * i2c_lcd_page->controllers) {
+
+				ret = -1;
+				continue;
+			}
+			i2c_lcd_page->cursor_col = a;
+			i2c_lcd_page->cursor_row = b;
+		} else if (0 == strcmp(name, "controller")) {
+			/* Each must be the instruction it is saved as, with only its own
+			 * flags set, and the interface must stay 4 bits wide (page 24 of
+			 * the HD44780 datasheet) */
+			if (4 != sscanf(line + n, "%d %d %d %d", &a, &b, &c, &d) \
+				|| a < 0 || a >= i2c_lcd_page->controllers \
+				|| (b & ~(LCD_2LINE | LCD_5x10DOTS)) != LCD_FUNCTIONSET \
+				|| (c & ~(LCD_DISPLAYON | LCD_CURSORON | LCD_BLINKON)) \
+					!= LCD_DISPLAYONOFFCONTROL \
+				|| (d & ~(LCD_ENTRYINCREMENT | LCD_ENTRYSHIFT)) != LCD_ENTRYMODESET) {
+				ret = -1;
+				continue;
+			}
+			struct i2c_lcd1602 *controller = i2c_lcd_page_controller(i2c_lcd_page, \
+				a * 2);
+			controller->function = b;
+			controller->display = c;
+			controller->entry_shift_increment = d & LCD_ENTRYINCREMENT;
+			controller->entry_shift = d & LCD_ENTRYSHIFT;
+		} else if (0 == strcmp(name, "line")) {
+			if (2 != sscanf(line + n, "%d %80s", &a, value) || a < 0 \
+				|| a >= 2 * i2c_lcd_page->controllers \
+				|| strlen(value) != 2 * I2C_LCD_PAGE_DDRAM_WIDTH) {
+				ret = -1;
+				continue;
+			}
+			for (int col = 0; col < I2C_LCD_PAGE_DDRAM_WIDTH; col++) {
+				unsigned int cell;
+				if (1 != sscanf(&value[2 * col], "%2x", &cell)) {
+					ret = -1;
+					break;
+				}
+				i2c_lcd_page->shadow[a][col] = cell;
+			}
+			if (ret == 0) lines |= 1 << a;
+		} else {
+			ret = -1;
 		}
 	}
 
-	i2c_lcd1602_send_char(&i2c_lcd_page->i2c_lcd1602, c);
+	fclose(f);
+
+	if (!geometry || lines != (1 << (2 * i2c_lcd_page->controllers)) - 1) ret = -1;
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Check that controller 'c' answers (see i2c_lcd1602_probe()) and read back
+ * up to I2C_LCD_PAGE_WARM_SAMPLES cells of each of its DDRAM lines, from the
+ * first one the shadow holds something other than a space in, to compare
+ * them with the shadow. A controller that has lost power fills DDRAM with
+ * spaces when it resets (page 23 of the HD44780 datasheet), or holds garbage,
+ * so cells that are not spaces show whether what the shadow says survived.
+ * If every cell is a space, it does not matter.
+ *
+ * Returns 0 if the cells match, -1 if they do not, and 1 if the controller
+ * does not answer (or cannot be read from at all).
+ */
+static int i2c_lcd_page_verify(struct i2c_lcd_page *i2c_lcd_page, int c) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, c * 2);
+	uint8_t cells[I2C_LCD_PAGE_WARM_SAMPLES];
+
+	for (int line = c * 2; line < c * 2 + 2; line++) {
+		uint8_t *shadow = i2c_lcd_page->shadow[line];
+		int col = 0;
+
+		while (col < I2C_LCD_PAGE_DDRAM_WIDTH && shadow[col] == ' ') col++;
+
+		int n = I2C_LCD_PAGE_DDRAM_WIDTH - col;
+		if (n > I2C_LCD_PAGE_WARM_SAMPLES) n = I2C_LCD_PAGE_WARM_SAMPLES;
+		if (n == 0) col = 0;
+
+		/* See page 11, 21 of the HD44780 datasheet */
+		if (0 != i2c_lcd1602_probe(i2c_lcd1602, (line % 2) * 0x40 + col)) return 1;
+
+		/* Reading moves the address counter the same way writing does (page
+		 * 25 of the HD44780 datasheet) */
+		for (int i = 0; i < n; i++) {
+			i2c_lcd1602_wait_ready(i2c_lcd1602);
+			if (0 != i2c_lcd1602_read_4bitmode(i2c_lcd1602, set_mode(1, 0), \
+				&cells[i])) {
+				return -1;
+			}
+			i2c_lcd1602_set_busy(i2c_lcd1602, \
+				i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]);
+		}
+		if (0 != memcmp(cells, &shadow[col], n)) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Start using the LCD of the page, taking over what it is already showing if
+ * it has not been reset since the state in the file at 'path' was saved with
+ * i2c_lcd_page_save() (e.g. when the program using it restarts), and
+ * otherwise initializing it with i2c_lcd1602_begin(). Taking it over skips
+ * the 40ms power on wait and the clear display, so the display does not
+ * flicker: each controller is resynchronized with the settings in the file
+ * (see i2c_lcd1602_resync()), and the page adopts the contents, display
+ * position and cursor in the file. The state is trusted if each controller
+ * answers (see i2c_lcd1602_probe()) and DDRAM reads back as it was saved (see
+ * i2c_lcd_page_verify()). If nothing can be read back because R/W is not
+ * connected, the state is trusted only if it was saved since the last boot,
+ * as the LCD may have been power cycled with the host. CGRAM is taken to hold
+ * nothing the page knows of, so glyphs are uploaded again when flushed.
+ *
+ * Returns 0 if the LCD was taken over as it was, 1 if it was initialized from
+ * scratch, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd_page_begin_warm(struct i2c_lcd_page *i2c_lcd_page, \
+	const char *path) {
+	/* {{{ */
+	struct i2c_lcd_page saved = *i2c_lcd_page;
+	int same_boot;
+	int warm = 0 == i2c_lcd_page_load(&saved, path, &same_boot);
+
+	for (int c = 0; c < saved.controllers && warm; c++) {
+		struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(&saved, c * 2);
+
+		if (0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+			warm = 0;
+		} else {
+			int verified = i2c_lcd_page_verify(&saved, c);
+			warm = verified == 0 || (verified == 1 && same_boot);
+		}
+	}
+
+	if (!warm) {
+		for (int c = 0; c < i2c_lcd_page->controllers; c++) {
+			i2c_lcd1602_begin(i2c_lcd_page_controller(i2c_lcd_page, c * 2));
+		}
+		*i2c_lcd_page = i2c_lcd_page->controllers == 2 \
+			? i2c_lcd_page_init_dual(i2c_lcd_page->i2c_lcd1602, i2c_lcd_page->second) \
+			: i2c_lcd_page_init(i2c_lcd_page->i2c_lcd1602);
+
+		return 1;
+	}
+
+	*i2c_lcd_page = saved;
+	memcpy(i2c_lcd_page->frame, i2c_lcd_page->shadow, sizeof(i2c_lcd_page->frame));
+	memset(i2c_lcd_page->frame_glyph, 0, sizeof(i2c_lcd_page->frame_glyph));
+	memset(i2c_lcd_page->slots, 0, sizeof(i2c_lcd_page->slots));
+	for (int g = 0; g < I2C_LCD_PAGE_GLYPHS; g++) {
+		for (int c = 0; c < I2C_LCD_PAGE_CONTROLLERS; c++) {
+			i2c_lcd_page->glyphs[g].slot[c] = -1;
+		}
+	}
+
+	/* Put the address counter of the controller with the cursor where the
+	 * page expects it to be */
+	uint8_t ac = i2c_lcd_page_ac(i2c_lcd_page, i2c_lcd_page->cursor_col, \
+		i2c_lcd_page->cursor_row);
+	if (ac != I2C_LCD_PAGE_NO_AC) {
+		struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_page_controller(i2c_lcd_page, \
+			ac / 0x40);
+		uint8_t bytes[I2C_LCD1602_BYTES_PER_COMMAND];
+		/* Set RS and R/W appropriately, respecting the backlight settings */
+		uint8_t command_mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+		size_t len = i2c_lcd1602_encode_command(i2c_lcd1602, bytes, \
+			LCD_SETDDRAMADDR | (ac & 0x7f), command_mode);
+		if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) return -1;
+		i2c_lcd1602_set_busy(i2c_lcd1602, \
+			i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_SET_DDRAM]);
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM, 1);
+		i2c_lcd1602_track(i2c_lcd1602, LCD_SETDDRAMADDR | (ac & 0x7f), \
+			command_mode);
+	}
+
+	return i2c_lcd_page_in_sync(i2c_lcd_page) ? 0 : -1;
 	/* }}} */
 }
@@ -5,19 +5,99 @@
 #include <stddef.h>
 
 #include "i2c-LCD1602.h"
+#include "i2c-lcd-charset.h"
+
+/* The HD44780 has 80 bytes of DDRAM which, in 2-line mode, is split into two
+ * lines of 40 characters each (page 11 of the HD44780 datasheet). Modules with
+ * more than 80 characters (40x4) have two controllers, whose lines are lines 2
+ * and 3 of the page. */
+#define I2C_LCD_PAGE_CONTROLLERS 2
+#define I2C_LCD_PAGE_DDRAM_LINES (2 * I2C_LCD_PAGE_CONTROLLERS)
+#define I2C_LCD_PAGE_DDRAM_WIDTH 40
+/* The largest number of bytes i2c_lcd_page_flush() can produce for one frame */
+#define I2C_LCD_PAGE_FLUSH_MAX (1536 * I2C_LCD_PAGE_CONTROLLERS)
+/* CGRAM holds 8 custom characters in 5x8 dot mode, shown by character codes 0
+ * to 7 (page 19 of the HD44780 datasheet) */
+#define I2C_LCD_PAGE_CGRAM_SLOTS 8
+/* The number of distinct glyphs a page can keep track of */
+#define I2C_LCD_PAGE_GLYPHS 64
+/* How many cells of each DDRAM line i2c_lcd_page_begin_warm() reads back to
+ * check that the LCD still shows what was saved */
+#define I2C_LCD_PAGE_WARM_SAMPLES 4
+/* The longest boot id kept in a saved page state, including the terminating
+ * '\0' */
+#define I2C_LCD_PAGE_BOOT_ID_MAX 64
+/* What is shown in place of a glyph that could not be given a CGRAM slot */
+#define I2C_LCD_PAGE_GLYPH_FALLBACK ' '
+
+
+/* A custom character, which is uploaded to a CGRAM slot only while it is
+ * needed on screen */
+struct i2c_lcd_page_glyph {
+	uint8_t rows[8];
+	uint32_t hash;
+	uint8_t used;
+	/* The CGRAM slot holding the glyph in each controller, or -1 if it is not
+	 * in the CGRAM of that controller */
+	int8_t slot[I2C_LCD_PAGE_CONTROLLERS];
+	/* The flush the glyph was last visible in, for evicting the least
+	 * recently used glyph from CGRAM */
+	uint32_t last_use;
+};
 
 
 struct i2c_lcd_page {
 	struct i2c_lcd1602 i2c_lcd1602;
+	/* The controller of the bottom two rows of a module with two, see
+	 * i2c_lcd_page_init_dual() */
+	struct i2c_lcd1602 second;
+	uint8_t controllers;
 	uint8_t cursor_col;
 	uint8_t cursor_row;
 	uint8_t display_pos;
 	uint8_t row_width;
+	/* A copy of what is currently in the DDRAM of the LCD, and what should be
+	 * in it after the next call to i2c_lcd_page_flush() */
+	uint8_t shadow[I2C_LCD_PAGE_DDRAM_LINES][I2C_LCD_PAGE_DDRAM_WIDTH];
+	uint8_t frame[I2C_LCD_PAGE_DDRAM_LINES][I2C_LCD_PAGE_DDRAM_WIDTH];
+	/* The glyph in each cell of the frame as 1 + its index in 'glyphs', or 0
+	 * for a plain character */
+	uint8_t frame_glyph[I2C_LCD_PAGE_DDRAM_LINES][I2C_LCD_PAGE_DDRAM_WIDTH];
+	struct i2c_lcd_page_glyph glyphs[I2C_LCD_PAGE_GLYPHS];
+	/* The glyph in each CGRAM slot of each controller as 1 + its index in
+	 * 'glyphs', or 0 if the slot has not been used */
+	uint8_t slots[I2C_LCD_PAGE_CONTROLLERS][I2C_LCD_PAGE_CGRAM_SLOTS];
+	uint32_t glyph_clock;
+	/* Set while the next flush is to rewrite every cell, see
+	 * i2c_lcd_page_recover() */
+	uint8_t replay;
+	/* Set when a transfer outside of a flush failed. The library
+	 * resynchronizes a controller by itself before its next instruction (see
+	 * i2c_lcd1602_command()), but not what it shows, so this keeps the next
+	 * flush recovering the page until i2c_lcd_page_recover() succeeds. */
+	uint8_t lost;
+	/* How many times the page has recovered from a failed transfer, and how
+	 * long (in nanoseconds) the last recovery took */
+	uint32_t recoveries;
+	long recovery_ns;
+};
+
+
+/* A line of text scrolled from right to left by shifting the display, see
+ * i2c_lcd_page_marquee_start() */
+struct i2c_lcd_page_marquee {
+	const char *text;
+	size_t len;
+	uint8_t row;
+	/* The index in 'text' of the character in the leftmost column */
+	size_t pos;
 };
 
 
 struct i2c_lcd_page i2c_lcd_page_init(struct i2c_lcd1602 i2c_lcd1602);
 
+struct i2c_lcd_page i2c_lcd_page_init_dual(struct i2c_lcd1602 first, struct i2c_lcd1602 second);
+
 void i2c_lcd_page_clear_display(struct i2c_lcd_page *i2c_lcd_page);
 
 void i2c_lcd_page_set_cursor_pos(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row);
@@ -26,4 +106,24 @@ void i2c_lcd_page_shift(struct i2c_lcd_page *i2c_lcd_page, char screen_cursor, c
 
 void i2c_lcd_page_send_char(struct i2c_lcd_page *i2c_lcd_page, char c);
 
+void i2c_lcd_page_write(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, const char *buf, size_t n);
+
+int i2c_lcd_page_write_glyph(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, const uint8_t rows[8]);
+
+int i2c_lcd_page_write_at(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, const char *buf, size_t n);
+
+size_t i2c_lcd_page_write_utf8(struct i2c_lcd_page *i2c_lcd_page, uint8_t column, uint8_t row, const struct i2c_lcd_charset *i2c_lcd_charset, const char *s, size_t n);
+
+int i2c_lcd_page_flush(struct i2c_lcd_page *i2c_lcd_page);
+
+int i2c_lcd_page_recover(struct i2c_lcd_page *i2c_lcd_page);
+
+int i2c_lcd_page_save(struct i2c_lcd_page *i2c_lcd_page, const char *path);
+
+int i2c_lcd_page_begin_warm(struct i2c_lcd_page *i2c_lcd_page, const char *path);
+
+int i2c_lcd_page_marquee_start(struct i2c_lcd_page *i2c_lcd_page, struct i2c_lcd_page_marquee *marquee, uint8_t row, const char *text, size_t len);
+
+int i2c_lcd_page_marquee_step(struct i2c_lcd_page *i2c_lcd_page, struct i2c_lcd_page_marquee *marquee);
+
 #endif
@@ -1,7 +1,12 @@
+#include <errno.h>
 #include <inttypes.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
 
 #include "i2c-LCD1602.h"
 
@@ -9,6 +14,68 @@
  * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
  */
 
+/* Tell the CPU it is in a spin loop, which saves power and lets another
+ * hardware thread of the same core run */
+#if defined(__x86_64__) || defined(__i386__)
+#define I2C_LCD1602_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+#define I2C_LCD1602_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define I2C_LCD1602_CPU_RELAX() ((void) 0)
+#endif
+
+/* The number of sleeps i2c_lcd1602_calibrate_wait() measures */
+#define I2C_LCD1602_WAIT_CALIBRATE_SAMPLES 64
+
+
+/* The maximum execution time of each type of instruction, according to page
+ * 24, 25 of the HD44780 datasheet */
+#define I2C_LCD1602_DATASHEET_EXEC_NS { \
+	/* No time is listed for clear display. 2ms is used to be safe. */ \
+	[I2C_LCD1602_CMD_CLEAR] = 2000000, \
+	[I2C_LCD1602_CMD_HOME] = 1520000, \
+	[I2C_LCD1602_CMD_ENTRY_MODE] = 37000, \
+	[I2C_LCD1602_CMD_DISPLAY_CONTROL] = 37000, \
+	[I2C_LCD1602_CMD_SHIFT] = 37000, \
+	[I2C_LCD1602_CMD_FUNCTION_SET] = 37000, \
+	[I2C_LCD1602_CMD_SET_CGRAM] = 37000, \
+	[I2C_LCD1602_CMD_SET_DDRAM] = 37000, \
+	/* 37µs + 4µs to update the address counter */ \
+	[I2C_LCD1602_CMD_DATA] = 41000 \
+}
+
+
+/* The timing the HD44780 datasheet requires. The address setup time before
+ * the enable strobe (40ns) and the enable pulse width (230ns, page 49) are
+ * shorter than it takes to send a single byte to the PCF8574, so no delay is
+ * needed around the strobe. */
+const struct i2c_lcd1602_timing i2c_lcd1602_datasheet_timing = {
+	.strobe_setup_ns = 0,
+	.strobe_hold_ns = 0,
+	.nibble_ns = 37000,
+	.exec_ns = I2C_LCD1602_DATASHEET_EXEC_NS,
+	/* 8 data bits plus an ACK at 100kHz */
+	.bus_byte_ns = 90000
+};
+
+/* The timing of earlier versions of this library, which waits 2ms on either
+ * side of each enable strobe. Far slower than any module should need, but a
+ * starting point for i2c_lcd_calibrate() on a module or bus that does not
+ * work with i2c_lcd1602_datasheet_timing. */
+const struct i2c_lcd1602_timing i2c_lcd1602_safe_timing = {
+	.strobe_setup_ns = 2000000,
+	.strobe_hold_ns = 2000000,
+	.nibble_ns = 37000,
+	.exec_ns = I2C_LCD1602_DATASHEET_EXEC_NS,
+	.bus_byte_ns = 90000
+};
+
+
+static void i2c_lcd1602_delay(struct i2c_lcd1602 *i2c_lcd1602, long ns);
+static long ns_until(const struct timespec *t);
+static int i2c_lcd1602_redundant(const struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t data, uint8_t mode);
+
 
 struct i2c_lcd1602 i2c_lcd1602_init(int i2c_lcd_fd, uint8_t periph_addr,
 	uint8_t columns, uint8_t rows, uint8_t dotsize, uint8_t backlight) {
@@ -19,16 +86,117 @@ struct i2c_lcd1602 i2c_lcd1602_init(int i2c_lcd_fd, uint8_t periph_addr,
 		.address = periph_addr,
 		.columns = columns,
 		.rows = rows,
-		.dotsize = 0 // 5x8 dotsize
+		.dotsize = 0, // 5x8 dotsize
+		/* The state after power on (page 23 of the HD44780 datasheet), but in
+		 * 4-bit mode, until i2c_lcd1602_begin() sets it */
+		.entry_shift_increment = LCD_ENTRYINCREMENT,
+		.entry_shift = LCD_ENTRYNOSHIFT,
+		.function = LCD_FUNCTIONSET | LCD_4BITMODE \
+			| (rows > 1 ? LCD_2LINE : LCD_1LINE),
+		.display = LCD_DISPLAYONOFFCONTROL,
+		.ac = I2C_LCD1602_AC_UNKNOWN,
+		.skip_redundant = 1,
+		.enable = E,
+		.xfer_max = I2C_LCD1602_XFER_MAX,
+		.timing = i2c_lcd1602_datasheet_timing,
+		.wait_mode = I2C_LCD1602_WAIT_ABSTIME,
+		.spin_threshold_ns = I2C_LCD1602_SPIN_THRESHOLD_NS,
+		.transport = &i2c_lcd1602_fd_transport
 	};
 
 	ret.backlight = backlight;
 
+	i2c_lcd1602_select_transport(&ret);
+
 	return ret;
 	/* }}} */
 }
 
 
+/** Have the i2c LCD send and receive bytes through 'transport' instead of
+ * its file descriptor. 'transport_ctx' is stored in the LCD for the
+ * transport to use. */
+void i2c_lcd1602_set_transport(struct i2c_lcd1602 *i2c_lcd1602, \
+	const struct i2c_lcd1602_transport *transport, void *transport_ctx) {
+	/* {{{ */
+	i2c_lcd1602->transport = transport;
+	i2c_lcd1602->transport_ctx = transport_ctx;
+	/* }}} */
+}
+
+
+/** Ask the i2c adapter of the LCD what it can do (I2C_FUNCS) and use the
+ * cheapest way of sending bytes it supports: I2C_RDWR if it can do plain i2c
+ * messages, SMBus writes if it can only do SMBus, and write() if the file
+ * descriptor is not an i2c-dev device (or the adapter claims neither). Called
+ * by i2c_lcd1602_init().
+ *
+ * Returns the transport chosen.
+ */
+const struct i2c_lcd1602_transport *i2c_lcd1602_select_transport( \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	unsigned long funcs = 0;
+
+	i2c_lcd1602->transport = &i2c_lcd1602_fd_transport;
+	i2c_lcd1602->transport_ctx = NULL;
+
+	if (0 > ioctl(i2c_lcd1602->fd, I2C_FUNCS, &funcs)) funcs = 0;
+	i2c_lcd1602->funcs = funcs;
+
+	if (funcs & I2C_FUNC_I2C) {
+		i2c_lcd1602->transport = &i2c_lcd1602_rdwr_transport;
+	} else if (funcs & (I2C_FUNC_SMBUS_WRITE_I2C_BLOCK \
+		| I2C_FUNC_SMBUS_WRITE_BYTE_DATA | I2C_FUNC_SMBUS_WRITE_BYTE)) {
+
+		i2c_lcd1602->transport = &i2c_lcd1602_smbus_transport;
+	}
+
+	return i2c_lcd1602->transport;
+	/* }}} */
+}
+
+
+/** Have the i2c LCD strobe the PCF8574 output(s) 'enable' instead of E to
+ * latch nibbles. A 40x4 module is two HD44780 controllers, each driving two
+ * lines of 40 characters (page 11 of the HD44780 datasheet only allows 80
+ * characters per controller), sharing RS, R/W and the data lines but with
+ * separate enable inputs. It is driven as two i2c LCDs of 40x2 with the same
+ * file descriptor and address, where the second has its enable set to the
+ * output its enable input is wired to. Only the controller whose enable input
+ * is strobed latches anything, so each keeps its own busy deadline and both
+ * can be executing instructions at the same time. */
+void i2c_lcd1602_set_enable(struct i2c_lcd1602 *i2c_lcd1602, uint8_t enable) {
+	/* {{{ */
+	i2c_lcd1602->enable = enable;
+	/* }}} */
+}
+
+
+/** Put the controller of the i2c LCD into 4-bit mode, regardless of whether
+ * it is currently in 8-bit mode (as it is after power on) or 4-bit mode (and
+ * regardless of which nibble it is expecting next). See page 46 of the
+ * HD44780 datasheet: the first three nibbles are each a complete function set
+ * instruction in 8-bit mode, and the last switches the interface to 4 bits.
+ */
+static void i2c_lcd1602_init_4bitmode(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+	uint8_t nibbles[] = { 0x30, 0x30, 0x30, 0x20 };
+	/* How long to wait after each nibble, according to page 46 of the
+	 * HD44780 datasheet */
+	long waits[] = { 4100000, 100000, 37000, 37000 };
+
+	for (int i = 0; i < 4; i++) {
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+		i2c_lcd1602_write_4bits(i2c_lcd1602, nibbles[i] | mode);
+		i2c_lcd1602_set_busy(i2c_lcd1602, waits[i]);
+	}
+	/* }}} */
+}
+
+
 /* See page 46 of the HD44780 datasheet for 4-bit initialization */
 void i2c_lcd1602_begin(struct i2c_lcd1602 *i2c_lcd1602) {
 
@@ -52,15 +220,26 @@ void i2c_lcd1602_begin(struct i2c_lcd1602 *i2c_lcd1602) {
 	 */
 
 
+	/* Nothing can be assumed about the state of the controller until the
+	 * instructions below have set it. Initializing by instruction brings the
+	 * nibble phase back in step whatever it was (page 46 of the HD44780
+	 * datasheet), so there is nothing to resynchronize. */
+	i2c_lcd1602_forget(i2c_lcd1602);
+	i2c_lcd1602->out_of_sync = 0;
+
 	/* According to page 46 of the HD44780 datasheet, we must wait for 40ms
 	 * after the Vcc reaches 2.7 V before sending commands. */
-	/* Sleep for 40ms */
-	struct timespec a = { .tv_sec = 0, .tv_nsec = 40000000};
-	nanosleep(&a, NULL);
+	i2c_lcd1602_set_busy(i2c_lcd1602, 40000000);
+
+	/* The controller starts in 8-bit mode, so it must be told to switch to
+	 * 4-bit mode one nibble at a time before anything else */
+	i2c_lcd1602_init_4bitmode(i2c_lcd1602);
 
 	/* Set the functionality of the LCD (E.g. here: 4-bit operation . 2 display
-	 * lines, font 0 (i.e. 5x8 dots) */
-	i2c_lcd1602_function_set(i2c_lcd1602, 4, 2, 0);
+	 * lines, font 0 (i.e. 5x8 dots). Displays of more than one row use 2-line
+	 * mode, with rows past the second continuing the first two lines (page 11
+	 * of the HD44780 datasheet). */
+	i2c_lcd1602_function_set(i2c_lcd1602, 4, i2c_lcd1602->rows > 1 ? 2 : 1, 0);
 
 	/* Set the display control of the LCD  (E.g. here: display = on,
 	 * cursor = on, cursor blinking = on) */
@@ -76,11 +255,200 @@ void i2c_lcd1602_begin(struct i2c_lcd1602 *i2c_lcd1602) {
 
 	/* Move the cursor back to the beginning */
 	i2c_lcd1602_cursor_home(i2c_lcd1602);
+
+	i2c_lcd1602->regs_known = 1;
+}
+
+
+/** Take over a controller that is already initialized and showing something
+ * (e.g. after the program using it restarts) without the 40ms wait and the
+ * clear display of i2c_lcd1602_begin(), so the display does not flicker. The
+ * nibble phase is put in step and the settings i2c_lcd1602_begin() uses are
+ * sent (see i2c_lcd1602_resync()), replacing whatever the previous program
+ * had set: a display it left with the cursor off comes back with the cursor
+ * on. The controller is then checked to be answering (see
+ * i2c_lcd1602_probe()) before the cursor and the display shift are returned
+ * home. If it is not, for example because R/W is not connected so nothing can
+ * be read back, it is initialized with i2c_lcd1602_begin() instead. DDRAM and
+ * CGRAM keep whatever they held.
+ *
+ * This cannot tell whether the LCD has been power cycled: the resync
+ * initializes a controller that has just been powered on as well, so it
+ * answers the probe, and its DDRAM holds whatever it powered up with.
+ * i2c_lcd_page_begin_warm() keeps the settings of the previous program, and
+ * tells a power cycle apart by reading DDRAM back, from a state saved with
+ * i2c_lcd_page_save().
+ *
+ * Returns 0 if the controller was taken over as it was, and 1 if it was
+ * initialized from scratch.
+ */
+int i2c_lcd1602_begin_warm(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	/* The settings i2c_lcd1602_begin() sends */
+	i2c_lcd1602->function = LCD_FUNCTIONSET | LCD_4BITMODE | LCD_5x8DOTS \
+		| (i2c_lcd1602->rows > 1 ? LCD_2LINE : LCD_1LINE);
+	i2c_lcd1602->display = LCD_DISPLAYONOFFCONTROL | LCD_DISPLAYON \
+		| LCD_CURSORON | LCD_BLINKON;
+	i2c_lcd1602->entry_shift_increment = LCD_ENTRYINCREMENT;
+	i2c_lcd1602->entry_shift = LCD_ENTRYNOSHIFT;
+
+	if (0 == i2c_lcd1602_resync(i2c_lcd1602) \
+		&& 0 == i2c_lcd1602_probe(i2c_lcd1602, 0x00)) {
+
+		i2c_lcd1602_cursor_home(i2c_lcd1602);
+		return 0;
+	}
+
+	i2c_lcd1602_begin(i2c_lcd1602);
+
+	return 1;
+	/* }}} */
+}
+
+
+/** Check that the controller of the i2c LCD is initialized and in step, by
+ * setting the DDRAM address to 'ac' and reading the address counter back
+ * (page 24 of the HD44780 datasheet). This only works if the R/W line of the
+ * LCD is connected to the PCF8574. The address counter is left at 'ac'.
+ *
+ * Returns 0 if the address counter read back as 'ac' with the busy flag
+ * clear, and -1 otherwise.
+ */
+int i2c_lcd1602_probe(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac) {
+	/* {{{ */
+	uint8_t bytes[I2C_LCD1602_BYTES_PER_COMMAND];
+	uint8_t read_ac;
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+
+	/* One transaction, with the bus providing the strobe timing as in
+	 * i2c_lcd1602_write_buffer() */
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+	size_t len = i2c_lcd1602_encode_command(i2c_lcd1602, bytes, \
+		LCD_SETDDRAMADDR | (ac & 0x7f), mode);
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) return -1;
+	i2c_lcd1602_set_busy(i2c_lcd1602, \
+		i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_SET_DDRAM]);
+	i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_SET_DDRAM, 1);
+	i2c_lcd1602_track(i2c_lcd1602, LCD_SETDDRAMADDR | (ac & 0x7f), mode);
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+	if (0 != i2c_lcd1602_read_busy_ac(i2c_lcd1602, &read_ac)) return -1;
+	if (read_ac != (ac & 0x7f)) return -1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Bring the controller of the i2c LCD back in step after a transfer to it
+ * failed (see 'out_of_sync'), without the power on wait and the clear display
+ * of i2c_lcd1602_begin(). Three 0x3 nibbles and a 0x2 (page 46 of the HD44780
+ * datasheet) leave the controller in 4-bit mode expecting a high nibble
+ * whichever nibble it was expecting before, and then the function set,
+ * display control and entry mode last sent are sent again, in case the
+ * nibbles read out of step changed them. DDRAM, CGRAM, the address counter
+ * and the display shift are not restored, so whatever was being shown has to
+ * be written again (i2c_lcd_page_flush() does this by itself).
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed, in
+ * which case the LCD is still out of sync.
+ */
+int i2c_lcd1602_resync(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	uint8_t bytes[1 + 3 * 2 + 3 * I2C_LCD1602_BYTES_PER_COMMAND];
+	uint8_t enable = i2c_lcd1602->enable;
+	uint8_t busy_poll = i2c_lcd1602->busy_poll;
+	size_t len = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd1602->backlight;
+
+	/* Whatever the controller latched out of step may still be executing.
+	 * Reading the busy flag strobes E as well, so the slowest instruction is
+	 * waited out instead. */
+	i2c_lcd1602->out_of_sync = 0;
+	i2c_lcd1602->busy_poll = 0;
+	i2c_lcd1602_forget(i2c_lcd1602);
+	if (ns_until(&i2c_lcd1602->busy_until) \
+		< i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_CLEAR]) {
+
+		i2c_lcd1602_set_busy(i2c_lcd1602, \
+			i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_CLEAR]);
+	}
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+	/* If the controller was expecting a low nibble, the first 0x3 completes
+	 * an instruction 0xX3, the slowest of which is return home (0x03) */
+	bytes[len++] = mode;
+	bytes[len++] = 0x30 | mode | enable;
+	bytes[len++] = (0x30 | mode) & ~enable;
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) {
+		i2c_lcd1602->busy_poll = busy_poll;
+		return -1;
+	}
+	i2c_lcd1602_set_busy(i2c_lcd1602, \
+		i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_HOME]);
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+	/* Everything after it executes faster than the bus sends the next nibble
+	 * (page 24 of the HD44780 datasheet, 37µs), so it is one transaction */
+	len = 0;
+	bytes[len++] = mode;
+	for (int i = 0; i < 3; i++) {
+		uint8_t nibble = (i < 2 ? 0x30 : 0x20) | mode;
+		bytes[len++] = nibble | enable;
+		bytes[len++] = nibble & ~enable;
+	}
+	len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+		i2c_lcd1602->function, mode);
+	len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], \
+		i2c_lcd1602->display, mode);
+	len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], LCD_ENTRYMODESET \
+		| i2c_lcd1602->entry_shift_increment | i2c_lcd1602->entry_shift, mode);
+
+	int ret = i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len);
+	i2c_lcd1602_set_busy(i2c_lcd1602, \
+		i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_ENTRY_MODE]);
+	i2c_lcd1602->busy_poll = busy_poll;
+
+	/* A write that only succeeded when retried may have been cut short */
+	if (ret != 0 || i2c_lcd1602->out_of_sync) return -1;
+
+	i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_FUNCTION_SET, 1);
+	i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_DISPLAY_CONTROL, 1);
+	i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_ENTRY_MODE, 1);
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, resyncs, 1);
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, resync_ns, -ns_until(&start));
+
+	/* The settings are known again, but not where the address counter is */
+	i2c_lcd1602->regs_known = 1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Return the DDRAM address of the first column of 'row'. In 2-line mode the
+ * lines start at 0x00 and 0x40, and on displays of four rows the third and
+ * fourth rows are the rest of those lines, starting 'columns' characters in
+ * (page 11 of the HD44780 datasheet): 0x00, 0x40, 0x14, 0x54 on a 20x4 and
+ * 0x00, 0x40, 0x10, 0x50 on a 16x4. A 1-line display is one line of 80. */
+uint8_t i2c_lcd1602_row_offset(const struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t row) {
+	/* {{{ */
+	if (i2c_lcd1602->rows <= 1) return 0;
+
+	return (row % 2) * 0x40 + (row / 2) * i2c_lcd1602->columns;
+	/* }}} */
 }
 
 
 /** Clear the display, and set the cursor position to zero */
-void i2c_lcd1602_clear_display(struct i2c_lcd1602 *i2c_lcd1602) {
+int i2c_lcd1602_clear_display(struct i2c_lcd1602 *i2c_lcd1602) {
 	/* {{{ */
 	/* See page 28 of the HD44780 datasheet */
 
@@ -91,20 +459,13 @@ void i2c_lcd1602_clear_display(struct i2c_lcd1602 *i2c_lcd1602) {
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	// TODO:
-	/* See page 24 of the HD44780 datasheet. No time is listed for this
-	 * instruction. */
-	/* Sleep for 2000µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 2000000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
 /** Set the cursor position */
-void i2c_lcd1602_set_cursor_pos(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac) {
+int i2c_lcd1602_set_cursor_pos(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac) {
 	/* {{{ */
 	/* See page 21, 24 of the HD44780 datasheet */
 
@@ -116,19 +477,57 @@ void i2c_lcd1602_set_cursor_pos(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac) {
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
+	/* }}} */
+}
+
+
+/** Set the CGRAM address, so that the characters sent after it are written to
+ * CGRAM instead of DDRAM */
+int i2c_lcd1602_set_cgram_addr(struct i2c_lcd1602 *i2c_lcd1602, uint8_t acg) {
+	/* {{{ */
+	/* See page 24 of the HD44780 datasheet */
+
+	/* Set the command type */
+	uint8_t data = LCD_SETCGRAMADDR;
+	data |= acg & 0x3f;
+	/* Set RS and R/W appropriately */
+	uint8_t mode = set_mode(0, 0);
+	/* Respect backlight settings for the LCD */
+	mode |= i2c_lcd1602->backlight;
+
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
+	/* }}} */
+}
+
+
+/** Define custom character 'location' (0 to 7) as the 5x8 dot pattern in
+ * 'rows', one byte per row from top to bottom using the low 5 bits of each.
+ * The character is then shown wherever character code 'location' is in DDRAM
+ * (page 19 of the HD44780 datasheet). This leaves the address counter in
+ * CGRAM, so the cursor position must be set before sending more characters
+ * to the display.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd1602_create_char(struct i2c_lcd1602 *i2c_lcd1602, uint8_t location, \
+	const uint8_t rows[8]) {
+	/* {{{ */
+	char pattern[8];
+
+	for (int i = 0; i < 8; i++) pattern[i] = rows[i] & 0x1f;
 
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	if (0 != i2c_lcd1602_set_cgram_addr(i2c_lcd1602, (location & 0x7) << 3)) {
+		return -1;
+	}
+
+	return i2c_lcd1602_write_buffer(i2c_lcd1602, pattern, 8);
 	/* }}} */
 }
 
 
 /** Move the cursor to (0, 0) */
-void i2c_lcd1602_cursor_home(struct i2c_lcd1602 *i2c_lcd1602) {
+int i2c_lcd1602_cursor_home(struct i2c_lcd1602 *i2c_lcd1602) {
 	/* {{{ */
 	/* See page 24 of the HD44780 datasheet */
 
@@ -139,19 +538,13 @@ void i2c_lcd1602_cursor_home(struct i2c_lcd1602 *i2c_lcd1602) {
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 1.52ms */
-	/* Sleep for 1.52ms */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 1520000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
 /** Set the entry mode for the i2c LCD */
-void i2c_lcd1602_entry_mode_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
+int i2c_lcd1602_entry_mode_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
 	increment, uint8_t shift) {
 	/* {{{ */
 	/* See page 24, 26, 40, 42 of the HD44780 datasheet */
@@ -170,26 +563,20 @@ void i2c_lcd1602_entry_mode_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
 	 *   cursor moves (which depends on whether increment or decrement is set)
 	 *   after receiving a new character).
 	 */
-	i2c_lcd1602->entry_shift_increment = increment;
 	data |= increment;
-	i2c_lcd1602->entry_shift = shift;
 	data |= shift;
 	/* Set both RS and R/W to 0 */
 	uint8_t mode = set_mode(0, 0);
+	/* Respect backlight settings for the LCD */
+	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
 /** Set the display controls for the i2c LCD */
-void i2c_lcd1602_display_control(struct i2c_lcd1602 *i2c_lcd1602,
+int i2c_lcd1602_display_control(struct i2c_lcd1602 *i2c_lcd1602,
 	uint8_t display, uint8_t cursor, uint8_t cursorblinking) {
 	/* {{{ */
 	/* See page 24, 42 of the HD44780 datasheet */
@@ -205,19 +592,13 @@ void i2c_lcd1602_display_control(struct i2c_lcd1602 *i2c_lcd1602,
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
 /** Shift the screen or the cursor to the right or to the left */
-void i2c_lcd1602_shift(struct i2c_lcd1602 *i2c_lcd1602, uint8_t screen_cursor,
+int i2c_lcd1602_shift(struct i2c_lcd1602 *i2c_lcd1602, uint8_t screen_cursor,
 	uint8_t right_left) {
 	/* {{{ */
 	/* See page 24, 29 of the HD44780 datasheet */
@@ -233,19 +614,13 @@ void i2c_lcd1602_shift(struct i2c_lcd1602 *i2c_lcd1602, uint8_t screen_cursor,
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
 /** Establish the functionality settings for the i2c LCD */
-void i2c_lcd1602_function_set(struct i2c_lcd1602 *i2c_lcd1602,
+int i2c_lcd1602_function_set(struct i2c_lcd1602 *i2c_lcd1602,
 	uint8_t data_length, uint8_t display_lines, uint8_t font) {
 	/* {{{ */
 	/* See page 24, 27, 29 of the HD44780 datasheet */
@@ -264,19 +639,15 @@ void i2c_lcd1602_function_set(struct i2c_lcd1602 *i2c_lcd1602,
 	else if (font == 0) data |= LCD_5x8DOTS;
 	/* Set both RS and R/W to 0 */
 	uint8_t mode = set_mode(0, 0);
+	/* Respect backlight settings for the LCD */
+	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
-void i2c_lcd1602_send_char(struct i2c_lcd1602 *i2c_lcd1602, char c) {
+int i2c_lcd1602_send_char(struct i2c_lcd1602 *i2c_lcd1602, char c) {
 	/* {{{ */
 	/* See page 25 of the HD44780 datasheet */
 
@@ -287,49 +658,116 @@ void i2c_lcd1602_send_char(struct i2c_lcd1602 *i2c_lcd1602, char c) {
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
-
-	/* According to page 25 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs + 4µs */
-	/* Sleep for 41µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 41000};
-	nanosleep(&a, NULL);
+	return i2c_lcd1602_command(i2c_lcd1602, data, mode);
 	/* }}} */
 }
 
 
-/** Set the backlight setting for the LCD */
-void i2c_lcd1602_set_backlight(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
-	backlight) {
+/** Write a run of 'n' characters to the i2c LCD starting at the current
+ * cursor position. Unlike calling i2c_lcd1602_send_char() 'n' times, every
+ * nibble and enable strobe for the whole run is encoded into one buffer and
+ * sent to the PCF8574 in a single transaction. No sleeping is done between
+ * the bytes: each byte takes longer on the bus than the enable pulse width
+ * (page 49 of the HD44780 datasheet, 230ns), and the next nibble is latched
+ * two bytes after the one that completes a character, which at 100kHz
+ * (180µs) or 400kHz (45µs) is longer than the execution time of a data write
+ * (page 25, 37µs + 4µs), so the bus itself provides the necessary timing. On
+ * a faster bus, where two bytes ('bus_byte_ns' of the timing) take less than
+ * that, the characters are sent one per transaction with a wait between them
+ * instead. Like i2c_lcd1602_command(), a controller left out of sync by an
+ * earlier failed transfer is resynchronized first.
+ *
+ * Returns 0 on success, and -1 if the resync or the write to the i2c device
+ * failed.
+ */
+int i2c_lcd1602_write_buffer(struct i2c_lcd1602 *i2c_lcd1602, const char *buf,
+	size_t n) {
 	/* {{{ */
-	// TODO:
-	/* See page 24, 26, 40, 42 of the HD44780 datasheet */
-
-	/* There is no "set backlight" command for the LCD. Instead, the backlight
-	 * is set on or off with each sent command. That said, we can change the
-	 * stored value for the backlight that exists in the LCD struct, and use
-	 * the entry mode set command as a means of immediately bringing about
-	 * that change without changing anything else (i.e. without sending a
-	 * character or shifting the display) */
-	i2c_lcd1602->backlight = backlight;
+	/* Encode at most this many characters per transaction, which is enough to
+	 * fill all 80 bytes of DDRAM (page 11 of the HD44780 datasheet) */
+	uint8_t bytes[1 + 128 * I2C_LCD1602_BYTES_PER_CHAR];
+#ifndef I2C_LCD1602_NO_STATS
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
 
-	/* Set the command type */
-	uint8_t data = LCD_ENTRYMODESET;
-	/* Maintain the LCD  entry mode settings */
-	data |= i2c_lcd1602->entry_shift_increment;
-	data |= i2c_lcd1602->entry_shift;
-	/* Set both RS and R/W to 0 */
-	uint8_t mode = set_mode(0, 0);
+	/* Set RS and R/W appropriately */
+	uint8_t mode = set_mode(1, 0);
 	/* Respect backlight settings for the LCD */
 	mode |= i2c_lcd1602->backlight;
 
-	i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
+	if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+		return -1;
+	}
+
+	/* Whether the bus is too fast to space the characters out by itself */
+	size_t run_max = 2 * i2c_lcd1602->timing.bus_byte_ns \
+		< i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA] ? 1 : 128;
+
+	while (n > 0) {
+		size_t run = n < run_max ? n : run_max;
+		size_t len = 0;
+
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+		/* Present RS before raising E for the first nibble (page 49 of the
+		 * HD44780 datasheet, tAS). RS does not change for the rest of the
+		 * run so no other setup bytes are needed. */
+		bytes[len++] = mode;
+		for (size_t i = 0; i < run; i++) {
+			len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &bytes[len], buf[i], \
+				mode);
+		}
+
+		if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) return -1;
+		i2c_lcd1602_stats_count(i2c_lcd1602, I2C_LCD1602_CMD_DATA, run);
+		for (size_t i = 0; i < run; i++) {
+			i2c_lcd1602_track(i2c_lcd1602, buf[i], mode);
+		}
+
+		/* The controller is busy until the last character has been
+		 * written */
+		i2c_lcd1602_set_busy(i2c_lcd1602, \
+			i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]);
+
+		buf += run;
+		n -= run;
+	}
+
+#ifndef I2C_LCD1602_NO_STATS
+	i2c_lcd1602_stats_latency(i2c_lcd1602, -ns_until(&start));
+#endif
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Set the backlight setting for the LCD. The backlight is not driven by the
+ * controller but by an output of the PCF8574 (see i2c_lcd1602_command()), so
+ * there is no instruction for it: the PCF8574 is sent a single byte with the
+ * new backlight bit and E low, which the controller does not latch. Nothing
+ * is sent if the backlight is already set that way. The new setting is only
+ * kept if it was sent, so a failed write leaves the backlight as it was.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
+ */
+int i2c_lcd1602_set_backlight(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
+	backlight) {
+	/* {{{ */
+	if (i2c_lcd1602->backlight == backlight && i2c_lcd1602->regs_known \
+		&& i2c_lcd1602->skip_redundant) {
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, commands_skipped, 1);
+		return 0;
+	}
+
+	/* Set RS and R/W appropriately, respecting the new backlight setting */
+	uint8_t byte = set_mode(0, 0) | backlight;
 
-	/* According to page 24 of the HD44780 datasheet, this operation takes a
-	 * maximum of 37µs */
-	/* Sleep for 37µs */
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, &byte, 1)) return -1;
+	i2c_lcd1602->backlight = backlight;
+
+	return 0;
 	/* }}} */
 }
 
@@ -339,41 +777,633 @@ void i2c_lcd1602_set_backlight(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
  * used to accomplish what would be accomplished in one 8 bit instruction.
  * Compare the last stages of page 45 and page 46 of the HD44780 datasheet
  * to see what I mean.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed, in
+ * which case the rest of the nibble is not sent.
  */
-void i2c_lcd1602_write_4bits(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
+int i2c_lcd1602_write_4bits(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
 	data_and_mode) {
 
 	/* =================
 	 * with enable bit stuff
 	 * ================= */
 
-	write(i2c_lcd1602->fd, &data_and_mode, 1);
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, &data_and_mode, 1)) return -1;
+
+	/* Give RS and the data lines time to settle before raising E (page 49 of
+	 * the HD44780 datasheet, tAS) */
+	if (i2c_lcd1602->timing.strobe_setup_ns > 0) {
+		i2c_lcd1602_delay(i2c_lcd1602, i2c_lcd1602->timing.strobe_setup_ns);
+	}
+
+	uint8_t data_and_mode_and_enable = data_and_mode | i2c_lcd1602->enable;
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, &data_and_mode_and_enable, 1)) {
+		return -1;
+	}
+
+	/* Keep E high for long enough (page 49 of the HD44780 datasheet,
+	 * PWEH) */
+	if (i2c_lcd1602->timing.strobe_hold_ns > 0) {
+		i2c_lcd1602_delay(i2c_lcd1602, i2c_lcd1602->timing.strobe_hold_ns);
+	}
+
+	uint8_t data_and_mode_and_disable = data_and_mode & ~i2c_lcd1602->enable;
+	if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, &data_and_mode_and_disable, 1)) {
+		return -1;
+	}
+
+	/* Wait before the next nibble */
+	if (i2c_lcd1602->timing.nibble_ns > 0) {
+		i2c_lcd1602_delay(i2c_lcd1602, i2c_lcd1602->timing.nibble_ns);
+	}
+
+	return 0;
+}
+
+
+/** Return the type of the instruction 'data' (page 24 of the HD44780
+ * datasheet), or I2C_LCD1602_CMD_DATA if 'mode' selects the data register */
+enum i2c_lcd1602_command_type i2c_lcd1602_command_type(uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	if (mode & Rs) return I2C_LCD1602_CMD_DATA;
+
+	/* The type of an instruction is given by its highest set bit */
+	if (data & LCD_SETDDRAMADDR) return I2C_LCD1602_CMD_SET_DDRAM;
+	if (data & LCD_SETCGRAMADDR) return I2C_LCD1602_CMD_SET_CGRAM;
+	if (data & LCD_FUNCTIONSET) return I2C_LCD1602_CMD_FUNCTION_SET;
+	if (data & LCD_CURSORDISPLAYSHIFT) return I2C_LCD1602_CMD_SHIFT;
+	if (data & LCD_DISPLAYONOFFCONTROL) return I2C_LCD1602_CMD_DISPLAY_CONTROL;
+	if (data & LCD_ENTRYMODESET) return I2C_LCD1602_CMD_ENTRY_MODE;
+	if (data & LCD_RETURNHOME) return I2C_LCD1602_CMD_HOME;
+	return I2C_LCD1602_CMD_CLEAR;
+	/* }}} */
+}
+
+
+/** Estimate how long sending one instruction (or character) of type 'type'
+ * with i2c_lcd1602_command() takes with the timing of the i2c LCD: two nibbles
+ * of three single byte messages (each also carrying the address byte), the
+ * sleeps around each strobe, and the execution time.
+ */
+long i2c_lcd1602_command_cost(const struct i2c_lcd1602 *i2c_lcd1602, \
+	enum i2c_lcd1602_command_type type) {
+	/* {{{ */
+	const struct i2c_lcd1602_timing *timing = &i2c_lcd1602->timing;
+
+	return 2 * (3 * 2 * timing->bus_byte_ns + timing->strobe_setup_ns \
+		+ timing->strobe_hold_ns + timing->nibble_ns) + timing->exec_ns[type];
+	/* }}} */
+}
+
+
+/** Estimate how long writing 'n' characters with i2c_lcd1602_write_buffer()
+ * takes with the timing of the i2c LCD: one message with the address byte,
+ * the RS setup byte and the bytes of each character, and the execution time
+ * of the last character.
+ */
+long i2c_lcd1602_write_buffer_cost(const struct i2c_lcd1602 *i2c_lcd1602, \
+	size_t n) {
+	/* {{{ */
+	const struct i2c_lcd1602_timing *timing = &i2c_lcd1602->timing;
+
+	return (2 + n * I2C_LCD1602_BYTES_PER_CHAR) * timing->bus_byte_ns \
+		+ timing->exec_ns[I2C_LCD1602_CMD_DATA];
+	/* }}} */
+}
+
+
+/** Add 'ns' nanoseconds (which may be negative) to 't' */
+static void timespec_add_ns(struct timespec *t, long ns) {
+	/* {{{ */
+	t->tv_nsec += ns;
+	while (t->tv_nsec >= 1000000000) {
+		t->tv_nsec -= 1000000000;
+		t->tv_sec++;
+	}
+	while (t->tv_nsec < 0) {
+		t->tv_nsec += 1000000000;
+		t->tv_sec--;
+	}
+	/* }}} */
+}
+
+
+/** Sleep until 'deadline' (or for the time left until it, with
+ * I2C_LCD1602_WAIT_SLEEP), recording how long was actually spent sleeping */
+static void i2c_lcd1602_sleep_until(struct i2c_lcd1602 *i2c_lcd1602, \
+	const struct timespec *deadline) {
+	/* {{{ */
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (i2c_lcd1602->wait_mode == I2C_LCD1602_WAIT_SLEEP) {
+		long remaining = (deadline->tv_sec - start.tv_sec) * 1000000000L \
+			+ (deadline->tv_nsec - start.tv_nsec);
+		struct timespec a = (struct timespec) { .tv_sec = remaining / 1000000000L, \
+			.tv_nsec = remaining % 1000000000L };
+		nanosleep(&a, NULL);
+	} else {
+		/* An interrupted sleep carries on to the same deadline */
+		while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, \
+			deadline, NULL));
+	}
+
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, sleeps, 1);
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, sleep_ns, -ns_until(&start));
+	/* }}} */
+}
+
+
+/** Spin until 'deadline', recording how long was spent spinning */
+static void i2c_lcd1602_spin_until(struct i2c_lcd1602 *i2c_lcd1602, \
+	const struct timespec *deadline) {
+	/* {{{ */
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (ns_until(deadline) > 0) I2C_LCD1602_CPU_RELAX();
+
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, spin_ns, -ns_until(&start));
+	/* }}} */
+}
+
+
+/** Wait until 'deadline' (a CLOCK_MONOTONIC time) has passed, the way set
+ * with i2c_lcd1602_set_wait(), and record how late the wait ended */
+void i2c_lcd1602_wait_until(struct i2c_lcd1602 *i2c_lcd1602, \
+	const struct timespec *deadline) {
+	/* {{{ */
+	long remaining = ns_until(deadline);
+
+	if (remaining <= 0) return;
+
+	switch (i2c_lcd1602->wait_mode) {
+	case I2C_LCD1602_WAIT_SPIN:
+		i2c_lcd1602_spin_until(i2c_lcd1602, deadline);
+		break;
+	case I2C_LCD1602_WAIT_HYBRID:
+		/* Wake up early enough for the sleep to almost never end late */
+		if (remaining > i2c_lcd1602->spin_threshold_ns) {
+			struct timespec wake = *deadline;
+			timespec_add_ns(&wake, -i2c_lcd1602->spin_threshold_ns);
+			i2c_lcd1602_sleep_until(i2c_lcd1602, &wake);
+		}
+		i2c_lcd1602_spin_until(i2c_lcd1602, deadline);
+		break;
+	default:
+		i2c_lcd1602_sleep_until(i2c_lcd1602, deadline);
+		break;
+	}
+
+#ifndef I2C_LCD1602_NO_STATS
+	long late = -ns_until(deadline);
+	if (late < 0) late = 0;
+	i2c_lcd1602->stats.waits++;
+	i2c_lcd1602->stats.wait_late_ns += late;
+	if ((uint64_t) late > i2c_lcd1602->stats.wait_late_max_ns) {
+		i2c_lcd1602->stats.wait_late_max_ns = late;
+	}
+	i2c_lcd1602->stats.wait_late_hist[i2c_lcd1602_stats_bucket(late)]++;
+#endif
+	/* }}} */
+}
+
+
+/** Wait for 'ns' nanoseconds from now, see i2c_lcd1602_wait_until() */
+static void i2c_lcd1602_delay(struct i2c_lcd1602 *i2c_lcd1602, long ns) {
+	/* {{{ */
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_ns(&deadline, ns);
+
+	i2c_lcd1602_wait_until(i2c_lcd1602, &deadline);
+	/* }}} */
+}
+
+
+/** Set how the i2c LCD waits for the controller (see enum
+ * i2c_lcd1602_wait_mode). Sleeping gives up the CPU but usually ends tens of
+ * microseconds late, several times the 37µs most instructions take, while
+ * spinning ends within a clock read of the deadline but keeps a CPU busy for
+ * the whole wait. I2C_LCD1602_WAIT_HYBRID only spins for the last
+ * 'spin_threshold_ns' nanoseconds of each wait, and waits shorter than that
+ * entirely (see i2c_lcd1602_calibrate_wait() for choosing it). How late the
+ * waits end is kept in the statistics of the LCD. */
+void i2c_lcd1602_set_wait(struct i2c_lcd1602 *i2c_lcd1602, \
+	enum i2c_lcd1602_wait_mode mode, long spin_threshold_ns) {
+	/* {{{ */
+	i2c_lcd1602->wait_mode = mode;
+	i2c_lcd1602->spin_threshold_ns = spin_threshold_ns;
+	/* }}} */
+}
+
+
+/** Measure how late short sleeps until a deadline end on this system, and
+ * make the spin threshold of I2C_LCD1602_WAIT_HYBRID the lateness that
+ * I2C_LCD1602_WAIT_CALIBRATE_SAMPLES of them exceeded only 1 in 16 times, so
+ * that its sleeps nearly always end before the deadline. This depends on the
+ * timer slack and scheduling policy of the calling thread, so it should be
+ * called from the thread that drives the LCD. Takes a few milliseconds.
+ *
+ * Returns the new spin threshold.
+ */
+long i2c_lcd1602_calibrate_wait(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	long late[I2C_LCD1602_WAIT_CALIBRATE_SAMPLES];
+	size_t n = I2C_LCD1602_WAIT_CALIBRATE_SAMPLES;
+
+	for (size_t i = 0; i < n; i++) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		/* About as long as the instructions that take 37µs */
+		timespec_add_ns(&deadline, 40000);
+		while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, \
+			&deadline, NULL));
+		late[i] = -ns_until(&deadline);
+
+		/* Insertion sort, there are only a few */
+		for (size_t j = i; j > 0 && late[j - 1] > late[j]; j--) {
+			long t = late[j];
+			late[j] = late[j - 1];
+			late[j - 1] = t;
+		}
+	}
+
+	i2c_lcd1602->spin_threshold_ns = late[n - n / 16 - 1];
+
+	return i2c_lcd1602->spin_threshold_ns;
+	/* }}} */
+}
+
+
+/** Record that the controller of the i2c LCD will be busy for the next 'ns'
+ * nanoseconds (e.g. executing the instruction that was just sent). The next
+ * call to i2c_lcd1602_wait_ready() will wait until that time has passed. */
+void i2c_lcd1602_set_busy(struct i2c_lcd1602 *i2c_lcd1602, long ns) {
+	/* {{{ */
+	clock_gettime(CLOCK_MONOTONIC, &i2c_lcd1602->busy_until);
+	timespec_add_ns(&i2c_lcd1602->busy_until, ns);
+	/* }}} */
+}
+
+
+/** Return the number of nanoseconds from now until 't' (negative if 't' has
+ * already passed) */
+static long ns_until(const struct timespec *t) {
+	/* {{{ */
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (t->tv_sec - now.tv_sec) * 1000000000L + (t->tv_nsec - now.tv_nsec);
+	/* }}} */
+}
+
+
+/** Poll the busy flag of the i2c LCD until it clears, or until the busy flag
+ * poll timeout has passed.
+ *
+ * Returns 0 if the controller is ready, and -1 if it could not be read or
+ * was still busy when the timeout passed.
+ */
+static int i2c_lcd1602_poll_busy(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	struct timespec timeout;
+	clock_gettime(CLOCK_MONOTONIC, &timeout);
+	timespec_add_ns(&timeout, i2c_lcd1602->busy_poll_timeout_ns);
+
+	while (1) {
+		int busy = i2c_lcd1602_read_busy_ac(i2c_lcd1602, NULL);
+
+		if (busy < 0) return -1;
+		if (busy == 0) {
+			/* The controller finished early, so forget the deadline */
+			clock_gettime(CLOCK_MONOTONIC, &i2c_lcd1602->busy_until);
+			return 0;
+		}
+		if (ns_until(&timeout) <= 0) return -1;
+
+		i2c_lcd1602_delay(i2c_lcd1602, i2c_lcd1602->busy_poll_interval_ns);
+	}
+	/* }}} */
+}
+
+
+/** Wait until the controller of the i2c LCD can accept a new instruction.
+ * Rather than sleeping for the full execution time of every instruction right
+ * after sending it, each instruction records when the controller will be done
+ * with it (see i2c_lcd1602_set_busy()) and this only sleeps for whatever part
+ * of that time the caller has not already spent doing something else.
+ *
+ * If busy flag polling is enabled (see i2c_lcd1602_set_busy_poll()) and
+ * there is more than one poll interval left until the deadline, the busy flag
+ * is polled instead, since the controller is usually much faster than the
+ * worst case listed in the datasheet. If polling fails or times out, the
+ * deadline is used.
+ */
+void i2c_lcd1602_wait_ready(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	long remaining = ns_until(&i2c_lcd1602->busy_until);
+
+	if (remaining <= 0) return;
+
+	if (i2c_lcd1602->busy_poll \
+		&& remaining > i2c_lcd1602->busy_poll_interval_ns) {
+
+		if (0 == i2c_lcd1602_poll_busy(i2c_lcd1602)) return;
+	}
+
+	i2c_lcd1602_wait_until(i2c_lcd1602, &i2c_lcd1602->busy_until);
+	/* }}} */
+}
+
+
+/** Enable or disable polling the busy flag of the i2c LCD instead of always
+ * waiting for the worst case execution time of each instruction. While the
+ * controller is busy, the busy flag is read every 'interval_ns' nanoseconds
+ * for up to 'timeout_ns' nanoseconds before falling back to the worst case
+ * delay. This requires the R/W line of the LCD to be connected to the
+ * PCF8574. */
+void i2c_lcd1602_set_busy_poll(struct i2c_lcd1602 *i2c_lcd1602, uint8_t \
+	enable, long interval_ns, long timeout_ns) {
+	/* {{{ */
+	i2c_lcd1602->busy_poll = enable;
+	i2c_lcd1602->busy_poll_interval_ns = interval_ns;
+	i2c_lcd1602->busy_poll_timeout_ns = timeout_ns;
+	/* }}} */
+}
+
+
+/** Read the busy flag and the address counter of the i2c LCD. If 'ac' is not
+ * NULL, the address counter is stored in it.
+ *
+ * Returns 1 if the controller is busy, 0 if it is not, and -1 if the read
+ * failed.
+ */
+int i2c_lcd1602_read_busy_ac(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *ac) {
+	/* {{{ */
+	/* See page 24 of the HD44780 datasheet. With RS = 0 and R/W = 1, DB7 is
+	 * the busy flag and DB6 to DB0 are the address counter. */
+	uint8_t data;
+
+	if (0 != i2c_lcd1602_read_4bitmode(i2c_lcd1602, set_mode(0, 1), &data)) {
+		return -1;
+	}
+
+	if (ac != NULL) *ac = data & 0x7f;
+
+	return (data & 0x80) ? 1 : 0;
+	/* }}} */
+}
+
+
+/** Read 'n' bytes of DDRAM from the i2c LCD starting at address 'ac' into
+ * 'buf'. This leaves the address counter after the last byte read.
+ *
+ * Returns 0 on success, and -1 if the i2c device could not be read.
+ */
+int i2c_lcd1602_read_buffer(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac, \
+	uint8_t *buf, size_t n) {
+	/* {{{ */
+	/* Reading DDRAM must be preceded by setting the address (page 33 of the
+	 * HD44780 datasheet) */
+	i2c_lcd1602_set_cursor_pos(i2c_lcd1602, ac);
+
+	for (size_t i = 0; i < n; i++) {
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+		if (0 != i2c_lcd1602_read_4bitmode(i2c_lcd1602, set_mode(1, 0), &buf[i])) {
+			return -1;
+		}
+
+		/* Reading moves the address counter the same way writing does (page
+		 * 25 of the HD44780 datasheet) */
+		i2c_lcd1602_set_busy(i2c_lcd1602, \
+			i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]);
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Read one 8 bit value from the i2c LCD in 4 bit mode. With RS = 0 (in
+ * 'mode') this reads the busy flag and address counter, and with RS = 1 this
+ * reads the data at the address counter from DDRAM or CGRAM. Each nibble is
+ * driven by the controller while E is high (page 22, 33 of the HD44780
+ * datasheet, and page 58 for timing), so it is read from the PCF8574 between
+ * raising and lowering E. The data pins are written high first so that the
+ * quasi-bidirectional outputs of the PCF8574 can be pulled low by the LCD.
+ *
+ * Returns 0 on success, and -1 if the i2c device could not be read.
+ */
+int i2c_lcd1602_read_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t mode, \
+	uint8_t *data) {
+	/* {{{ */
+	mode |= Rw | i2c_lcd1602->backlight;
+	uint8_t idle = 0xf0 | (mode & ~i2c_lcd1602->enable);
+	uint8_t setup[2] = { idle, idle | i2c_lcd1602->enable };
+	uint8_t strobe[2] = { idle, idle | i2c_lcd1602->enable };
+	uint8_t highnib;
+	uint8_t lownib;
+
+	struct i2c_lcd1602_msg msgs[] = {
+		{ .buf = setup, .len = 2 },
+		{ .buf = &highnib, .len = 1, .read = 1 },
+		{ .buf = strobe, .len = 2 },
+		{ .buf = &lownib, .len = 1, .read = 1 },
+		{ .buf = &idle, .len = 1 }
+	};
+
+	if (0 != i2c_lcd1602->transport->submit(i2c_lcd1602, msgs, 5)) {
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, transfer_failures, 1);
+		/* Reading strobes E too, and a strobe that got through moved the
+		 * nibble the controller expects next */
+		i2c_lcd1602->out_of_sync = 1;
+		return -1;
+	}
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, bytes_written, 5);
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, bytes_read, 2);
+
+	*data = (highnib & 0xf0) | ((lownib >> 4) & 0x0f);
 
-	// TODO: switch this to the minimum delay necessary (1µs)?
-	struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 2000000};
-	nanosleep(&a, NULL);
+	/* Reading data moves the address counter the same way writing does (page
+	 * 25 of the HD44780 datasheet) */
+	if (mode & Rs) i2c_lcd1602_track(i2c_lcd1602, *data, mode & ~Rw);
 
-	uint8_t data_and_mode_and_enable = data_and_mode | E;
-	write(i2c_lcd1602->fd, &data_and_mode_and_enable, 1);
+	return 0;
+	/* }}} */
+}
+
+
+/** Send an instruction (or character, depending on 'mode') to the i2c LCD
+ * once the controller is ready for it, and record how long the controller
+ * will be busy executing it. If an earlier transfer failed and left the
+ * controller out of sync, it is resynchronized first (see
+ * i2c_lcd1602_resync()), so that the instruction is not read out of step.
+ *
+ * Returns 0 on success, and -1 if the resync or the write to the i2c device
+ * failed.
+ */
+int i2c_lcd1602_command(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	enum i2c_lcd1602_command_type type = i2c_lcd1602_command_type(data, mode);
+#ifndef I2C_LCD1602_NO_STATS
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+	if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+		return -1;
+	}
+
+	if (i2c_lcd1602_redundant(i2c_lcd1602, data, mode)) {
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, commands_skipped, 1);
+		return 0;
+	}
+
+	i2c_lcd1602_wait_ready(i2c_lcd1602);
+
+	int ret = i2c_lcd1602_write_4bitmode(i2c_lcd1602, data, mode);
+
+	i2c_lcd1602_set_busy(i2c_lcd1602, i2c_lcd1602->timing.exec_ns[type]);
+
+	/* Even if the write failed, this is the state i2c_lcd1602_resync() should
+	 * bring back */
+	i2c_lcd1602_track(i2c_lcd1602, data, mode);
+
+	i2c_lcd1602_stats_count(i2c_lcd1602, type, 1);
+#ifndef I2C_LCD1602_NO_STATS
+	i2c_lcd1602_stats_latency(i2c_lcd1602, -ns_until(&start));
+#endif
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Move the address counter in the register model of the i2c LCD one step
+ * forwards (if 'forwards' is set) or backwards. In 2-line mode it goes from
+ * the end of one line to the start of the other and back, and in 1-line mode
+ * it wraps around all 80 characters (page 11, 29 of the HD44780 datasheet). */
+static void i2c_lcd1602_step_ac(struct i2c_lcd1602 *i2c_lcd1602, int forwards) {
+	/* {{{ */
+	uint8_t ac = i2c_lcd1602->ac;
+
+	if (ac == I2C_LCD1602_AC_UNKNOWN) return;
+
+	if (i2c_lcd1602->function & LCD_2LINE) {
+		if (forwards) ac = ac == 0x27 ? 0x40 : ac == 0x67 ? 0x00 : ac + 1;
+		else ac = ac == 0x40 ? 0x27 : ac == 0x00 ? 0x67 : ac - 1;
+	} else {
+		if (forwards) ac = ac == 0x4f ? 0x00 : ac + 1;
+		else ac = ac == 0x00 ? 0x4f : ac - 1;
+	}
+
+	i2c_lcd1602->ac = ac;
+	/* }}} */
+}
+
+
+/** Return whether sending the instruction 'data' (with 'mode') to the i2c LCD
+ * would leave the controller as it is, according to its register model (see
+ * i2c_lcd1602_track()). Clear display and return home are always sent, as
+ * they also affect DDRAM and the display shift, which are not modelled. */
+static int i2c_lcd1602_redundant(const struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t data, uint8_t mode) {
+	/* {{{ */
+	if (!i2c_lcd1602->skip_redundant || i2c_lcd1602->out_of_sync) return 0;
+
+	switch (i2c_lcd1602_command_type(data, mode)) {
+	case I2C_LCD1602_CMD_ENTRY_MODE:
+		return i2c_lcd1602->regs_known && data == (LCD_ENTRYMODESET \
+			| i2c_lcd1602->entry_shift_increment | i2c_lcd1602->entry_shift);
+	case I2C_LCD1602_CMD_DISPLAY_CONTROL:
+		return i2c_lcd1602->regs_known && data == i2c_lcd1602->display;
+	case I2C_LCD1602_CMD_FUNCTION_SET:
+		return i2c_lcd1602->regs_known && data == i2c_lcd1602->function;
+	case I2C_LCD1602_CMD_SET_DDRAM:
+		return i2c_lcd1602->ac == (data & 0x7f);
+	default:
+		return 0;
+	}
+	/* }}} */
+}
+
+
+/** Update the register model of the i2c LCD for the instruction (or
+ * character, depending on 'mode') 'data' having been sent to it. Called for
+ * everything sent through i2c_lcd1602_command() and
+ * i2c_lcd1602_write_buffer(); anything that encodes instructions itself and
+ * sends them with i2c_lcd1602_write_bytes() should call it too, or else
+ * i2c_lcd1602_forget(). The model follows pages 24 to 29 of the HD44780
+ * datasheet. */
+void i2c_lcd1602_track(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	switch (i2c_lcd1602_command_type(data, mode)) {
+	case I2C_LCD1602_CMD_CLEAR:
+		/* Clear display also sets the entry mode to increment */
+		i2c_lcd1602->entry_shift_increment = LCD_ENTRYINCREMENT;
+		i2c_lcd1602->ac = 0x00;
+		break;
+	case I2C_LCD1602_CMD_HOME:
+		i2c_lcd1602->ac = 0x00;
+		break;
+	case I2C_LCD1602_CMD_ENTRY_MODE:
+		i2c_lcd1602->entry_shift_increment = data & LCD_ENTRYINCREMENT;
+		i2c_lcd1602->entry_shift = data & LCD_ENTRYSHIFT;
+		break;
+	case I2C_LCD1602_CMD_DISPLAY_CONTROL:
+		i2c_lcd1602->display = data;
+		break;
+	case I2C_LCD1602_CMD_SHIFT:
+		/* Shifting the display leaves the address counter where it is */
+		if (!(data & LCD_DISPLAYMOVE)) {
+			i2c_lcd1602_step_ac(i2c_lcd1602, data & LCD_MOVERIGHT);
+		}
+		break;
+	case I2C_LCD1602_CMD_FUNCTION_SET:
+		i2c_lcd1602->function = data;
+		break;
+	case I2C_LCD1602_CMD_SET_CGRAM:
+		i2c_lcd1602->ac = I2C_LCD1602_AC_UNKNOWN;
+		break;
+	case I2C_LCD1602_CMD_SET_DDRAM:
+		i2c_lcd1602->ac = data & 0x7f;
+		break;
+	case I2C_LCD1602_CMD_DATA:
+		i2c_lcd1602_step_ac(i2c_lcd1602, \
+			i2c_lcd1602->entry_shift_increment == LCD_ENTRYINCREMENT);
+		break;
+	default:
+		break;
+	}
+	/* }}} */
+}
 
-	// TODO: return to the minimum delay necessary
-	// /* According to page 49 of the HD44780 datasheet, ______ takes
-	// at most 1µs (1000ns) */
-	// /* Sleep for 1µs */
-	// struct timespec a = (struct timespec) { .tv_sec = 0, .tv_nsec = 1000};
-	// nanosleep(&a, NULL);
 
-	// TODO: temporary "long" delay for testing purposes
-	/* Sleep for 2ms */
-	a = (struct timespec) { .tv_sec = 0, .tv_nsec = 2000000};
-	nanosleep(&a, NULL);
+/** Mark the register model of the i2c LCD as unknown, so that the next
+ * instructions are all sent. Needed after anything else drives the
+ * controller, such as another program. */
+void i2c_lcd1602_forget(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	i2c_lcd1602->regs_known = 0;
+	i2c_lcd1602->ac = I2C_LCD1602_AC_UNKNOWN;
+	/* }}} */
+}
 
-	uint8_t data_and_mode_and_disable = data_and_mode & ~E;
-	write(i2c_lcd1602->fd, &data_and_mode_and_disable, 1);
 
-	/* Sleep for 37µs */
-	a = (struct timespec) { .tv_sec = 0, .tv_nsec = 37000};
-	nanosleep(&a, NULL);
+/** Set whether instructions that would not change the state of the
+ * controller, according to its register model, are skipped (the default).
+ * Turning it off makes every instruction reach the controller, as needed to
+ * time them (see i2c_lcd_calibrate()). */
+void i2c_lcd1602_set_skip_redundant(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t enable) {
+	/* {{{ */
+	i2c_lcd1602->skip_redundant = enable;
+	/* }}} */
 }
 
 
@@ -382,19 +1412,354 @@ void i2c_lcd1602_write_4bits(struct i2c_lcd1602 *i2c_lcd1602, uint8_t
  * are used to accomplish what would be accomplished in one 8 bit instruction.
  * Compare the last stages of page 45 and page 46 of the HD44780 datasheet to
  * see what I mean.
+ *
+ * Returns 0 on success, and -1 if the write to the i2c device failed.
  */
-void i2c_lcd1602_write_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data,
+int i2c_lcd1602_write_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data,
 	uint8_t mode) {
 	/* {{{ */
 	uint8_t highnib = (data & 0xf0) | mode;
 	uint8_t lownib = ((data << 4) & 0xf0) | mode;
 
-	i2c_lcd1602_write_4bits(i2c_lcd1602, highnib);
-	i2c_lcd1602_write_4bits(i2c_lcd1602, lownib);
+	if (0 != i2c_lcd1602_write_4bits(i2c_lcd1602, highnib)) return -1;
+
+	return i2c_lcd1602_write_4bits(i2c_lcd1602, lownib);
+	/* }}} */
+}
+
+
+/** Encode one instruction or character for the PCF8574 in 4 bit mode into
+ * 'buf', which must have room for I2C_LCD1602_BYTES_PER_CHAR bytes. Each
+ * nibble is latched by raising and then lowering E (page 49 of the HD44780
+ * datasheet, the controller latches on the falling edge). The caller is
+ * responsible for presenting RS (via 'mode') before the first byte if it
+ * differs from what the PCF8574 last output.
+ *
+ * Returns the number of bytes written to 'buf'.
+ */
+size_t i2c_lcd1602_encode_4bitmode(const struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, uint8_t data, uint8_t mode) {
+	/* {{{ */
+	uint8_t enable = i2c_lcd1602->enable;
+	uint8_t highnib = (data & 0xf0) | mode;
+	uint8_t lownib = ((data << 4) & 0xf0) | mode;
+
+	buf[0] = highnib | enable;
+	buf[1] = highnib & ~enable;
+	buf[2] = lownib | enable;
+	buf[3] = lownib & ~enable;
+
+	return I2C_LCD1602_BYTES_PER_CHAR;
+	/* }}} */
+}
+
+
+/** Encode a standalone instruction or character into 'buf', which must have
+ * room for I2C_LCD1602_BYTES_PER_COMMAND bytes. This is the same as
+ * i2c_lcd1602_encode_4bitmode() except that 'mode' is presented to the
+ * controller first so that RS is stable before E rises (page 49 of the
+ * HD44780 datasheet, tAS).
+ *
+ * Returns the number of bytes written to 'buf'.
+ */
+size_t i2c_lcd1602_encode_command(const struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, uint8_t data, uint8_t mode) {
+	/* {{{ */
+	buf[0] = mode & ~i2c_lcd1602->enable;
+
+	return 1 + i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &buf[1], data, mode);
+	/* }}} */
+}
+
+
+/** Send 'n' raw bytes to the PCF8574 using as few write() calls as possible.
+ * i2c-dev turns each write() into one i2c message, and some adapters cannot
+ * handle messages as long as I2C_LCD1602_XFER_MAX. A write the adapter
+ * rejects (EINVAL, EOPNOTSUPP or EMSGSIZE, the same errors the bus scheduler
+ * takes as a rejection) sent nothing, so the maximum message length for this
+ * LCD is halved and the write is retried in smaller chunks, and the limit of
+ * the adapter is only discovered once. A write interrupted by a signal is
+ * retried as it was. Any other failure, such as EIO from a NAK part way, may
+ * have cut a transfer short after some of its nibbles were latched, so it is
+ * not retried: the LCD is marked out of sync (see i2c_lcd1602_resync()). A
+ * transport that writes nothing is taken to have failed with EIO.
+ *
+ * Returns 0 on success, and -1 if the bytes could not be written.
+ */
+int i2c_lcd1602_write_bytes(struct i2c_lcd1602 *i2c_lcd1602, const uint8_t *buf,
+	size_t n) {
+	/* {{{ */
+	while (n > 0) {
+		size_t chunk = n < i2c_lcd1602->xfer_max ? n : i2c_lcd1602->xfer_max;
+		ssize_t r = i2c_lcd1602->transport->write(i2c_lcd1602, buf, chunk);
+
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR) continue;
+			I2C_LCD1602_STATS_ADD(i2c_lcd1602, transfer_failures, 1);
+			/* A transport that takes nothing would be called forever */
+			if (r == 0) errno = EIO;
+			/* If the adapter rejected a message this long, lower the limit
+			 * and try again */
+			int rejected = errno == EINVAL || errno == EOPNOTSUPP \
+				|| errno == EMSGSIZE;
+			if (rejected && chunk > 1) {
+				i2c_lcd1602->xfer_max = chunk / 2;
+				continue;
+			}
+			/* Whatever was sent before this chunk has been latched, but not
+			 * the rest */
+			i2c_lcd1602->out_of_sync = 1;
+			return -1;
+		}
+
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, bytes_written, r);
+		buf += r;
+		n -= r;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Copy the statistics of the i2c LCD into 'stats'. All zeros if the
+ * library was compiled with I2C_LCD1602_NO_STATS. */
+void i2c_lcd1602_stats_snapshot(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_stats *stats) {
+	/* {{{ */
+	*stats = i2c_lcd1602->stats;
+	/* }}} */
+}
+
+
+/** Start the statistics of the i2c LCD over from zero */
+void i2c_lcd1602_stats_reset(struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	memset(&i2c_lcd1602->stats, 0, sizeof(i2c_lcd1602->stats));
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd1602_fd_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	return write(i2c_lcd1602->fd, buf, n);
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd1602_fd_read(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, size_t n) {
+	/* {{{ */
+	return read(i2c_lcd1602->fd, buf, n);
+	/* }}} */
+}
+
+
+/** Perform each message with its own write() or read() call */
+static int i2c_lcd1602_fd_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		ssize_t r;
+
+		if (msgs[i].read) r = read(i2c_lcd1602->fd, msgs[i].buf, msgs[i].len);
+		else r = write(i2c_lcd1602->fd, msgs[i].buf, msgs[i].len);
+
+		if (r != (ssize_t) msgs[i].len) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+const struct i2c_lcd1602_transport i2c_lcd1602_fd_transport = {
+	.write = i2c_lcd1602_fd_write,
+	.read = i2c_lcd1602_fd_read,
+	.submit = i2c_lcd1602_fd_submit
+};
+
+
+/** Perform the messages as I2C_RDWR transactions of up to
+ * I2C_RDWR_IOCTL_MAX_MSGS messages each, joined by repeated starts */
+static int i2c_lcd1602_rdwr_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	struct i2c_msg i2c_msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+
+	while (n > 0) {
+		size_t batch = n < I2C_RDWR_IOCTL_MAX_MSGS ? n : I2C_RDWR_IOCTL_MAX_MSGS;
+		struct i2c_rdwr_ioctl_data data = {
+			.msgs = i2c_msgs,
+			.nmsgs = batch
+		};
+
+		for (size_t i = 0; i < batch; i++) {
+			i2c_msgs[i] = (struct i2c_msg) {
+				.addr = i2c_lcd1602->address,
+				.flags = msgs[i].read ? I2C_M_RD : 0,
+				.len = msgs[i].len,
+				.buf = msgs[i].buf
+			};
+		}
+
+		if (0 > ioctl(i2c_lcd1602->fd, I2C_RDWR, &data)) return -1;
+
+		msgs += batch;
+		n -= batch;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd1602_rdwr_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	struct i2c_lcd1602_msg msg = { .buf = (uint8_t *) buf, .len = n };
+
+	if (0 != i2c_lcd1602_rdwr_submit(i2c_lcd1602, &msg, 1)) return -1;
+
+	return n;
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd1602_rdwr_read(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, size_t n) {
+	/* {{{ */
+	struct i2c_lcd1602_msg msg = { .buf = buf, .len = n, .read = 1 };
+
+	if (0 != i2c_lcd1602_rdwr_submit(i2c_lcd1602, &msg, 1)) return -1;
+
+	return n;
+	/* }}} */
+}
+
+
+const struct i2c_lcd1602_transport i2c_lcd1602_rdwr_transport = {
+	.write = i2c_lcd1602_rdwr_write,
+	.read = i2c_lcd1602_rdwr_read,
+	.submit = i2c_lcd1602_rdwr_submit
+};
+
+
+/** Perform one SMBus transfer on the file descriptor of the LCD */
+static int i2c_lcd1602_smbus_access(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t read_write, uint8_t command, int size, union i2c_smbus_data *data) {
+	/* {{{ */
+	struct i2c_smbus_ioctl_data args = {
+		.read_write = read_write,
+		.command = command,
+		.size = size,
+		.data = data
+	};
+
+	return ioctl(i2c_lcd1602->fd, I2C_SMBUS, &args);
+	/* }}} */
+}
+
+
+/** Write as many bytes as one SMBus transfer allows. The PCF8574 has no
+ * registers, so the "command" byte of each SMBus write is just the first byte
+ * to output: an I2C block write sends up to I2C_SMBUS_BLOCK_MAX + 1 bytes
+ * (without the count byte of an SMBus block write, which the PCF8574 would
+ * output too), a byte data write sends 2 and a send byte sends 1.
+ *
+ * Returns the number of bytes written, or -1 on failure.
+ */
+static ssize_t i2c_lcd1602_smbus_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	union i2c_smbus_data data;
+	unsigned long funcs = i2c_lcd1602->funcs;
+	size_t max = n < i2c_lcd1602->xfer_max ? n : i2c_lcd1602->xfer_max;
+
+	if (max == 0) return 0;
+
+	if (max > 2 && (funcs & I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)) {
+		size_t len = max - 1 < I2C_SMBUS_BLOCK_MAX ? max - 1 : I2C_SMBUS_BLOCK_MAX;
+		data.block[0] = len;
+		memcpy(&data.block[1], &buf[1], len);
+		if (0 > i2c_lcd1602_smbus_access(i2c_lcd1602, I2C_SMBUS_WRITE, buf[0], \
+			I2C_SMBUS_I2C_BLOCK_DATA, &data)) {
+			return -1;
+		}
+		return 1 + len;
+	}
+
+	if (max > 1 && (funcs & I2C_FUNC_SMBUS_WRITE_BYTE_DATA)) {
+		data.byte = buf[1];
+		if (0 > i2c_lcd1602_smbus_access(i2c_lcd1602, I2C_SMBUS_WRITE, buf[0], \
+			I2C_SMBUS_BYTE_DATA, &data)) {
+			return -1;
+		}
+		return 2;
+	}
+
+	if (0 > i2c_lcd1602_smbus_access(i2c_lcd1602, I2C_SMBUS_WRITE, buf[0], \
+		I2C_SMBUS_BYTE, NULL)) {
+		return -1;
+	}
+	return 1;
+	/* }}} */
+}
+
+
+/** Read 'n' bytes with one SMBus receive byte each */
+static ssize_t i2c_lcd1602_smbus_read(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, size_t n) {
+	/* {{{ */
+	union i2c_smbus_data data;
+
+	for (size_t i = 0; i < n; i++) {
+		if (0 > i2c_lcd1602_smbus_access(i2c_lcd1602, I2C_SMBUS_READ, 0, \
+			I2C_SMBUS_BYTE, &data)) {
+			return -1;
+		}
+		buf[i] = data.byte;
+	}
+
+	return n;
+	/* }}} */
+}
+
+
+/** Perform each message with as many SMBus transfers as it takes. SMBus cannot
+ * join messages with repeated starts, but the PCF8574 does not need them. */
+static int i2c_lcd1602_smbus_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (msgs[i].read) {
+			if (0 > i2c_lcd1602_smbus_read(i2c_lcd1602, msgs[i].buf, msgs[i].len)) {
+				return -1;
+			}
+			continue;
+		}
+
+		for (size_t done = 0; done < msgs[i].len; ) {
+			ssize_t r = i2c_lcd1602_smbus_write(i2c_lcd1602, &msgs[i].buf[done], \
+				msgs[i].len - done);
+			if (r < 0) return -1;
+			done += r;
+		}
+	}
+
+	return 0;
 	/* }}} */
 }
 
 
+const struct i2c_lcd1602_transport i2c_lcd1602_smbus_transport = {
+	.write = i2c_lcd1602_smbus_write,
+	.read = i2c_lcd1602_smbus_read,
+	.submit = i2c_lcd1602_smbus_submit
+};
+
+
 uint8_t set_mode(uint8_t rs, uint8_t rw) {
 	/* {{{ */
 	uint8_t mode = 0x00; // 00000000
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
 
 /* Constants for command types (page 24 of HD44780 datasheet) */
 #define LCD_CLEARDISPLAY 0x01
@@ -47,11 +49,151 @@
 #define LCD_NOBACKLIGHT 0x00
 
 /* Constants for the Enable bit, the Read/Write bit, and the Register Select
- * bit */
+ * bit. Modules with two controllers (such as 40x4) wire the enable input of the
+ * second to another output of the PCF8574, see i2c_lcd1602_set_enable(). */
 #define E 0x04
 #define Rw 0x02
 #define Rs 0x01
 
+/* The number of bytes sent to the PCF8574 to transfer one full 8-bit
+ * instruction or character in 4-bit mode when the enable strobe is left to
+ * the timing of the i2c bus (see i2c_lcd1602_encode_4bitmode()) */
+#define I2C_LCD1602_BYTES_PER_CHAR 4
+/* The number of bytes needed to send a standalone instruction, i.e. one whose
+ * RS value must first be presented to the controller before the first enable
+ * strobe (see i2c_lcd1602_encode_command()) */
+#define I2C_LCD1602_BYTES_PER_COMMAND (1 + I2C_LCD1602_BYTES_PER_CHAR)
+/* The largest message i2c-dev will accept in a single write() call. Adapters
+ * may support less than this, in which case it is lowered at runtime */
+#define I2C_LCD1602_XFER_MAX 8192
+/* The value of the address counter in the register model of an LCD when where
+ * it is is not known, or it is in CGRAM */
+#define I2C_LCD1602_AC_UNKNOWN 0xff
+
+/* The types of instruction (page 24 of the HD44780 datasheet), plus writing
+ * data, which differ in how long the controller takes to execute them */
+enum i2c_lcd1602_command_type {
+	I2C_LCD1602_CMD_CLEAR,
+	I2C_LCD1602_CMD_HOME,
+	I2C_LCD1602_CMD_ENTRY_MODE,
+	I2C_LCD1602_CMD_DISPLAY_CONTROL,
+	I2C_LCD1602_CMD_SHIFT,
+	I2C_LCD1602_CMD_FUNCTION_SET,
+	I2C_LCD1602_CMD_SET_CGRAM,
+	I2C_LCD1602_CMD_SET_DDRAM,
+	I2C_LCD1602_CMD_DATA,
+	I2C_LCD1602_CMD_TYPES
+};
+
+/* How long (in nanoseconds) to wait around each enable strobe sent by
+ * i2c_lcd1602_write_4bits(), how long the controller is busy after each
+ * type of instruction, and how long one byte takes on the i2c bus (which is
+ * only used to estimate the cost of different ways of doing the same thing) */
+struct i2c_lcd1602_timing {
+	long strobe_setup_ns;
+	long strobe_hold_ns;
+	long nibble_ns;
+	long exec_ns[I2C_LCD1602_CMD_TYPES];
+	long bus_byte_ns;
+};
+
+extern const struct i2c_lcd1602_timing i2c_lcd1602_datasheet_timing;
+extern const struct i2c_lcd1602_timing i2c_lcd1602_safe_timing;
+
+/* How the library waits for the controller: for the delays around each
+ * enable strobe, and until it has executed the last instruction (see
+ * i2c_lcd1602_set_wait()) */
+enum i2c_lcd1602_wait_mode {
+	/* nanosleep() for the time left */
+	I2C_LCD1602_WAIT_SLEEP,
+	/* clock_nanosleep() with TIMER_ABSTIME until the deadline, so time spent
+	 * between setting the deadline and waiting for it, or in a signal
+	 * handler, is not added to the wait */
+	I2C_LCD1602_WAIT_ABSTIME,
+	/* Spin on the clock until the deadline, never giving up the CPU */
+	I2C_LCD1602_WAIT_SPIN,
+	/* Sleep as with I2C_LCD1602_WAIT_ABSTIME until the spin threshold before
+	 * the deadline, then spin */
+	I2C_LCD1602_WAIT_HYBRID,
+	I2C_LCD1602_WAIT_MODES
+};
+
+/* The spin threshold of I2C_LCD1602_WAIT_HYBRID until it is calibrated (see
+ * i2c_lcd1602_calibrate_wait()), about the time a short sleep overshoots by
+ * with the default timer slack of Linux */
+#define I2C_LCD1602_SPIN_THRESHOLD_NS 100000
+
+/* The number of buckets in the latency histogram. Bucket i counts calls that
+ * took at least 2^i and less than 2^(i + 1) nanoseconds (the last bucket also
+ * counts anything longer). */
+#define I2C_LCD1602_LATENCY_BUCKETS 32
+
+/* Counters kept for each LCD so that time spent on the bus, sleeping and in
+ * the application can be told apart. Compile with -DI2C_LCD1602_NO_STATS to
+ * remove the cost of keeping them entirely. */
+struct i2c_lcd1602_stats {
+	/* Instructions and characters sent, by type */
+	uint64_t commands[I2C_LCD1602_CMD_TYPES];
+	/* Instructions not sent because the controller already had the state
+	 * they set (see i2c_lcd1602_command()) */
+	uint64_t commands_skipped;
+	uint64_t bytes_written;
+	uint64_t bytes_read;
+	/* Transport writes, reads and transactions that failed */
+	uint64_t transfer_failures;
+	/* Calls to i2c_lcd1602_resync() that succeeded, and the total time spent
+	 * in them */
+	uint64_t resyncs;
+	uint64_t resync_ns;
+	/* Calls to nanosleep() and the total time spent in them */
+	uint64_t sleeps;
+	uint64_t sleep_ns;
+	/* Waits (see i2c_lcd1602_set_wait()), the total time spent spinning in
+	 * them, and how late they ended: in total, at worst, and as a histogram
+	 * with the same buckets as 'latency_hist' */
+	uint64_t waits;
+	uint64_t spin_ns;
+	uint64_t wait_late_ns;
+	uint64_t wait_late_max_ns;
+	uint64_t wait_late_hist[I2C_LCD1602_LATENCY_BUCKETS];
+	/* Wall clock time of each instruction sent with i2c_lcd1602_command()
+	 * and each call to i2c_lcd1602_write_buffer(), including waiting for the
+	 * controller */
+	uint64_t latency_hist[I2C_LCD1602_LATENCY_BUCKETS];
+};
+
+struct i2c_lcd1602;
+
+/* One message of a transaction given to the submit function of a transport */
+struct i2c_lcd1602_msg {
+	uint8_t *buf;
+	size_t len;
+	/* Whether 'buf' should be read into rather than written */
+	uint8_t read;
+};
+
+/* How bytes get to and from the PCF8574. The write and read functions behave
+ * like write() and read(), returning the number of bytes transferred or -1
+ * (with errno set) on failure. The submit function performs 'n' messages in
+ * order as one transaction, returning 0 on success and -1 on failure. */
+struct i2c_lcd1602_transport {
+	ssize_t (*write)(struct i2c_lcd1602 *i2c_lcd1602, const uint8_t *buf, size_t n);
+	ssize_t (*read)(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, size_t n);
+	int (*submit)(struct i2c_lcd1602 *i2c_lcd1602, struct i2c_lcd1602_msg *msgs, size_t n);
+};
+
+/* Transports that use the i2c-dev file descriptor of the LCD, cheapest first.
+ * i2c_lcd1602_init() picks the cheapest one the adapter supports, see
+ * i2c_lcd1602_select_transport().
+ *  - rdwr: I2C_RDWR, which performs every message of a transaction (such as
+ *    the writes and reads of i2c_lcd1602_read_4bitmode()) in one ioctl()
+ *  - smbus: SMBus I2C block writes of up to 33 bytes, or byte writes of 2 or 1
+ *    bytes, for adapters that cannot do plain i2c
+ *  - fd: write() and read(), one message per call */
+extern const struct i2c_lcd1602_transport i2c_lcd1602_rdwr_transport;
+extern const struct i2c_lcd1602_transport i2c_lcd1602_smbus_transport;
+extern const struct i2c_lcd1602_transport i2c_lcd1602_fd_transport;
+
 struct i2c_lcd1602 {
 	int fd;
 	uint8_t address;
@@ -61,33 +203,167 @@ struct i2c_lcd1602 {
 	uint8_t backlight;
 	uint8_t entry_shift;
 	uint8_t entry_shift_increment;
+	/* The last function set and display control instructions sent, which
+	 * i2c_lcd1602_resync() sends again */
+	uint8_t function;
+	uint8_t display;
+	/* The register model of the controller (see i2c_lcd1602_track()): whether
+	 * 'function', 'display' and the entry mode are known to be what the
+	 * controller has, and the DDRAM address in its address counter, or
+	 * I2C_LCD1602_AC_UNKNOWN. With 'skip_redundant' set, instructions that
+	 * would not change them are not sent. */
+	uint8_t regs_known;
+	uint8_t ac;
+	uint8_t skip_redundant;
+	/* Set when a transfer to the controller failed part way, after which it
+	 * may have latched an odd number of nibbles and be reading every byte
+	 * as the low nibble of one and the high nibble of the next. Cleared by
+	 * i2c_lcd1602_resync(). */
+	uint8_t out_of_sync;
+	/* The PCF8574 output wired to the enable input of the controller, E unless
+	 * it is the second controller of a module that has two */
+	uint8_t enable;
+	size_t xfer_max;
+	/* What the i2c adapter can do (I2C_FUNCS), or 0 if unknown */
+	unsigned long funcs;
+	struct i2c_lcd1602_timing timing;
+	/* CLOCK_MONOTONIC time until which the controller is still executing the
+	 * last instruction sent */
+	struct timespec busy_until;
+	/* Whether to poll the busy flag while waiting for the controller, and how
+	 * often and for how long to do so */
+	uint8_t busy_poll;
+	long busy_poll_interval_ns;
+	long busy_poll_timeout_ns;
+	/* How to wait, and how close to the deadline I2C_LCD1602_WAIT_HYBRID
+	 * starts spinning */
+	enum i2c_lcd1602_wait_mode wait_mode;
+	long spin_threshold_ns;
+	const struct i2c_lcd1602_transport *transport;
+	/* Data for transports other than i2c_lcd1602_fd_transport */
+	void *transport_ctx;
+	struct i2c_lcd1602_stats stats;
 };
 
+#ifndef I2C_LCD1602_NO_STATS
+#define I2C_LCD1602_STATS_ADD(i2c_lcd1602, field, n) \
+	((i2c_lcd1602)->stats.field += (n))
+#else
+#define I2C_LCD1602_STATS_ADD(i2c_lcd1602, field, n) ((void) 0)
+#endif
+
+/** Count 'n' instructions or characters of type 'type' as sent */
+static inline void i2c_lcd1602_stats_count(struct i2c_lcd1602 *i2c_lcd1602, \
+	enum i2c_lcd1602_command_type type, uint64_t n) {
+	I2C_LCD1602_STATS_ADD(i2c_lcd1602, commands[type], n);
+}
+
+/** Return the histogram bucket that 'ns' nanoseconds falls in */
+static inline int i2c_lcd1602_stats_bucket(long ns) {
+	int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+	if (bucket >= I2C_LCD1602_LATENCY_BUCKETS) {
+		bucket = I2C_LCD1602_LATENCY_BUCKETS - 1;
+	}
+	return bucket;
+}
+
+/** Add one call that took 'ns' nanoseconds to the latency histogram */
+static inline void i2c_lcd1602_stats_latency(struct i2c_lcd1602 *i2c_lcd1602, \
+	long ns) {
+#ifndef I2C_LCD1602_NO_STATS
+	i2c_lcd1602->stats.latency_hist[i2c_lcd1602_stats_bucket(ns)]++;
+#endif
+}
+
 
 struct i2c_lcd1602 i2c_lcd1602_init(int i2c_lcd_fd, uint8_t periph_addr,
 	uint8_t columns, uint8_t rows, uint8_t dotsize, uint8_t backlight);
 
+void i2c_lcd1602_set_transport(struct i2c_lcd1602 *i2c_lcd1602, const struct i2c_lcd1602_transport *transport, void *transport_ctx);
+
+const struct i2c_lcd1602_transport *i2c_lcd1602_select_transport(struct i2c_lcd1602 *i2c_lcd1602);
+
+void i2c_lcd1602_set_enable(struct i2c_lcd1602 *i2c_lcd1602, uint8_t enable);
+
 void i2c_lcd1602_begin(struct i2c_lcd1602 *i2c_lcd1602);
 
-void i2c_lcd1602_clear_display(struct i2c_lcd1602 *i2c_lcd1602);
+int i2c_lcd1602_begin_warm(struct i2c_lcd1602 *i2c_lcd1602);
+
+int i2c_lcd1602_probe(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac);
+
+int i2c_lcd1602_resync(struct i2c_lcd1602 *i2c_lcd1602);
+
+uint8_t i2c_lcd1602_row_offset(const struct i2c_lcd1602 *i2c_lcd1602, uint8_t row);
+
+int i2c_lcd1602_clear_display(struct i2c_lcd1602 *i2c_lcd1602);
+
+int i2c_lcd1602_set_cursor_pos(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac);
+
+int i2c_lcd1602_set_cgram_addr(struct i2c_lcd1602 *i2c_lcd1602, uint8_t acg);
+
+int i2c_lcd1602_create_char(struct i2c_lcd1602 *i2c_lcd1602, uint8_t location, const uint8_t rows[8]);
+
+int i2c_lcd1602_cursor_home(struct i2c_lcd1602 *i2c_lcd1602);
+
+int i2c_lcd1602_entry_mode_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t increment, uint8_t shift);
+
+int i2c_lcd1602_display_control(struct i2c_lcd1602 *i2c_lcd1602, uint8_t display, uint8_t cursor, uint8_t cursorblinking);
+
+int i2c_lcd1602_shift(struct i2c_lcd1602 *i2c_lcd1602, uint8_t screen_cursor, uint8_t right_left);
+
+int i2c_lcd1602_function_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data_length, uint8_t display_lines, uint8_t font);
+
+int i2c_lcd1602_send_char(struct i2c_lcd1602 *i2c_lcd1602, char c);
+
+int i2c_lcd1602_write_buffer(struct i2c_lcd1602 *i2c_lcd1602, const char *buf, size_t n);
+
+int i2c_lcd1602_set_backlight(struct i2c_lcd1602 *i2c_lcd1602, uint8_t backlight);
+
+enum i2c_lcd1602_command_type i2c_lcd1602_command_type(uint8_t data, uint8_t mode);
+
+long i2c_lcd1602_command_cost(const struct i2c_lcd1602 *i2c_lcd1602, enum i2c_lcd1602_command_type type);
+
+long i2c_lcd1602_write_buffer_cost(const struct i2c_lcd1602 *i2c_lcd1602, size_t n);
+
+void i2c_lcd1602_set_busy(struct i2c_lcd1602 *i2c_lcd1602, long ns);
+
+void i2c_lcd1602_wait_ready(struct i2c_lcd1602 *i2c_lcd1602);
+
+void i2c_lcd1602_set_busy_poll(struct i2c_lcd1602 *i2c_lcd1602, uint8_t enable, long interval_ns, long timeout_ns);
+
+void i2c_lcd1602_set_wait(struct i2c_lcd1602 *i2c_lcd1602, enum i2c_lcd1602_wait_mode mode, long spin_threshold_ns);
+
+long i2c_lcd1602_calibrate_wait(struct i2c_lcd1602 *i2c_lcd1602);
+
+void i2c_lcd1602_wait_until(struct i2c_lcd1602 *i2c_lcd1602, const struct timespec *deadline);
+
+int i2c_lcd1602_read_busy_ac(struct i2c_lcd1602 *i2c_lcd1602, uint8_t *ac);
+
+int i2c_lcd1602_read_buffer(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac, uint8_t *buf, size_t n);
+
+int i2c_lcd1602_read_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t mode, uint8_t *data);
+
+int i2c_lcd1602_command(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, uint8_t mode);
+
+void i2c_lcd1602_track(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, uint8_t mode);
 
-void i2c_lcd1602_set_cursor_pos(struct i2c_lcd1602 *i2c_lcd1602, uint8_t ac);
+void i2c_lcd1602_forget(struct i2c_lcd1602 *i2c_lcd1602);
 
-void i2c_lcd1602_cursor_home(struct i2c_lcd1602 *i2c_lcd1602);
+void i2c_lcd1602_set_skip_redundant(struct i2c_lcd1602 *i2c_lcd1602, uint8_t enable);
 
-void i2c_lcd1602_entry_mode_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t increment, uint8_t shift);
+int i2c_lcd1602_write_4bits(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data_and_mode);
 
-void i2c_lcd1602_display_control(struct i2c_lcd1602 *i2c_lcd1602, uint8_t display, uint8_t cursor, uint8_t cursorblinking);
+int i2c_lcd1602_write_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, uint8_t mode);
 
-void i2c_lcd1602_shift(struct i2c_lcd1602 *i2c_lcd1602, uint8_t screen_cursor, uint8_t right_left);
+size_t i2c_lcd1602_encode_4bitmode(const struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, uint8_t data, uint8_t mode);
 
-void i2c_lcd1602_function_set(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data_length, uint8_t display_lines, uint8_t font);
+size_t i2c_lcd1602_encode_command(const struct i2c_lcd1602 *i2c_lcd1602, uint8_t *buf, uint8_t data, uint8_t mode);
 
-void i2c_lcd1602_send_char(struct i2c_lcd1602 *i2c_lcd1602, char c);
+int i2c_lcd1602_write_bytes(struct i2c_lcd1602 *i2c_lcd1602, const uint8_t *buf, size_t n);
 
-void i2c_lcd1602_set_backlight(struct i2c_lcd1602 *i2c_lcd1602, uint8_t backlight);
+void i2c_lcd1602_stats_snapshot(struct i2c_lcd1602 *i2c_lcd1602, struct i2c_lcd1602_stats *stats);
 
-void i2c_lcd1602_write_4bitmode(struct i2c_lcd1602 *i2c_lcd1602, uint8_t data, uint8_t mode);
+void i2c_lcd1602_stats_reset(struct i2c_lcd1602 *i2c_lcd1602);
 
 uint8_t set_mode(uint8_t rs, uint8_t rw);
 
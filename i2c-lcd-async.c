@@ -0,0 +1,332 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-async.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+#define I2C_LCD_ASYNC_RING_MASK (I2C_LCD_ASYNC_RING_SIZE - 1)
+
+
+/** Wake up anyone waiting in i2c_lcd_async_submit() or i2c_lcd_async_flush()
+ * for the writer thread to make progress */
+static void i2c_lcd_async_notify(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	if (atomic_load(&i2c_lcd_async->waiters)) {
+		pthread_mutex_lock(&i2c_lcd_async->lock);
+		pthread_cond_broadcast(&i2c_lcd_async->progress);
+		pthread_mutex_unlock(&i2c_lcd_async->lock);
+	}
+	/* }}} */
+}
+
+
+/** The writer thread. Takes entries from the ring, encodes as many of them as
+ * possible into one transaction and sends them to the LCD, waiting for the
+ * controller only when it is still busy with the previous transaction. */
+static void *i2c_lcd_async_writer(void *arg) {
+	/* {{{ */
+	struct i2c_lcd_async *i2c_lcd_async = arg;
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_async->i2c_lcd1602;
+	uint8_t bytes[I2C_LCD_ASYNC_BATCH_MAX];
+	/* The entries encoded into 'bytes', which only update the register model
+	 * once they have been claimed and sent */
+	uint16_t entries[I2C_LCD_ASYNC_BATCH_MAX / I2C_LCD1602_BYTES_PER_CHAR];
+
+	while (1) {
+		size_t tail = atomic_load(&i2c_lcd_async->tail);
+		size_t head = atomic_load(&i2c_lcd_async->head);
+
+		/* If there is nothing to do, sleep until there is */
+		if (tail == head) {
+			if (!atomic_load(&i2c_lcd_async->running)) break;
+
+			pthread_mutex_lock(&i2c_lcd_async->lock);
+			atomic_store(&i2c_lcd_async->writer_sleeping, 1);
+			while (atomic_load(&i2c_lcd_async->tail) \
+				== atomic_load(&i2c_lcd_async->head) \
+				&& atomic_load(&i2c_lcd_async->running)) {
+
+				pthread_cond_wait(&i2c_lcd_async->wake, &i2c_lcd_async->lock);
+			}
+			atomic_store(&i2c_lcd_async->writer_sleeping, 0);
+			pthread_mutex_unlock(&i2c_lcd_async->lock);
+			continue;
+		}
+
+		/* Encode entries until the transaction is full. Instructions and
+		 * characters that execute faster than the bus can send the next one
+		 * need no delay after them, but the batch must end after anything
+		 * slower (clear display, return home) */
+		size_t len = 0;
+		size_t n = 0;
+		int last_mode = -1;
+		enum i2c_lcd1602_command_type last = I2C_LCD1602_CMD_DATA;
+		long bus_covered_ns = i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA];
+		uint64_t counts[I2C_LCD1602_CMD_TYPES] = { 0 };
+
+		while (tail + n != head \
+			&& len + I2C_LCD1602_BYTES_PER_COMMAND <= sizeof(bytes)) {
+
+			uint16_t entry = atomic_load_explicit( \
+				&i2c_lcd_async->ring[(tail + n) & I2C_LCD_ASYNC_RING_MASK], \
+				memory_order_relaxed);
+			uint8_t data = entry & 0xff;
+			uint8_t mode = entry >> 8;
+
+			/* Only present RS separately when it changes */
+			if (mode != last_mode) {
+				len += i2c_lcd1602_encode_command(i2c_lcd1602, &bytes[len], data, \
+					mode);
+			} else {
+				len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, &bytes[len], data, \
+					mode);
+			}
+			last_mode = mode;
+			last = i2c_lcd1602_command_type(data, mode);
+			counts[last]++;
+			entries[n++] = entry;
+
+			if (i2c_lcd1602->timing.exec_ns[last] > bus_covered_ns) break;
+		}
+
+		/* Claim the entries. If the producer dropped the oldest entries in
+		 * the meantime then what was read may have been overwritten, so try
+		 * again. Nothing read so far has touched the register model. */
+		if (!atomic_compare_exchange_strong(&i2c_lcd_async->tail, &tail, \
+			tail + n)) {
+
+			continue;
+		}
+
+		/* A failed transfer may have left the controller expecting the low
+		 * nibble, so bring it back in step before sending anything else */
+		if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+			atomic_fetch_add(&i2c_lcd_async->errors, 1);
+		}
+
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+		if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, bytes, len)) {
+			/* The entries are lost, and where the controller got to with
+			 * them is unknown until the resync before the next batch */
+			atomic_fetch_add(&i2c_lcd_async->errors, 1);
+		} else {
+			/* Keep the register model (and so the mode state
+			 * i2c_lcd1602_resync() sends again) up to date */
+			for (size_t i = 0; i < n; i++) {
+				i2c_lcd1602_track(i2c_lcd1602, entries[i] & 0xff, entries[i] >> 8);
+			}
+			for (int i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+				i2c_lcd1602_stats_count(i2c_lcd1602, i, counts[i]);
+			}
+		}
+		i2c_lcd1602_set_busy(i2c_lcd1602, i2c_lcd1602->timing.exec_ns[last]);
+
+		atomic_store(&i2c_lcd_async->done, tail + n);
+		i2c_lcd_async_notify(i2c_lcd_async);
+	}
+
+	return NULL;
+	/* }}} */
+}
+
+
+/** Start a writer thread for the given i2c LCD. From then on, instructions
+ * for the LCD should be submitted through 'i2c_lcd_async' (from a single
+ * thread) rather than by calling the i2c_lcd1602_* functions directly, until
+ * i2c_lcd_async_stop() is called. 'policy' decides what happens when
+ * instructions are submitted faster than the LCD can take them.
+ *
+ * Returns 0 on success, and -1 if the writer thread could not be started.
+ */
+int i2c_lcd_async_start(struct i2c_lcd_async *i2c_lcd_async, \
+	struct i2c_lcd1602 *i2c_lcd1602, enum i2c_lcd_async_policy policy) {
+	/* {{{ */
+	i2c_lcd_async->i2c_lcd1602 = i2c_lcd1602;
+	i2c_lcd_async->policy = policy;
+	atomic_init(&i2c_lcd_async->head, 0);
+	atomic_init(&i2c_lcd_async->tail, 0);
+	atomic_init(&i2c_lcd_async->done, 0);
+	atomic_init(&i2c_lcd_async->dropped, 0);
+	atomic_init(&i2c_lcd_async->errors, 0);
+	atomic_init(&i2c_lcd_async->running, 1);
+	atomic_init(&i2c_lcd_async->writer_sleeping, 0);
+	atomic_init(&i2c_lcd_async->waiters, 0);
+	pthread_mutex_init(&i2c_lcd_async->lock, NULL);
+	pthread_cond_init(&i2c_lcd_async->wake, NULL);
+	pthread_cond_init(&i2c_lcd_async->progress, NULL);
+
+	if (0 != pthread_create(&i2c_lcd_async->thread, NULL, \
+		i2c_lcd_async_writer, i2c_lcd_async)) {
+
+		pthread_mutex_destroy(&i2c_lcd_async->lock);
+		pthread_cond_destroy(&i2c_lcd_async->wake);
+		pthread_cond_destroy(&i2c_lcd_async->progress);
+		return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Send everything still in the ring to the LCD and stop the writer thread */
+void i2c_lcd_async_stop(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	pthread_mutex_lock(&i2c_lcd_async->lock);
+	atomic_store(&i2c_lcd_async->running, 0);
+	pthread_cond_signal(&i2c_lcd_async->wake);
+	pthread_mutex_unlock(&i2c_lcd_async->lock);
+
+	pthread_join(i2c_lcd_async->thread, NULL);
+
+	pthread_mutex_destroy(&i2c_lcd_async->lock);
+	pthread_cond_destroy(&i2c_lcd_async->wake);
+	pthread_cond_destroy(&i2c_lcd_async->progress);
+	/* }}} */
+}
+
+
+/** Queue an instruction (or character, depending on 'mode') for the writer
+ * thread. In the common case this is a few atomic loads and stores; the lock
+ * is only taken if the writer thread is asleep or the ring is full and the
+ * policy is I2C_LCD_ASYNC_BLOCK.
+ *
+ * Returns 0 if the entry was queued, and -1 if it was dropped.
+ */
+int i2c_lcd_async_submit(struct i2c_lcd_async *i2c_lcd_async, uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	size_t head = atomic_load_explicit(&i2c_lcd_async->head, \
+		memory_order_relaxed);
+
+	while (head - atomic_load(&i2c_lcd_async->tail) >= I2C_LCD_ASYNC_RING_SIZE) {
+		if (i2c_lcd_async->policy == I2C_LCD_ASYNC_DROP_NEWEST) {
+			atomic_fetch_add(&i2c_lcd_async->dropped, 1);
+			return -1;
+		} else if (i2c_lcd_async->policy == I2C_LCD_ASYNC_DROP_OLDEST) {
+			size_t tail = head - I2C_LCD_ASYNC_RING_SIZE;
+			if (atomic_compare_exchange_strong(&i2c_lcd_async->tail, &tail, \
+				tail + 1)) {
+
+				atomic_fetch_add(&i2c_lcd_async->dropped, 1);
+			}
+		} else {
+			pthread_mutex_lock(&i2c_lcd_async->lock);
+			atomic_fetch_add(&i2c_lcd_async->waiters, 1);
+			while (head - atomic_load(&i2c_lcd_async->tail) \
+				>= I2C_LCD_ASYNC_RING_SIZE) {
+
+				pthread_cond_wait(&i2c_lcd_async->progress, &i2c_lcd_async->lock);
+			}
+			atomic_fetch_sub(&i2c_lcd_async->waiters, 1);
+			pthread_mutex_unlock(&i2c_lcd_async->lock);
+		}
+	}
+
+	atomic_store_explicit(&i2c_lcd_async->ring[head & I2C_LCD_ASYNC_RING_MASK], \
+		(uint16_t) ((mode << 8) | data), memory_order_relaxed);
+	atomic_store(&i2c_lcd_async->head, head + 1);
+
+	if (atomic_load(&i2c_lcd_async->writer_sleeping)) {
+		pthread_mutex_lock(&i2c_lcd_async->lock);
+		pthread_cond_signal(&i2c_lcd_async->wake);
+		pthread_mutex_unlock(&i2c_lcd_async->lock);
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Queue a character, see i2c_lcd1602_send_char() */
+int i2c_lcd_async_send_char(struct i2c_lcd_async *i2c_lcd_async, char c) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(1, 0) | i2c_lcd_async->i2c_lcd1602->backlight;
+
+	return i2c_lcd_async_submit(i2c_lcd_async, c, mode);
+	/* }}} */
+}
+
+
+/** Queue a run of 'n' characters, see i2c_lcd1602_write_buffer().
+ *
+ * Returns 0 if every character was queued, and -1 if any were dropped.
+ */
+int i2c_lcd_async_write_buffer(struct i2c_lcd_async *i2c_lcd_async, \
+	const char *buf, size_t n) {
+	/* {{{ */
+	int ret = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (0 != i2c_lcd_async_send_char(i2c_lcd_async, buf[i])) ret = -1;
+	}
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Queue setting the cursor position, see i2c_lcd1602_set_cursor_pos() */
+int i2c_lcd_async_set_cursor_pos(struct i2c_lcd_async *i2c_lcd_async, \
+	uint8_t ac) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd_async->i2c_lcd1602->backlight;
+
+	return i2c_lcd_async_submit(i2c_lcd_async, LCD_SETDDRAMADDR | ac, mode);
+	/* }}} */
+}
+
+
+/** Queue clearing the display, see i2c_lcd1602_clear_display() */
+int i2c_lcd_async_clear_display(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd_async->i2c_lcd1602->backlight;
+
+	return i2c_lcd_async_submit(i2c_lcd_async, LCD_CLEARDISPLAY, mode);
+	/* }}} */
+}
+
+
+/** Wait until everything submitted so far has been sent to the LCD */
+void i2c_lcd_async_flush(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	size_t target = atomic_load(&i2c_lcd_async->head);
+
+	pthread_mutex_lock(&i2c_lcd_async->lock);
+	atomic_fetch_add(&i2c_lcd_async->waiters, 1);
+	while (atomic_load(&i2c_lcd_async->done) < target) {
+		pthread_cond_wait(&i2c_lcd_async->progress, &i2c_lcd_async->lock);
+	}
+	atomic_fetch_sub(&i2c_lcd_async->waiters, 1);
+	pthread_mutex_unlock(&i2c_lcd_async->lock);
+	/* }}} */
+}
+
+
+/** Return how many batches the writer thread failed to send to the LCD, and
+ * how many times it failed to bring the LCD back in step afterwards (see
+ * i2c_lcd1602_resync()) */
+size_t i2c_lcd_async_errors(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	return atomic_load(&i2c_lcd_async->errors);
+	/* }}} */
+}
+
+
+/** Return how many entries have been dropped because the ring was full */
+size_t i2c_lcd_async_dropped(struct i2c_lcd_async *i2c_lcd_async) {
+	/* {{{ */
+	return atomic_load(&i2c_lcd_async->dropped);
+	/* }}} */
+}
@@ -0,0 +1,78 @@
+#ifndef I2C_LCD_ASYNC
+#define I2C_LCD_ASYNC
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-LCD1602.h"
+
+/* The number of instructions/characters the ring can hold. Must be a power of
+ * 2. */
+#define I2C_LCD_ASYNC_RING_SIZE 1024
+/* The most bytes the writer thread will send to the LCD in one transaction */
+#define I2C_LCD_ASYNC_BATCH_MAX 128
+
+/* What i2c_lcd_async_submit() does when the ring is full */
+enum i2c_lcd_async_policy {
+	/* Wait for the writer thread to make room */
+	I2C_LCD_ASYNC_BLOCK,
+	/* Discard the instruction being submitted */
+	I2C_LCD_ASYNC_DROP_NEWEST,
+	/* Discard the oldest instruction in the ring to make room */
+	I2C_LCD_ASYNC_DROP_OLDEST
+};
+
+struct i2c_lcd_async {
+	struct i2c_lcd1602 *i2c_lcd1602;
+	enum i2c_lcd_async_policy policy;
+	/* Each entry holds the mode (RS, R/W, backlight) in the high byte and the
+	 * instruction or character in the low byte */
+	_Atomic uint16_t ring[I2C_LCD_ASYNC_RING_SIZE];
+	/* The next position the producer will write to. Only the producer writes
+	 * this. Kept on its own cache line so the producer and writer thread do
+	 * not contend on it. */
+	_Alignas(64) atomic_size_t head;
+	/* The next position the writer thread will read from. Only the writer
+	 * thread writes this, except when the producer drops the oldest entry. */
+	_Alignas(64) atomic_size_t tail;
+	/* The position up to which entries have been sent to the LCD */
+	atomic_size_t done;
+	atomic_size_t dropped;
+	/* The number of failed transfers and resyncs of the writer thread */
+	atomic_size_t errors;
+	atomic_int running;
+	/* Set while the writer thread is waiting for work, and while a producer is
+	 * waiting for room or for the ring to drain, so that the other side only
+	 * takes the lock when someone actually needs waking */
+	_Alignas(64) atomic_int writer_sleeping;
+	atomic_int waiters;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t progress;
+	pthread_t thread;
+};
+
+
+int i2c_lcd_async_start(struct i2c_lcd_async *i2c_lcd_async, struct i2c_lcd1602 *i2c_lcd1602, enum i2c_lcd_async_policy policy);
+
+void i2c_lcd_async_stop(struct i2c_lcd_async *i2c_lcd_async);
+
+int i2c_lcd_async_submit(struct i2c_lcd_async *i2c_lcd_async, uint8_t data, uint8_t mode);
+
+int i2c_lcd_async_send_char(struct i2c_lcd_async *i2c_lcd_async, char c);
+
+int i2c_lcd_async_write_buffer(struct i2c_lcd_async *i2c_lcd_async, const char *buf, size_t n);
+
+int i2c_lcd_async_set_cursor_pos(struct i2c_lcd_async *i2c_lcd_async, uint8_t ac);
+
+int i2c_lcd_async_clear_display(struct i2c_lcd_async *i2c_lcd_async);
+
+void i2c_lcd_async_flush(struct i2c_lcd_async *i2c_lcd_async);
+
+size_t i2c_lcd_async_dropped(struct i2c_lcd_async *i2c_lcd_async);
+
+size_t i2c_lcd_async_errors(struct i2c_lcd_async *i2c_lcd_async);
+
+#endif
@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-bus.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+#define I2C_LCD_BUS_QUEUE_MASK (I2C_LCD_BUS_QUEUE - 1)
+
+
+/* One LCD's turn in a round: the bytes it is sent, the type of the last
+ * instruction or character in them, and how many of each type there are */
+struct i2c_lcd_bus_batch {
+	uint8_t bytes[I2C_LCD_BUS_BATCH_MAX];
+	size_t len;
+	enum i2c_lcd1602_command_type last;
+	uint64_t counts[I2C_LCD1602_CMD_TYPES];
+};
+
+
+/** Set up a bus with no LCDs. 'fd' is the i2c-dev file descriptor the LCDs
+ * share, or -1 if none of them use one. */
+void i2c_lcd_bus_init(struct i2c_lcd_bus *i2c_lcd_bus, int fd) {
+	/* {{{ */
+	memset(i2c_lcd_bus, 0, sizeof(*i2c_lcd_bus));
+	i2c_lcd_bus->fd = fd;
+	i2c_lcd_bus->slave = -1;
+	i2c_lcd_bus->combine = 1;
+	/* }}} */
+}
+
+
+/** Add an i2c LCD, which should have been started with i2c_lcd1602_begin()
+ * already. From then on, instructions for it should be queued through the
+ * bus rather than by calling the i2c_lcd1602_* functions directly.
+ *
+ * Returns the index of the LCD on the bus, which is passed to the other
+ * functions, or -1 if the bus is full.
+ */
+int i2c_lcd_bus_add(struct i2c_lcd_bus *i2c_lcd_bus, \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	if (i2c_lcd_bus->n_displays >= I2C_LCD_BUS_DISPLAYS) return -1;
+
+	struct i2c_lcd_bus_display *display = \
+		&i2c_lcd_bus->displays[i2c_lcd_bus->n_displays];
+	memset(display, 0, sizeof(*display));
+	display->i2c_lcd1602 = i2c_lcd1602;
+
+	return i2c_lcd_bus->n_displays++;
+	/* }}} */
+}
+
+
+/** Queue an instruction (or character, depending on 'mode') for LCD
+ * 'display'. If its queue is full, the bus is run until there is room.
+ *
+ * Returns 0 on success, and -1 if there is no such LCD.
+ */
+int i2c_lcd_bus_command(struct i2c_lcd_bus *i2c_lcd_bus, int display, \
+	uint8_t data, uint8_t mode) {
+	/* {{{ */
+	if (display < 0 || (size_t) display >= i2c_lcd_bus->n_displays) return -1;
+
+	struct i2c_lcd_bus_display *d = &i2c_lcd_bus->displays[display];
+	while (d->head - d->tail >= I2C_LCD_BUS_QUEUE) i2c_lcd_bus_step(i2c_lcd_bus);
+
+	d->queue[d->head & I2C_LCD_BUS_QUEUE_MASK] = (uint16_t) ((mode << 8) | data);
+	d->head++;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Queue a character, see i2c_lcd1602_send_char() */
+int i2c_lcd_bus_send_char(struct i2c_lcd_bus *i2c_lcd_bus, int display, \
+	char c) {
+	/* {{{ */
+	if (display < 0 || (size_t) display >= i2c_lcd_bus->n_displays) return -1;
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(1, 0) \
+		| i2c_lcd_bus->displays[display].i2c_lcd1602->backlight;
+
+	return i2c_lcd_bus_command(i2c_lcd_bus, display, c, mode);
+	/* }}} */
+}
+
+
+/** Queue a run of 'n' characters, see i2c_lcd1602_write_buffer() */
+int i2c_lcd_bus_write_buffer(struct i2c_lcd_bus *i2c_lcd_bus, int display, \
+	const char *buf, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (0 != i2c_lcd_bus_send_char(i2c_lcd_bus, display, buf[i])) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Queue setting the cursor position, see i2c_lcd1602_set_cursor_pos() */
+int i2c_lcd_bus_set_cursor_pos(struct i2c_lcd_bus *i2c_lcd_bus, int display, \
+	uint8_t ac) {
+	/* {{{ */
+	if (display < 0 || (size_t) display >= i2c_lcd_bus->n_displays) return -1;
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) \
+		| i2c_lcd_bus->displays[display].i2c_lcd1602->backlight;
+
+	return i2c_lcd_bus_command(i2c_lcd_bus, display, LCD_SETDDRAMADDR | ac, mode);
+	/* }}} */
+}
+
+
+/** Queue clearing the display, see i2c_lcd1602_clear_display() */
+int i2c_lcd_bus_clear_display(struct i2c_lcd_bus *i2c_lcd_bus, int display) {
+	/* {{{ */
+	if (display < 0 || (size_t) display >= i2c_lcd_bus->n_displays) return -1;
+
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) \
+		| i2c_lcd_bus->displays[display].i2c_lcd1602->backlight;
+
+	return i2c_lcd_bus_command(i2c_lcd_bus, display, LCD_CLEARDISPLAY, mode);
+	/* }}} */
+}
+
+
+/** Return whether 'a' is before 'b' */
+static int i2c_lcd_bus_before(const struct timespec *a, \
+	const struct timespec *b) {
+	/* {{{ */
+	return a->tv_sec < b->tv_sec \
+		|| (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+	/* }}} */
+}
+
+
+/** Take entries from the queue of 'display' and encode them into 'batch', as
+ * the writer thread of i2c-lcd-async.c does: until the batch is full, or
+ * after an instruction the controller takes longer to execute than the bus
+ * takes to send the next one (clear display, return home) */
+static void i2c_lcd_bus_encode(struct i2c_lcd_bus_display *display, \
+	struct i2c_lcd_bus_batch *batch) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = display->i2c_lcd1602;
+	long bus_covered_ns = i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA];
+	int last_mode = -1;
+
+	batch->len = 0;
+	memset(batch->counts, 0, sizeof(batch->counts));
+
+	while (display->tail != display->head \
+		&& batch->len + I2C_LCD1602_BYTES_PER_COMMAND <= sizeof(batch->bytes)) {
+
+		uint16_t entry = display->queue[display->tail & I2C_LCD_BUS_QUEUE_MASK];
+		uint8_t data = entry & 0xff;
+		uint8_t mode = entry >> 8;
+
+		/* Only present RS separately when it changes */
+		if (mode != last_mode) {
+			batch->len += i2c_lcd1602_encode_command(i2c_lcd1602, \
+				&batch->bytes[batch->len], data, mode);
+		} else {
+			batch->len += i2c_lcd1602_encode_4bitmode(i2c_lcd1602, \
+				&batch->bytes[batch->len], data, mode);
+		}
+		last_mode = mode;
+		batch->last = i2c_lcd1602_command_type(data, mode);
+		batch->counts[batch->last]++;
+
+		/* Keep the register model (and so the mode state
+		 * i2c_lcd1602_resync() sends again) up to date */
+		i2c_lcd1602_track(i2c_lcd1602, data, mode);
+		display->tail++;
+
+		if (i2c_lcd1602->timing.exec_ns[batch->last] > bus_covered_ns) break;
+	}
+	/* }}} */
+}
+
+
+/** Return whether 'i2c_lcd1602' is reached through I2C_RDWR on the file
+ * descriptor of the bus, so that a batch of 'len' bytes for it can be one
+ * message of a combined transaction */
+static int i2c_lcd_bus_combinable(struct i2c_lcd_bus *i2c_lcd_bus, \
+	struct i2c_lcd1602 *i2c_lcd1602, size_t len) {
+	/* {{{ */
+	return i2c_lcd_bus->combine && i2c_lcd_bus->fd >= 0 \
+		&& i2c_lcd1602->fd == i2c_lcd_bus->fd \
+		&& i2c_lcd1602->transport == &i2c_lcd1602_rdwr_transport \
+		&& len <= i2c_lcd1602->xfer_max;
+	/* }}} */
+}
+
+
+/** Point the file descriptor of the bus at the address of 'i2c_lcd1602', if
+ * its transport goes by that.
+ *
+ * Returns 0 on success, and -1 if the address could not be set.
+ */
+static int i2c_lcd_bus_select(struct i2c_lcd_bus *i2c_lcd_bus, \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	if (i2c_lcd_bus->fd >= 0 && i2c_lcd1602->fd == i2c_lcd_bus->fd \
+		&& i2c_lcd_bus->slave != i2c_lcd1602->address \
+		&& (i2c_lcd1602->transport == &i2c_lcd1602_fd_transport \
+			|| i2c_lcd1602->transport == &i2c_lcd1602_smbus_transport)) {
+
+		if (0 > ioctl(i2c_lcd_bus->fd, I2C_SLAVE, i2c_lcd1602->address)) {
+			i2c_lcd_bus->slave = -1;
+			return -1;
+		}
+		i2c_lcd_bus->slave = i2c_lcd1602->address;
+		i2c_lcd_bus->slave_switches++;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Send 'batch' to 'i2c_lcd1602' on its own, first pointing the file
+ * descriptor of the bus at its address if its transport goes by that.
+ *
+ * Returns 0 on success, and -1 if the address could not be set or the write
+ * failed.
+ */
+static int i2c_lcd_bus_send(struct i2c_lcd_bus *i2c_lcd_bus, \
+	struct i2c_lcd1602 *i2c_lcd1602, struct i2c_lcd_bus_batch *batch) {
+	/* {{{ */
+	if (0 != i2c_lcd_bus_select(i2c_lcd_bus, i2c_lcd1602)) {
+		/* What was taken from the queue is lost, but the register model
+		 * already has it, so i2c_lcd1602_resync() brings it back */
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, transfer_failures, 1);
+		i2c_lcd1602->out_of_sync = 1;
+		return -1;
+	}
+
+	i2c_lcd_bus->transactions++;
+	return i2c_lcd1602_write_bytes(i2c_lcd1602, batch->bytes, batch->len);
+	/* }}} */
+}
+
+
+/** Send the batches of the 'n' LCDs 'displays' as one I2C_RDWR transaction,
+ * each message addressed to its own LCD. If the adapter rejects the
+ * transaction (before sending any of it), combining is turned off for the bus
+ * and the batches are sent one by one instead.
+ *
+ * Returns 0 on success, and -1 if any batch could not be sent.
+ */
+static int i2c_lcd_bus_send_combined(struct i2c_lcd_bus *i2c_lcd_bus, \
+	const size_t *displays, struct i2c_lcd_bus_batch *batches, size_t n) {
+	/* {{{ */
+	struct i2c_msg msgs[I2C_LCD_BUS_DISPLAYS];
+	struct i2c_rdwr_ioctl_data data = {
+		.msgs = msgs,
+		.nmsgs = n
+	};
+	int ret = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		msgs[i] = (struct i2c_msg) {
+			.addr = i2c_lcd_bus->displays[displays[i]].i2c_lcd1602->address,
+			.flags = 0,
+			.len = batches[displays[i]].len,
+			.buf = batches[displays[i]].bytes
+		};
+	}
+
+	i2c_lcd_bus->transactions++;
+	if (0 <= ioctl(i2c_lcd_bus->fd, I2C_RDWR, &data)) {
+		for (size_t i = 0; i < n; i++) {
+			I2C_LCD1602_STATS_ADD(i2c_lcd_bus->displays[displays[i]].i2c_lcd1602, \
+				bytes_written, msgs[i].len);
+		}
+		return 0;
+	}
+
+	int rejected = errno == EINVAL || errno == EOPNOTSUPP || errno == EMSGSIZE;
+	for (size_t i = 0; i < n; i++) {
+		struct i2c_lcd1602 *i2c_lcd1602 = \
+			i2c_lcd_bus->displays[displays[i]].i2c_lcd1602;
+
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, transfer_failures, 1);
+		if (rejected) {
+			if (0 != i2c_lcd_bus_send(i2c_lcd_bus, i2c_lcd1602, \
+				&batches[displays[i]])) {
+
+				ret = -1;
+			}
+		} else {
+			/* Any of the messages may have been cut short */
+			i2c_lcd1602->out_of_sync = 1;
+			ret = -1;
+		}
+	}
+	if (rejected) i2c_lcd_bus->combine = 0;
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Run one round of the bus: every LCD that has something queued and whose
+ * controller is ready gets one batch, starting one LCD further along each
+ * round so that none is always first. If every LCD with something queued is
+ * still busy, wait until the first of them is ready instead. An LCD that is
+ * out of sync after an earlier failure is resynchronized (see
+ * i2c_lcd1602_resync()) before its batch, and skipped this round if that
+ * fails.
+ *
+ * Returns 0 on success, and -1 if anything could not be sent.
+ */
+int i2c_lcd_bus_step(struct i2c_lcd_bus *i2c_lcd_bus) {
+	/* {{{ */
+	struct i2c_lcd_bus_batch batches[I2C_LCD_BUS_DISPLAYS];
+	size_t sent[I2C_LCD_BUS_DISPLAYS];
+	size_t combined[I2C_LCD_BUS_DISPLAYS];
+	size_t n_sent = 0;
+	size_t n_combined = 0;
+	struct i2c_lcd1602 *earliest = NULL;
+	struct timespec now;
+	int ret = 0;
+
+	if (i2c_lcd_bus->n_displays == 0) return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	i2c_lcd_bus->rounds++;
+
+	for (size_t k = 0; k < i2c_lcd_bus->n_displays; k++) {
+		size_t d = (i2c_lcd_bus->next + k) % i2c_lcd_bus->n_displays;
+		struct i2c_lcd_bus_display *display = &i2c_lcd_bus->displays[d];
+		struct i2c_lcd1602 *i2c_lcd1602 = display->i2c_lcd1602;
+
+		if (display->tail == display->head) continue;
+
+		/* A batch encoded for a controller that is between the two nibbles
+		 * of a byte would be read a nibble out of step */
+		if (i2c_lcd1602->out_of_sync) {
+			if (0 != i2c_lcd_bus_select(i2c_lcd_bus, i2c_lcd1602) \
+				|| 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+
+				display->stalled = 1;
+				ret = -1;
+				continue;
+			}
+			display->stalled = 0;
+		}
+
+		/* Leave controllers that are still busy for a later round */
+		if (i2c_lcd_bus_before(&now, &i2c_lcd1602->busy_until)) {
+			if (earliest == NULL \
+				|| i2c_lcd_bus_before(&i2c_lcd1602->busy_until, &earliest->busy_until)) {
+
+				earliest = i2c_lcd1602;
+			}
+			continue;
+		}
+
+		i2c_lcd_bus_encode(display, &batches[d]);
+		sent[n_sent++] = d;
+
+		if (i2c_lcd_bus_combinable(i2c_lcd_bus, i2c_lcd1602, batches[d].len)) {
+			combined[n_combined++] = d;
+		} else if (0 != i2c_lcd_bus_send(i2c_lcd_bus, i2c_lcd1602, &batches[d])) {
+			ret = -1;
+		}
+	}
+
+	if (n_combined > 0 && 0 != i2c_lcd_bus_send_combined(i2c_lcd_bus, combined, \
+		batches, n_combined)) {
+
+		ret = -1;
+	}
+
+	/* Each controller is busy from when its batch was sent, which for a
+	 * combined transaction is taken to be when all of it was */
+	for (size_t i = 0; i < n_sent; i++) {
+		struct i2c_lcd_bus_display *display = &i2c_lcd_bus->displays[sent[i]];
+		struct i2c_lcd_bus_batch *batch = &batches[sent[i]];
+
+		i2c_lcd1602_set_busy(display->i2c_lcd1602, \
+			display->i2c_lcd1602->timing.exec_ns[batch->last]);
+		for (int t = 0; t < I2C_LCD1602_CMD_TYPES; t++) {
+			i2c_lcd1602_stats_count(display->i2c_lcd1602, t, batch->counts[t]);
+		}
+		display->batches++;
+	}
+
+	i2c_lcd_bus->next = (i2c_lcd_bus->next + 1) % i2c_lcd_bus->n_displays;
+
+	if (n_sent == 0 && earliest != NULL) {
+		i2c_lcd_bus->waits++;
+		i2c_lcd1602_wait_until(earliest, &earliest->busy_until);
+	}
+
+	if (ret != 0) i2c_lcd_bus->failed = 1;
+
+	return ret;
+	/* }}} */
+}
+
+
+/** Run the bus until everything queued for every LCD has been sent.
+ *
+ * Returns 0 on success, and -1 if anything sent since the last call could not
+ * be, in which case the LCDs it was for are marked out of sync and
+ * resynchronized before they are sent anything else (see
+ * i2c_lcd1602_resync()). What is queued for an LCD that could not be
+ * resynchronized is left for the next call.
+ */
+int i2c_lcd_bus_flush(struct i2c_lcd_bus *i2c_lcd_bus) {
+	/* {{{ */
+	for (size_t d = 0; d < i2c_lcd_bus->n_displays; d++) {
+		i2c_lcd_bus->displays[d].stalled = 0;
+	}
+
+	while (1) {
+		int pending = 0;
+
+		for (size_t d = 0; d < i2c_lcd_bus->n_displays && !pending; d++) {
+			struct i2c_lcd_bus_display *display = &i2c_lcd_bus->displays[d];
+			pending = display->tail != display->head && !display->stalled;
+		}
+		if (!pending) break;
+
+		i2c_lcd_bus_step(i2c_lcd_bus);
+	}
+
+	int ret = i2c_lcd_bus->failed ? -1 : 0;
+	i2c_lcd_bus->failed = 0;
+
+	return ret;
+	/* }}} */
+}
@@ -0,0 +1,85 @@
+#ifndef I2C_LCD_BUS
+#define I2C_LCD_BUS
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-LCD1602.h"
+
+/* The most LCDs one bus can drive, which is how many addresses a PCF8574 (or
+ * a PCF8574A) can be strapped to */
+#define I2C_LCD_BUS_DISPLAYS 8
+/* The number of instructions/characters each LCD can have queued. Must be a
+ * power of 2. */
+#define I2C_LCD_BUS_QUEUE 256
+/* The most bytes one LCD is sent in its turn, about 6ms at 100kHz, after
+ * which the other LCDs get a turn */
+#define I2C_LCD_BUS_BATCH_MAX 64
+
+/* An LCD on the bus and the instructions and characters queued for it, each
+ * with the mode (RS, R/W, backlight) in the high byte and the instruction or
+ * character in the low byte */
+struct i2c_lcd_bus_display {
+	struct i2c_lcd1602 *i2c_lcd1602;
+	uint16_t queue[I2C_LCD_BUS_QUEUE];
+	size_t head;
+	size_t tail;
+	/* Set when the LCD was out of sync and could not be resynchronized, so
+	 * that i2c_lcd_bus_flush() leaves what is queued for it until it is
+	 * called again */
+	uint8_t stalled;
+	/* Statistics */
+	uint64_t batches;
+};
+
+/* Shares one i2c bus between several LCDs at different addresses. Rather than
+ * each LCD waiting for its own controller in turn, the LCDs are sent batches
+ * round robin, and whichever controllers are still executing their last
+ * instruction are skipped until they are done, so that the time one
+ * controller is busy is spent sending to the others. Batches for LCDs using
+ * i2c_lcd1602_rdwr_transport on the file descriptor of the bus are sent as
+ * one I2C_RDWR transaction per round, each message addressed to its own LCD;
+ * the I2C_SLAVE address of the file descriptor is switched as needed for
+ * LCDs using i2c_lcd1602_fd_transport or i2c_lcd1602_smbus_transport, and
+ * any other transport is used as is. */
+struct i2c_lcd_bus {
+	int fd;
+	struct i2c_lcd_bus_display displays[I2C_LCD_BUS_DISPLAYS];
+	size_t n_displays;
+	/* The display the next round starts with */
+	size_t next;
+	/* The address I2C_SLAVE was last set to on 'fd', or -1 */
+	int slave;
+	/* Whether batches for different LCDs may be combined into one I2C_RDWR
+	 * transaction. Cleared if the adapter rejects one. */
+	uint8_t combine;
+	/* Set when anything could not be sent, until i2c_lcd_bus_flush()
+	 * reports it */
+	uint8_t failed;
+	/* Statistics */
+	uint64_t rounds;
+	uint64_t transactions;
+	uint64_t slave_switches;
+	uint64_t waits;
+};
+
+
+void i2c_lcd_bus_init(struct i2c_lcd_bus *i2c_lcd_bus, int fd);
+
+int i2c_lcd_bus_add(struct i2c_lcd_bus *i2c_lcd_bus, struct i2c_lcd1602 *i2c_lcd1602);
+
+int i2c_lcd_bus_command(struct i2c_lcd_bus *i2c_lcd_bus, int display, uint8_t data, uint8_t mode);
+
+int i2c_lcd_bus_send_char(struct i2c_lcd_bus *i2c_lcd_bus, int display, char c);
+
+int i2c_lcd_bus_write_buffer(struct i2c_lcd_bus *i2c_lcd_bus, int display, const char *buf, size_t n);
+
+int i2c_lcd_bus_set_cursor_pos(struct i2c_lcd_bus *i2c_lcd_bus, int display, uint8_t ac);
+
+int i2c_lcd_bus_clear_display(struct i2c_lcd_bus *i2c_lcd_bus, int display);
+
+int i2c_lcd_bus_step(struct i2c_lcd_bus *i2c_lcd_bus);
+
+int i2c_lcd_bus_flush(struct i2c_lcd_bus *i2c_lcd_bus);
+
+#endif
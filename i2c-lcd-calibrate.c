@@ -0,0 +1,330 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-calibrate.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+
+/* The names of the fields of a timing profile as they appear in a saved
+ * profile */
+static const char *i2c_lcd_timing_names[] = {
+	[I2C_LCD1602_CMD_CLEAR] = "clear_ns",
+	[I2C_LCD1602_CMD_HOME] = "home_ns",
+	[I2C_LCD1602_CMD_ENTRY_MODE] = "entry_mode_ns",
+	[I2C_LCD1602_CMD_DISPLAY_CONTROL] = "display_control_ns",
+	[I2C_LCD1602_CMD_SHIFT] = "shift_ns",
+	[I2C_LCD1602_CMD_FUNCTION_SET] = "function_set_ns",
+	[I2C_LCD1602_CMD_SET_CGRAM] = "set_cgram_ns",
+	[I2C_LCD1602_CMD_SET_DDRAM] = "set_ddram_ns",
+	[I2C_LCD1602_CMD_DATA] = "data_ns"
+};
+
+
+/** Write 16 characters depending on 'seed' to each line of the i2c LCD using
+ * the regular (one nibble per strobe) instructions, and read them back.
+ *
+ * Returns 0 if what was read matches what was written, and -1 otherwise.
+ */
+static int i2c_lcd_calibrate_test_pattern(struct i2c_lcd1602 *i2c_lcd1602, \
+	int seed) {
+	/* {{{ */
+	uint8_t line_acs[] = { 0x00, 0x40 };
+
+	for (int line = 0; line < 2; line++) {
+		uint8_t expected[16];
+		uint8_t got[16];
+
+		i2c_lcd1602_set_cursor_pos(i2c_lcd1602, line_acs[line]);
+		for (int i = 0; i < 16; i++) {
+			/* Use characters with varied nibbles, including ones with every
+			 * data line low and high */
+			expected[i] = 0x20 + (seed * 37 + line * 16 + i * 13) % 0xd0;
+			i2c_lcd1602_send_char(i2c_lcd1602, expected[i]);
+		}
+
+		if (0 != i2c_lcd1602_read_buffer(i2c_lcd1602, line_acs[line], got, 16)) {
+			return -1;
+		}
+		if (0 != memcmp(expected, got, 16)) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Check that clear display finishes in time for the instruction after it.
+ *
+ * Returns 0 if it does, and -1 otherwise.
+ */
+static int i2c_lcd_calibrate_test_clear(struct i2c_lcd1602 *i2c_lcd1602, \
+	int seed) {
+	/* {{{ */
+	uint8_t got[8];
+
+	i2c_lcd1602_set_cursor_pos(i2c_lcd1602, 0x00);
+	for (int i = 0; i < 8; i++) i2c_lcd1602_send_char(i2c_lcd1602, 'X');
+
+	i2c_lcd1602_clear_display(i2c_lcd1602);
+	i2c_lcd1602_set_cursor_pos(i2c_lcd1602, seed % 8);
+	i2c_lcd1602_send_char(i2c_lcd1602, 'C');
+
+	if (0 != i2c_lcd1602_read_buffer(i2c_lcd1602, 0x00, got, 8)) return -1;
+
+	for (int i = 0; i < 8; i++) {
+		if (got[i] != (i == seed % 8 ? 'C' : ' ')) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Check that return home finishes in time for the character after it.
+ *
+ * Returns 0 if it does, and -1 otherwise.
+ */
+static int i2c_lcd_calibrate_test_home(struct i2c_lcd1602 *i2c_lcd1602, \
+	int seed) {
+	/* {{{ */
+	uint8_t got;
+	uint8_t c = 'A' + seed % 26;
+
+	i2c_lcd1602_set_cursor_pos(i2c_lcd1602, 0x00);
+	i2c_lcd1602_send_char(i2c_lcd1602, ' ');
+	i2c_lcd1602_set_cursor_pos(i2c_lcd1602, 0x45);
+
+	i2c_lcd1602_cursor_home(i2c_lcd1602);
+	i2c_lcd1602_send_char(i2c_lcd1602, c);
+
+	if (0 != i2c_lcd1602_read_buffer(i2c_lcd1602, 0x00, &got, 1)) return -1;
+
+	return got == c ? 0 : -1;
+	/* }}} */
+}
+
+
+/* A set of timing fields that are calibrated together, and the test that
+ * shows whether they are long enough */
+struct i2c_lcd_calibrate_step {
+	long *fields[I2C_LCD1602_CMD_TYPES];
+	size_t n_fields;
+	int (*test)(struct i2c_lcd1602 *, int);
+};
+
+
+/** Run 'test' I2C_LCD_CALIBRATE_TRIALS times.
+ *
+ * Returns 0 if every trial passed, and -1 otherwise.
+ */
+static int i2c_lcd_calibrate_trials(struct i2c_lcd1602 *i2c_lcd1602, \
+	int (*test)(struct i2c_lcd1602 *, int)) {
+	/* {{{ */
+	for (int trial = 0; trial < I2C_LCD_CALIBRATE_TRIALS; trial++) {
+		if (0 != test(i2c_lcd1602, trial)) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Find the fastest timing that the given i2c LCD works reliably with, by
+ * measuring how long a byte takes on the bus and then starting from the
+ * (safe) timing it currently has and halving each delay until writing and
+ * reading back test patterns fails. Each delay that worked is then
+ * lengthened by a quarter as a margin. This needs the R/W line of the LCD to
+ * be connected to the PCF8574 so that DDRAM can be read back (or the emulator
+ * transport). The contents of the display are destroyed, and the LCD is
+ * reinitialized with i2c_lcd1602_begin() after any failed test.
+ *
+ * On success the LCD is left using the calibrated timing, which is also
+ * stored in 'timing', and 0 is returned. If the LCD does not pass the tests
+ * even with the timing it started with, its timing is left unchanged and -1
+ * is returned.
+ */
+int i2c_lcd_calibrate(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_timing *timing) {
+	/* {{{ */
+	struct i2c_lcd1602_timing safe = i2c_lcd1602->timing;
+	struct i2c_lcd1602_timing *t = &i2c_lcd1602->timing;
+	/* The busy flag would hide execution times that are too short */
+	uint8_t busy_poll = i2c_lcd1602->busy_poll;
+	i2c_lcd1602->busy_poll = 0;
+	/* So would instructions that are skipped because the register model says
+	 * they change nothing, whereas with timing that is too short it is wrong */
+	uint8_t skip_redundant = i2c_lcd1602->skip_redundant;
+	i2c_lcd1602->skip_redundant = 0;
+
+	struct i2c_lcd_calibrate_step steps[] = {
+		{ { &t->strobe_setup_ns }, 1, i2c_lcd_calibrate_test_pattern },
+		{ { &t->strobe_hold_ns }, 1, i2c_lcd_calibrate_test_pattern },
+		{ { &t->nibble_ns }, 1, i2c_lcd_calibrate_test_pattern },
+		/* All the instructions the datasheet lists as 37µs */
+		{ {
+			&t->exec_ns[I2C_LCD1602_CMD_ENTRY_MODE],
+			&t->exec_ns[I2C_LCD1602_CMD_DISPLAY_CONTROL],
+			&t->exec_ns[I2C_LCD1602_CMD_SHIFT],
+			&t->exec_ns[I2C_LCD1602_CMD_FUNCTION_SET],
+			&t->exec_ns[I2C_LCD1602_CMD_SET_CGRAM],
+			&t->exec_ns[I2C_LCD1602_CMD_SET_DDRAM]
+		}, 6, i2c_lcd_calibrate_test_pattern },
+		{ { &t->exec_ns[I2C_LCD1602_CMD_DATA] }, 1, i2c_lcd_calibrate_test_pattern },
+		{ { &t->exec_ns[I2C_LCD1602_CMD_CLEAR] }, 1, i2c_lcd_calibrate_test_clear },
+		{ { &t->exec_ns[I2C_LCD1602_CMD_HOME] }, 1, i2c_lcd_calibrate_test_home }
+	};
+	size_t n_steps = sizeof(steps) / sizeof(steps[0]);
+
+	/* Time a message of bytes that leave E low, which the LCD ignores, to find
+	 * out how long each byte takes on the bus (counting the address byte) */
+	uint8_t idle[64];
+	struct timespec start;
+	struct timespec end;
+	memset(idle, i2c_lcd1602->backlight, sizeof(idle));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (0 == i2c_lcd1602_write_bytes(i2c_lcd1602, idle, sizeof(idle))) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t->bus_byte_ns = ((end.tv_sec - start.tv_sec) * 1000000000L \
+			+ (end.tv_nsec - start.tv_nsec)) / (long) (sizeof(idle) + 1);
+	}
+
+	/* Make sure the LCD works at all before making anything faster */
+	if (0 != i2c_lcd_calibrate_trials(i2c_lcd1602, i2c_lcd_calibrate_test_pattern)) {
+		i2c_lcd1602->timing = safe;
+		i2c_lcd1602->busy_poll = busy_poll;
+		i2c_lcd1602->skip_redundant = skip_redundant;
+		return -1;
+	}
+
+	for (size_t s = 0; s < n_steps; s++) {
+		struct i2c_lcd_calibrate_step *step = &steps[s];
+		long good = *step->fields[0];
+
+		while (good > 0) {
+			long candidate = good / 2;
+			if (candidate < I2C_LCD_CALIBRATE_FLOOR_NS) candidate = 0;
+
+			for (size_t f = 0; f < step->n_fields; f++) *step->fields[f] = candidate;
+
+			if (0 != i2c_lcd_calibrate_trials(i2c_lcd1602, step->test)) {
+				/* Go back to what worked, and get the controller back into a
+				 * known state since the failure may have left it anywhere */
+				for (size_t f = 0; f < step->n_fields; f++) *step->fields[f] = good;
+				i2c_lcd1602_begin(i2c_lcd1602);
+				break;
+			}
+			good = candidate;
+		}
+
+		/* Leave some margin */
+		for (size_t f = 0; f < step->n_fields; f++) {
+			*step->fields[f] = good + good / 4;
+		}
+	}
+
+	/* Check that everything still works together. If not, give up on the
+	 * calibration. */
+	if (0 != i2c_lcd_calibrate_trials(i2c_lcd1602, i2c_lcd_calibrate_test_pattern) \
+		|| 0 != i2c_lcd_calibrate_trials(i2c_lcd1602, i2c_lcd_calibrate_test_clear) \
+		|| 0 != i2c_lcd_calibrate_trials(i2c_lcd1602, i2c_lcd_calibrate_test_home)) {
+
+		i2c_lcd1602->timing = safe;
+		i2c_lcd1602_begin(i2c_lcd1602);
+		i2c_lcd1602->busy_poll = busy_poll;
+		i2c_lcd1602->skip_redundant = skip_redundant;
+		return -1;
+	}
+
+	*timing = i2c_lcd1602->timing;
+	i2c_lcd1602->busy_poll = busy_poll;
+	i2c_lcd1602->skip_redundant = skip_redundant;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Save a timing profile to the file at 'path' as lines of "<name> <ns>",
+ * for loading at startup with i2c_lcd_timing_load().
+ *
+ * Returns 0 on success, and -1 if the file could not be written.
+ */
+int i2c_lcd_timing_save(const struct i2c_lcd1602_timing *timing, \
+	const char *path) {
+	/* {{{ */
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL) return -1;
+
+	fprintf(f, "# i2c-LCD1602 timing profile (nanoseconds)\n");
+	fprintf(f, "strobe_setup_ns %ld\n", timing->strobe_setup_ns);
+	fprintf(f, "strobe_hold_ns %ld\n", timing->strobe_hold_ns);
+	fprintf(f, "nibble_ns %ld\n", timing->nibble_ns);
+	fprintf(f, "bus_byte_ns %ld\n", timing->bus_byte_ns);
+	for (int i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+		fprintf(f, "%s %ld\n", i2c_lcd_timing_names[i], timing->exec_ns[i]);
+	}
+
+	if (0 != fclose(f)) return -1;
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Load a timing profile saved with i2c_lcd_timing_save() from the file at
+ * 'path' into 'timing'. Fields missing from the file are left as they were,
+ * so 'timing' should hold usable values (e.g. i2c_lcd1602_datasheet_timing)
+ * beforehand.
+ *
+ * Returns 0 on success, and -1 if the file could not be read or contains a
+ * line that is not understood.
+ */
+int i2c_lcd_timing_load(struct i2c_lcd1602_timing *timing, const char *path) {
+	/* {{{ */
+	FILE *f = fopen(path, "r");
+	char line[128];
+	int ret = 0;
+
+	if (f == NULL) return -1;
+
+	while (NULL != fgets(line, sizeof(line), f)) {
+		char name[64];
+		long ns;
+
+		if (line[0] == '#' || line[0] == '\n') continue;
+		if (2 != sscanf(line, "%63s %ld", name, &ns) || ns < 0) {
+			ret = -1;
+			continue;
+		}
+
+		if (0 == strcmp(name, "strobe_setup_ns")) {
+			timing->strobe_setup_ns = ns;
+		} else if (0 == strcmp(name, "strobe_hold_ns")) {
+			timing->strobe_hold_ns = ns;
+		} else if (0 == strcmp(name, "nibble_ns")) {
+			timing->nibble_ns = ns;
+		} else if (0 == strcmp(name, "bus_byte_ns")) {
+			timing->bus_byte_ns = ns;
+		} else {
+			int i;
+			for (i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+				if (0 == strcmp(name, i2c_lcd_timing_names[i])) break;
+			}
+			if (i == I2C_LCD1602_CMD_TYPES) ret = -1;
+			else timing->exec_ns[i] = ns;
+		}
+	}
+
+	fclose(f);
+
+	return ret;
+	/* }}} */
+}
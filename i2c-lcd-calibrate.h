@@ -0,0 +1,22 @@
+#ifndef I2C_LCD_CALIBRATE
+#define I2C_LCD_CALIBRATE
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-LCD1602.h"
+
+/* How many times each candidate timing must pass the readback test */
+#define I2C_LCD_CALIBRATE_TRIALS 3
+/* Delays shorter than this are rounded down to 0 (no sleep at all) since
+ * nanosleep() cannot sleep for less than this anyway */
+#define I2C_LCD_CALIBRATE_FLOOR_NS 1000
+
+
+int i2c_lcd_calibrate(struct i2c_lcd1602 *i2c_lcd1602, struct i2c_lcd1602_timing *timing);
+
+int i2c_lcd_timing_save(const struct i2c_lcd1602_timing *timing, const char *path);
+
+int i2c_lcd_timing_load(struct i2c_lcd1602_timing *timing, const char *path);
+
+#endif
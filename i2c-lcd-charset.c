@@ -0,0 +1,337 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2c-lcd-charset.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+
+/* The code points outside ASCII that each ROM has, sorted by code point, from
+ * the character tables on page 17 (A00) and 18 (A02) of the HD44780
+ * datasheet. Katakana are mapped from both their halfwidth and fullwidth
+ * forms, with voiced and semi-voiced katakana written as the plain katakana
+ * followed by the (semi-)voiced sound mark. A00 has no degree sign, so the
+ * semi-voiced sound mark (which looks the same) is used for it. */
+static const struct i2c_lcd_charset_entry i2c_lcd_charset_a00[] = {
+	{ 0x00a2, { 0xec, 0x00 } }, { 0x00a5, { 0x5c, 0x00 } }, { 0x00b0, { 0xdf, 0x00 } },
+	{ 0x00b5, { 0xe4, 0x00 } }, { 0x00df, { 0xe2, 0x00 } }, { 0x00e4, { 0xe1, 0x00 } },
+	{ 0x00f1, { 0xee, 0x00 } }, { 0x00f6, { 0xef, 0x00 } }, { 0x00f7, { 0xfd, 0x00 } },
+	{ 0x00fc, { 0xf5, 0x00 } }, { 0x03a3, { 0xf6, 0x00 } }, { 0x03a9, { 0xf4, 0x00 } },
+	{ 0x03b1, { 0xe0, 0x00 } }, { 0x03b2, { 0xe2, 0x00 } }, { 0x03b5, { 0xe3, 0x00 } },
+	{ 0x03b8, { 0xf2, 0x00 } }, { 0x03bc, { 0xe4, 0x00 } }, { 0x03c0, { 0xf7, 0x00 } },
+	{ 0x03c1, { 0xe6, 0x00 } }, { 0x03c3, { 0xe5, 0x00 } }, { 0x2126, { 0xf4, 0x00 } },
+	{ 0x2190, { 0x7f, 0x00 } }, { 0x2192, { 0x7e, 0x00 } }, { 0x221a, { 0xe8, 0x00 } },
+	{ 0x221e, { 0xf3, 0x00 } }, { 0x2588, { 0xff, 0x00 } }, { 0x3001, { 0xa4, 0x00 } },
+	{ 0x3002, { 0xa1, 0x00 } }, { 0x300c, { 0xa2, 0x00 } }, { 0x300d, { 0xa3, 0x00 } },
+	{ 0x3099, { 0xde, 0x00 } }, { 0x309a, { 0xdf, 0x00 } }, { 0x309b, { 0xde, 0x00 } },
+	{ 0x309c, { 0xdf, 0x00 } }, { 0x30a1, { 0xa7, 0x00 } }, { 0x30a2, { 0xb1, 0x00 } },
+	{ 0x30a3, { 0xa8, 0x00 } }, { 0x30a4, { 0xb2, 0x00 } }, { 0x30a5, { 0xa9, 0x00 } },
+	{ 0x30a6, { 0xb3, 0x00 } }, { 0x30a7, { 0xaa, 0x00 } }, { 0x30a8, { 0xb4, 0x00 } },
+	{ 0x30a9, { 0xab, 0x00 } }, { 0x30aa, { 0xb5, 0x00 } }, { 0x30ab, { 0xb6, 0x00 } },
+	{ 0x30ac, { 0xb6, 0xde } }, { 0x30ad, { 0xb7, 0x00 } }, { 0x30ae, { 0xb7, 0xde } },
+	{ 0x30af, { 0xb8, 0x00 } }, { 0x30b0, { 0xb8, 0xde } }, { 0x30b1, { 0xb9, 0x00 } },
+	{ 0x30b2, { 0xb9, 0xde } }, { 0x30b3, { 0xba, 0x00 } }, { 0x30b4, { 0xba, 0xde } },
+	{ 0x30b5, { 0xbb, 0x00 } }, { 0x30b6, { 0xbb, 0xde } }, { 0x30b7, { 0xbc, 0x00 } },
+	{ 0x30b8, { 0xbc, 0xde } }, { 0x30b9, { 0xbd, 0x00 } }, { 0x30ba, { 0xbd, 0xde } },
+	{ 0x30bb, { 0xbe, 0x00 } }, { 0x30bc, { 0xbe, 0xde } }, { 0x30bd, { 0xbf, 0x00 } },
+	{ 0x30be, { 0xbf, 0xde } }, { 0x30bf, { 0xc0, 0x00 } }, { 0x30c0, { 0xc0, 0xde } },
+	{ 0x30c1, { 0xc1, 0x00 } }, { 0x30c2, { 0xc1, 0xde } }, { 0x30c3, { 0xaf, 0x00 } },
+	{ 0x30c4, { 0xc2, 0x00 } }, { 0x30c5, { 0xc2, 0xde } }, { 0x30c6, { 0xc3, 0x00 } },
+	{ 0x30c7, { 0xc3, 0xde } }, { 0x30c8, { 0xc4, 0x00 } }, { 0x30c9, { 0xc4, 0xde } },
+	{ 0x30ca, { 0xc5, 0x00 } }, { 0x30cb, { 0xc6, 0x00 } }, { 0x30cc, { 0xc7, 0x00 } },
+	{ 0x30cd, { 0xc8, 0x00 } }, { 0x30ce, { 0xc9, 0x00 } }, { 0x30cf, { 0xca, 0x00 } },
+	{ 0x30d0, { 0xca, 0xde } }, { 0x30d1, { 0xca, 0xdf } }, { 0x30d2, { 0xcb, 0x00 } },
+	{ 0x30d3, { 0xcb, 0xde } }, { 0x30d4, { 0xcb, 0xdf } }, { 0x30d5, { 0xcc, 0x00 } },
+	{ 0x30d6, { 0xcc, 0xde } }, { 0x30d7, { 0xcc, 0xdf } }, { 0x30d8, { 0xcd, 0x00 } },
+	{ 0x30d9, { 0xcd, 0xde } }, { 0x30da, { 0xcd, 0xdf } }, { 0x30db, { 0xce, 0x00 } },
+	{ 0x30dc, { 0xce, 0xde } }, { 0x30dd, { 0xce, 0xdf } }, { 0x30de, { 0xcf, 0x00 } },
+	{ 0x30df, { 0xd0, 0x00 } }, { 0x30e0, { 0xd1, 0x00 } }, { 0x30e1, { 0xd2, 0x00 } },
+	{ 0x30e2, { 0xd3, 0x00 } }, { 0x30e3, { 0xac, 0x00 } }, { 0x30e4, { 0xd4, 0x00 } },
+	{ 0x30e5, { 0xad, 0x00 } }, { 0x30e6, { 0xd5, 0x00 } }, { 0x30e7, { 0xae, 0x00 } },
+	{ 0x30e8, { 0xd6, 0x00 } }, { 0x30e9, { 0xd7, 0x00 } }, { 0x30ea, { 0xd8, 0x00 } },
+	{ 0x30eb, { 0xd9, 0x00 } }, { 0x30ec, { 0xda, 0x00 } }, { 0x30ed, { 0xdb, 0x00 } },
+	{ 0x30ef, { 0xdc, 0x00 } }, { 0x30f2, { 0xa6, 0x00 } }, { 0x30f3, { 0xdd, 0x00 } },
+	{ 0x30f4, { 0xb3, 0xde } }, { 0x30f7, { 0xdc, 0xde } }, { 0x30fa, { 0xa6, 0xde } },
+	{ 0x30fb, { 0xa5, 0x00 } }, { 0x30fc, { 0xb0, 0x00 } }, { 0x4e07, { 0xfb, 0x00 } },
+	{ 0x5186, { 0xfc, 0x00 } }, { 0x5343, { 0xfa, 0x00 } }, { 0xff61, { 0xa1, 0x00 } },
+	{ 0xff62, { 0xa2, 0x00 } }, { 0xff63, { 0xa3, 0x00 } }, { 0xff64, { 0xa4, 0x00 } },
+	{ 0xff65, { 0xa5, 0x00 } }, { 0xff66, { 0xa6, 0x00 } }, { 0xff67, { 0xa7, 0x00 } },
+	{ 0xff68, { 0xa8, 0x00 } }, { 0xff69, { 0xa9, 0x00 } }, { 0xff6a, { 0xaa, 0x00 } },
+	{ 0xff6b, { 0xab, 0x00 } }, { 0xff6c, { 0xac, 0x00 } }, { 0xff6d, { 0xad, 0x00 } },
+	{ 0xff6e, { 0xae, 0x00 } }, { 0xff6f, { 0xaf, 0x00 } }, { 0xff70, { 0xb0, 0x00 } },
+	{ 0xff71, { 0xb1, 0x00 } }, { 0xff72, { 0xb2, 0x00 } }, { 0xff73, { 0xb3, 0x00 } },
+	{ 0xff74, { 0xb4, 0x00 } }, { 0xff75, { 0xb5, 0x00 } }, { 0xff76, { 0xb6, 0x00 } },
+	{ 0xff77, { 0xb7, 0x00 } }, { 0xff78, { 0xb8, 0x00 } }, { 0xff79, { 0xb9, 0x00 } },
+	{ 0xff7a, { 0xba, 0x00 } }, { 0xff7b, { 0xbb, 0x00 } }, { 0xff7c, { 0xbc, 0x00 } },
+	{ 0xff7d, { 0xbd, 0x00 } }, { 0xff7e, { 0xbe, 0x00 } }, { 0xff7f, { 0xbf, 0x00 } },
+	{ 0xff80, { 0xc0, 0x00 } }, { 0xff81, { 0xc1, 0x00 } }, { 0xff82, { 0xc2, 0x00 } },
+	{ 0xff83, { 0xc3, 0x00 } }, { 0xff84, { 0xc4, 0x00 } }, { 0xff85, { 0xc5, 0x00 } },
+	{ 0xff86, { 0xc6, 0x00 } }, { 0xff87, { 0xc7, 0x00 } }, { 0xff88, { 0xc8, 0x00 } },
+	{ 0xff89, { 0xc9, 0x00 } }, { 0xff8a, { 0xca, 0x00 } }, { 0xff8b, { 0xcb, 0x00 } },
+	{ 0xff8c, { 0xcc, 0x00 } }, { 0xff8d, { 0xcd, 0x00 } }, { 0xff8e, { 0xce, 0x00 } },
+	{ 0xff8f, { 0xcf, 0x00 } }, { 0xff90, { 0xd0, 0x00 } }, { 0xff91, { 0xd1, 0x00 } },
+	{ 0xff92, { 0xd2, 0x00 } }, { 0xff93, { 0xd3, 0x00 } }, { 0xff94, { 0xd4, 0x00 } },
+	{ 0xff95, { 0xd5, 0x00 } }, { 0xff96, { 0xd6, 0x00 } }, { 0xff97, { 0xd7, 0x00 } },
+	{ 0xff98, { 0xd8, 0x00 } }, { 0xff99, { 0xd9, 0x00 } }, { 0xff9a, { 0xda, 0x00 } },
+	{ 0xff9b, { 0xdb, 0x00 } }, { 0xff9c, { 0xdc, 0x00 } }, { 0xff9d, { 0xdd, 0x00 } },
+	{ 0xff9e, { 0xde, 0x00 } }, { 0xff9f, { 0xdf, 0x00 } }
+};
+
+static const struct i2c_lcd_charset_entry i2c_lcd_charset_a02[] = {
+	{ 0x00a1, { 0xa1, 0x00 } }, { 0x00a2, { 0xa2, 0x00 } }, { 0x00a3, { 0xa3, 0x00 } },
+	{ 0x00a4, { 0xa4, 0x00 } }, { 0x00a5, { 0xa5, 0x00 } }, { 0x00a6, { 0xa6, 0x00 } },
+	{ 0x00a7, { 0xa7, 0x00 } }, { 0x00a8, { 0xa8, 0x00 } }, { 0x00a9, { 0xa9, 0x00 } },
+	{ 0x00aa, { 0xaa, 0x00 } }, { 0x00ab, { 0xab, 0x00 } }, { 0x00ac, { 0xac, 0x00 } },
+	{ 0x00ad, { 0xad, 0x00 } }, { 0x00ae, { 0xae, 0x00 } }, { 0x00af, { 0xaf, 0x00 } },
+	{ 0x00b0, { 0xb0, 0x00 } }, { 0x00b1, { 0xb1, 0x00 } }, { 0x00b2, { 0xb2, 0x00 } },
+	{ 0x00b3, { 0xb3, 0x00 } }, { 0x00b4, { 0xb4, 0x00 } }, { 0x00b5, { 0xb5, 0x00 } },
+	{ 0x00b6, { 0xb6, 0x00 } }, { 0x00b7, { 0xb7, 0x00 } }, { 0x00b8, { 0xb8, 0x00 } },
+	{ 0x00b9, { 0xb9, 0x00 } }, { 0x00ba, { 0xba, 0x00 } }, { 0x00bb, { 0xbb, 0x00 } },
+	{ 0x00bc, { 0xbc, 0x00 } }, { 0x00bd, { 0xbd, 0x00 } }, { 0x00be, { 0xbe, 0x00 } },
+	{ 0x00bf, { 0xbf, 0x00 } }, { 0x00c0, { 0xc0, 0x00 } }, { 0x00c1, { 0xc1, 0x00 } },
+	{ 0x00c2, { 0xc2, 0x00 } }, { 0x00c3, { 0xc3, 0x00 } }, { 0x00c4, { 0xc4, 0x00 } },
+	{ 0x00c5, { 0xc5, 0x00 } }, { 0x00c6, { 0xc6, 0x00 } }, { 0x00c7, { 0xc7, 0x00 } },
+	{ 0x00c8, { 0xc8, 0x00 } }, { 0x00c9, { 0xc9, 0x00 } }, { 0x00ca, { 0xca, 0x00 } },
+	{ 0x00cb, { 0xcb, 0x00 } }, { 0x00cc, { 0xcc, 0x00 } }, { 0x00cd, { 0xcd, 0x00 } },
+	{ 0x00ce, { 0xce, 0x00 } }, { 0x00cf, { 0xcf, 0x00 } }, { 0x00d0, { 0xd0, 0x00 } },
+	{ 0x00d1, { 0xd1, 0x00 } }, { 0x00d2, { 0xd2, 0x00 } }, { 0x00d3, { 0xd3, 0x00 } },
+	{ 0x00d4, { 0xd4, 0x00 } }, { 0x00d5, { 0xd5, 0x00 } }, { 0x00d6, { 0xd6, 0x00 } },
+	{ 0x00d7, { 0xd7, 0x00 } }, { 0x00d8, { 0xd8, 0x00 } }, { 0x00d9, { 0xd9, 0x00 } },
+	{ 0x00da, { 0xda, 0x00 } }, { 0x00db, { 0xdb, 0x00 } }, { 0x00dc, { 0xdc, 0x00 } },
+	{ 0x00dd, { 0xdd, 0x00 } }, { 0x00de, { 0xde, 0x00 } }, { 0x00df, { 0xdf, 0x00 } },
+	{ 0x00e0, { 0xe0, 0x00 } }, { 0x00e1, { 0xe1, 0x00 } }, { 0x00e2, { 0xe2, 0x00 } },
+	{ 0x00e3, { 0xe3, 0x00 } }, { 0x00e4, { 0xe4, 0x00 } }, { 0x00e5, { 0xe5, 0x00 } },
+	{ 0x00e6, { 0xe6, 0x00 } }, { 0x00e7, { 0xe7, 0x00 } }, { 0x00e8, { 0xe8, 0x00 } },
+	{ 0x00e9, { 0xe9, 0x00 } }, { 0x00ea, { 0xea, 0x00 } }, { 0x00eb, { 0xeb, 0x00 } },
+	{ 0x00ec, { 0xec, 0x00 } }, { 0x00ed, { 0xed, 0x00 } }, { 0x00ee, { 0xee, 0x00 } },
+	{ 0x00ef, { 0xef, 0x00 } }, { 0x00f0, { 0xf0, 0x00 } }, { 0x00f1, { 0xf1, 0x00 } },
+	{ 0x00f2, { 0xf2, 0x00 } }, { 0x00f3, { 0xf3, 0x00 } }, { 0x00f4, { 0xf4, 0x00 } },
+	{ 0x00f5, { 0xf5, 0x00 } }, { 0x00f6, { 0xf6, 0x00 } }, { 0x00f7, { 0xf7, 0x00 } },
+	{ 0x00f8, { 0xf8, 0x00 } }, { 0x00f9, { 0xf9, 0x00 } }, { 0x00fa, { 0xfa, 0x00 } },
+	{ 0x00fb, { 0xfb, 0x00 } }, { 0x00fc, { 0xfc, 0x00 } }, { 0x00fd, { 0xfd, 0x00 } },
+	{ 0x00fe, { 0xfe, 0x00 } }, { 0x00ff, { 0xff, 0x00 } }, { 0x0393, { 0x92, 0x00 } },
+	{ 0x0398, { 0x99, 0x00 } }, { 0x03a3, { 0x94, 0x00 } }, { 0x03a9, { 0x9a, 0x00 } },
+	{ 0x03b1, { 0x90, 0x00 } }, { 0x03b4, { 0x9b, 0x00 } }, { 0x03b5, { 0x9e, 0x00 } },
+	{ 0x03c0, { 0x93, 0x00 } }, { 0x03c3, { 0x95, 0x00 } }, { 0x03c4, { 0x97, 0x00 } },
+	{ 0x0411, { 0x80, 0x00 } }, { 0x0414, { 0x81, 0x00 } }, { 0x0416, { 0x82, 0x00 } },
+	{ 0x0417, { 0x83, 0x00 } }, { 0x0418, { 0x84, 0x00 } }, { 0x0419, { 0x85, 0x00 } },
+	{ 0x041b, { 0x86, 0x00 } }, { 0x041f, { 0x87, 0x00 } }, { 0x0423, { 0x88, 0x00 } },
+	{ 0x0426, { 0x89, 0x00 } }, { 0x0427, { 0x8a, 0x00 } }, { 0x0428, { 0x8b, 0x00 } },
+	{ 0x0429, { 0x8c, 0x00 } }, { 0x042a, { 0x8d, 0x00 } }, { 0x042b, { 0x8e, 0x00 } },
+	{ 0x042d, { 0x8f, 0x00 } }, { 0x201c, { 0x12, 0x00 } }, { 0x201d, { 0x13, 0x00 } },
+	{ 0x2126, { 0x9a, 0x00 } }, { 0x2190, { 0x1b, 0x00 } }, { 0x2191, { 0x18, 0x00 } },
+	{ 0x2192, { 0x1a, 0x00 } }, { 0x2193, { 0x19, 0x00 } }, { 0x21b5, { 0x17, 0x00 } },
+	{ 0x221e, { 0x9c, 0x00 } }, { 0x2229, { 0x9f, 0x00 } }, { 0x2264, { 0x1c, 0x00 } },
+	{ 0x2265, { 0x1d, 0x00 } }, { 0x2302, { 0x7f, 0x00 } }, { 0x25b2, { 0x1e, 0x00 } },
+	{ 0x25b6, { 0x10, 0x00 } }, { 0x25bc, { 0x1f, 0x00 } }, { 0x25c0, { 0x11, 0x00 } },
+	{ 0x25cf, { 0x16, 0x00 } }, { 0x2665, { 0x9d, 0x00 } }, { 0x266a, { 0x91, 0x00 } },
+	{ 0x266c, { 0x96, 0x00 } }
+};
+
+
+/** Return the character code of ASCII character 'c' in 'rom', or -1 if the
+ * ROM does not have it. Codes 0x00 to 0x0f are CGRAM and 0x10 to 0x1f are not
+ * ASCII in either ROM, so control characters are never mapped. */
+static int i2c_lcd_charset_rom_ascii(enum i2c_lcd_rom rom, uint8_t c) {
+	/* {{{ */
+	if (c < 0x20 || c == 0x7f) return -1;
+
+	/* A00 has a yen sign in place of the backslash and arrows in place of the
+	 * tilde and DEL */
+	if (rom == I2C_LCD_ROM_A00 && (c == '\\' || c == '~')) return -1;
+
+	return c;
+	/* }}} */
+}
+
+
+struct i2c_lcd_charset i2c_lcd_charset_init(enum i2c_lcd_rom rom, \
+	uint8_t fallback) {
+	/* {{{ */
+	struct i2c_lcd_charset i2c_lcd_charset = {
+		.rom = rom,
+		.fallback = fallback,
+		.glyph = NULL,
+		.glyph_ctx = NULL
+	};
+
+	for (int c = 0; c < 128; c++) {
+		int code = i2c_lcd_charset_rom_ascii(rom, c);
+		i2c_lcd_charset.ascii[c] = code == -1 ? fallback : code;
+	}
+
+	return i2c_lcd_charset;
+	/* }}} */
+}
+
+
+/** Show code points the ROM does not have with the dot patterns returned by
+ * 'glyph' (where the text is written through something that manages CGRAM,
+ * such as i2c_lcd_page_write_utf8()) */
+void i2c_lcd_charset_set_glyphs(struct i2c_lcd_charset *i2c_lcd_charset, \
+	const uint8_t *(*glyph)(void *, uint32_t), void *ctx) {
+	/* {{{ */
+	i2c_lcd_charset->glyph = glyph;
+	i2c_lcd_charset->glyph_ctx = ctx;
+	/* }}} */
+}
+
+
+/** Decode one code point from the UTF-8 in the 'n' (at least 1) bytes at 's'
+ * into 'cp'. Overlong forms, surrogates, code points past U+10FFFF and
+ * truncated sequences are invalid, in which case one byte is skipped and 'cp'
+ * is set to I2C_LCD_CHARSET_INVALID.
+ *
+ * Returns the number of bytes used.
+ */
+size_t i2c_lcd_charset_decode(const char *s, size_t n, uint32_t *cp) {
+	/* {{{ */
+	const uint8_t *in = (const uint8_t *) s;
+	/* The smallest code point each length can encode */
+	static const uint32_t min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+	size_t len;
+	uint32_t value;
+
+	if (in[0] < 0x80) {
+		*cp = in[0];
+		return 1;
+	} else if ((in[0] & 0xe0) == 0xc0) {
+		len = 2;
+		value = in[0] & 0x1f;
+	} else if ((in[0] & 0xf0) == 0xe0) {
+		len = 3;
+		value = in[0] & 0x0f;
+	} else if ((in[0] & 0xf8) == 0xf0) {
+		len = 4;
+		value = in[0] & 0x07;
+	} else {
+		*cp = I2C_LCD_CHARSET_INVALID;
+		return 1;
+	}
+
+	if (len > n) {
+		*cp = I2C_LCD_CHARSET_INVALID;
+		return 1;
+	}
+	for (size_t i = 1; i < len; i++) {
+		if ((in[i] & 0xc0) != 0x80) {
+			*cp = I2C_LCD_CHARSET_INVALID;
+			return 1;
+		}
+		value = (value << 6) | (in[i] & 0x3f);
+	}
+
+	if (value < min[len] || value > 0x10ffff \
+		|| (value >= 0xd800 && value <= 0xdfff)) {
+		*cp = I2C_LCD_CHARSET_INVALID;
+		return 1;
+	}
+
+	*cp = value;
+	return len;
+	/* }}} */
+}
+
+
+static int i2c_lcd_charset_entry_cmp(const void *key, const void *entry) {
+	/* {{{ */
+	uint32_t cp = *(const uint32_t *) key;
+	uint32_t other = ((const struct i2c_lcd_charset_entry *) entry)->cp;
+
+	return (cp > other) - (cp < other);
+	/* }}} */
+}
+
+
+/** Look up the character codes that show code point 'cp' in the ROM of
+ * 'i2c_lcd_charset', storing them in 'code'.
+ *
+ * Returns the number of character codes (1 or 2), or 0 if the ROM does not
+ * have the code point.
+ */
+int i2c_lcd_charset_lookup(const struct i2c_lcd_charset *i2c_lcd_charset, \
+	uint32_t cp, uint8_t code[2]) {
+	/* {{{ */
+	const struct i2c_lcd_charset_entry *table = i2c_lcd_charset_a00;
+	size_t n = sizeof(i2c_lcd_charset_a00) / sizeof(i2c_lcd_charset_a00[0]);
+	const struct i2c_lcd_charset_entry *entry;
+
+	if (cp < 0x80) {
+		int c = i2c_lcd_charset_rom_ascii(i2c_lcd_charset->rom, cp);
+		if (c == -1) return 0;
+		code[0] = c;
+		return 1;
+	}
+
+	if (i2c_lcd_charset->rom == I2C_LCD_ROM_A02) {
+		table = i2c_lcd_charset_a02;
+		n = sizeof(i2c_lcd_charset_a02) / sizeof(i2c_lcd_charset_a02[0]);
+	}
+
+	entry = bsearch(&cp, table, n, sizeof(*table), i2c_lcd_charset_entry_cmp);
+	if (entry == NULL) return 0;
+
+	code[0] = entry->code[0];
+	code[1] = entry->code[1];
+
+	return entry->code[1] == 0 ? 1 : 2;
+	/* }}} */
+}
+
+
+/** Transcode the 'n' bytes of UTF-8 text at 's' into character codes for the
+ * ROM of 'i2c_lcd_charset', ready for i2c_lcd1602_write_buffer(). Code points
+ * the ROM does not have (and invalid UTF-8) become the fallback character.
+ * Every character code comes from at least as many bytes of UTF-8, so 'out'
+ * needs room for at most 'n' bytes.
+ *
+ * Runs of ASCII are looked up 8 bytes at a time without decoding, with a
+ * single check of the top bits of all 8 bytes deciding whether the run
+ * continues.
+ *
+ * Returns the number of character codes written to 'out'.
+ */
+size_t i2c_lcd_charset_transcode(const struct i2c_lcd_charset *i2c_lcd_charset, \
+	const char *s, size_t n, uint8_t *out) {
+	/* {{{ */
+	const uint8_t *in = (const uint8_t *) s;
+	const uint8_t *ascii = i2c_lcd_charset->ascii;
+	size_t i = 0;
+	size_t len = 0;
+
+	while (i < n) {
+		/* ASCII fast path */
+		while (n - i >= 8) {
+			uint64_t word;
+			memcpy(&word, &in[i], 8);
+			if (word & 0x8080808080808080ull) break;
+
+			for (int k = 0; k < 8; k++) out[len + k] = ascii[in[i + k]];
+			i += 8;
+			len += 8;
+		}
+		if (i == n) break;
+
+		if (in[i] < 0x80) {
+			out[len++] = ascii[in[i++]];
+			continue;
+		}
+
+		uint32_t cp;
+		uint8_t code[2];
+		i += i2c_lcd_charset_decode((const char *) &in[i], n - i, &cp);
+
+		int k = i2c_lcd_charset_lookup(i2c_lcd_charset, cp, code);
+		if (k == 0) {
+			out[len++] = i2c_lcd_charset->fallback;
+		} else {
+			for (int j = 0; j < k; j++) out[len++] = code[j];
+		}
+	}
+
+	return len;
+	/* }}} */
+}
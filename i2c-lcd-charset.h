@@ -0,0 +1,50 @@
+#ifndef I2C_LCD_CHARSET
+#define I2C_LCD_CHARSET
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The character generator ROM variants of the HD44780 (page 17, 18 of the
+ * HD44780 datasheet). A00 has Japanese katakana, A02 has European and Cyrillic
+ * characters. */
+enum i2c_lcd_rom {
+	I2C_LCD_ROM_A00,
+	I2C_LCD_ROM_A02
+};
+
+/* Returned by i2c_lcd_charset_decode() for invalid UTF-8 */
+#define I2C_LCD_CHARSET_INVALID 0xfffd
+
+
+/* One code point and the one or two character codes that show it */
+struct i2c_lcd_charset_entry {
+	uint32_t cp;
+	uint8_t code[2];
+};
+
+struct i2c_lcd_charset {
+	enum i2c_lcd_rom rom;
+	/* The character code shown for code points the ROM does not have */
+	uint8_t fallback;
+	/* The character code of each ASCII character, with 'fallback' for the
+	 * ones the ROM does not have, so that ASCII text needs nothing more than
+	 * one lookup per character */
+	uint8_t ascii[128];
+	/* Optionally returns a 5x8 dot pattern (8 rows) to show a code point the
+	 * ROM does not have as a custom character, or NULL to use 'fallback' */
+	const uint8_t *(*glyph)(void *ctx, uint32_t cp);
+	void *glyph_ctx;
+};
+
+
+struct i2c_lcd_charset i2c_lcd_charset_init(enum i2c_lcd_rom rom, uint8_t fallback);
+
+void i2c_lcd_charset_set_glyphs(struct i2c_lcd_charset *i2c_lcd_charset, const uint8_t *(*glyph)(void *, uint32_t), void *ctx);
+
+size_t i2c_lcd_charset_decode(const char *s, size_t n, uint32_t *cp);
+
+int i2c_lcd_charset_lookup(const struct i2c_lcd_charset *i2c_lcd_charset, uint32_t cp, uint8_t code[2]);
+
+size_t i2c_lcd_charset_transcode(const struct i2c_lcd_charset *i2c_lcd_charset, const char *s, size_t n, uint8_t *out);
+
+#endif
@@ -0,0 +1,327 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-dlist.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+
+/** Start an empty display list for the given i2c LCD. Recording only encodes
+ * into the list, nothing is sent until i2c_lcd_dlist_replay(). */
+void i2c_lcd_dlist_init(struct i2c_lcd_dlist *i2c_lcd_dlist, \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	memset(i2c_lcd_dlist, 0, sizeof(*i2c_lcd_dlist));
+	i2c_lcd_dlist->i2c_lcd1602 = i2c_lcd1602;
+	i2c_lcd_dlist->last_mode = -1;
+	i2c_lcd_dlist->backlight = i2c_lcd1602->backlight;
+	i2c_lcd_dlist->model = *i2c_lcd1602;
+	i2c_lcd_dlist->model.ac = I2C_LCD1602_AC_UNKNOWN;
+	/* }}} */
+}
+
+
+/** Record an instruction (or character, depending on 'mode'). As in
+ * i2c_lcd_uring_command(), runs of instructions and characters the
+ * controller executes faster than the bus can send the next one go into one
+ * write, and a delay of the execution time follows anything slower (clear
+ * display, return home, page 24 of the HD44780 datasheet).
+ *
+ * Returns 0 on success, and -1 (with errno set to ENOSPC) if the list is
+ * full.
+ */
+int i2c_lcd_dlist_command(struct i2c_lcd_dlist *i2c_lcd_dlist, uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_dlist->i2c_lcd1602;
+	enum i2c_lcd1602_command_type type = i2c_lcd1602_command_type(data, mode);
+	struct i2c_lcd_dlist_step *step = i2c_lcd_dlist->n_steps > 0 \
+		? &i2c_lcd_dlist->steps[i2c_lcd_dlist->n_steps - 1] : NULL;
+
+	/* Every byte carries the backlight setting of the list, so that
+	 * i2c_lcd_dlist_replay() can follow a change to it */
+	mode = (mode & ~LCD_BACKLIGHT) | i2c_lcd_dlist->backlight;
+	size_t need = mode != i2c_lcd_dlist->last_mode \
+		? I2C_LCD1602_BYTES_PER_COMMAND : I2C_LCD1602_BYTES_PER_CHAR;
+
+	/* Each entry may start a write and add a delay */
+	if (i2c_lcd_dlist->len + need > sizeof(i2c_lcd_dlist->bytes) \
+		|| i2c_lcd_dlist->n_steps + 2 > I2C_LCD_DLIST_STEPS) {
+
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if (step == NULL || step->len == 0) {
+		step = &i2c_lcd_dlist->steps[i2c_lcd_dlist->n_steps++];
+		step->offset = i2c_lcd_dlist->len;
+		step->len = 0;
+		step->delay_ns = 0;
+	}
+
+	/* Only present RS separately when it changes */
+	uint8_t *buf = &i2c_lcd_dlist->bytes[i2c_lcd_dlist->len];
+	if (mode != i2c_lcd_dlist->last_mode) {
+		need = i2c_lcd1602_encode_command(i2c_lcd1602, buf, data, mode);
+	} else {
+		need = i2c_lcd1602_encode_4bitmode(i2c_lcd1602, buf, data, mode);
+	}
+	i2c_lcd_dlist->len += need;
+	step->len += need;
+	i2c_lcd_dlist->last_mode = mode;
+	i2c_lcd_dlist->counts[type]++;
+
+	i2c_lcd1602_track(&i2c_lcd_dlist->model, data, mode);
+
+	long exec_ns = i2c_lcd1602->timing.exec_ns[type];
+	if (exec_ns > i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]) {
+		step = &i2c_lcd_dlist->steps[i2c_lcd_dlist->n_steps++];
+		step->offset = i2c_lcd_dlist->len;
+		step->len = 0;
+		step->delay_ns = exec_ns;
+		i2c_lcd_dlist->last_mode = -1;
+		i2c_lcd_dlist->last_exec_ns = 0;
+	} else {
+		i2c_lcd_dlist->last_exec_ns = exec_ns;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Record a character, see i2c_lcd1602_send_char() */
+int i2c_lcd_dlist_send_char(struct i2c_lcd_dlist *i2c_lcd_dlist, char c) {
+	/* {{{ */
+	/* Set RS and R/W appropriately */
+	return i2c_lcd_dlist_command(i2c_lcd_dlist, c, set_mode(1, 0));
+	/* }}} */
+}
+
+
+/** Record a run of 'n' characters, see i2c_lcd1602_write_buffer().
+ *
+ * Returns 0 on success, and -1 if the list is full, in which case only the
+ * characters that fit were recorded.
+ */
+int i2c_lcd_dlist_write_buffer(struct i2c_lcd_dlist *i2c_lcd_dlist, \
+	const char *buf, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (0 != i2c_lcd_dlist_send_char(i2c_lcd_dlist, buf[i])) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Record setting the cursor position, see i2c_lcd1602_set_cursor_pos() */
+int i2c_lcd_dlist_set_cursor_pos(struct i2c_lcd_dlist *i2c_lcd_dlist, \
+	uint8_t ac) {
+	/* {{{ */
+	/* Set RS and R/W appropriately */
+	return i2c_lcd_dlist_command(i2c_lcd_dlist, LCD_SETDDRAMADDR | ac, \
+		set_mode(0, 0));
+	/* }}} */
+}
+
+
+/** Record clearing the display, see i2c_lcd1602_clear_display() */
+int i2c_lcd_dlist_clear_display(struct i2c_lcd_dlist *i2c_lcd_dlist) {
+	/* {{{ */
+	/* Set RS and R/W appropriately */
+	return i2c_lcd_dlist_command(i2c_lcd_dlist, LCD_CLEARDISPLAY, \
+		set_mode(0, 0));
+	/* }}} */
+}
+
+
+/** Record a hole called 'name' of 'width' characters at the cursor, which
+ * is blank until it is filled in with i2c_lcd_dlist_set(). The characters of
+ * a hole are recorded in one run, so each is encoded into the same number of
+ * bytes and can be patched in place.
+ *
+ * Returns the index of the hole, which is passed to i2c_lcd_dlist_set(), or
+ * -1 (with errno set to ENOSPC) if there is no room for it.
+ */
+int i2c_lcd_dlist_hole(struct i2c_lcd_dlist *i2c_lcd_dlist, \
+	const char *name, uint8_t width) {
+	/* {{{ */
+	uint8_t mode = set_mode(1, 0) | i2c_lcd_dlist->backlight;
+	/* The byte presenting RS, if it changes, comes before the first
+	 * character */
+	size_t setup = mode != i2c_lcd_dlist->last_mode ? 1 : 0;
+
+	if (width == 0 || width > I2C_LCD_DLIST_HOLE_MAX \
+		|| i2c_lcd_dlist->n_holes == I2C_LCD_DLIST_HOLES \
+		|| i2c_lcd_dlist->len + setup + width * I2C_LCD1602_BYTES_PER_CHAR \
+			> sizeof(i2c_lcd_dlist->bytes) \
+		|| i2c_lcd_dlist->n_steps + 2 > I2C_LCD_DLIST_STEPS) {
+
+		errno = ENOSPC;
+		return -1;
+	}
+
+	int index = i2c_lcd_dlist->n_holes++;
+	struct i2c_lcd_dlist_hole *hole = &i2c_lcd_dlist->holes[index];
+	snprintf(hole->name, sizeof(hole->name), "%s", name);
+	hole->offset = i2c_lcd_dlist->len + setup;
+	hole->width = width;
+	memset(hole->text, ' ', width);
+
+	for (uint8_t i = 0; i < width; i++) {
+		i2c_lcd_dlist_command(i2c_lcd_dlist, ' ', mode);
+	}
+
+	return index;
+	/* }}} */
+}
+
+
+/** Return the index of the hole called 'name', or -1 if there is none */
+int i2c_lcd_dlist_find(struct i2c_lcd_dlist *i2c_lcd_dlist, const char *name) {
+	/* {{{ */
+	for (size_t i = 0; i < i2c_lcd_dlist->n_holes; i++) {
+		if (0 == strncmp(i2c_lcd_dlist->holes[i].name, name, \
+			I2C_LCD_DLIST_NAME_MAX)) {
+
+			return i;
+		}
+	}
+
+	return -1;
+	/* }}} */
+}
+
+
+/** Fill in hole 'hole' with the 'n' characters at 'text', padded with spaces
+ * or cut to the width of the hole, for the next replay. Only the characters
+ * that differ from what the hole holds are encoded again.
+ *
+ * Returns 0 on success, and -1 if there is no such hole.
+ */
+int i2c_lcd_dlist_set(struct i2c_lcd_dlist *i2c_lcd_dlist, int hole, \
+	const char *text, size_t n) {
+	/* {{{ */
+	if (hole < 0 || (size_t) hole >= i2c_lcd_dlist->n_holes) return -1;
+
+	struct i2c_lcd_dlist_hole *h = &i2c_lcd_dlist->holes[hole];
+	uint8_t mode = set_mode(1, 0) | i2c_lcd_dlist->backlight;
+
+	for (uint8_t i = 0; i < h->width; i++) {
+		char c = i < n ? text[i] : ' ';
+
+		if (c == h->text[i]) continue;
+		h->text[i] = c;
+		i2c_lcd1602_encode_4bitmode(i2c_lcd_dlist->i2c_lcd1602, \
+			&i2c_lcd_dlist->bytes[h->offset + i * I2C_LCD1602_BYTES_PER_CHAR], \
+			c, mode);
+		i2c_lcd_dlist->patched++;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Send the display list to its LCD. Unless the list contains slow
+ * instructions, which need a delay after them, this is one write of bytes
+ * that were encoded when the list was recorded (or a hole was set). Waiting
+ * for the controller uses the wait mode of the LCD, see
+ * i2c_lcd1602_set_wait(). Afterwards the register model of the LCD is what
+ * the list leaves it as, and the LCD is busy until the controller has
+ * executed the last instruction. An LCD left out of sync by an earlier failed
+ * transfer is resynchronized (see i2c_lcd1602_resync()) before anything is
+ * sent.
+ *
+ * Returns 0 on success, and -1 if the resync or the write to the i2c device
+ * failed.
+ */
+int i2c_lcd_dlist_replay(struct i2c_lcd_dlist *i2c_lcd_dlist) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_dlist->i2c_lcd1602;
+	struct i2c_lcd1602 *model = &i2c_lcd_dlist->model;
+	uint64_t *counts = i2c_lcd_dlist->counts;
+	int ret = 0;
+#ifndef I2C_LCD1602_NO_STATS
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+	if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+		return -1;
+	}
+
+	/* The backlight is an output of the PCF8574 that every byte sets, so the
+	 * list is brought in line with it once after it changes */
+	if (i2c_lcd_dlist->backlight != i2c_lcd1602->backlight) {
+		for (size_t i = 0; i < i2c_lcd_dlist->len; i++) {
+			i2c_lcd_dlist->bytes[i] = (i2c_lcd_dlist->bytes[i] & ~LCD_BACKLIGHT) \
+				| i2c_lcd1602->backlight;
+		}
+		i2c_lcd_dlist->backlight = i2c_lcd1602->backlight;
+	}
+
+	for (size_t s = 0; s < i2c_lcd_dlist->n_steps; s++) {
+		struct i2c_lcd_dlist_step *step = &i2c_lcd_dlist->steps[s];
+
+		if (step->len == 0) {
+			i2c_lcd1602_set_busy(i2c_lcd1602, step->delay_ns);
+			continue;
+		}
+
+		i2c_lcd1602_wait_ready(i2c_lcd1602);
+		if (0 != i2c_lcd1602_write_bytes(i2c_lcd1602, \
+			&i2c_lcd_dlist->bytes[step->offset], step->len)) {
+
+			ret = -1;
+			break;
+		}
+	}
+
+	/* A list that ends with a slow instruction has already set the time the
+	 * controller is busy for */
+	if (i2c_lcd_dlist->last_exec_ns > 0) {
+		i2c_lcd1602_set_busy(i2c_lcd1602, i2c_lcd_dlist->last_exec_ns);
+	}
+
+	/* Even if the write failed, this is the state i2c_lcd1602_resync() should
+	 * bring back */
+	if (counts[I2C_LCD1602_CMD_CLEAR] || counts[I2C_LCD1602_CMD_ENTRY_MODE]) {
+		i2c_lcd1602->entry_shift_increment = model->entry_shift_increment;
+		i2c_lcd1602->entry_shift = model->entry_shift;
+	}
+	if (counts[I2C_LCD1602_CMD_DISPLAY_CONTROL]) {
+		i2c_lcd1602->display = model->display;
+	}
+	if (counts[I2C_LCD1602_CMD_FUNCTION_SET]) {
+		i2c_lcd1602->function = model->function;
+	}
+	if (counts[I2C_LCD1602_CMD_CLEAR] || counts[I2C_LCD1602_CMD_HOME] \
+		|| counts[I2C_LCD1602_CMD_SHIFT] || counts[I2C_LCD1602_CMD_SET_CGRAM] \
+		|| counts[I2C_LCD1602_CMD_SET_DDRAM] || counts[I2C_LCD1602_CMD_DATA]) {
+
+		i2c_lcd1602->ac = model->ac;
+	}
+
+	for (int type = 0; type < I2C_LCD1602_CMD_TYPES; type++) {
+		i2c_lcd1602_stats_count(i2c_lcd1602, type, counts[type]);
+	}
+	i2c_lcd_dlist->replays++;
+
+#ifndef I2C_LCD1602_NO_STATS
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	i2c_lcd1602_stats_latency(i2c_lcd1602, (end.tv_sec - start.tv_sec) \
+		* 1000000000L + (end.tv_nsec - start.tv_nsec));
+#endif
+
+	return ret;
+	/* }}} */
+}
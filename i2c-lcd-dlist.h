@@ -0,0 +1,95 @@
+#ifndef I2C_LCD_DLIST
+#define I2C_LCD_DLIST
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i2c-LCD1602.h"
+
+/* The most bytes a display list can send to the PCF8574, enough to draw every
+ * cell of a 20x4 display and the instructions to get to each row */
+#define I2C_LCD_DLIST_MAX 512
+/* The most writes and delays a display list can be cut into */
+#define I2C_LCD_DLIST_STEPS 16
+/* The most holes a display list can have */
+#define I2C_LCD_DLIST_HOLES 16
+/* The longest hole name, including the terminating '\0' */
+#define I2C_LCD_DLIST_NAME_MAX 16
+/* The widest hole, which is one line of DDRAM in 2-line mode (page 11 of the
+ * HD44780 datasheet) */
+#define I2C_LCD_DLIST_HOLE_MAX 40
+
+/* One write of the bytes of a display list from 'offset' to 'offset' +
+ * 'len', or a delay of 'delay_ns' (if 'len' is 0) */
+struct i2c_lcd_dlist_step {
+	size_t offset;
+	size_t len;
+	long delay_ns;
+};
+
+/* A field of a display list that is filled in at replay time: 'width'
+ * characters whose encoded bytes start at 'offset', I2C_LCD1602_BYTES_PER_CHAR
+ * bytes apart */
+struct i2c_lcd_dlist_hole {
+	char name[I2C_LCD_DLIST_NAME_MAX];
+	size_t offset;
+	uint8_t width;
+	/* The characters currently encoded into the hole */
+	char text[I2C_LCD_DLIST_HOLE_MAX];
+};
+
+/* A sequence of instructions and characters recorded once and encoded into
+ * the bytes the PCF8574 is sent, so that drawing a fixed layout again costs a
+ * copy rather than a call (and an encode) per instruction. Fields that change
+ * are recorded as holes, whose characters are patched into the encoded bytes
+ * before each replay. A display list only replays correctly on an LCD in the
+ * state it was recorded for: the same entry mode and line count, and the same
+ * enable output. The backlight may change in between. */
+struct i2c_lcd_dlist {
+	struct i2c_lcd1602 *i2c_lcd1602;
+	uint8_t bytes[I2C_LCD_DLIST_MAX];
+	size_t len;
+	struct i2c_lcd_dlist_step steps[I2C_LCD_DLIST_STEPS];
+	size_t n_steps;
+	struct i2c_lcd_dlist_hole holes[I2C_LCD_DLIST_HOLES];
+	size_t n_holes;
+	/* The mode of the last entry, or -1 if the next must present RS first */
+	int last_mode;
+	/* How long the controller takes to execute the last entry, if the list
+	 * does not end with a delay for it */
+	long last_exec_ns;
+	/* The backlight setting encoded into the bytes */
+	uint8_t backlight;
+	/* The instructions and characters in the list, by type */
+	uint64_t counts[I2C_LCD1602_CMD_TYPES];
+	/* The register model (see i2c_lcd1602_track()) as the list leaves it.
+	 * Its address counter starts out unknown, so it is only known at the end
+	 * if the list sets it before moving it. */
+	struct i2c_lcd1602 model;
+	/* Statistics */
+	uint64_t replays;
+	uint64_t patched;
+};
+
+
+void i2c_lcd_dlist_init(struct i2c_lcd_dlist *i2c_lcd_dlist, struct i2c_lcd1602 *i2c_lcd1602);
+
+int i2c_lcd_dlist_command(struct i2c_lcd_dlist *i2c_lcd_dlist, uint8_t data, uint8_t mode);
+
+int i2c_lcd_dlist_send_char(struct i2c_lcd_dlist *i2c_lcd_dlist, char c);
+
+int i2c_lcd_dlist_write_buffer(struct i2c_lcd_dlist *i2c_lcd_dlist, const char *buf, size_t n);
+
+int i2c_lcd_dlist_set_cursor_pos(struct i2c_lcd_dlist *i2c_lcd_dlist, uint8_t ac);
+
+int i2c_lcd_dlist_clear_display(struct i2c_lcd_dlist *i2c_lcd_dlist);
+
+int i2c_lcd_dlist_hole(struct i2c_lcd_dlist *i2c_lcd_dlist, const char *name, uint8_t width);
+
+int i2c_lcd_dlist_find(struct i2c_lcd_dlist *i2c_lcd_dlist, const char *name);
+
+int i2c_lcd_dlist_set(struct i2c_lcd_dlist *i2c_lcd_dlist, int hole, const char *text, size_t n);
+
+int i2c_lcd_dlist_replay(struct i2c_lcd_dlist *i2c_lcd_dlist);
+
+#endif
@@ -0,0 +1,437 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-emulator.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+
+/** Add 'ns' nanoseconds to 't' */
+static void timespec_add_ns(struct timespec *t, long ns) {
+	/* {{{ */
+	t->tv_nsec += ns;
+	while (t->tv_nsec >= 1000000000) {
+		t->tv_nsec -= 1000000000;
+		t->tv_sec++;
+	}
+	/* }}} */
+}
+
+
+/** Return whether 'a' is earlier than 'b' */
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+	/* {{{ */
+	if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+	/* }}} */
+}
+
+
+/** Put the emulated LCD in the state the HD44780 is in after power on (page
+ * 23 of the HD44780 datasheet), and start its statistics from zero */
+void i2c_lcd_emu_init(struct i2c_lcd_emu *i2c_lcd_emu) {
+	/* {{{ */
+	memset(i2c_lcd_emu, 0, sizeof(*i2c_lcd_emu));
+
+	i2c_lcd_emu->function = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
+	i2c_lcd_emu->display = LCD_DISPLAYOFF | LCD_CURSOROFF | LCD_BLINKOFF;
+	i2c_lcd_emu->entry = LCD_ENTRYINCREMENT | LCD_ENTRYNOSHIFT;
+	memset(i2c_lcd_emu->ddram, ' ', sizeof(i2c_lcd_emu->ddram));
+
+	i2c_lcd_emu->enable = E;
+	i2c_lcd_emu->byte_ns = I2C_LCD_EMU_BYTE_NS_100KHZ;
+	i2c_lcd_emu->timing = i2c_lcd1602_datasheet_timing;
+	/* }}} */
+}
+
+
+/** Have the given i2c LCD send its bytes to the emulated LCD */
+void i2c_lcd_emu_attach(struct i2c_lcd_emu *i2c_lcd_emu, \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	i2c_lcd1602_set_transport(i2c_lcd1602, &i2c_lcd_emu_transport, i2c_lcd_emu);
+	/* }}} */
+}
+
+
+/** Make 'second' the other controller of a module with two, whose enable
+ * input is wired to the PCF8574 output(s) 'enable'. Everything written to
+ * 'i2c_lcd_emu' (which should be the one attached to the i2c LCDs of both
+ * controllers) is also seen by 'second', but each controller only latches
+ * nibbles on its own enable strobe. If 'enable' is R/W, the R/W input of
+ * 'second' is taken to be tied low. Both must have been initialised with
+ * i2c_lcd_emu_init(), and the statistics of the bus are only kept in
+ * 'i2c_lcd_emu'. */
+void i2c_lcd_emu_share(struct i2c_lcd_emu *i2c_lcd_emu, \
+	struct i2c_lcd_emu *second, uint8_t enable) {
+	/* {{{ */
+	second->enable = enable;
+	i2c_lcd_emu->shared = second;
+	/* }}} */
+}
+
+
+/** Return the DDRAM address after 'ac' in the direction 'increment'. In
+ * 2-line mode the end of each line wraps to the start of the other (page 11
+ * of the HD44780 datasheet), in 1-line mode DDRAM is one line of 80. */
+static uint8_t i2c_lcd_emu_next_ddram(struct i2c_lcd_emu *i2c_lcd_emu, \
+	uint8_t ac, int increment) {
+	/* {{{ */
+	if (i2c_lcd_emu->function & LCD_2LINE) {
+		if (increment) {
+			if (ac == 0x27) return 0x40;
+			if (ac >= 0x67) return 0x00;
+			return ac + 1;
+		}
+		if (ac == 0x00) return 0x67;
+		if (ac == 0x40) return 0x27;
+		return ac - 1;
+	}
+
+	if (increment) return (ac + 1) % 80;
+	return (ac + 79) % 80;
+	/* }}} */
+}
+
+
+/** Move the address counter one step in the direction 'increment' */
+static void i2c_lcd_emu_step_ac(struct i2c_lcd_emu *i2c_lcd_emu, int increment) {
+	/* {{{ */
+	if (i2c_lcd_emu->ac_in_cgram) {
+		i2c_lcd_emu->ac = (i2c_lcd_emu->ac + (increment ? 1 : -1)) \
+			& (I2C_LCD_EMU_CGRAM_SIZE - 1);
+	} else {
+		i2c_lcd_emu->ac = i2c_lcd_emu_next_ddram(i2c_lcd_emu, i2c_lcd_emu->ac, \
+			increment);
+	}
+	/* }}} */
+}
+
+
+/** Shift the display one column in the direction 'left' */
+static void i2c_lcd_emu_shift_display(struct i2c_lcd_emu *i2c_lcd_emu, \
+	int left) {
+	/* {{{ */
+	uint8_t width = (i2c_lcd_emu->function & LCD_2LINE) ? 40 : 80;
+
+	i2c_lcd_emu->display_shift = \
+		(i2c_lcd_emu->display_shift + (left ? 1 : width - 1)) % width;
+	/* }}} */
+}
+
+
+/** Execute an instruction, or write a character if 'rs' is set, as the
+ * controller would at time 't' (page 24 - 29 of the HD44780 datasheet) */
+static void i2c_lcd_emu_execute(struct i2c_lcd_emu *i2c_lcd_emu, uint8_t data, \
+	uint8_t rs, const struct timespec *t) {
+	/* {{{ */
+	enum i2c_lcd1602_command_type type = \
+		i2c_lcd1602_command_type(data, rs ? Rs : 0);
+
+	if (timespec_before(t, &i2c_lcd_emu->busy_until)) {
+		i2c_lcd_emu->busy_violations++;
+		if (i2c_lcd_emu->strict) return;
+	}
+	i2c_lcd_emu->busy_until = *t;
+	timespec_add_ns(&i2c_lcd_emu->busy_until, i2c_lcd_emu->timing.exec_ns[type]);
+
+	if (rs) {
+		i2c_lcd_emu->characters++;
+	} else {
+		i2c_lcd_emu->instructions++;
+	}
+
+	int increment = i2c_lcd_emu->entry & LCD_ENTRYINCREMENT;
+
+	switch (type) {
+	case I2C_LCD1602_CMD_CLEAR:
+		memset(i2c_lcd_emu->ddram, ' ', sizeof(i2c_lcd_emu->ddram));
+		i2c_lcd_emu->ac = 0;
+		i2c_lcd_emu->ac_in_cgram = 0;
+		i2c_lcd_emu->display_shift = 0;
+		i2c_lcd_emu->entry |= LCD_ENTRYINCREMENT;
+		break;
+	case I2C_LCD1602_CMD_HOME:
+		i2c_lcd_emu->ac = 0;
+		i2c_lcd_emu->ac_in_cgram = 0;
+		i2c_lcd_emu->display_shift = 0;
+		break;
+	case I2C_LCD1602_CMD_ENTRY_MODE:
+		i2c_lcd_emu->entry = data & (LCD_ENTRYINCREMENT | LCD_ENTRYSHIFT);
+		break;
+	case I2C_LCD1602_CMD_DISPLAY_CONTROL:
+		i2c_lcd_emu->display = data & (LCD_DISPLAYON | LCD_CURSORON | LCD_BLINKON);
+		break;
+	case I2C_LCD1602_CMD_SHIFT:
+		if (data & LCD_DISPLAYMOVE) {
+			i2c_lcd_emu_shift_display(i2c_lcd_emu, !(data & LCD_MOVERIGHT));
+		} else {
+			i2c_lcd_emu_step_ac(i2c_lcd_emu, data & LCD_MOVERIGHT);
+		}
+		break;
+	case I2C_LCD1602_CMD_FUNCTION_SET:
+		i2c_lcd_emu->function = data & (LCD_8BITMODE | LCD_2LINE | LCD_5x10DOTS);
+		break;
+	case I2C_LCD1602_CMD_SET_CGRAM:
+		i2c_lcd_emu->ac = data & (I2C_LCD_EMU_CGRAM_SIZE - 1);
+		i2c_lcd_emu->ac_in_cgram = 1;
+		break;
+	case I2C_LCD1602_CMD_SET_DDRAM:
+		i2c_lcd_emu->ac = data & (I2C_LCD_EMU_DDRAM_SIZE - 1);
+		i2c_lcd_emu->ac_in_cgram = 0;
+		break;
+	case I2C_LCD1602_CMD_DATA:
+		if (i2c_lcd_emu->ac_in_cgram) {
+			i2c_lcd_emu->cgram[i2c_lcd_emu->ac] = data;
+		} else {
+			i2c_lcd_emu->ddram[i2c_lcd_emu->ac] = data;
+			if (i2c_lcd_emu->entry & LCD_ENTRYSHIFT) {
+				i2c_lcd_emu_shift_display(i2c_lcd_emu, increment);
+			}
+		}
+		i2c_lcd_emu_step_ac(i2c_lcd_emu, increment);
+		break;
+	default:
+		break;
+	}
+	/* }}} */
+}
+
+
+/** Return whether the controller is busy at time 't' */
+static int i2c_lcd_emu_busy(struct i2c_lcd_emu *i2c_lcd_emu, \
+	const struct timespec *t) {
+	/* {{{ */
+	return timespec_before(t, &i2c_lcd_emu->busy_until);
+	/* }}} */
+}
+
+
+/** Handle the PCF8574 outputs changing to 'port' at time 't' */
+static void i2c_lcd_emu_port(struct i2c_lcd_emu *i2c_lcd_emu, uint8_t port, \
+	const struct timespec *t) {
+	/* {{{ */
+	uint8_t prev = i2c_lcd_emu->port;
+	uint8_t enable = i2c_lcd_emu->enable;
+	/* A controller strobed by the R/W output has its R/W input tied low */
+	uint8_t rw = enable & Rw ? 0 : Rw;
+	int four_bit = !(i2c_lcd_emu->function & LCD_8BITMODE);
+	i2c_lcd_emu->port = port;
+
+	/* E rising while reading: the controller starts driving the data lines.
+	 * The whole 8 bit value is latched at the start of the first nibble. */
+	if (!(prev & enable) && (port & enable) && (port & rw)) {
+		if (!four_bit || !i2c_lcd_emu->nibble_pending) {
+			if (port & Rs) {
+				i2c_lcd_emu->read_value = i2c_lcd_emu->ac_in_cgram \
+					? i2c_lcd_emu->cgram[i2c_lcd_emu->ac] \
+					: i2c_lcd_emu->ddram[i2c_lcd_emu->ac];
+			} else {
+				i2c_lcd_emu->read_value = i2c_lcd_emu->ac \
+					| (i2c_lcd_emu_busy(i2c_lcd_emu, t) ? 0x80 : 0x00);
+			}
+		}
+		return;
+	}
+
+	/* Only the falling edge of E does anything else (page 49 of the HD44780
+	 * datasheet), and it uses RS, R/W and the data lines as they were while E
+	 * was high */
+	if (!((prev & enable) && !(port & enable))) return;
+
+	uint8_t nibble = prev & 0xf0;
+	uint8_t rs = prev & Rs;
+
+	if (prev & rw) {
+		/* The end of a read. Reading data moves the address counter. */
+		if (four_bit && !i2c_lcd_emu->nibble_pending) {
+			i2c_lcd_emu->nibble_pending = 1;
+			return;
+		}
+		i2c_lcd_emu->nibble_pending = 0;
+		if (rs) i2c_lcd_emu_step_ac(i2c_lcd_emu, \
+			i2c_lcd_emu->entry & LCD_ENTRYINCREMENT);
+		return;
+	}
+
+	/* In 8-bit mode only DB7 to DB4 are connected, so each nibble is a whole
+	 * instruction with DB3 to DB0 low */
+	if (!four_bit) {
+		i2c_lcd_emu_execute(i2c_lcd_emu, nibble, rs, t);
+		return;
+	}
+
+	if (!i2c_lcd_emu->nibble_pending) {
+		i2c_lcd_emu->nibble = nibble;
+		i2c_lcd_emu->nibble_pending = 1;
+		return;
+	}
+
+	i2c_lcd_emu->nibble_pending = 0;
+	i2c_lcd_emu_execute(i2c_lcd_emu, i2c_lcd_emu->nibble | (nibble >> 4), rs, t);
+	/* }}} */
+}
+
+
+/** Start a new message on the emulated bus, which cannot start before now */
+static void i2c_lcd_emu_start(struct i2c_lcd_emu *i2c_lcd_emu) {
+	/* {{{ */
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (timespec_before(&i2c_lcd_emu->bus_time, &now)) {
+		i2c_lcd_emu->bus_time = now;
+	}
+	/* The address byte */
+	timespec_add_ns(&i2c_lcd_emu->bus_time, i2c_lcd_emu->byte_ns);
+	/* }}} */
+}
+
+
+/** Decode 'n' bytes as if they had been written to the PCF8574 in one
+ * message */
+void i2c_lcd_emu_feed(struct i2c_lcd_emu *i2c_lcd_emu, const uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	i2c_lcd_emu_start(i2c_lcd_emu);
+
+	for (size_t i = 0; i < n; i++) {
+		timespec_add_ns(&i2c_lcd_emu->bus_time, i2c_lcd_emu->byte_ns);
+		/* A second controller sees the same outputs at the same time */
+		for (struct i2c_lcd_emu *e = i2c_lcd_emu; e != NULL; e = e->shared) {
+			i2c_lcd_emu_port(e, buf[i], &i2c_lcd_emu->bus_time);
+		}
+	}
+
+	i2c_lcd_emu->writes++;
+	i2c_lcd_emu->bytes_written += n;
+	/* }}} */
+}
+
+
+/** Read 'n' bytes from the PCF8574 in one message. The PCF8574 returns the
+ * level of its pins, which is what was last written to them unless the LCD is
+ * driving DB7 to DB4 (R/W and E high). */
+static void i2c_lcd_emu_sample(struct i2c_lcd_emu *i2c_lcd_emu, uint8_t *buf, \
+	size_t n) {
+	/* {{{ */
+	i2c_lcd_emu_start(i2c_lcd_emu);
+
+	for (size_t i = 0; i < n; i++) {
+		uint8_t port = i2c_lcd_emu->port;
+
+		timespec_add_ns(&i2c_lcd_emu->bus_time, i2c_lcd_emu->byte_ns);
+
+		/* Whichever controller has its enable input high drives the data
+		 * lines */
+		for (struct i2c_lcd_emu *e = i2c_lcd_emu; e != NULL; e = e->shared) {
+			if (!(port & e->enable) || !(port & Rw) || (e->enable & Rw)) continue;
+
+			uint8_t value = e->read_value;
+			/* The busy flag is live while it is being read */
+			if (!(port & Rs)) {
+				value = (value & 0x7f) \
+					| (i2c_lcd_emu_busy(e, &i2c_lcd_emu->bus_time) ? 0x80 : 0);
+			}
+			if (e->nibble_pending) value <<= 4;
+			port = (port & 0x0f) | (value & 0xf0);
+			break;
+		}
+		buf[i] = port;
+	}
+
+	i2c_lcd_emu->reads++;
+	i2c_lcd_emu->bytes_read += n;
+	/* }}} */
+}
+
+
+/** Write what the emulated LCD is showing into 'out' as 'rows' rows of
+ * 'columns' characters each, followed by a '\0'. 'out' must have room for
+ * columns * rows + 1 characters. */
+void i2c_lcd_emu_render(struct i2c_lcd_emu *i2c_lcd_emu, uint8_t columns, \
+	uint8_t rows, char *out) {
+	/* {{{ */
+	for (int row = 0; row < rows; row++) {
+		for (int col = 0; col < columns; col++) {
+			uint8_t ac;
+
+			if (i2c_lcd_emu->function & LCD_2LINE) {
+				/* Rows past the second continue the first two lines (page 11
+				 * of the HD44780 datasheet) */
+				ac = (row % 2) * 0x40 \
+					+ ((row / 2) * columns + col + i2c_lcd_emu->display_shift) % 40;
+			} else {
+				ac = (row * columns + col + i2c_lcd_emu->display_shift) % 80;
+			}
+
+			*out++ = i2c_lcd_emu->ddram[ac];
+		}
+	}
+	*out = '\0';
+	/* }}} */
+}
+
+
+/** Wait until the emulated bus has finished the messages so far, like a
+ * write() or read() on a real i2c adapter does. Without this the host would
+ * start timing instructions before the emulated LCD had received them. */
+static void i2c_lcd_emu_complete(struct i2c_lcd_emu *i2c_lcd_emu) {
+	/* {{{ */
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, \
+		&i2c_lcd_emu->bus_time, NULL));
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd_emu_write(struct i2c_lcd1602 *i2c_lcd1602, \
+	const uint8_t *buf, size_t n) {
+	/* {{{ */
+	i2c_lcd_emu_feed(i2c_lcd1602->transport_ctx, buf, n);
+	i2c_lcd_emu_complete(i2c_lcd1602->transport_ctx);
+
+	return n;
+	/* }}} */
+}
+
+
+static ssize_t i2c_lcd_emu_read(struct i2c_lcd1602 *i2c_lcd1602, \
+	uint8_t *buf, size_t n) {
+	/* {{{ */
+	i2c_lcd_emu_sample(i2c_lcd1602->transport_ctx, buf, n);
+	i2c_lcd_emu_complete(i2c_lcd1602->transport_ctx);
+
+	return n;
+	/* }}} */
+}
+
+
+static int i2c_lcd_emu_submit(struct i2c_lcd1602 *i2c_lcd1602, \
+	struct i2c_lcd1602_msg *msgs, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (msgs[i].read) {
+			i2c_lcd_emu_sample(i2c_lcd1602->transport_ctx, msgs[i].buf, msgs[i].len);
+		} else {
+			i2c_lcd_emu_feed(i2c_lcd1602->transport_ctx, msgs[i].buf, msgs[i].len);
+		}
+	}
+	i2c_lcd_emu_complete(i2c_lcd1602->transport_ctx);
+
+	return 0;
+	/* }}} */
+}
+
+
+const struct i2c_lcd1602_transport i2c_lcd_emu_transport = {
+	.write = i2c_lcd_emu_write,
+	.read = i2c_lcd_emu_read,
+	.submit = i2c_lcd_emu_submit
+};
@@ -0,0 +1,83 @@
+#ifndef I2C_LCD_EMULATOR
+#define I2C_LCD_EMULATOR
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "i2c-LCD1602.h"
+
+/* The size of the address spaces of DDRAM and CGRAM (page 10 - 13 of the
+ * HD44780 datasheet). Only 0x00 - 0x27 and 0x40 - 0x67 of DDRAM are real in
+ * 2-line mode. */
+#define I2C_LCD_EMU_DDRAM_SIZE 0x80
+#define I2C_LCD_EMU_CGRAM_SIZE 0x40
+/* How long one byte takes on a 100kHz i2c bus (8 data bits plus an ACK) */
+#define I2C_LCD_EMU_BYTE_NS_100KHZ 90000
+
+/* A software model of an HD44780 behind a PCF8574 i2c backpack. Bytes written
+ * to it are decoded the same way the hardware would: each byte sets the eight
+ * outputs of the PCF8574, the controller latches a nibble on each falling edge
+ * of E, and in 4-bit mode pairs of nibbles are assembled into instructions
+ * and characters. */
+struct i2c_lcd_emu {
+	/* The last byte written to the PCF8574 */
+	uint8_t port;
+	/* The PCF8574 output wired to the enable input of the controller */
+	uint8_t enable;
+	/* The other controller of a module that has two (such as 40x4), which
+	 * sees every byte written to this one, see i2c_lcd_emu_share() */
+	struct i2c_lcd_emu *shared;
+	/* The controller state (page 24 - 29 of the HD44780 datasheet) */
+	uint8_t function;
+	uint8_t display;
+	uint8_t entry;
+	uint8_t ac;
+	uint8_t ac_in_cgram;
+	/* How many columns the display has been shifted to the left */
+	uint8_t display_shift;
+	uint8_t ddram[I2C_LCD_EMU_DDRAM_SIZE];
+	uint8_t cgram[I2C_LCD_EMU_CGRAM_SIZE];
+	/* Whether the next nibble is the second half of an 8 bit value in 4-bit
+	 * mode, and the first half if so */
+	uint8_t nibble_pending;
+	uint8_t nibble;
+	/* The value being read out of the controller, latched on the first
+	 * nibble of a read */
+	uint8_t read_value;
+	/* Timing model. Each byte advances the bus clock by 'byte_ns' (plus one
+	 * extra byte for the address at the start of each message) and each
+	 * instruction keeps the controller busy for its entry in 'timing'. The
+	 * busy flag reads as set while the controller is busy, and instructions
+	 * that arrive while it is busy are counted as violations. */
+	long byte_ns;
+	struct i2c_lcd1602_timing timing;
+	/* If set, instructions that arrive while the controller is busy are
+	 * ignored, as a real controller may do, instead of only being counted */
+	uint8_t strict;
+	struct timespec bus_time;
+	struct timespec busy_until;
+	/* Statistics */
+	size_t writes;
+	size_t reads;
+	size_t bytes_written;
+	size_t bytes_read;
+	size_t instructions;
+	size_t characters;
+	size_t busy_violations;
+};
+
+
+void i2c_lcd_emu_init(struct i2c_lcd_emu *i2c_lcd_emu);
+
+void i2c_lcd_emu_attach(struct i2c_lcd_emu *i2c_lcd_emu, struct i2c_lcd1602 *i2c_lcd1602);
+
+void i2c_lcd_emu_share(struct i2c_lcd_emu *i2c_lcd_emu, struct i2c_lcd_emu *second, uint8_t enable);
+
+void i2c_lcd_emu_feed(struct i2c_lcd_emu *i2c_lcd_emu, const uint8_t *buf, size_t n);
+
+void i2c_lcd_emu_render(struct i2c_lcd_emu *i2c_lcd_emu, uint8_t columns, uint8_t rows, char *out);
+
+extern const struct i2c_lcd1602_transport i2c_lcd_emu_transport;
+
+#endif
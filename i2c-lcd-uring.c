@@ -0,0 +1,480 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "i2c-LCD1602.h"
+#include "i2c-lcd-uring.h"
+
+/* HD44780 datasheet:
+ * https://www.sparkfun.com/datasheets/LCD/HD44780.pdf
+ */
+
+
+/** Start 'frame' over with nothing queued */
+static void i2c_lcd_uring_reset(struct i2c_lcd_uring_frame *frame) {
+	/* {{{ */
+	frame->len = 0;
+	frame->n_steps = 0;
+	frame->last_mode = -1;
+	frame->last_exec_ns = 0;
+	memset(frame->counts, 0, sizeof(frame->counts));
+	/* }}} */
+}
+
+
+/** Set up an io_uring instance for sending frames to the given i2c LCD. The
+ * writes go straight to the file descriptor of the LCD, so its adapter must
+ * accept plain i2c messages through write() (see i2c_lcd1602_fd_transport);
+ * the transport of the LCD is not used. While frames are in flight, nothing
+ * else should talk to the LCD.
+ *
+ * Returns 0 on success, and -1 (with errno set) if io_uring is not available.
+ */
+int i2c_lcd_uring_init(struct i2c_lcd_uring *i2c_lcd_uring, \
+	struct i2c_lcd1602 *i2c_lcd1602) {
+	/* {{{ */
+	struct io_uring_params params;
+
+	memset(i2c_lcd_uring, 0, sizeof(*i2c_lcd_uring));
+	memset(&params, 0, sizeof(params));
+	i2c_lcd_uring->i2c_lcd1602 = i2c_lcd1602;
+	i2c_lcd_uring->sq_ring = MAP_FAILED;
+	i2c_lcd_uring->cq_ring = MAP_FAILED;
+	i2c_lcd_uring->sqes = MAP_FAILED;
+	i2c_lcd_uring_reset(&i2c_lcd_uring->frames[0]);
+	i2c_lcd_uring_reset(&i2c_lcd_uring->frames[1]);
+
+	i2c_lcd_uring->ring_fd = syscall(__NR_io_uring_setup, \
+		I2C_LCD_URING_ENTRIES, &params);
+	if (i2c_lcd_uring->ring_fd < 0) return -1;
+
+	/* Map the submission and completion rings, which newer kernels let share
+	 * one mapping, and the submission queue entries */
+	i2c_lcd_uring->sq_ring_size = params.sq_off.array \
+		+ params.sq_entries * sizeof(unsigned);
+	i2c_lcd_uring->cq_ring_size = params.cq_off.cqes \
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (i2c_lcd_uring->cq_ring_size > i2c_lcd_uring->sq_ring_size) {
+			i2c_lcd_uring->sq_ring_size = i2c_lcd_uring->cq_ring_size;
+		}
+		i2c_lcd_uring->cq_ring_size = 0;
+	}
+
+	i2c_lcd_uring->sq_ring = mmap(NULL, i2c_lcd_uring->sq_ring_size, \
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, \
+		i2c_lcd_uring->ring_fd, IORING_OFF_SQ_RING);
+	if (i2c_lcd_uring->sq_ring == MAP_FAILED) goto fail;
+
+	if (i2c_lcd_uring->cq_ring_size == 0) {
+		i2c_lcd_uring->cq_ring = i2c_lcd_uring->sq_ring;
+	} else {
+		i2c_lcd_uring->cq_ring = mmap(NULL, i2c_lcd_uring->cq_ring_size, \
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, \
+			i2c_lcd_uring->ring_fd, IORING_OFF_CQ_RING);
+		if (i2c_lcd_uring->cq_ring == MAP_FAILED) goto fail;
+	}
+
+	i2c_lcd_uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	i2c_lcd_uring->sqes = mmap(NULL, i2c_lcd_uring->sqes_size, \
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, \
+		i2c_lcd_uring->ring_fd, IORING_OFF_SQES);
+	if (i2c_lcd_uring->sqes == MAP_FAILED) goto fail;
+
+	uint8_t *sq = i2c_lcd_uring->sq_ring;
+	uint8_t *cq = i2c_lcd_uring->cq_ring;
+	i2c_lcd_uring->sq_head = (unsigned *) (sq + params.sq_off.head);
+	i2c_lcd_uring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	i2c_lcd_uring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	i2c_lcd_uring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	i2c_lcd_uring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	i2c_lcd_uring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	i2c_lcd_uring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	i2c_lcd_uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	return 0;
+
+fail:
+	i2c_lcd_uring_destroy(i2c_lcd_uring);
+	return -1;
+	/* }}} */
+}
+
+
+/** Free the io_uring instance. Frames still in flight are waited for first,
+ * since the kernel may still be reading their bytes. */
+void i2c_lcd_uring_destroy(struct i2c_lcd_uring *i2c_lcd_uring) {
+	/* {{{ */
+	if (i2c_lcd_uring->in_flight) i2c_lcd_uring_reap(i2c_lcd_uring, 1);
+
+	if (i2c_lcd_uring->sqes != MAP_FAILED) {
+		munmap(i2c_lcd_uring->sqes, i2c_lcd_uring->sqes_size);
+	}
+	if (i2c_lcd_uring->cq_ring != MAP_FAILED \
+		&& i2c_lcd_uring->cq_ring != i2c_lcd_uring->sq_ring) {
+
+		munmap(i2c_lcd_uring->cq_ring, i2c_lcd_uring->cq_ring_size);
+	}
+	if (i2c_lcd_uring->sq_ring != MAP_FAILED) {
+		munmap(i2c_lcd_uring->sq_ring, i2c_lcd_uring->sq_ring_size);
+	}
+	if (i2c_lcd_uring->ring_fd >= 0) close(i2c_lcd_uring->ring_fd);
+
+	i2c_lcd_uring->sqes = MAP_FAILED;
+	i2c_lcd_uring->cq_ring = MAP_FAILED;
+	i2c_lcd_uring->sq_ring = MAP_FAILED;
+	i2c_lcd_uring->ring_fd = -1;
+	/* }}} */
+}
+
+
+/** Queue an instruction (or character, depending on 'mode') in the current
+ * frame. Like i2c_lcd_async_submit(), runs of instructions and characters the
+ * controller executes faster than the bus can send the next one go into one
+ * write, and a delay of the execution time follows anything slower (clear
+ * display, return home, page 24 of the HD44780 datasheet). Nothing is sent
+ * until i2c_lcd_uring_submit().
+ *
+ * Returns 0 on success, and -1 (with errno set to ENOSPC) if the frame is
+ * full.
+ */
+int i2c_lcd_uring_command(struct i2c_lcd_uring *i2c_lcd_uring, uint8_t data, \
+	uint8_t mode) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_uring->i2c_lcd1602;
+	struct i2c_lcd_uring_frame *frame = \
+		&i2c_lcd_uring->frames[i2c_lcd_uring->queueing];
+	enum i2c_lcd1602_command_type type = i2c_lcd1602_command_type(data, mode);
+	size_t need = mode != frame->last_mode \
+		? I2C_LCD1602_BYTES_PER_COMMAND : I2C_LCD1602_BYTES_PER_CHAR;
+	struct i2c_lcd_uring_step *step = frame->n_steps > 0 \
+		? &frame->steps[frame->n_steps - 1] : NULL;
+
+	/* Each entry may start a write and add a delay, and one entry is kept
+	 * for waiting for an instruction sent before the frame */
+	if (frame->len + need > sizeof(frame->bytes) \
+		|| frame->n_steps + 2 > I2C_LCD_URING_ENTRIES - 1) {
+
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if (step == NULL || step->len == 0 \
+		|| step->len + need > i2c_lcd1602->xfer_max) {
+
+		step = &frame->steps[frame->n_steps++];
+		step->offset = frame->len;
+		step->len = 0;
+		step->delay_ns = 0;
+	}
+
+	/* Only present RS separately when it changes */
+	if (mode != frame->last_mode) {
+		need = i2c_lcd1602_encode_command(i2c_lcd1602, &frame->bytes[frame->len], \
+			data, mode);
+	} else {
+		need = i2c_lcd1602_encode_4bitmode(i2c_lcd1602, \
+			&frame->bytes[frame->len], data, mode);
+	}
+	frame->len += need;
+	step->len += need;
+	frame->last_mode = mode;
+	frame->counts[type]++;
+
+	/* Keep the register model (and so the mode state i2c_lcd1602_resync()
+	 * sends again) up to date */
+	i2c_lcd1602_track(i2c_lcd1602, data, mode);
+
+	long exec_ns = i2c_lcd1602->timing.exec_ns[type];
+	if (exec_ns > i2c_lcd1602->timing.exec_ns[I2C_LCD1602_CMD_DATA]) {
+		step = &frame->steps[frame->n_steps++];
+		step->offset = frame->len;
+		step->len = 0;
+		step->delay_ns = exec_ns;
+		frame->last_mode = -1;
+		frame->last_exec_ns = 0;
+	} else {
+		frame->last_exec_ns = exec_ns;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Queue a character, see i2c_lcd1602_send_char() */
+int i2c_lcd_uring_send_char(struct i2c_lcd_uring *i2c_lcd_uring, char c) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(1, 0) | i2c_lcd_uring->i2c_lcd1602->backlight;
+
+	return i2c_lcd_uring_command(i2c_lcd_uring, c, mode);
+	/* }}} */
+}
+
+
+/** Queue a run of 'n' characters, see i2c_lcd1602_write_buffer().
+ *
+ * Returns 0 on success, and -1 if the frame is full, in which case only the
+ * characters that fit were queued.
+ */
+int i2c_lcd_uring_write_buffer(struct i2c_lcd_uring *i2c_lcd_uring, \
+	const char *buf, size_t n) {
+	/* {{{ */
+	for (size_t i = 0; i < n; i++) {
+		if (0 != i2c_lcd_uring_send_char(i2c_lcd_uring, buf[i])) return -1;
+	}
+
+	return 0;
+	/* }}} */
+}
+
+
+/** Queue setting the cursor position, see i2c_lcd1602_set_cursor_pos() */
+int i2c_lcd_uring_set_cursor_pos(struct i2c_lcd_uring *i2c_lcd_uring, \
+	uint8_t ac) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd_uring->i2c_lcd1602->backlight;
+
+	return i2c_lcd_uring_command(i2c_lcd_uring, LCD_SETDDRAMADDR | ac, mode);
+	/* }}} */
+}
+
+
+/** Queue clearing the display, see i2c_lcd1602_clear_display() */
+int i2c_lcd_uring_clear_display(struct i2c_lcd_uring *i2c_lcd_uring) {
+	/* {{{ */
+	/* Set RS and R/W appropriately, respecting the backlight settings */
+	uint8_t mode = set_mode(0, 0) | i2c_lcd_uring->i2c_lcd1602->backlight;
+
+	return i2c_lcd_uring_command(i2c_lcd_uring, LCD_CLEARDISPLAY, mode);
+	/* }}} */
+}
+
+
+/** Take one submission queue entry, cleared, and link it to the next one
+ * unless it is the last of the chain */
+static struct io_uring_sqe *i2c_lcd_uring_sqe(struct i2c_lcd_uring \
+	*i2c_lcd_uring, unsigned *tail, int last, uint8_t link) {
+	/* {{{ */
+	unsigned index = *tail & *i2c_lcd_uring->sq_mask;
+	struct io_uring_sqe *sqe = &i2c_lcd_uring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (!last) sqe->flags = link;
+	i2c_lcd_uring->sq_array[index] = index;
+	(*tail)++;
+
+	return sqe;
+	/* }}} */
+}
+
+
+/** Count one completion of the frame in flight. The user data of each
+ * completion holds the length of the write it is for, or 0 for a delay. */
+static void i2c_lcd_uring_complete(struct i2c_lcd_uring *i2c_lcd_uring, \
+	const struct io_uring_cqe *cqe) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_uring->i2c_lcd1602;
+	struct i2c_lcd_uring_frame *frame = \
+		&i2c_lcd_uring->frames[!i2c_lcd_uring->queueing];
+
+	if (cqe->user_data > 0) {
+		if (cqe->res > 0) I2C_LCD1602_STATS_ADD(i2c_lcd1602, bytes_written, cqe->res);
+		/* A write that failed or was cut short cancels the rest of the
+		 * chain */
+		if (cqe->res != (int32_t) cqe->user_data) frame->failed = 1;
+	} else if (cqe->res != -ETIME && cqe->res != 0) {
+		frame->failed = 1;
+	}
+
+	if (--frame->pending > 0) return;
+
+	i2c_lcd_uring->in_flight = 0;
+	if (frame->failed) {
+		/* As with i2c_lcd1602_write_bytes(), some of the nibbles may have been
+		 * latched */
+		I2C_LCD1602_STATS_ADD(i2c_lcd1602, transfer_failures, 1);
+		i2c_lcd1602->out_of_sync = 1;
+		i2c_lcd_uring->frames_failed++;
+	} else {
+		i2c_lcd_uring->frames_sent++;
+	}
+
+	/* The chain ends with a delay after slow instructions, but the controller
+	 * may still be executing the last one otherwise */
+	i2c_lcd1602_set_busy(i2c_lcd1602, frame->last_exec_ns);
+	/* }}} */
+}
+
+
+/** Handle the completions of the frame in flight. If 'wait' is set, block
+ * until it has completed; otherwise only handle what the kernel has already
+ * posted, which needs no syscall. Call this when 'ring_fd' becomes readable.
+ *
+ * Returns 0 once no frame is in flight and the last one was sent, 1 if a
+ * frame is still in flight, and -1 if the last frame failed.
+ */
+int i2c_lcd_uring_reap(struct i2c_lcd_uring *i2c_lcd_uring, int wait) {
+	/* {{{ */
+	while (i2c_lcd_uring->in_flight) {
+		unsigned head = *i2c_lcd_uring->cq_head;
+		unsigned tail = __atomic_load_n(i2c_lcd_uring->cq_tail, \
+			__ATOMIC_ACQUIRE);
+
+		while (head != tail && i2c_lcd_uring->in_flight) {
+			i2c_lcd_uring_complete(i2c_lcd_uring, \
+				&i2c_lcd_uring->cqes[head & *i2c_lcd_uring->cq_mask]);
+			head++;
+		}
+		__atomic_store_n(i2c_lcd_uring->cq_head, head, __ATOMIC_RELEASE);
+
+		if (!i2c_lcd_uring->in_flight) break;
+		if (!wait) return 1;
+
+		i2c_lcd_uring->enters++;
+		if (0 > syscall(__NR_io_uring_enter, i2c_lcd_uring->ring_fd, 0, 1, \
+			IORING_ENTER_GETEVENTS, NULL, 0) && errno != EINTR) {
+
+			return -1;
+		}
+	}
+
+	return i2c_lcd_uring->frames[!i2c_lcd_uring->queueing].failed ? -1 : 0;
+	/* }}} */
+}
+
+
+/** Submit the frame queued so far as one chain: each write is linked to the
+ * next step, and each delay is an IORING_OP_TIMEOUT hard linked to the next
+ * step, so that the timeout expiring (which completes it with -ETIME) does
+ * not break the chain but a failed write cancels everything after it. The
+ * timeouts start when the write before them has completed, so each one
+ * covers the execution time of the instruction just sent, as
+ * i2c_lcd1602_wait_ready() does. If the controller is still busy with an
+ * instruction sent before the frame, the chain starts with an absolute
+ * timeout until it is done.
+ *
+ * If 'wait' is set, this also waits for the frame to complete, all in one
+ * io_uring_enter() call. Otherwise the frame is in flight when this returns,
+ * and the next frame can be queued meanwhile; see i2c_lcd_uring_reap().
+ * If a previous frame failed, the LCD is resynchronized with
+ * i2c_lcd1602_resync() first.
+ *
+ * Returns 0 on success, and -1 if the frame could not be submitted (with
+ * errno set to EBUSY if the previous frame is still in flight and 'wait' is
+ * not set), the LCD could not be resynchronized, or the frame failed.
+ */
+int i2c_lcd_uring_submit(struct i2c_lcd_uring *i2c_lcd_uring, int wait) {
+	/* {{{ */
+	struct i2c_lcd1602 *i2c_lcd1602 = i2c_lcd_uring->i2c_lcd1602;
+
+	if (i2c_lcd_uring->in_flight \
+		&& 1 == i2c_lcd_uring_reap(i2c_lcd_uring, wait)) {
+
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* A failed frame may have left the controller between the two nibbles
+	 * of a byte */
+	if (i2c_lcd1602->out_of_sync && 0 != i2c_lcd1602_resync(i2c_lcd1602)) {
+		return -1;
+	}
+
+	struct i2c_lcd_uring_frame *frame = \
+		&i2c_lcd_uring->frames[i2c_lcd_uring->queueing];
+	if (frame->n_steps == 0) return 0;
+
+	/* Only the submitter moves the tail of the submission queue */
+	unsigned tail = *i2c_lcd_uring->sq_tail;
+	size_t n = 0;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < i2c_lcd1602->busy_until.tv_sec \
+		|| (now.tv_sec == i2c_lcd1602->busy_until.tv_sec \
+			&& now.tv_nsec < i2c_lcd1602->busy_until.tv_nsec)) {
+
+		struct __kernel_timespec *ts = &frame->timeouts[n];
+		ts->tv_sec = i2c_lcd1602->busy_until.tv_sec;
+		ts->tv_nsec = i2c_lcd1602->busy_until.tv_nsec;
+
+		struct io_uring_sqe *sqe = i2c_lcd_uring_sqe(i2c_lcd_uring, &tail, 0, \
+			IOSQE_IO_HARDLINK);
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (uintptr_t) ts;
+		sqe->len = 1;
+		sqe->timeout_flags = IORING_TIMEOUT_ABS;
+		n++;
+	}
+
+	for (size_t i = 0; i < frame->n_steps; i++) {
+		struct i2c_lcd_uring_step *step = &frame->steps[i];
+		int last = i + 1 == frame->n_steps;
+
+		if (step->len > 0) {
+			struct io_uring_sqe *sqe = i2c_lcd_uring_sqe(i2c_lcd_uring, &tail, \
+				last, IOSQE_IO_LINK);
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = i2c_lcd1602->fd;
+			sqe->addr = (uintptr_t) &frame->bytes[step->offset];
+			sqe->len = step->len;
+			sqe->off = (uint64_t) -1;
+			sqe->user_data = step->len;
+		} else {
+			struct __kernel_timespec *ts = &frame->timeouts[n];
+			ts->tv_sec = step->delay_ns / 1000000000;
+			ts->tv_nsec = step->delay_ns % 1000000000;
+
+			struct io_uring_sqe *sqe = i2c_lcd_uring_sqe(i2c_lcd_uring, &tail, \
+				last, IOSQE_IO_HARDLINK);
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->addr = (uintptr_t) ts;
+			sqe->len = 1;
+		}
+		n++;
+	}
+	__atomic_store_n(i2c_lcd_uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	for (int i = 0; i < I2C_LCD1602_CMD_TYPES; i++) {
+		i2c_lcd1602_stats_count(i2c_lcd1602, i, frame->counts[i]);
+	}
+
+	frame->pending = n;
+	frame->failed = 0;
+	i2c_lcd_uring->in_flight = 1;
+	i2c_lcd_uring->queueing = !i2c_lcd_uring->queueing;
+	i2c_lcd_uring_reset(&i2c_lcd_uring->frames[i2c_lcd_uring->queueing]);
+
+	/* Submit the chain, and if asked to, wait for all of it in the same
+	 * call */
+	size_t submitted = 0;
+	while (submitted < n) {
+		i2c_lcd_uring->enters++;
+		int r = syscall(__NR_io_uring_enter, i2c_lcd_uring->ring_fd, \
+			n - submitted, wait ? n : 0, wait ? IORING_ENTER_GETEVENTS : 0, \
+			NULL, 0);
+
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			/* Take back what the kernel did not consume, which will never
+			 * complete */
+			__atomic_store_n(i2c_lcd_uring->sq_tail, *i2c_lcd_uring->sq_head, \
+				__ATOMIC_RELEASE);
+			frame->pending -= n - submitted;
+			frame->failed = 1;
+			if (frame->pending == 0) i2c_lcd_uring->in_flight = 0;
+			return -1;
+		}
+		submitted += r;
+	}
+
+	return wait ? i2c_lcd_uring_reap(i2c_lcd_uring, 1) : 0;
+	/* }}} */
+}
@@ -0,0 +1,103 @@
+#ifndef I2C_LCD_URING
+#define I2C_LCD_URING
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#include "i2c-LCD1602.h"
+
+/* The number of submission queue entries of the ring, which is also the most
+ * writes and delays one frame can be made of. Must be a power of 2. */
+#define I2C_LCD_URING_ENTRIES 64
+/* The most bytes one frame can send to the PCF8574, enough to redraw every
+ * cell of a 40x4 module */
+#define I2C_LCD_URING_FRAME_MAX 1024
+
+/* One write of the bytes of a frame from 'offset' to 'offset' + 'len', or a
+ * delay of 'delay_ns' (if 'len' is 0) */
+struct i2c_lcd_uring_step {
+	size_t offset;
+	size_t len;
+	long delay_ns;
+};
+
+/* The instructions and characters queued for one submission, encoded into
+ * the bytes that will be sent to the PCF8574 and cut into steps wherever the
+ * controller needs time that the bus does not give it */
+struct i2c_lcd_uring_frame {
+	uint8_t bytes[I2C_LCD_URING_FRAME_MAX];
+	size_t len;
+	struct i2c_lcd_uring_step steps[I2C_LCD_URING_ENTRIES];
+	size_t n_steps;
+	/* The mode of the last entry, or -1 if a new write must present RS
+	 * first */
+	int last_mode;
+	/* How long the controller takes to execute the last entry, if the frame
+	 * does not end with a delay for it */
+	long last_exec_ns;
+	/* The instructions and characters in the frame, by type */
+	uint64_t counts[I2C_LCD1602_CMD_TYPES];
+	/* The timeouts of the delays, which the kernel reads when they are
+	 * submitted */
+	struct __kernel_timespec timeouts[I2C_LCD_URING_ENTRIES];
+	/* While submitted: the completions still to come, and whether a write
+	 * failed or was cut short */
+	size_t pending;
+	uint8_t failed;
+};
+
+/* Sends frames to an i2c LCD through io_uring. Each frame is submitted as a
+ * chain of linked writes and timeouts, so that the kernel performs the whole
+ * redraw, including waiting for the controller between instructions, from a
+ * single io_uring_enter() call. The application can wait for the frame to
+ * complete, or poll 'ring_fd' from its own event loop and call
+ * i2c_lcd_uring_reap() when it becomes readable. */
+struct i2c_lcd_uring {
+	struct i2c_lcd1602 *i2c_lcd1602;
+	int ring_fd;
+	/* The rings shared with the kernel */
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* The frame being queued, and the other one, which may be in flight */
+	struct i2c_lcd_uring_frame frames[2];
+	uint8_t queueing;
+	uint8_t in_flight;
+	/* Statistics */
+	uint64_t enters;
+	uint64_t frames_sent;
+	uint64_t frames_failed;
+};
+
+
+int i2c_lcd_uring_init(struct i2c_lcd_uring *i2c_lcd_uring, struct i2c_lcd1602 *i2c_lcd1602);
+
+void i2c_lcd_uring_destroy(struct i2c_lcd_uring *i2c_lcd_uring);
+
+int i2c_lcd_uring_command(struct i2c_lcd_uring *i2c_lcd_uring, uint8_t data, uint8_t mode);
+
+int i2c_lcd_uring_send_char(struct i2c_lcd_uring *i2c_lcd_uring, char c);
+
+int i2c_lcd_uring_write_buffer(struct i2c_lcd_uring *i2c_lcd_uring, const char *buf, size_t n);
+
+int i2c_lcd_uring_set_cursor_pos(struct i2c_lcd_uring *i2c_lcd_uring, uint8_t ac);
+
+int i2c_lcd_uring_clear_display(struct i2c_lcd_uring *i2c_lcd_uring);
+
+int i2c_lcd_uring_submit(struct i2c_lcd_uring *i2c_lcd_uring, int wait);
+
+int i2c_lcd_uring_reap(struct i2c_lcd_uring *i2c_lcd_uring, int wait);
+
+#endif